@@ -0,0 +1,733 @@
+// HTTP负载生成器:多个线程各自用epoll驱动一组连接,按权重轮流请求一组url,
+// 支持保持连接和流水线,统计吞吐量,状态码和延迟分布(HDR直方图),以文本和JSON输出
+// 用法: load_gen [选项] host port
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( uint64_t )ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// HDR直方图:值按2的幂分段,每段再等分为1024个子桶,相对误差小于千分之一,
+// 记录和合并都是O(1)的数组操作,单位由调用者决定(这里为微秒)
+class latency_histogram
+{
+public:
+    latency_histogram() : m_counts( SUB_BUCKETS + ( BUCKETS - 1 ) * HALF, 0 ), m_total( 0 ), m_sum( 0 ), m_min( UINT64_MAX ), m_max( 0 ) {}
+
+    void record( uint64_t v )
+    {
+        ++m_counts[ index_of( v ) ];
+        ++m_total;
+        m_sum += v;
+        m_min = v < m_min ? v : m_min;
+        m_max = v > m_max ? v : m_max;
+    }
+
+    void merge( const latency_histogram& other )
+    {
+        for ( size_t i = 0; i < m_counts.size(); ++i )
+        {
+            m_counts[i] += other.m_counts[i];
+        }
+        m_total += other.m_total;
+        m_sum += other.m_sum;
+        m_min = other.m_min < m_min ? other.m_min : m_min;
+        m_max = other.m_max > m_max ? other.m_max : m_max;
+    }
+
+	// 不超过该值的记录占p%,返回所在子桶的上界
+    uint64_t percentile( double p ) const
+    {
+        if ( m_total == 0 )
+        {
+            return 0;
+        }
+        uint64_t target = ( uint64_t )( p / 100.0 * m_total + 0.999999 );
+        target = target == 0 ? 1 : target;
+        uint64_t seen = 0;
+        for ( size_t i = 0; i < m_counts.size(); ++i )
+        {
+            seen += m_counts[i];
+            if ( seen >= target )
+            {
+                uint64_t v = highest_of( i );
+                return v < m_max ? v : m_max;
+            }
+        }
+        return m_max;
+    }
+
+    uint64_t count() const { return m_total; }
+    uint64_t min() const { return m_total ? m_min : 0; }
+    uint64_t max() const { return m_max; }
+    double mean() const { return m_total ? ( double )m_sum / m_total : 0; }
+
+private:
+    static const int SUB_BITS = 11;
+    static const uint64_t SUB_BUCKETS = 1 << SUB_BITS;
+    static const uint64_t HALF = SUB_BUCKETS / 2;
+    static const int BUCKETS = 64 - SUB_BITS + 1;
+
+	// 小于SUB_BUCKETS的值各占一个桶,之后每段的值右移到[HALF, SUB_BUCKETS)
+    static size_t index_of( uint64_t v )
+    {
+        if ( v < SUB_BUCKETS )
+        {
+            return v;
+        }
+        int b = 63 - __builtin_clzll( v ) - ( SUB_BITS - 1 );
+        return SUB_BUCKETS + ( b - 1 ) * HALF + ( ( v >> b ) - HALF );
+    }
+
+    static uint64_t highest_of( size_t i )
+    {
+        if ( i < SUB_BUCKETS )
+        {
+            return i;
+        }
+        size_t b = ( i - SUB_BUCKETS ) / HALF + 1;
+        uint64_t sub = ( i - SUB_BUCKETS ) % HALF + HALF;
+        return ( ( sub + 1 ) << b ) - 1;
+    }
+
+private:
+    std::vector< uint64_t > m_counts;
+    uint64_t m_total;
+    uint64_t m_sum;
+    uint64_t m_min;
+    uint64_t m_max;
+};
+
+// 命令行参数
+struct bench_options
+{
+    const char* host;
+    int port;
+    int threads;            // 线程数,每个线程一个epoll实例
+    int connections;        // 总连接数,平均分给各线程
+    int duration;           // 测试时长(秒)
+    int pipeline;           // 每个连接上同时发出的请求数
+    bool keep_alive;        // 关闭时每个请求使用一个新连接
+    std::vector< std::string > urls;
+    std::vector< int > weights;
+    std::vector< std::string > headers;
+    const char* json_path;  // JSON结果的输出文件,"-"为标准输出
+};
+
+// 每个线程的统计,结束后合并
+struct bench_stats
+{
+    uint64_t requests;
+    uint64_t errors;        // 连接失败,连接意外关闭时未完成的请求,无法解析的应答
+    uint64_t bytes;         // 收到的应答字节数,包括头部
+    uint64_t status[6];     // 按状态码的首位分类,0为其他
+    uint64_t connects;
+    latency_histogram latency;
+
+    bench_stats() : requests( 0 ), errors( 0 ), bytes( 0 ), connects( 0 ) { memset( status, 0, sizeof( status ) ); }
+};
+
+// 应答的增量解析状态
+enum parse_state { STATUS_LINE, HEADERS, BODY, CHUNK_SIZE, CHUNK_DATA, CHUNK_DATA_END, CHUNK_TRAILER };
+
+struct bench_conn
+{
+    int fd;
+    std::string out;            // 尚未发出的请求
+    size_t out_pos;
+    std::string in;             // 尚未解析的应答数据
+    std::deque< uint64_t > sent;// 已发出请求的发送时间
+    int issued;                 // 本连接已发出的请求数,不保持连接时每个连接只发一个
+    parse_state state;
+    int status;
+    int64_t remaining;          // 应答体或当前块剩余的字节数
+    bool chunked;
+    bool close_after;           // 应答要求关闭连接
+    uint64_t response_bytes;
+
+    bench_conn() : fd( -1 ), out_pos( 0 ), issued( 0 ), state( STATUS_LINE ), status( 0 ), remaining( 0 ),
+        chunked( false ), close_after( false ), response_bytes( 0 ) {}
+};
+
+struct bench_thread
+{
+    const bench_options* opt;
+    sockaddr_in addr;
+    int connections;
+    uint64_t deadline;
+	// 按权重展开的url下标,依次轮转
+    std::vector< int > schedule;
+    size_t next_url;
+    std::vector< std::string > requests;
+    int epollfd;
+    std::vector< bench_conn > conns;
+    bench_stats stats;
+    pthread_t thread;
+};
+
+static void update_events( bench_thread& t, bench_conn& c, int op )
+{
+    epoll_event event;
+    event.data.u64 = &c - &t.conns[0];
+    event.events = EPOLLIN | ( c.out_pos < c.out.size() ? ( uint32_t )EPOLLOUT : ( uint32_t )0 );
+    epoll_ctl( t.epollfd, op, c.fd, &event );
+}
+
+static bool flush_out( bench_thread& t, bench_conn& c )
+{
+    while ( c.out_pos < c.out.size() )
+    {
+        ssize_t n = send( c.fd, c.out.data() + c.out_pos, c.out.size() - c.out_pos, MSG_NOSIGNAL );
+        if ( n < 0 )
+        {
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            {
+                break;
+            }
+            return false;
+        }
+        c.out_pos += n;
+    }
+    if ( c.out_pos == c.out.size() )
+    {
+        c.out.clear();
+        c.out_pos = 0;
+    }
+    update_events( t, c, EPOLL_CTL_MOD );
+    return true;
+}
+
+// 补足流水线深度,不保持连接时每个连接只发一个请求
+static bool issue_requests( bench_thread& t, bench_conn& c )
+{
+    const bench_options& opt = *t.opt;
+    int depth = opt.keep_alive ? opt.pipeline : 1;
+    while ( ( int )c.sent.size() < depth && ( opt.keep_alive || c.issued == 0 ) && now_ns() < t.deadline )
+    {
+        c.out += t.requests[ t.schedule[ t.next_url++ % t.schedule.size() ] ];
+        c.sent.push_back( now_ns() );
+        ++c.issued;
+    }
+    return flush_out( t, c );
+}
+
+static void close_bench_conn( bench_thread& t, bench_conn& c )
+{
+    if ( c.fd >= 0 )
+    {
+        epoll_ctl( t.epollfd, EPOLL_CTL_DEL, c.fd, 0 );
+        close( c.fd );
+    }
+    c = bench_conn();
+}
+
+static bool open_bench_conn( bench_thread& t, bench_conn& c )
+{
+    c.fd = socket( AF_INET, SOCK_STREAM, 0 );
+    if ( c.fd < 0 )
+    {
+        return false;
+    }
+	// 回环地址上阻塞连接很快完成,之后改为非阻塞
+    if ( connect( c.fd, ( sockaddr* )&t.addr, sizeof( t.addr ) ) < 0 )
+    {
+        close( c.fd );
+        c.fd = -1;
+        return false;
+    }
+    int one = 1;
+    setsockopt( c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+    fcntl( c.fd, F_SETFL, fcntl( c.fd, F_GETFL ) | O_NONBLOCK );
+    ++t.stats.connects;
+    update_events( t, c, EPOLL_CTL_ADD );
+    return issue_requests( t, c );
+}
+
+// 连接出错或关闭,未完成的请求计为错误,测试未结束时重新连接
+static void reconnect( bench_thread& t, bench_conn& c, bool failed )
+{
+    if ( failed )
+    {
+        t.stats.errors += c.sent.size();
+    }
+    close_bench_conn( t, c );
+    while ( now_ns() < t.deadline && ! open_bench_conn( t, c ) )
+    {
+        ++t.stats.errors;
+        close_bench_conn( t, c );
+        usleep( 1000 );
+    }
+}
+
+// 一个应答解析完毕
+static void complete_response( bench_thread& t, bench_conn& c )
+{
+    if ( ! c.sent.empty() )
+    {
+        uint64_t now = now_ns();
+		// 测试结束后才完成的请求不计入结果
+        if ( now <= t.deadline )
+        {
+            t.stats.latency.record( ( now - c.sent.front() ) / 1000 );
+            ++t.stats.requests;
+            t.stats.bytes += c.response_bytes;
+            int cls = c.status / 100;
+            ++t.stats.status[ cls >= 1 && cls <= 5 ? cls : 0 ];
+        }
+        c.sent.pop_front();
+    }
+    c.state = STATUS_LINE;
+    c.chunked = false;
+    c.remaining = 0;
+    c.response_bytes = 0;
+}
+
+// 取出一行,不含行结束符,没有完整的一行时返回false
+static bool take_line( bench_conn& c, size_t& pos, std::string& line )
+{
+    size_t eol = c.in.find( "\r\n", pos );
+    if ( eol == std::string::npos )
+    {
+        return false;
+    }
+    line.assign( c.in, pos, eol - pos );
+    c.response_bytes += eol + 2 - pos;
+    pos = eol + 2;
+    return true;
+}
+
+// 解析已收到的数据,应答格式错误时返回false
+static bool parse_responses( bench_thread& t, bench_conn& c )
+{
+    size_t pos = 0;
+    std::string line;
+    bool progress = true;
+    while ( progress )
+    {
+        progress = false;
+        switch ( c.state )
+        {
+            case STATUS_LINE:
+                if ( take_line( c, pos, line ) )
+                {
+                    if ( line.compare( 0, 5, "HTTP/" ) != 0 || line.size() < 12 )
+                    {
+                        return false;
+                    }
+                    c.status = atoi( line.c_str() + 9 );
+                    c.remaining = 0;
+                    c.close_after = false;
+                    c.state = HEADERS;
+                    progress = true;
+                }
+                break;
+            case HEADERS:
+                if ( take_line( c, pos, line ) )
+                {
+                    progress = true;
+                    if ( line.empty() )
+                    {
+                        c.state = c.chunked ? CHUNK_SIZE : BODY;
+                        if ( c.state == BODY && c.remaining == 0 )
+                        {
+                            complete_response( t, c );
+                        }
+                    }
+                    else if ( strncasecmp( line.c_str(), "Content-Length:", 15 ) == 0 )
+                    {
+                        c.remaining = atoll( line.c_str() + 15 );
+                    }
+                    else if ( strncasecmp( line.c_str(), "Transfer-Encoding:", 18 ) == 0 )
+                    {
+                        c.chunked = strstr( line.c_str(), "chunked" ) != NULL;
+                    }
+                    else if ( strncasecmp( line.c_str(), "Connection:", 11 ) == 0 )
+                    {
+                        c.close_after = strcasestr( line.c_str(), "close" ) != NULL;
+                    }
+                }
+                break;
+            case BODY:
+            case CHUNK_DATA:
+            {
+                size_t n = c.in.size() - pos;
+                n = ( int64_t )n < c.remaining ? n : c.remaining;
+                pos += n;
+                c.remaining -= n;
+                c.response_bytes += n;
+                if ( c.remaining == 0 )
+                {
+                    if ( c.state == BODY )
+                    {
+                        complete_response( t, c );
+                    }
+                    else
+                    {
+                        c.state = CHUNK_DATA_END;
+                    }
+                    progress = true;
+                }
+                break;
+            }
+            case CHUNK_SIZE:
+                if ( take_line( c, pos, line ) )
+                {
+                    char* end = NULL;
+                    c.remaining = strtoll( line.c_str(), &end, 16 );
+                    if ( end == line.c_str() || c.remaining < 0 )
+                    {
+                        return false;
+                    }
+                    c.state = c.remaining == 0 ? CHUNK_TRAILER : CHUNK_DATA;
+                    progress = true;
+                }
+                break;
+            case CHUNK_DATA_END:
+                if ( take_line( c, pos, line ) )
+                {
+                    c.state = CHUNK_SIZE;
+                    progress = true;
+                }
+                break;
+            case CHUNK_TRAILER:
+                if ( take_line( c, pos, line ) )
+                {
+                    if ( line.empty() )
+                    {
+                        complete_response( t, c );
+                    }
+                    progress = true;
+                }
+                break;
+        }
+    }
+    c.in.erase( 0, pos );
+    return true;
+}
+
+static void handle_readable( bench_thread& t, bench_conn& c )
+{
+    char buf[ 65536 ];
+    while ( true )
+    {
+        ssize_t n = recv( c.fd, buf, sizeof( buf ), 0 );
+        if ( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+        {
+            break;
+        }
+        if ( n <= 0 )
+        {
+			// 不保持连接时,已收完应答的连接正常关闭
+            reconnect( t, c, ! c.sent.empty() );
+            return;
+        }
+        c.in.append( buf, n );
+        size_t before = c.sent.size();
+        if ( ! parse_responses( t, c ) )
+        {
+            reconnect( t, c, true );
+            return;
+        }
+        if ( c.sent.size() < before && ( c.close_after || ! t.opt->keep_alive ) )
+        {
+            reconnect( t, c, ! c.sent.empty() );
+            return;
+        }
+    }
+    if ( ! issue_requests( t, c ) )
+    {
+        reconnect( t, c, true );
+    }
+}
+
+static void* run_thread( void* arg )
+{
+    bench_thread& t = *( bench_thread* )arg;
+    t.conns.resize( t.connections );
+    for ( size_t i = 0; i < t.conns.size(); ++i )
+    {
+        if ( ! open_bench_conn( t, t.conns[i] ) )
+        {
+            reconnect( t, t.conns[i], true );
+        }
+    }
+    epoll_event events[ 256 ];
+    while ( now_ns() < t.deadline )
+    {
+        int n = epoll_wait( t.epollfd, events, 256, 100 );
+        for ( int i = 0; i < n; ++i )
+        {
+            bench_conn& c = t.conns[ events[i].data.u64 ];
+            if ( c.fd < 0 )
+            {
+                continue;
+            }
+            if ( events[i].events & EPOLLIN )
+            {
+                handle_readable( t, c );
+            }
+            else if ( events[i].events & ( EPOLLERR | EPOLLHUP ) )
+            {
+                reconnect( t, c, true );
+            }
+            else if ( ( events[i].events & EPOLLOUT ) && ! flush_out( t, c ) )
+            {
+                reconnect( t, c, true );
+            }
+        }
+    }
+    for ( size_t i = 0; i < t.conns.size(); ++i )
+    {
+        close_bench_conn( t, t.conns[i] );
+    }
+    return NULL;
+}
+
+static void usage( const char* prog )
+{
+    printf( "usage: %s [options] host port\n", prog );
+    printf( "  --threads N       load generator threads, each with its own epoll (default 2)\n" );
+    printf( "  --connections N   concurrent connections over all threads (default 64)\n" );
+    printf( "  --duration N      seconds to run (default 10)\n" );
+    printf( "  --pipeline N      requests in flight per keep-alive connection (default 1)\n" );
+    printf( "  --no-keep-alive   one request per connection\n" );
+    printf( "  --url PATH[@W]    request PATH with weight W (default 1), may be repeated;\n" );
+    printf( "                    default mix: home page, the two books and a search\n" );
+    printf( "  --header LINE     extra request header, e.g. \"Accept-Encoding: gzip\", may be repeated\n" );
+    printf( "  --json FILE       also write the results as JSON to FILE, - for stdout\n" );
+}
+
+static bool parse_options( int argc, char* argv[], bench_options& opt )
+{
+    static const struct option long_options[] =
+    {
+        { "threads", required_argument, NULL, 't' },
+        { "connections", required_argument, NULL, 'c' },
+        { "duration", required_argument, NULL, 'd' },
+        { "pipeline", required_argument, NULL, 'p' },
+        { "no-keep-alive", no_argument, NULL, 'k' },
+        { "url", required_argument, NULL, 'u' },
+        { "header", required_argument, NULL, 'H' },
+        { "json", required_argument, NULL, 'j' },
+        { NULL, 0, NULL, 0 }
+    };
+    opt.threads = 2;
+    opt.connections = 64;
+    opt.duration = 10;
+    opt.pipeline = 1;
+    opt.keep_alive = true;
+    opt.json_path = NULL;
+    int c;
+    while ( ( c = getopt_long( argc, argv, "", long_options, NULL ) ) != -1 )
+    {
+        switch ( c )
+        {
+            case 't':
+                opt.threads = atoi( optarg );
+                break;
+            case 'c':
+                opt.connections = atoi( optarg );
+                break;
+            case 'd':
+                opt.duration = atoi( optarg );
+                break;
+            case 'p':
+                opt.pipeline = atoi( optarg );
+                break;
+            case 'k':
+                opt.keep_alive = false;
+                break;
+            case 'u':
+            {
+                std::string url( optarg );
+                int weight = 1;
+                size_t at = url.rfind( '@' );
+                if ( at != std::string::npos )
+                {
+                    weight = atoi( url.c_str() + at + 1 );
+                    url.erase( at );
+                }
+                if ( url.empty() || url[0] != '/' || weight <= 0 )
+                {
+                    return false;
+                }
+                opt.urls.push_back( url );
+                opt.weights.push_back( weight );
+                break;
+            }
+            case 'H':
+                opt.headers.push_back( optarg );
+                break;
+            case 'j':
+                opt.json_path = optarg;
+                break;
+            default:
+                return false;
+        }
+    }
+    if ( opt.threads <= 0 || opt.connections < opt.threads || opt.duration <= 0 || opt.pipeline <= 0 || argc - optind != 2 )
+    {
+        return false;
+    }
+    opt.host = argv[ optind ];
+    opt.port = atoi( argv[ optind + 1 ] );
+    if ( opt.urls.empty() )
+    {
+		// 首页和小文件为主,夹杂大文件和搜索
+        const char* urls[] = { "/home.html", "/file/guiguzi.txt", "/file/huxueyan.txt", "/cgi-bin/search?book=%E9%AC%BC%E8%B0%B7" };
+        const int weights[] = { 6, 2, 1, 1 };
+        for ( size_t i = 0; i < sizeof( urls ) / sizeof( urls[0] ); ++i )
+        {
+            opt.urls.push_back( urls[i] );
+            opt.weights.push_back( weights[i] );
+        }
+    }
+    return true;
+}
+
+static void write_json( FILE* out, const bench_options& opt, const bench_stats& s, double seconds )
+{
+    const latency_histogram& h = s.latency;
+    fprintf( out, "{\n" );
+    fprintf( out, "  \"threads\": %d, \"connections\": %d, \"pipeline\": %d, \"keep_alive\": %s,\n",
+        opt.threads, opt.connections, opt.pipeline, opt.keep_alive ? "true" : "false" );
+    fprintf( out, "  \"urls\": [" );
+    for ( size_t i = 0; i < opt.urls.size(); ++i )
+    {
+        fprintf( out, "%s{\"path\": \"%s\", \"weight\": %d}", i ? ", " : "", opt.urls[i].c_str(), opt.weights[i] );
+    }
+    fprintf( out, "],\n" );
+    fprintf( out, "  \"duration_s\": %.3f, \"requests\": %llu, \"errors\": %llu, \"connects\": %llu,\n", seconds,
+        ( unsigned long long )s.requests, ( unsigned long long )s.errors, ( unsigned long long )s.connects );
+    fprintf( out, "  \"requests_per_s\": %.1f, \"mb_per_s\": %.2f,\n", s.requests / seconds, s.bytes / seconds / 1e6 );
+    fprintf( out, "  \"status\": {\"1xx\": %llu, \"2xx\": %llu, \"3xx\": %llu, \"4xx\": %llu, \"5xx\": %llu, \"other\": %llu},\n",
+        ( unsigned long long )s.status[1], ( unsigned long long )s.status[2], ( unsigned long long )s.status[3],
+        ( unsigned long long )s.status[4], ( unsigned long long )s.status[5], ( unsigned long long )s.status[0] );
+    fprintf( out, "  \"latency_us\": {\"min\": %llu, \"mean\": %.1f, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}\n",
+        ( unsigned long long )h.min(), h.mean(), ( unsigned long long )h.percentile( 50 ), ( unsigned long long )h.percentile( 90 ),
+        ( unsigned long long )h.percentile( 99 ), ( unsigned long long )h.percentile( 99.9 ), ( unsigned long long )h.max() );
+    fprintf( out, "}\n" );
+}
+
+int main( int argc, char* argv[] )
+{
+    bench_options opt;
+    if ( ! parse_options( argc, argv, opt ) )
+    {
+        usage( argv[0] );
+        return 1;
+    }
+    sockaddr_in addr;
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( opt.port );
+    if ( inet_pton( AF_INET, opt.host, &addr.sin_addr ) != 1 )
+    {
+        printf( "bad address %s\n", opt.host );
+        return 1;
+    }
+	// 预先生成各url的请求
+    std::vector< std::string > requests;
+    for ( size_t i = 0; i < opt.urls.size(); ++i )
+    {
+        std::string req = "GET " + opt.urls[i] + " HTTP/1.1\r\nHost: " + opt.host + "\r\n";
+        req += opt.keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+        for ( size_t k = 0; k < opt.headers.size(); ++k )
+        {
+            req += opt.headers[k] + "\r\n";
+        }
+        requests.push_back( req + "\r\n" );
+    }
+    std::vector< int > schedule;
+    for ( size_t i = 0; i < opt.urls.size(); ++i )
+    {
+        schedule.insert( schedule.end(), opt.weights[i], ( int )i );
+    }
+
+    uint64_t start = now_ns();
+    std::vector< bench_thread > threads( opt.threads );
+    for ( int i = 0; i < opt.threads; ++i )
+    {
+        bench_thread& t = threads[i];
+        t.opt = &opt;
+        t.addr = addr;
+        t.connections = opt.connections / opt.threads + ( i < opt.connections % opt.threads ? 1 : 0 );
+        t.deadline = start + ( uint64_t )opt.duration * 1000000000;
+        t.schedule = schedule;
+		// 各线程从不同的位置开始轮转
+        t.next_url = i * schedule.size() / opt.threads;
+        t.requests = requests;
+        t.epollfd = epoll_create1( 0 );
+        if ( t.epollfd < 0 || pthread_create( &t.thread, NULL, run_thread, &t ) != 0 )
+        {
+            printf( "start thread failed: %s\n", strerror( errno ) );
+            return 1;
+        }
+    }
+    bench_stats total;
+    for ( int i = 0; i < opt.threads; ++i )
+    {
+        pthread_join( threads[i].thread, NULL );
+        close( threads[i].epollfd );
+        const bench_stats& s = threads[i].stats;
+        total.requests += s.requests;
+        total.errors += s.errors;
+        total.bytes += s.bytes;
+        total.connects += s.connects;
+        for ( int k = 0; k < 6; ++k )
+        {
+            total.status[k] += s.status[k];
+        }
+        total.latency.merge( s.latency );
+    }
+    double seconds = ( now_ns() - start ) / 1e9;
+
+    const latency_histogram& h = total.latency;
+    printf( "%d threads, %d connections, pipeline %d, %s, %.1f s\n", opt.threads, opt.connections,
+        opt.keep_alive ? opt.pipeline : 1, opt.keep_alive ? "keep-alive" : "close", seconds );
+    printf( "requests   %llu (%.1f/s), %.2f MB/s, errors %llu, connects %llu\n", ( unsigned long long )total.requests,
+        total.requests / seconds, total.bytes / seconds / 1e6, ( unsigned long long )total.errors, ( unsigned long long )total.connects );
+    printf( "status     2xx %llu, 3xx %llu, 4xx %llu, 5xx %llu, other %llu\n", ( unsigned long long )total.status[2],
+        ( unsigned long long )total.status[3], ( unsigned long long )total.status[4], ( unsigned long long )total.status[5],
+        ( unsigned long long )( total.status[0] + total.status[1] ) );
+    printf( "latency us min %llu, mean %.1f, p50 %llu, p90 %llu, p99 %llu, p999 %llu, max %llu\n",
+        ( unsigned long long )h.min(), h.mean(), ( unsigned long long )h.percentile( 50 ), ( unsigned long long )h.percentile( 90 ),
+        ( unsigned long long )h.percentile( 99 ), ( unsigned long long )h.percentile( 99.9 ), ( unsigned long long )h.max() );
+    if ( opt.json_path )
+    {
+        FILE* out = strcmp( opt.json_path, "-" ) == 0 ? stdout : fopen( opt.json_path, "w" );
+        if ( ! out )
+        {
+            printf( "open %s failed: %s\n", opt.json_path, strerror( errno ) );
+            return 1;
+        }
+        write_json( out, opt, total, seconds );
+        if ( out != stdout )
+        {
+            fclose( out );
+        }
+    }
+    return total.requests > 0 ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+// 请求解析的微基准:比较逐字节查找行结束符加strncasecmp逐个匹配头部的旧方式,
+// 与按块查找行结束符加完美散列识别头部的http_parser
+// 用法: parser_bench [迭代次数]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "../http_parser.h"
+
+// 浏览器发出的典型请求,头部较多,其中大部分服务器并不关心
+static const char* REQUEST =
+    "GET /file/guiguzi.txt HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Cookie: session=8f14e45fceea167a5a36dedd4bea2543; theme=dark; lang=zh-CN; tracking=0123456789abcdef\r\n"
+    "Referer: http://www.example.com/home.html\r\n"
+    "If-None-Match: \"11e022-1ea-6ad4157a\"\r\n"
+    "If-Modified-Since: Sun, 18 Oct 2026 00:40:26 GMT\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n";
+
+// 解析结果,防止编译器把解析过程优化掉
+struct result
+{
+    int lines;
+    int known;
+    size_t checksum;
+};
+
+// 旧方式:逐字节查找回车换行,依次用strncasecmp比较各个头部名称
+static void parse_legacy( char* buf, int size, result& r )
+{
+    static const char* const names[] = { "Connection:", "Content-Length:", "Host:", "Range:", "If-Range:",
+        "If-None-Match:", "If-Modified-Since:", "Accept-Encoding:" };
+    int start = 0;
+    for ( int i = 0; i < size; ++i )
+    {
+        if ( buf[i] != '\r' || i + 1 >= size || buf[ i + 1 ] != '\n' )
+        {
+            continue;
+        }
+        buf[i] = '\0';
+        char* text = buf + start;
+        ++r.lines;
+        for ( size_t k = 0; k < sizeof( names ) / sizeof( names[0] ); ++k )
+        {
+            size_t n = strlen( names[k] );
+            if ( strncasecmp( text, names[k], n ) == 0 )
+            {
+                text += n;
+                text += strspn( text, " \t" );
+                r.checksum += strlen( text );
+                ++r.known;
+                break;
+            }
+        }
+        buf[i] = '\r';
+        start = ++i + 1;
+    }
+}
+
+// 新方式:按块查找行结束符,拆分名称和值后查完美散列表
+static void parse_scan( char* buf, int size, result& r )
+{
+    const char* p = buf;
+    const char* end = buf + size;
+    while ( p < end )
+    {
+        const char* eol = http_parser::find_line_end( p, end );
+        if ( eol + 1 >= end || eol[0] != '\r' || eol[1] != '\n' )
+        {
+            break;
+        }
+        ++r.lines;
+        str_view name, value;
+        if ( http_parser::split_header( p, eol - p, name, value )
+            && http_parser::lookup_header( name.data, name.len ) != HEADER_UNKNOWN )
+        {
+            r.checksum += value.len;
+            ++r.known;
+        }
+        p = eol + 2;
+    }
+}
+
+static double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run( const char* label, void ( *parse )( char*, int, result& ), std::vector< char >& buf, long iterations )
+{
+    result r = result();
+    double begin = now_seconds();
+    for ( long i = 0; i < iterations; ++i )
+    {
+        parse( &buf[0], ( int )buf.size(), r );
+    }
+    double elapsed = now_seconds() - begin;
+    printf( "%-8s %8.1f ns/request %8.1f MB/s  (lines %d, known %d, checksum %zu)\n", label,
+        elapsed * 1e9 / iterations, buf.size() * iterations / elapsed / 1e6,
+        r.lines / ( int )iterations, r.known / ( int )iterations, r.checksum / iterations );
+}
+
+int main( int argc, char* argv[] )
+{
+    long iterations = argc > 1 ? atol( argv[1] ) : 2000000;
+    if ( iterations <= 0 )
+    {
+        printf( "usage: %s [iterations]\n", argv[0] );
+        return 1;
+    }
+    std::vector< char > buf( REQUEST, REQUEST + strlen( REQUEST ) );
+    printf( "request size %zu bytes, %ld iterations, scanner: %s\n", buf.size(), iterations, http_parser::scanner_name() );
+    run( "legacy", parse_legacy, buf, iterations );
+    run( "scan", parse_scan, buf, iterations );
+    return 0;
+}
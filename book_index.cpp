@@ -0,0 +1,689 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "book_index.h"
+
+// 解码gbk(兼容gb18030)编码中的一个字符,返回该字符的字节数,code为其16位编码
+static inline size_t next_char( const unsigned char* p, const unsigned char* end, uint32_t& code )
+{
+    if ( p[0] < 0x81 || p[0] == 0xff || p + 1 >= end )
+    {
+        code = p[0];
+        return 1;
+    }
+	// gb18030的四字节字符,折叠为16位编码,检索时会再逐字节比对
+    if ( p[1] >= 0x30 && p[1] <= 0x39 && p + 3 < end )
+    {
+        code = ( ( ( p[0] << 8 ) | p[1] ) ^ ( ( p[2] << 8 ) | p[3] ) ) | 0x8000;
+        return 4;
+    }
+    code = ( p[0] << 8 ) | p[1];
+    return 2;
+}
+
+static inline size_t char_len( const unsigned char* p, const unsigned char* end )
+{
+    uint32_t code;
+    return next_char( p, end, code );
+}
+
+// 索引文件的头部,其后依次为书籍表,字符串表,二元组的索引项,起点和位置列表,
+// 字符的编码,起点和位置列表,各段按8字节对齐
+struct index_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t book_count;
+    uint32_t gram_count;
+    uint32_t posting_count;
+    uint32_t char_count;
+    uint32_t char_posting_count;
+    uint64_t books_offset;
+    uint64_t strings_offset;
+    uint64_t grams_offset;
+    uint64_t starts_offset;
+    uint64_t postings_offset;
+    uint64_t chars_offset;
+    uint64_t char_starts_offset;
+    uint64_t char_postings_offset;
+    uint64_t file_size;
+};
+
+// 索引文件中的一条书籍记录,名字和地址存放在字符串表中
+struct index_book
+{
+    uint32_t name_offset;
+    uint32_t name_len;
+    uint32_t url_offset;
+    uint32_t url_len;
+    uint32_t size;
+    uint32_t base;
+    int64_t mtime;
+};
+
+static const char INDEX_MAGIC[8] = { 'W', 'S', 'B', 'K', 'I', 'D', 'X', '\0' };
+
+static inline uint64_t align8( uint64_t n )
+{
+    return ( n + 7 ) & ~( uint64_t )7;
+}
+
+// 已排序的(索引项, 位置)对转换为紧凑的索引项数组,起点和位置列表
+static void group_entries( const std::vector< uint64_t >& entries, std::vector< uint32_t >& keys,
+    std::vector< uint32_t >& starts, std::vector< uint32_t >& postings )
+{
+    postings.resize( entries.size() );
+    for ( size_t i = 0; i < entries.size(); ++i )
+    {
+        uint32_t key = entries[i] >> 32;
+        if ( keys.empty() || keys.back() != key )
+        {
+            keys.push_back( key );
+            starts.push_back( i );
+        }
+        postings[i] = ( uint32_t )entries[i];
+    }
+    starts.push_back( entries.size() );
+}
+
+// 检索时直接使用这些值作为下标和偏移,文件损坏时不能越界:索引项严格递增,
+// 起点从0开始不减且以位置总数结尾,位置都在书籍范围之内
+static bool valid_lists( const uint32_t* keys, const uint32_t* starts, uint32_t count,
+    const uint32_t* postings, uint32_t posting_count, uint64_t total )
+{
+    bool ok = starts[0] == 0 && starts[ count ] == posting_count;
+    for ( uint32_t i = 0; ok && i < count; ++i )
+    {
+        ok = starts[i] <= starts[ i + 1 ] && ( i == 0 || keys[ i - 1 ] < keys[i] );
+    }
+    for ( uint32_t i = 0; ok && i < posting_count; ++i )
+    {
+        ok = postings[i] < total;
+    }
+    return ok;
+}
+
+// 在有序的索引项中查找key,返回其位置列表的范围
+static bool find_list( const uint32_t* keys, const uint32_t* starts, uint32_t count, const uint32_t* postings,
+    uint32_t key, const uint32_t*& begin, const uint32_t*& end )
+{
+    const uint32_t* it = std::lower_bound( keys, keys + count, key );
+    if ( it == keys + count || *it != key )
+    {
+        return false;
+    }
+    size_t i = it - keys;
+    begin = postings + starts[i];
+    end = postings + starts[ i + 1 ];
+    return true;
+}
+
+book_index::book_index() :
+    m_grams( 0 ), m_starts( 0 ), m_postings( 0 ), m_gram_count( 0 ), m_posting_count( 0 ),
+    m_chars( 0 ), m_char_starts( 0 ), m_char_postings( 0 ), m_char_count( 0 ), m_char_posting_count( 0 ),
+    m_map( 0 ), m_map_size( 0 )
+{
+}
+
+book_index::~book_index()
+{
+    release();
+}
+
+void book_index::release()
+{
+    for ( size_t i = 0; i < m_books.size(); ++i )
+    {
+        munmap( const_cast< char* >( m_books[i].text ), m_books[i].size );
+    }
+    m_books.clear();
+    m_gram_store.clear();
+    m_start_store.clear();
+    m_posting_store.clear();
+    m_char_store.clear();
+    m_char_start_store.clear();
+    m_char_posting_store.clear();
+    if ( m_map )
+    {
+        munmap( m_map, m_map_size );
+        m_map = 0;
+        m_map_size = 0;
+    }
+    m_grams = m_starts = m_postings = 0;
+    m_gram_count = m_posting_count = 0;
+    m_chars = m_char_starts = m_char_postings = 0;
+    m_char_count = m_char_posting_count = 0;
+}
+
+// 映射一本书籍的内容
+static const char* map_book( const char* path, struct stat& st )
+{
+    int fd = open( path, O_RDONLY );
+    if ( fd < 0 )
+    {
+        return NULL;
+    }
+    void* text = MAP_FAILED;
+    if ( fstat( fd, &st ) == 0 && S_ISREG( st.st_mode ) && st.st_size > 0 )
+    {
+        text = mmap( 0, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    }
+    close( fd );
+    return text == MAP_FAILED ? NULL : ( const char* )text;
+}
+
+// 列出目录下(含子目录)所有要索引的书籍文件,按文件名排序,保证书籍编号稳定;
+// files中为文件路径和访问地址
+static bool list_books( const std::string& dir, const std::string& url_prefix, std::vector< std::pair< std::string, std::string > >& files )
+{
+    DIR* dp = opendir( dir.c_str() );
+    if ( ! dp )
+    {
+        return false;
+    }
+    std::vector< std::string > names;
+    struct dirent* entry;
+    while ( ( entry = readdir( dp ) ) != NULL )
+    {
+        if ( entry->d_name[0] != '.' )
+        {
+            names.push_back( entry->d_name );
+        }
+    }
+    closedir( dp );
+    std::sort( names.begin(), names.end() );
+
+    for ( size_t i = 0; i < names.size(); ++i )
+    {
+        std::string path = dir + "/" + names[i];
+        std::string url = url_prefix + "/" + names[i];
+        struct stat st;
+        if ( stat( path.c_str(), &st ) < 0 )
+        {
+            continue;
+        }
+        if ( S_ISDIR( st.st_mode ) )
+        {
+            list_books( path, url, files );
+            continue;
+        }
+        if ( ! S_ISREG( st.st_mode ) || st.st_size == 0 || st.st_size >= UINT32_MAX )
+        {
+            continue;
+        }
+		// 预压缩的副本不是独立的书籍
+        size_t len = names[i].size();
+        if ( ( len > 3 && names[i].compare( len - 3, 3, ".gz" ) == 0 ) || ( len > 3 && names[i].compare( len - 3, 3, ".br" ) == 0 ) )
+        {
+            continue;
+        }
+        files.push_back( std::make_pair( path, url ) );
+    }
+    return true;
+}
+
+bool book_index::add_books( const std::string& dir, const std::string& url_prefix )
+{
+    std::vector< std::pair< std::string, std::string > > files;
+    if ( ! list_books( dir, url_prefix, files ) )
+    {
+        return false;
+    }
+    for ( size_t i = 0; i < files.size(); ++i )
+    {
+        struct stat st;
+        const char* text = map_book( files[i].first.c_str(), st );
+        if ( ! text )
+        {
+            continue;
+        }
+        std::string name = files[i].first.substr( files[i].first.rfind( '/' ) + 1 );
+        book b;
+        b.name = name.substr( 0, name.rfind( '.' ) );
+        b.url = files[i].second;
+        b.text = text;
+        b.size = st.st_size;
+        b.base = 0;
+        b.mtime = st.st_mtime;
+        m_books.push_back( b );
+    }
+    return true;
+}
+
+bool book_index::build( const char* dir, const char* url_prefix )
+{
+    release();
+    if ( ! add_books( dir, url_prefix ) )
+    {
+        return false;
+    }
+	// 分配每本书的全局起始偏移
+    uint64_t total = 0;
+    for ( size_t i = 0; i < m_books.size(); ++i )
+    {
+        m_books[i].base = total;
+        total += m_books[i].size;
+        if ( total >= UINT32_MAX )
+        {
+            release();
+            return false;
+        }
+    }
+	// 收集所有的(二元组, 位置)对和(字符, 位置)对,索引项在高32位,排序后即按索引项分组且位置有序
+    std::vector< uint64_t > entries;
+    std::vector< uint64_t > char_entries;
+    entries.reserve( total / 2 );
+    char_entries.reserve( total / 2 );
+    for ( size_t i = 0; i < m_books.size(); ++i )
+    {
+        const unsigned char* p = ( const unsigned char* )m_books[i].text;
+        const unsigned char* end = p + m_books[i].size;
+        uint32_t prev = 0, prev_pos = 0, code;
+        bool has_prev = false;
+        for ( const unsigned char* q = p; q < end; )
+        {
+            size_t n = next_char( q, end, code );
+            if ( has_prev )
+            {
+                entries.push_back( ( ( uint64_t )( ( prev << 16 ) | code ) << 32 ) | ( m_books[i].base + prev_pos ) );
+            }
+            char_entries.push_back( ( ( uint64_t )code << 32 ) | ( m_books[i].base + ( q - p ) ) );
+            prev = code;
+            prev_pos = q - p;
+            has_prev = true;
+            q += n;
+        }
+    }
+    std::sort( entries.begin(), entries.end() );
+    std::sort( char_entries.begin(), char_entries.end() );
+    group_entries( entries, m_gram_store, m_start_store, m_posting_store );
+    group_entries( char_entries, m_char_store, m_char_start_store, m_char_posting_store );
+
+    m_grams = m_gram_store.data();
+    m_starts = m_start_store.data();
+    m_postings = m_posting_store.data();
+    m_gram_count = m_gram_store.size();
+    m_posting_count = m_posting_store.size();
+    m_chars = m_char_store.data();
+    m_char_starts = m_char_start_store.data();
+    m_char_postings = m_char_posting_store.data();
+    m_char_count = m_char_store.size();
+    m_char_posting_count = m_char_posting_store.size();
+    return true;
+}
+
+bool book_index::save( const char* path ) const
+{
+	// 依次计算各段在文件中的位置
+    std::string strings;
+    std::vector< index_book > records( m_books.size() );
+    for ( size_t i = 0; i < m_books.size(); ++i )
+    {
+        records[i].name_offset = strings.size();
+        records[i].name_len = m_books[i].name.size();
+        strings += m_books[i].name;
+        records[i].url_offset = strings.size();
+        records[i].url_len = m_books[i].url.size();
+        strings += m_books[i].url;
+        records[i].size = m_books[i].size;
+        records[i].base = m_books[i].base;
+        records[i].mtime = m_books[i].mtime;
+    }
+    index_header header;
+    memset( &header, 0, sizeof( header ) );
+    memcpy( header.magic, INDEX_MAGIC, sizeof( header.magic ) );
+    header.version = FILE_VERSION;
+    header.book_count = m_books.size();
+    header.gram_count = m_gram_count;
+    header.posting_count = m_posting_count;
+    header.char_count = m_char_count;
+    header.char_posting_count = m_char_posting_count;
+    header.books_offset = align8( sizeof( header ) );
+    header.strings_offset = align8( header.books_offset + records.size() * sizeof( index_book ) );
+    header.grams_offset = align8( header.strings_offset + strings.size() );
+    header.starts_offset = align8( header.grams_offset + ( uint64_t )m_gram_count * 4 );
+    header.postings_offset = align8( header.starts_offset + ( ( uint64_t )m_gram_count + 1 ) * 4 );
+    header.chars_offset = align8( header.postings_offset + ( uint64_t )m_posting_count * 4 );
+    header.char_starts_offset = align8( header.chars_offset + ( uint64_t )m_char_count * 4 );
+    header.char_postings_offset = align8( header.char_starts_offset + ( ( uint64_t )m_char_count + 1 ) * 4 );
+    header.file_size = header.char_postings_offset + ( uint64_t )m_char_posting_count * 4;
+
+    std::string tmp = std::string( path ) + ".tmp";
+    FILE* fp = fopen( tmp.c_str(), "wb" );
+    if ( ! fp )
+    {
+        return false;
+    }
+	// 写入一段数据,并在其后填充到下一段的起点
+    struct section
+    {
+        const void* data;
+        size_t len;
+        uint64_t next;
+    } sections[] =
+    {
+        { &header, sizeof( header ), header.books_offset },
+        { records.data(), records.size() * sizeof( index_book ), header.strings_offset },
+        { strings.data(), strings.size(), header.grams_offset },
+        { m_grams, ( size_t )m_gram_count * 4, header.starts_offset },
+        { m_starts, ( ( size_t )m_gram_count + 1 ) * 4, header.postings_offset },
+        { m_postings, ( size_t )m_posting_count * 4, header.chars_offset },
+        { m_chars, ( size_t )m_char_count * 4, header.char_starts_offset },
+        { m_char_starts, ( ( size_t )m_char_count + 1 ) * 4, header.char_postings_offset },
+        { m_char_postings, ( size_t )m_char_posting_count * 4, header.file_size },
+    };
+    static const char zeros[8] = { 0 };
+    uint64_t pos = 0;
+    bool ok = true;
+    for ( size_t i = 0; ok && i < sizeof( sections ) / sizeof( sections[0] ); ++i )
+    {
+        ok = fwrite( sections[i].data, 1, sections[i].len, fp ) == sections[i].len;
+        pos += sections[i].len;
+        if ( ok && sections[i].next > pos )
+        {
+            ok = fwrite( zeros, 1, sections[i].next - pos, fp ) == sections[i].next - pos;
+            pos = sections[i].next;
+        }
+    }
+    ok = ( fclose( fp ) == 0 ) && ok;
+    if ( ! ok || rename( tmp.c_str(), path ) < 0 )
+    {
+        unlink( tmp.c_str() );
+        return false;
+    }
+    return true;
+}
+
+bool book_index::load( const char* path, const char* root, const char* url_prefix )
+{
+    release();
+    int fd = open( path, O_RDONLY );
+    if ( fd < 0 )
+    {
+        return false;
+    }
+    struct stat st;
+    if ( fstat( fd, &st ) < 0 || ( size_t )st.st_size < sizeof( index_header ) )
+    {
+        close( fd );
+        return false;
+    }
+    void* map = mmap( 0, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if ( map == MAP_FAILED )
+    {
+        return false;
+    }
+    m_map = map;
+    m_map_size = st.st_size;
+	// 校验文件头和各段的范围,各段须按4字节对齐且依次排列在文件之内
+    const char* base = ( const char* )map;
+    const index_header* header = ( const index_header* )base;
+    if ( memcmp( header->magic, INDEX_MAGIC, sizeof( INDEX_MAGIC ) ) != 0
+        || header->version != FILE_VERSION
+        || header->file_size != ( uint64_t )st.st_size
+        || header->books_offset < sizeof( index_header )
+        || ( header->books_offset | header->grams_offset | header->starts_offset | header->postings_offset
+            | header->chars_offset | header->char_starts_offset | header->char_postings_offset ) % 4 != 0
+        || header->books_offset + ( uint64_t )header->book_count * sizeof( index_book ) > header->strings_offset
+        || header->strings_offset > header->grams_offset
+        || header->grams_offset + ( uint64_t )header->gram_count * 4 > header->starts_offset
+        || header->starts_offset + ( ( uint64_t )header->gram_count + 1 ) * 4 > header->postings_offset
+        || header->postings_offset + ( uint64_t )header->posting_count * 4 > header->chars_offset
+        || header->chars_offset + ( uint64_t )header->char_count * 4 > header->char_starts_offset
+        || header->char_starts_offset + ( ( uint64_t )header->char_count + 1 ) * 4 > header->char_postings_offset
+        || header->char_postings_offset + ( uint64_t )header->char_posting_count * 4 > header->file_size )
+    {
+        release();
+        return false;
+    }
+	// 目录下的书籍须与建立索引时相同,新增或删除了书籍都要重新建立
+    std::vector< std::pair< std::string, std::string > > files;
+    if ( ! list_books( std::string( root ) + url_prefix, url_prefix, files ) || files.size() != header->book_count )
+    {
+        release();
+        return false;
+    }
+	// 书籍表很小,复制出来;书籍内容重新映射,并确认建立索引后未被修改
+    const index_book* records = ( const index_book* )( base + header->books_offset );
+    const char* strings = base + header->strings_offset;
+    uint64_t strings_len = header->grams_offset - header->strings_offset;
+    uint64_t total = 0;
+    for ( uint32_t i = 0; i < header->book_count; ++i )
+    {
+        const index_book& r = records[i];
+		// 书籍按顺序首尾相接
+        if ( ( uint64_t )r.name_offset + r.name_len > strings_len || ( uint64_t )r.url_offset + r.url_len > strings_len
+            || r.base != total || r.size == 0 )
+        {
+            release();
+            return false;
+        }
+        total += r.size;
+        if ( total >= UINT32_MAX )
+        {
+            release();
+            return false;
+        }
+        book b;
+        b.name.assign( strings + r.name_offset, r.name_len );
+        b.url.assign( strings + r.url_offset, r.url_len );
+        if ( b.url != files[i].second )
+        {
+            release();
+            return false;
+        }
+        struct stat book_st;
+        b.text = map_book( files[i].first.c_str(), book_st );
+        if ( ! b.text )
+        {
+            release();
+            return false;
+        }
+        b.size = book_st.st_size;
+        b.base = r.base;
+        b.mtime = r.mtime;
+        m_books.push_back( b );
+        if ( book_st.st_size != r.size || book_st.st_mtime != r.mtime )
+        {
+            release();
+            return false;
+        }
+    }
+	// 索引项和位置列表直接指向映射区,无需反序列化
+    m_grams = ( const uint32_t* )( base + header->grams_offset );
+    m_starts = ( const uint32_t* )( base + header->starts_offset );
+    m_postings = ( const uint32_t* )( base + header->postings_offset );
+    m_gram_count = header->gram_count;
+    m_posting_count = header->posting_count;
+    m_chars = ( const uint32_t* )( base + header->chars_offset );
+    m_char_starts = ( const uint32_t* )( base + header->char_starts_offset );
+    m_char_postings = ( const uint32_t* )( base + header->char_postings_offset );
+    m_char_count = header->char_count;
+    m_char_posting_count = header->char_posting_count;
+    if ( ! valid_lists( m_grams, m_starts, m_gram_count, m_postings, m_posting_count, total )
+        || ! valid_lists( m_chars, m_char_starts, m_char_count, m_char_postings, m_char_posting_count, total ) )
+    {
+        release();
+        return false;
+    }
+    return true;
+}
+
+int book_index::find_book( uint32_t pos ) const
+{
+    int lo = 0, hi = m_books.size() - 1;
+    while ( lo < hi )
+    {
+        int mid = ( lo + hi + 1 ) / 2;
+        if ( m_books[ mid ].base <= pos )
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+bool book_index::find_gram( uint32_t gram, const uint32_t*& begin, const uint32_t*& end ) const
+{
+    return find_list( m_grams, m_starts, m_gram_count, m_postings, gram, begin, end );
+}
+
+bool book_index::find_char( uint32_t code, const uint32_t*& begin, const uint32_t*& end ) const
+{
+    return find_list( m_chars, m_char_starts, m_char_count, m_char_postings, code, begin, end );
+}
+
+int book_index::search( const char* query, size_t len, std::vector< book_result >& results, size_t max_offsets ) const
+{
+    results.clear();
+    if ( len == 0 || m_books.empty() )
+    {
+        return 0;
+    }
+	// 切分查询串,记录每个字符的编码和在查询串中的偏移
+    const unsigned char* q = ( const unsigned char* )query;
+    std::vector< uint32_t > codes, offsets;
+    for ( size_t i = 0; i < len; )
+    {
+        uint32_t code;
+        offsets.push_back( i );
+        i += next_char( q + i, q + len, code );
+        codes.push_back( code );
+    }
+
+	// 候选位置为一个有序的位置列表减去shift,直接在索引中遍历,不复制
+    const uint32_t* best_begin = 0;
+    const uint32_t* best_end = 0;
+    uint32_t best_offset = 0;
+    if ( codes.size() == 1 )
+    {
+		// 单个字符:使用该字符的位置列表
+        if ( ! find_char( codes[0], best_begin, best_end ) )
+        {
+            return 0;
+        }
+    }
+    else
+    {
+		// 多个字符:选出位置列表最短的二元组,其余部分逐字节比对
+        for ( size_t i = 0; i + 1 < codes.size(); ++i )
+        {
+            const uint32_t* begin;
+            const uint32_t* end;
+            if ( ! find_gram( ( codes[i] << 16 ) | codes[ i + 1 ], begin, end ) )
+            {
+                return 0;
+            }
+            if ( ! best_begin || end - begin < best_end - best_begin )
+            {
+                best_begin = begin;
+                best_end = end;
+                best_offset = offsets[i];
+            }
+        }
+    }
+
+	// 逐个验证候选位置,并按书籍分组;候选位置有序,所属的书籍只会向后移动
+    int total = 0;
+    int id = -1;
+    uint32_t next_base = 0;
+    for ( const uint32_t* p = best_begin; p < best_end; ++p )
+    {
+        if ( *p < best_offset )
+        {
+            continue;
+        }
+        uint32_t pos = *p - best_offset;
+        if ( id < 0 || pos >= next_base )
+        {
+            id = find_book( pos );
+            next_base = id + 1 < ( int )m_books.size() ? m_books[ id + 1 ].base : UINT32_MAX;
+        }
+        const book& b = m_books[ id ];
+        if ( pos < b.base || pos - b.base + len > b.size || memcmp( b.text + ( pos - b.base ), query, len ) != 0 )
+        {
+            continue;
+        }
+        if ( results.empty() || results.back().book != id )
+        {
+            results.push_back( book_result() );
+            results.back().book = id;
+            results.back().count = 0;
+        }
+        book_result& r = results.back();
+        if ( r.offsets.size() < max_offsets )
+        {
+            r.offsets.push_back( pos - b.base );
+        }
+        ++r.count;
+        ++total;
+    }
+	// 命中次数多的书籍排在前面
+    for ( size_t i = 1; i < results.size(); ++i )
+    {
+        for ( size_t j = i; j > 0 && results[ j - 1 ].count < results[j].count; --j )
+        {
+            std::swap( results[ j - 1 ], results[j] );
+        }
+    }
+    return total;
+}
+
+void book_index::snippet( int id, uint32_t offset, size_t len, size_t context, uint32_t& begin, uint32_t& end ) const
+{
+    const book& b = m_books[ id ];
+    const unsigned char* text = ( const unsigned char* )b.text;
+    const unsigned char* text_end = text + b.size;
+	// 换行符之后一定是字符边界,先在上下文范围内向前寻找换行符
+    uint32_t lo = offset > context ? offset - context : 0;
+    uint32_t i = offset;
+    while ( i > lo && text[ i - 1 ] != '\n' )
+    {
+        --i;
+    }
+    begin = offset;
+    if ( i == 0 || text[ i - 1 ] == '\n' )
+    {
+        begin = i;
+    }
+    else
+    {
+		// 上下文内没有换行符,从更早的换行处逐字符前进到上下文的起点
+        uint32_t far = lo > 4096 ? lo - 4096 : 0;
+        uint32_t j = lo;
+        while ( j > far && text[ j - 1 ] != '\n' )
+        {
+            --j;
+        }
+        if ( j == 0 || text[ j - 1 ] == '\n' )
+        {
+            while ( j < lo )
+            {
+                j += char_len( text + j, text_end );
+            }
+            begin = std::min( j, offset );
+        }
+    }
+	// 向后逐字符扩展,遇到换行或者超出上下文时停止
+    uint32_t hi = std::min< uint64_t >( ( uint64_t )offset + len + context, b.size );
+    end = std::min< uint64_t >( ( uint64_t )offset + len, b.size );
+    while ( end < hi && text[ end ] != '\r' && text[ end ] != '\n' )
+    {
+        size_t n = char_len( text + end, text_end );
+        if ( end + n > hi )
+        {
+            break;
+        }
+        end += n;
+    }
+}
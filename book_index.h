@@ -0,0 +1,94 @@
+#ifndef BOOK_INDEX_H
+#define BOOK_INDEX_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+// 书籍全文检索的倒排索引
+// 书籍为gbk编码的中文文本,以相邻两个字符组成的二元组作为索引项,
+// 每个索引项对应一个有序的出现位置列表,位置为所有书籍首尾相接后的全局偏移;
+// 另有每个字符的位置列表,单个字符的检索直接使用,不必合并该字符开头的所有二元组
+// 索引可以在启动时建立,也可以由make_index离线写入文件,启动时只读映射后原地查询
+class book_index
+{
+public:
+    // 一本被索引的书籍
+    struct book
+    {
+        std::string name;       // 书名,即去掉扩展名的文件名
+        std::string url;        // 书籍的访问地址
+        const char* text;       // 书籍内容,只读映射
+        uint32_t size;          // 书籍大小
+        uint32_t base;          // 书籍在全局偏移中的起始位置
+        int64_t mtime;          // 建立索引时书籍文件的修改时间
+    };
+    // 一本书的检索结果
+    struct book_result
+    {
+        int book;                           // 书籍编号
+        int count;                          // 命中次数
+        std::vector< uint32_t > offsets;    // 前若干个命中位置在书中的偏移
+    };
+
+public:
+    book_index();
+    ~book_index();
+
+    // 扫描目录下的所有文件并建立索引,url_prefix为这些文件的访问路径前缀
+    bool build( const char* dir, const char* url_prefix );
+    // 将索引写入文件,先写临时文件再改名,不影响正在使用旧文件的进程
+    bool save( const char* path ) const;
+    // 只读映射索引文件,root+url_prefix为建立索引时的书籍目录;文件格式或版本不符,
+    // 内容损坏或被截断,目录下新增或删除了书籍,或者书籍在建立索引后被修改过,都返回false
+    bool load( const char* path, const char* root, const char* url_prefix );
+    // 检索query(gbk编码),结果按命中次数从高到低排序,每本书最多保留max_offsets个位置
+    // 返回总的命中次数
+    int search( const char* query, size_t len, std::vector< book_result >& results, size_t max_offsets ) const;
+    // 计算书中offset处长度为len的命中附近的摘要范围[begin, end),保证不截断字符
+    void snippet( int id, uint32_t offset, size_t len, size_t context, uint32_t& begin, uint32_t& end ) const;
+
+    int book_count() const { return m_books.size(); }
+    const book& get_book( int id ) const { return m_books[ id ]; }
+
+public:
+    // 索引文件的格式版本,格式变化时递增
+    static const uint32_t FILE_VERSION = 3;
+
+private:
+    bool add_books( const std::string& dir, const std::string& url_prefix );
+    void release();
+    // 根据全局偏移查找所属的书籍
+    int find_book( uint32_t pos ) const;
+    // 查找索引项,返回其位置列表的范围
+    bool find_gram( uint32_t gram, const uint32_t*& begin, const uint32_t*& end ) const;
+    // 查找字符,返回其位置列表的范围
+    bool find_char( uint32_t code, const uint32_t*& begin, const uint32_t*& end ) const;
+
+private:
+    std::vector< book > m_books;
+	// 以下数组指向m_*_store或者映射的索引文件
+    const uint32_t* m_grams;                // 有序的索引项
+    const uint32_t* m_starts;               // 每个索引项的位置列表在m_postings中的起点,多出一个结尾
+    const uint32_t* m_postings;             // 所有索引项的位置列表
+    uint32_t m_gram_count;
+    uint32_t m_posting_count;
+    const uint32_t* m_chars;                // 有序的字符编码
+    const uint32_t* m_char_starts;          // 每个字符的位置列表在m_char_postings中的起点,多出一个结尾
+    const uint32_t* m_char_postings;        // 所有字符的位置列表
+    uint32_t m_char_count;
+    uint32_t m_char_posting_count;
+	// 启动时建立索引所使用的存储
+    std::vector< uint32_t > m_gram_store;
+    std::vector< uint32_t > m_start_store;
+    std::vector< uint32_t > m_posting_store;
+    std::vector< uint32_t > m_char_store;
+    std::vector< uint32_t > m_char_start_store;
+    std::vector< uint32_t > m_char_posting_store;
+	// 映射的索引文件
+    void* m_map;
+    size_t m_map_size;
+};
+
+#endif
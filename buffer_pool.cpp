@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include "buffer_pool.h"
+#include "locker.h"
+
+namespace
+{
+// 块大小的种类数,从MIN_CHUNK开始每种翻倍
+const int CLASSES = 5;
+// 每种大小最多保留的空闲块数,多余的直接释放
+const size_t MAX_FREE = 256;
+
+// 空闲块的开头用来链接下一个空闲块
+struct free_chunk
+{
+    free_chunk* next;
+};
+
+struct chunk_list
+{
+    locker lock;
+    free_chunk* head;
+    size_t count;
+    chunk_list() : head( NULL ), count( 0 ) {}
+};
+
+chunk_list g_lists[ CLASSES ];
+
+int size_class( size_t size )
+{
+    int c = 0;
+    size_t chunk = buffer_pool::MIN_CHUNK;
+    while ( chunk < size )
+    {
+        chunk <<= 1;
+        ++c;
+    }
+    return c;
+}
+}
+
+char* buffer_pool::alloc( size_t& size )
+{
+    if ( size > MAX_CHUNK )
+    {
+        return NULL;
+    }
+    int c = size_class( size );
+    size = MIN_CHUNK << c;
+    chunk_list& list = g_lists[c];
+    list.lock.lock();
+    free_chunk* chunk = list.head;
+    if ( chunk )
+    {
+        list.head = chunk->next;
+        --list.count;
+    }
+    list.lock.unlock();
+    if ( chunk )
+    {
+        return ( char* )chunk;
+    }
+    return ( char* )malloc( size );
+}
+
+void buffer_pool::free( char* chunk, size_t size )
+{
+    chunk_list& list = g_lists[ size_class( size ) ];
+    list.lock.lock();
+    if ( list.count < MAX_FREE )
+    {
+        free_chunk* c = ( free_chunk* )chunk;
+        c->next = list.head;
+        list.head = c;
+        ++list.count;
+        chunk = NULL;
+    }
+    list.lock.unlock();
+    ::free( chunk );
+}
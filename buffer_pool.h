@@ -0,0 +1,77 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+#include <string.h>
+
+// 连接缓冲区溢出时使用的内存块池,块大小为4KB到64KB之间的2的幂,
+// 归还的块按大小挂在空闲链表上供其他连接复用,每种大小保留的块数有上限
+namespace buffer_pool
+{
+    static const size_t MIN_CHUNK = 4096;
+    static const size_t MAX_CHUNK = 65536;
+	// 分配不小于size的块,size更新为块的实际大小,size超过MAX_CHUNK时返回NULL
+    char* alloc( size_t& size );
+    void free( char* chunk, size_t size );
+}
+
+// 带内联存储的可增长缓冲区,内容不超过INLINE字节时不分配内存,
+// 超过时换用内存池中的块,reset后归还块并回到内联存储
+template< size_t INLINE >
+class conn_buffer
+{
+public:
+    conn_buffer() : m_data( m_inline ), m_capacity( INLINE ) {}
+    ~conn_buffer() { reset(); }
+
+    char* data() { return m_data; }
+    const char* data() const { return m_data; }
+    size_t capacity() const { return m_capacity; }
+    char& operator[]( size_t i ) { return m_data[i]; }
+    const char& operator[]( size_t i ) const { return m_data[i]; }
+
+	// 扩大到至少size字节,保留前used个字节的内容,失败时保持原样并返回false
+	// 扩大后原有的指针失效,调用者需要自行调整指向缓冲区内部的指针
+    bool grow( size_t size, size_t used )
+    {
+        if ( size <= m_capacity )
+        {
+            return true;
+        }
+        size_t capacity = size;
+        char* chunk = buffer_pool::alloc( capacity );
+        if ( ! chunk )
+        {
+            return false;
+        }
+        memcpy( chunk, m_data, used );
+        release();
+        m_data = chunk;
+        m_capacity = capacity;
+        return true;
+    }
+    void reset()
+    {
+        release();
+        m_data = m_inline;
+        m_capacity = INLINE;
+    }
+
+private:
+    void release()
+    {
+        if ( m_data != m_inline )
+        {
+            buffer_pool::free( m_data, m_capacity );
+        }
+    }
+    conn_buffer( const conn_buffer& );
+    conn_buffer& operator=( const conn_buffer& );
+
+private:
+    char* m_data;
+    size_t m_capacity;
+    char m_inline[ INLINE ];
+};
+
+#endif
@@ -0,0 +1,29 @@
+/*
+ * make_index.cpp - 离线建立书籍的全文索引文件,服务器启动时直接映射使用
+ */
+#include <stdio.h>
+#include "../book_index.h"
+
+int main( int argc, char* argv[] )
+{
+    if ( argc != 4 )
+    {
+        printf( "usage: %s root url_prefix index_file\n", argv[0] );
+        printf( "example: %s .. /file books.idx\n", argv[0] );
+        return 1;
+    }
+    std::string dir = std::string( argv[1] ) + argv[2];
+    book_index index;
+    if ( ! index.build( dir.c_str(), argv[2] ) )
+    {
+        printf( "build index of %s failed\n", dir.c_str() );
+        return 1;
+    }
+    if ( ! index.save( argv[3] ) )
+    {
+        printf( "write %s failed\n", argv[3] );
+        return 1;
+    }
+    printf( "indexed %d books into %s\n", index.book_count(), argv[3] );
+    return 0;
+}
@@ -0,0 +1,267 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <exception>
+#include <set>
+#include "cgi_launcher.h"
+
+// 一个作业消息的最大长度:路径和各环境变量,以'\0'分隔
+static const size_t JOB_MAX = 8192;
+
+// 随消息传递一个描述符所需的控制信息
+union fd_control
+{
+    cmsghdr align;
+    char data[ CMSG_SPACE( sizeof( int ) ) ];
+};
+
+cgi_launcher::cgi_launcher( int spare, int max_running )
+    : m_fd( -1 ), m_kill_fd( -1 ), m_pid( -1 ), m_max_running( max_running ), m_running( 0 )
+{
+    int fds[2];
+    if ( socketpair( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds ) < 0 )
+    {
+        throw std::exception();
+    }
+    int kill_pipe[2];
+    if ( pipe2( kill_pipe, O_CLOEXEC ) < 0 )
+    {
+        close( fds[0] );
+        close( fds[1] );
+        throw std::exception();
+    }
+    pid_t server = getpid();
+	// 避免子进程退出时再次输出继承的缓冲内容
+    fflush( stdout );
+    m_pid = fork();
+    if ( m_pid < 0 )
+    {
+        close( fds[0] );
+        close( fds[1] );
+        close( kill_pipe[0] );
+        close( kill_pipe[1] );
+        throw std::exception();
+    }
+    if ( m_pid == 0 )
+    {
+		// 只保留作业套接字(3)和终止请求管道的读端(4),继承的监听描述符等全部关闭,服务器退出时随之退出
+        close( fds[0] );
+        close( kill_pipe[1] );
+        int jobfd = fcntl( fds[1], F_DUPFD_CLOEXEC, 5 );
+        int killfd = fcntl( kill_pipe[0], F_DUPFD_CLOEXEC, 5 );
+        dup3( jobfd, 3, O_CLOEXEC );
+        dup3( killfd, 4, O_CLOEXEC );
+        close_range( 5, ~0U, 0 );
+        prctl( PR_SET_PDEATHSIG, SIGKILL );
+        if ( getppid() != server )
+        {
+            _exit( 0 );
+        }
+        run( 3, 4, spare );
+    }
+    close( fds[1] );
+    close( kill_pipe[0] );
+    m_fd = fds[0];
+    m_kill_fd = kill_pipe[1];
+	// 启动进程来不及读取时丢弃终止请求,不阻塞事件循环
+    fcntl( m_kill_fd, F_SETFL, fcntl( m_kill_fd, F_GETFL ) | O_NONBLOCK );
+}
+
+cgi_launcher::~cgi_launcher()
+{
+	// 空闲子进程读到套接字关闭后退出,启动进程在服务器退出时收到SIGKILL
+    close( m_fd );
+    close( m_kill_fd );
+}
+
+void cgi_launcher::terminate( pid_t pid )
+{
+	// 不超过PIPE_BUF的写入是原子的,多个线程可以同时调用
+    ssize_t n = write( m_kill_fd, &pid, sizeof( pid ) );
+    ( void )n;
+}
+
+bool cgi_launcher::acquire()
+{
+    if ( __sync_add_and_fetch( &m_running, 1 ) > m_max_running )
+    {
+        __sync_fetch_and_sub( &m_running, 1 );
+        return false;
+    }
+    return true;
+}
+
+void cgi_launcher::release()
+{
+    __sync_fetch_and_sub( &m_running, 1 );
+}
+
+bool cgi_launcher::launch( const char* path, const std::vector< std::string >& env, int out_fd )
+{
+    std::string job( path );
+    job += '\0';
+    for ( size_t i = 0; i < env.size(); ++i )
+    {
+        job += env[i];
+        job += '\0';
+    }
+    if ( job.size() >= JOB_MAX )
+    {
+        return false;
+    }
+    iovec iov = { &job[0], job.size() };
+    fd_control control;
+    memset( &control, 0, sizeof( control ) );
+    msghdr msg;
+    memset( &msg, 0, sizeof( msg ) );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data;
+    msg.msg_controllen = sizeof( control.data );
+    cmsghdr* cmsg = CMSG_FIRSTHDR( &msg );
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN( sizeof( int ) );
+    memcpy( CMSG_DATA( cmsg ), &out_fd, sizeof( int ) );
+	// SOCK_SEQPACKET的消息整体发送,多个线程可以同时调用;
+	// 空闲子进程都已被占用时作业在套接字中排队,缓冲区满时不等待
+    ssize_t n;
+    do
+    {
+        n = sendmsg( m_fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL );
+    } while ( n < 0 && errno == EINTR );
+    return n == ( ssize_t )job.size();
+}
+
+void cgi_launcher::run( int jobfd, int killfd, int spare )
+{
+	// 服务器忽略了SIGPIPE,CGI程序应恢复默认的处理方式
+    signal( SIGPIPE, SIG_DFL );
+    signal( SIGCHLD, SIG_DFL );
+	// 空闲子进程取得作业后经该管道写回自己的pid
+    int notify[2];
+    if ( pipe2( notify, O_CLOEXEC | O_NONBLOCK ) < 0 )
+    {
+        _exit( 1 );
+    }
+	// 等待作业的空闲子进程,以及已取得作业,尚未回收的子进程
+    std::set< pid_t > idle;
+    std::set< pid_t > running;
+    while ( true )
+    {
+        while ( ( int )idle.size() < spare )
+        {
+            pid_t pid = fork();
+            if ( pid == 0 )
+            {
+                close( notify[0] );
+                serve( jobfd, notify[1] );
+            }
+            if ( pid < 0 )
+            {
+                break;
+            }
+            idle.insert( pid );
+        }
+		// 定期醒来回收已结束的CGI程序,fork失败时稍后重试
+        pollfd p[2] = { { notify[0], POLLIN, 0 }, { killfd, POLLIN, 0 } };
+        poll( p, killfd >= 0 ? 2 : 1, 1000 );
+        pid_t taken[ 64 ];
+        ssize_t n;
+        while ( ( n = read( notify[0], taken, sizeof( taken ) ) ) > 0 )
+        {
+            for ( size_t i = 0; i < n / sizeof( pid_t ); ++i )
+            {
+                idle.erase( taken[i] );
+                running.insert( taken[i] );
+            }
+        }
+		// 子进程取得作业时先写notify再向服务器写pid,终止请求到达时对应的notify已在上面读出;
+		// 尚未回收的pid不会被复用,已结束但未回收的程序的进程组也一并终止
+        if ( killfd >= 0 && ( p[1].revents & ( POLLIN | POLLHUP ) ) )
+        {
+            n = read( killfd, taken, sizeof( taken ) );
+            if ( n == 0 )
+            {
+                close( killfd );
+                killfd = -1;
+            }
+            for ( ssize_t i = 0; i < n / ( ssize_t )sizeof( pid_t ); ++i )
+            {
+                if ( running.count( taken[i] ) )
+                {
+                    kill( -taken[i], SIGKILL );
+                }
+            }
+        }
+        pid_t pid;
+        while ( ( pid = waitpid( -1, NULL, WNOHANG ) ) > 0 )
+        {
+            idle.erase( pid );
+            running.erase( pid );
+        }
+    }
+}
+
+void cgi_launcher::serve( int jobfd, int notify_fd )
+{
+    char buf[ JOB_MAX ];
+    iovec iov = { buf, sizeof( buf ) - 1 };
+    fd_control control;
+    msghdr msg;
+    memset( &msg, 0, sizeof( msg ) );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data;
+    msg.msg_controllen = sizeof( control.data );
+    ssize_t n;
+    do
+    {
+        n = recvmsg( jobfd, &msg, 0 );
+    } while ( n < 0 && errno == EINTR );
+	// 服务器已关闭套接字
+    if ( n <= 0 )
+    {
+        _exit( 0 );
+    }
+    pid_t self = getpid();
+    write( notify_fd, &self, sizeof( self ) );
+    int out_fd = -1;
+    cmsghdr* cmsg = CMSG_FIRSTHDR( &msg );
+    if ( cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS )
+    {
+        memcpy( &out_fd, CMSG_DATA( cmsg ), sizeof( int ) );
+    }
+    if ( out_fd < 0 || ( msg.msg_flags & ( MSG_TRUNC | MSG_CTRUNC ) ) )
+    {
+        _exit( 1 );
+    }
+    buf[ n ] = '\0';
+	// 自成进程组,超时时连同CGI程序创建的子进程一起终止
+    setpgid( 0, 0 );
+	// 先写入pid,服务器读到之后才开始解析CGI程序的输出
+    write( out_fd, &self, sizeof( self ) );
+    const char* path = buf;
+    for ( char* p = buf + strlen( buf ) + 1; p < buf + n; p += strlen( p ) + 1 )
+    {
+        putenv( p );
+    }
+    dup2( out_fd, STDOUT_FILENO );
+    int null_fd = open( "/dev/null", O_RDONLY );
+    if ( null_fd >= 0 )
+    {
+        dup2( null_fd, STDIN_FILENO );
+    }
+    close_range( 3, ~0U, 0 );
+	// 调用CGI程序,参数列表为空,实际参数通过环境变量传递
+    char* argv[] = { const_cast< char* >( path ), NULL };
+    execv( path, argv );
+    _exit( 127 );
+}
@@ -0,0 +1,50 @@
+#ifndef CGI_LAUNCHER_H
+#define CGI_LAUNCHER_H
+
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+// CGI程序的启动器:启动时fork出一个单线程的启动进程,它预先fork若干空闲子进程,
+// 子进程阻塞在与服务器相连的SOCK_SEQPACKET套接字上等待作业,收到作业后直接exec,
+// 启动进程随即补充新的空闲子进程;服务器不再在多线程的大进程中为每个请求fork,
+// fork的开销也不在请求的路径上。作业经套接字传递CGI程序的路径,环境变量和
+// 标准输出管道的写端,子进程在exec之前自成进程组,并向管道写入自己的pid,以便超时时终止整个进程组;
+// CGI程序由启动进程回收,回收之后pid可能被其他进程复用,终止请求因此也交给启动进程,由它判断是否仍未回收
+class cgi_launcher
+{
+public:
+	// spare为空闲子进程数,max_running为同时运行的CGI程序数的上限;
+	// 须在创建线程之前调用,fork失败时抛出异常
+    cgi_launcher( int spare, int max_running );
+    ~cgi_launcher();
+	// 占用一个运行名额,已达上限时返回false,CGI程序结束后调用release
+    bool acquire();
+    void release();
+	// 正在运行的CGI程序数
+    int running() const { return m_running; }
+	// 以env(形如"NAME=value")为额外的环境变量运行path,子进程的标准输出为out_fd,
+	// 调用后out_fd可以关闭;启动进程来不及接收或者已经退出时返回false,可在任意线程调用
+    bool launch( const char* path, const std::vector< std::string >& env, int out_fd );
+	// 请求启动进程终止pid所在的进程组,pid已被回收时忽略,可在任意线程调用
+    void terminate( pid_t pid );
+	// 启动进程的pid,由服务器的SIGCHLD处理回收
+    pid_t pid() const { return m_pid; }
+
+private:
+	// 启动进程的主循环,保持spare个空闲子进程,不返回
+    static void run( int jobfd, int killfd, int spare );
+	// 空闲子进程等待一个作业并exec,不返回
+    static void serve( int jobfd, int notify_fd );
+
+private:
+	// 服务器一端的套接字
+    int m_fd;
+	// 终止请求管道的写端
+    int m_kill_fd;
+    pid_t m_pid;
+    int m_max_running;
+    volatile int m_running;
+};
+
+#endif
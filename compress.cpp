@@ -0,0 +1,152 @@
+#include <zlib.h>
+#include <brotli/encode.h>
+#include "compress.h"
+
+// run的操作类型
+enum { OP_PROCESS = 0, OP_FLUSH, OP_FINISH };
+
+const char* encoding_name( content_encoding encoding )
+{
+    switch ( encoding )
+    {
+        case ENCODING_GZIP: return "gzip";
+        case ENCODING_BR: return "br";
+        default: return "identity";
+    }
+}
+
+const char* encoding_suffix( content_encoding encoding )
+{
+    switch ( encoding )
+    {
+        case ENCODING_GZIP: return ".gz";
+        case ENCODING_BR: return ".br";
+        default: return "";
+    }
+}
+
+compress_stream::compress_stream() : m_encoding( ENCODING_IDENTITY ), m_state( 0 )
+{
+}
+
+compress_stream::~compress_stream()
+{
+    reset();
+}
+
+void compress_stream::reset()
+{
+    if ( ! m_state )
+    {
+        return;
+    }
+    if ( m_encoding == ENCODING_GZIP )
+    {
+        deflateEnd( ( z_stream* )m_state );
+        delete ( z_stream* )m_state;
+    }
+    else
+    {
+        BrotliEncoderDestroyInstance( ( BrotliEncoderState* )m_state );
+    }
+    m_state = 0;
+    m_encoding = ENCODING_IDENTITY;
+}
+
+bool compress_stream::init( content_encoding encoding, int level )
+{
+    reset();
+    if ( encoding == ENCODING_GZIP )
+    {
+        z_stream* zs = new z_stream();
+		// 窗口位数加16表示输出gzip格式的头部和尾部
+        if ( deflateInit2( zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY ) != Z_OK )
+        {
+            delete zs;
+            return false;
+        }
+        m_state = zs;
+    }
+    else if ( encoding == ENCODING_BR )
+    {
+        BrotliEncoderState* bs = BrotliEncoderCreateInstance( NULL, NULL, NULL );
+        if ( ! bs )
+        {
+            return false;
+        }
+        BrotliEncoderSetParameter( bs, BROTLI_PARAM_QUALITY, level );
+        BrotliEncoderSetParameter( bs, BROTLI_PARAM_MODE, BROTLI_MODE_TEXT );
+        m_state = bs;
+    }
+    else
+    {
+        return false;
+    }
+    m_encoding = encoding;
+    return true;
+}
+
+bool compress_stream::write( const char* data, size_t len, std::string& out, bool flush )
+{
+    return run( data, len, flush ? OP_FLUSH : OP_PROCESS, out );
+}
+
+bool compress_stream::finish( std::string& out )
+{
+    return run( NULL, 0, OP_FINISH, out );
+}
+
+bool compress_stream::run( const char* data, size_t len, int op, std::string& out )
+{
+    if ( ! m_state )
+    {
+        return false;
+    }
+    unsigned char buf[ 16384 ];
+    if ( m_encoding == ENCODING_GZIP )
+    {
+        z_stream* zs = ( z_stream* )m_state;
+        int flush = op == OP_FINISH ? Z_FINISH : ( op == OP_FLUSH ? Z_SYNC_FLUSH : Z_NO_FLUSH );
+        zs->next_in = ( Bytef* )data;
+        zs->avail_in = len;
+		// 输出缓冲区写满时继续,直到输入全部消耗且没有待输出的数据
+        do
+        {
+            zs->next_out = buf;
+            zs->avail_out = sizeof( buf );
+            int ret = deflate( zs, flush );
+            if ( ret == Z_STREAM_ERROR )
+            {
+                return false;
+            }
+            out.append( ( const char* )buf, sizeof( buf ) - zs->avail_out );
+        } while ( zs->avail_out == 0 );
+        return zs->avail_in == 0;
+    }
+    BrotliEncoderState* bs = ( BrotliEncoderState* )m_state;
+    BrotliEncoderOperation operation = op == OP_FINISH ? BROTLI_OPERATION_FINISH
+        : ( op == OP_FLUSH ? BROTLI_OPERATION_FLUSH : BROTLI_OPERATION_PROCESS );
+    size_t avail_in = len;
+    const uint8_t* next_in = ( const uint8_t* )data;
+    while ( true )
+    {
+        size_t avail_out = sizeof( buf );
+        uint8_t* next_out = buf;
+        if ( ! BrotliEncoderCompressStream( bs, operation, &avail_in, &next_in, &avail_out, &next_out, NULL ) )
+        {
+            return false;
+        }
+        out.append( ( const char* )buf, sizeof( buf ) - avail_out );
+        if ( avail_in == 0 && ! BrotliEncoderHasMoreOutput( bs )
+            && ( op != OP_FINISH || BrotliEncoderIsFinished( bs ) ) )
+        {
+            return true;
+        }
+    }
+}
+
+bool compress_buffer( content_encoding encoding, int level, const char* data, size_t len, std::string& out )
+{
+    compress_stream stream;
+    return stream.init( encoding, level ) && stream.write( data, len, out ) && stream.finish( out );
+}
@@ -0,0 +1,40 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+#include <string>
+
+// 应答内容的编码方式
+enum content_encoding { ENCODING_IDENTITY = 0, ENCODING_GZIP, ENCODING_BR, ENCODING_COUNT };
+
+// 编码方式在Content-Encoding中的名字和预压缩文件的扩展名
+const char* encoding_name( content_encoding encoding );
+const char* encoding_suffix( content_encoding encoding );
+
+// 流式压缩器,支持gzip和brotli
+// 内容可以分多次写入,每次写入的压缩结果追加到out中,最后调用finish写出结尾
+class compress_stream
+{
+public:
+    compress_stream();
+    ~compress_stream();
+
+	// level为压缩级别,gzip为1-9,brotli为0-11
+    bool init( content_encoding encoding, int level );
+	// 压缩一段内容,flush为true时输出所有已写入内容对应的压缩数据,便于边生成边发送
+    bool write( const char* data, size_t len, std::string& out, bool flush = false );
+    bool finish( std::string& out );
+    void reset();
+
+private:
+    bool run( const char* data, size_t len, int op, std::string& out );
+
+private:
+    content_encoding m_encoding;
+    void* m_state;
+};
+
+// 一次性压缩整段内容
+bool compress_buffer( content_encoding encoding, int level, const char* data, size_t len, std::string& out );
+
+#endif
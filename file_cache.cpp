@@ -0,0 +1,508 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <vector>
+#include "file_cache.h"
+
+// 引起文件内容或者权限变化的事件
+static const uint32_t WATCH_EVENTS = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF;
+// 值得压缩的最小文件大小
+static const off_t COMPRESS_MIN_SIZE = 256;
+// 在内存中压缩时使用的压缩级别,每个文件版本只压缩一次,在压缩率和首次请求的延迟之间折中
+static const int COMPRESS_LEVEL[ ENCODING_COUNT ] = { 0, 6, 5 };
+
+file_cache::file_cache( size_t max_bytes, size_t sendfile_min ) :
+    m_max_bytes( max_bytes ), m_sendfile_min( sendfile_min ), m_bytes( 0 ), m_stop( false )
+{
+    m_notify_fd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+    if ( pthread_create( &m_builder, NULL, builder, this ) != 0 )
+    {
+        if ( m_notify_fd >= 0 )
+        {
+            close( m_notify_fd );
+        }
+        throw std::exception();
+    }
+}
+
+file_cache::~file_cache()
+{
+    m_lock.lock();
+    m_stop = true;
+    m_lock.unlock();
+    m_build_sem.post();
+    pthread_join( m_builder, NULL );
+	// 丢弃尚未生成的版本
+    for ( std::list< std::pair< entry*, content_encoding > >::iterator it = m_build_queue.begin(); it != m_build_queue.end(); ++it )
+    {
+        release( it->first );
+    }
+    m_build_queue.clear();
+    clear();
+    if ( m_notify_fd >= 0 )
+    {
+        close( m_notify_fd );
+    }
+}
+
+// 判断文件是否在缓存之后被修改
+static bool changed( const struct stat& a, const struct stat& b )
+{
+    return a.st_ino != b.st_ino || a.st_dev != b.st_dev || a.st_size != b.st_size
+        || a.st_mtim.tv_sec != b.st_mtim.tv_sec || a.st_mtim.tv_nsec != b.st_mtim.tv_nsec
+        || a.st_mode != b.st_mode;
+}
+
+file_cache::entry* file_cache::acquire( const char* path )
+{
+    time_t now = time( NULL );
+    std::vector< entry* > dead;
+    entry* e = NULL;
+    m_lock.lock();
+    std::unordered_map< std::string, entry* >::iterator it = m_entries.find( path );
+    if ( it != m_entries.end() )
+    {
+        e = it->second;
+		// 没有inotify监视的条目定期检查修改时间
+        struct stat st;
+        if ( e->wd < 0 && now - e->checked >= REVALIDATE_SECONDS )
+        {
+            if ( stat( path, &st ) == 0 && ! changed( st, e->st ) )
+            {
+                e->checked = now;
+            }
+            else
+            {
+                if ( remove( e ) )
+                {
+                    dead.push_back( e );
+                }
+                e = NULL;
+            }
+        }
+        if ( e )
+        {
+            m_lru.splice( m_lru.begin(), m_lru, e->lru );
+            ++e->refs;
+        }
+    }
+    m_lock.unlock();
+    for ( size_t i = 0; i < dead.size(); ++i )
+    {
+        destroy( dead[i] );
+    }
+    if ( e )
+    {
+        return e;
+    }
+
+	// 未命中,在锁外打开并映射文件
+    e = load( path );
+    if ( ! e )
+    {
+        return NULL;
+    }
+    dead.clear();
+    m_lock.lock();
+    it = m_entries.find( path );
+    if ( it != m_entries.end() )
+    {
+		// 其他线程已经加载了同一文件,使用已有的条目
+        dead.push_back( e );
+        e = it->second;
+        ++e->refs;
+    }
+    else if ( charge( e ) <= m_max_bytes )
+    {
+        e->checked = now;
+        insert( e );
+		// 淘汰最久未使用的条目,正在发送的映射在其引用释放后才解除
+        evict( e, dead );
+    }
+    m_lock.unlock();
+    for ( size_t i = 0; i < dead.size(); ++i )
+    {
+        destroy( dead[i] );
+    }
+    return e;
+}
+
+void file_cache::evict( entry* keep, std::vector< entry* >& dead )
+{
+    while ( ( m_bytes > m_max_bytes || m_entries.size() > MAX_ENTRIES ) && ! m_lru.empty() && m_lru.back() != keep )
+    {
+        entry* victim = m_lru.back();
+        if ( remove( victim ) )
+        {
+            dead.push_back( victim );
+        }
+    }
+}
+
+size_t file_cache::charge( const entry* e )
+{
+    size_t bytes = e->address ? e->st.st_size : 0;
+    for ( int i = 0; i < ENCODING_COUNT; ++i )
+    {
+        const variant& v = e->variants[i];
+        if ( v.state == VARIANT_READY && v.fd < 0 )
+        {
+            bytes += v.size;
+        }
+    }
+    return bytes;
+}
+
+bool file_cache::compressible( const entry* e )
+{
+    static const char* const types[] = { ".txt", ".html", ".htm", ".css", ".js", ".json", ".xml", ".svg" };
+    if ( e->st.st_size < COMPRESS_MIN_SIZE )
+    {
+        return false;
+    }
+    const char* ext = strrchr( e->path.c_str(), '.' );
+    for ( size_t i = 0; ext && i < sizeof( types ) / sizeof( types[0] ); ++i )
+    {
+        if ( strcasecmp( ext, types[i] ) == 0 )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+const file_cache::variant* file_cache::get_variant( entry* e, content_encoding encoding )
+{
+	// 不在缓存中的条目用完即丢弃,不值得为其压缩
+    if ( encoding == ENCODING_IDENTITY || ! e->cached || ! compressible( e ) )
+    {
+        return NULL;
+    }
+    variant& v = e->variants[ encoding ];
+    m_lock.lock();
+    VARIANT_STATE state = v.state;
+    if ( state == VARIANT_NONE )
+    {
+		// 压缩不在工作线程上进行,队列持有条目的引用直到生成完毕
+        v.state = VARIANT_BUILDING;
+        ++e->refs;
+        m_build_queue.push_back( std::make_pair( e, encoding ) );
+    }
+    m_lock.unlock();
+    if ( state == VARIANT_NONE )
+    {
+        m_build_sem.post();
+    }
+    return state == VARIANT_READY ? &v : NULL;
+}
+
+void* file_cache::builder( void* arg )
+{
+    ( ( file_cache* )arg )->run_builder();
+    return NULL;
+}
+
+void file_cache::run_builder()
+{
+    while ( m_build_sem.wait() )
+    {
+        m_lock.lock();
+        if ( m_stop )
+        {
+            m_lock.unlock();
+            break;
+        }
+        if ( m_build_queue.empty() )
+        {
+            m_lock.unlock();
+            continue;
+        }
+        entry* e = m_build_queue.front().first;
+        content_encoding encoding = m_build_queue.front().second;
+        m_build_queue.pop_front();
+        m_lock.unlock();
+
+		// 在锁外生成,其他线程看到VARIANT_BUILDING时发送未压缩的原文件
+        variant& v = e->variants[ encoding ];
+        bool ok = build_variant( e, encoding, v );
+        std::vector< entry* > dead;
+        m_lock.lock();
+        v.state = ok ? VARIANT_READY : VARIANT_FAILED;
+        if ( ok && e->cached && v.fd < 0 )
+        {
+            m_bytes += v.size;
+            evict( e, dead );
+        }
+        m_lock.unlock();
+        for ( size_t i = 0; i < dead.size(); ++i )
+        {
+            destroy( dead[i] );
+        }
+        release( e );
+    }
+}
+
+bool file_cache::build_variant( entry* e, content_encoding encoding, variant& v )
+{
+    std::string etag( e->etag, strlen( e->etag ) - 1 );
+    snprintf( v.etag, sizeof( v.etag ), "%s-%s\"", etag.c_str(), encoding_name( encoding ) );
+	// 优先使用不旧于原文件的预压缩文件
+    std::string path = e->path + encoding_suffix( encoding );
+    int fd = open( path.c_str(), O_RDONLY | O_CLOEXEC );
+    if ( fd >= 0 )
+    {
+        struct stat st;
+        if ( fstat( fd, &st ) == 0 && S_ISREG( st.st_mode ) && ( st.st_mode & S_IROTH ) && st.st_size > 0
+            && st.st_mtime >= e->st.st_mtime )
+        {
+            v.size = st.st_size;
+            if ( m_sendfile_min > 0 && ( size_t )st.st_size >= m_sendfile_min )
+            {
+                v.fd = fd;
+                return true;
+            }
+            void* p = mmap( 0, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+            if ( p != MAP_FAILED )
+            {
+                v.address = ( char* )p;
+                close( fd );
+                return true;
+            }
+        }
+        close( fd );
+    }
+	// 在内存中压缩,大文件没有常驻的映射,临时映射一次
+    const char* data = e->address;
+    if ( ! data )
+    {
+        void* p = mmap( 0, e->st.st_size, PROT_READ, MAP_SHARED, e->fd, 0 );
+        if ( p == MAP_FAILED )
+        {
+            return false;
+        }
+        data = ( const char* )p;
+    }
+    bool ok = compress_buffer( encoding, COMPRESS_LEVEL[ encoding ], data, e->st.st_size, v.data );
+    if ( ! e->address )
+    {
+        munmap( const_cast< char* >( data ), e->st.st_size );
+    }
+	// 压缩效果不明显时不使用压缩版本
+    if ( ! ok || v.data.size() >= ( size_t )e->st.st_size * 9 / 10 )
+    {
+        std::string().swap( v.data );
+        return false;
+    }
+    v.size = v.data.size();
+    return true;
+}
+
+void file_cache::release( entry* e )
+{
+    m_lock.lock();
+    bool last = --e->refs == 0;
+    m_lock.unlock();
+    if ( last )
+    {
+        destroy( e );
+    }
+}
+
+file_cache::entry* file_cache::load( const char* path )
+{
+    int fd = open( path, O_RDONLY | O_CLOEXEC );
+    if ( fd < 0 )
+    {
+        return NULL;
+    }
+    struct stat st;
+	// 只缓存其他人可读的普通文件
+    if ( fstat( fd, &st ) < 0 || ! S_ISREG( st.st_mode ) || ! ( st.st_mode & S_IROTH ) )
+    {
+        close( fd );
+        return NULL;
+    }
+    char* address = NULL;
+	// 大文件保持描述符打开,由sendfile发送,其余文件映射后即可关闭描述符
+    bool use_sendfile = m_sendfile_min > 0 && ( size_t )st.st_size >= m_sendfile_min;
+    if ( ! use_sendfile && st.st_size > 0 )
+    {
+        void* p = mmap( 0, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+        if ( p == MAP_FAILED )
+        {
+            close( fd );
+            return NULL;
+        }
+        address = ( char* )p;
+    }
+    if ( ! use_sendfile )
+    {
+        close( fd );
+        fd = -1;
+    }
+
+    entry* e = new entry;
+    e->path = path;
+    e->st = st;
+    e->address = address;
+    e->fd = fd;
+	// 校验值随文件一起缓存,每个应答无需重新计算
+    snprintf( e->etag, sizeof( e->etag ), "\"%lx-%lx-%lx.%lx\"", ( unsigned long )st.st_ino,
+        ( unsigned long )st.st_size, ( unsigned long )st.st_mtim.tv_sec, ( unsigned long )st.st_mtim.tv_nsec );
+    struct tm tm;
+    gmtime_r( &st.st_mtime, &tm );
+    strftime( e->last_modified, sizeof( e->last_modified ), "%a, %d %b %Y %H:%M:%S GMT", &tm );
+    for ( int i = 0; i < ENCODING_COUNT; ++i )
+    {
+        e->variants[i].state = VARIANT_NONE;
+        e->variants[i].address = NULL;
+        e->variants[i].fd = -1;
+        e->variants[i].size = 0;
+        e->variants[i].etag[0] = '\0';
+    }
+    e->refs = 1;
+    e->cached = false;
+    e->wd = -1;
+    e->checked = 0;
+    return e;
+}
+
+void file_cache::insert( entry* e )
+{
+    if ( m_notify_fd >= 0 )
+    {
+        e->wd = inotify_add_watch( m_notify_fd, e->path.c_str(), WATCH_EVENTS );
+        if ( e->wd >= 0 )
+        {
+            m_watches.insert( std::make_pair( e->wd, e ) );
+        }
+    }
+    m_entries[ e->path ] = e;
+    m_lru.push_front( e );
+    e->lru = m_lru.begin();
+    e->cached = true;
+    ++e->refs;
+    m_bytes += charge( e );
+}
+
+// 将条目移出缓存并释放缓存持有的引用,返回true表示已无引用,需调用destroy
+bool file_cache::remove( entry* e )
+{
+    m_entries.erase( e->path );
+    m_lru.erase( e->lru );
+    m_bytes -= charge( e );
+    if ( e->wd >= 0 )
+    {
+		// 同一文件的不同路径共享监视描述符,最后一个条目移除时才取消监视
+        std::pair< std::unordered_multimap< int, entry* >::iterator, std::unordered_multimap< int, entry* >::iterator > range = m_watches.equal_range( e->wd );
+        size_t count = 0;
+        for ( std::unordered_multimap< int, entry* >::iterator it = range.first; it != range.second; )
+        {
+            if ( it->second == e )
+            {
+                it = m_watches.erase( it );
+            }
+            else
+            {
+                ++it;
+                ++count;
+            }
+        }
+        if ( count == 0 )
+        {
+            inotify_rm_watch( m_notify_fd, e->wd );
+        }
+        e->wd = -1;
+    }
+    e->cached = false;
+    return --e->refs == 0;
+}
+
+void file_cache::destroy( entry* e )
+{
+    if ( e->address )
+    {
+        munmap( e->address, e->st.st_size );
+    }
+    if ( e->fd >= 0 )
+    {
+        close( e->fd );
+    }
+    for ( int i = 0; i < ENCODING_COUNT; ++i )
+    {
+        if ( e->variants[i].address )
+        {
+            munmap( e->variants[i].address, e->variants[i].size );
+        }
+        if ( e->variants[i].fd >= 0 )
+        {
+            close( e->variants[i].fd );
+        }
+    }
+    delete e;
+}
+
+void file_cache::handle_events()
+{
+    char buf[ 4096 ] __attribute__( ( aligned( __alignof__( struct inotify_event ) ) ) );
+    std::vector< entry* > dead;
+    while ( true )
+    {
+        ssize_t len = read( m_notify_fd, buf, sizeof( buf ) );
+        if ( len <= 0 )
+        {
+            break;
+        }
+        m_lock.lock();
+        for ( char* p = buf; p < buf + len; )
+        {
+            const struct inotify_event* event = ( const struct inotify_event* )p;
+            p += sizeof( struct inotify_event ) + event->len;
+			// 使监视该文件的所有条目失效
+            std::unordered_multimap< int, entry* >::iterator it;
+            while ( ( it = m_watches.find( event->wd ) ) != m_watches.end() )
+            {
+                entry* e = it->second;
+                if ( event->mask & IN_IGNORED )
+                {
+					// 监视已被内核移除,无需再取消
+                    m_watches.erase( it );
+                    e->wd = -1;
+                }
+                if ( remove( e ) )
+                {
+                    dead.push_back( e );
+                }
+            }
+        }
+        m_lock.unlock();
+    }
+    for ( size_t i = 0; i < dead.size(); ++i )
+    {
+        destroy( dead[i] );
+    }
+}
+
+void file_cache::clear()
+{
+    std::vector< entry* > dead;
+    m_lock.lock();
+    while ( ! m_lru.empty() )
+    {
+        entry* e = m_lru.back();
+        if ( remove( e ) )
+        {
+            dead.push_back( e );
+        }
+    }
+    m_lock.unlock();
+    for ( size_t i = 0; i < dead.size(); ++i )
+    {
+        destroy( dead[i] );
+    }
+}
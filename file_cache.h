@@ -0,0 +1,107 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/stat.h>
+#include <time.h>
+#include <pthread.h>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "locker.h"
+#include "compress.h"
+
+// 静态文件的共享缓存
+// 以文件路径为键,保存文件的只读映射和状态信息,各连接通过引用计数共享同一映射,
+// 文件被修改后通过inotify(不可用时按修改时间)失效,总字节数超过上限时淘汰最久未使用的文件
+// 不小于sendfile阈值的大文件不做映射,只保持打开的文件描述符,由sendfile直接发送
+// 文本文件的gzip和brotli压缩版本在首次需要时交给后台线程生成一次,生成之前先发送未压缩的原文件,
+// 生成后与原文件一起缓存,原文件修改后随之失效
+class file_cache
+{
+public:
+    enum VARIANT_STATE { VARIANT_NONE = 0, VARIANT_BUILDING, VARIANT_READY, VARIANT_FAILED };
+	// 文件的一种压缩版本,优先使用与原文件同目录,不旧于原文件的预压缩文件(.gz/.br),否则在内存中压缩
+    struct variant
+    {
+        VARIANT_STATE state;
+        std::string data;       // 在内存中压缩得到的内容
+        char* address;          // 预压缩文件的映射
+        int fd;                 // 较大的预压缩文件保持打开的描述符,用于sendfile
+        size_t size;
+        char etag[ 72 ];        // 压缩版本的校验值,与原文件的不同
+    };
+
+    struct entry
+    {
+        std::string path;
+        struct stat st;
+        char* address;      // 文件的只读映射,空文件和大文件为NULL
+        int fd;             // 大文件保持打开的描述符,用于sendfile,其他为-1
+        char etag[ 64 ];            // 强校验值,由inode,大小和修改时间组成
+        char last_modified[ 32 ];   // http日期格式的修改时间
+        int refs;           // 引用计数,缓存本身也持有一个引用
+        bool cached;        // 是否仍在缓存中,失效或淘汰后为false
+        int wd;             // inotify的监视描述符,未监视为-1
+        time_t checked;     // 最近一次确认文件未修改的时间
+        std::list< entry* >::iterator lru;
+        variant variants[ ENCODING_COUNT ];
+    };
+
+public:
+	// sendfile_min为使用sendfile发送的最小文件大小,为0时所有文件都做映射
+    file_cache( size_t max_bytes, size_t sendfile_min );
+    ~file_cache();
+
+	// 获取可读的普通文件的映射,返回带一个引用的条目,使用完毕后调用release
+	// 文件不存在,无读权限或不是普通文件时返回NULL
+    entry* acquire( const char* path );
+    void release( entry* e );
+	// 获取条目的压缩版本,尚未生成时交给后台线程生成并返回NULL,正在生成,不可压缩或压缩失败时也返回NULL
+	// 返回的版本在条目的引用释放之前有效
+    const variant* get_variant( entry* e, content_encoding encoding );
+	// 判断文件是否为值得压缩的文本
+    static bool compressible( const entry* e );
+	// inotify的文件描述符,可读时调用handle_events,不可用时为-1
+    int notify_fd() const { return m_notify_fd; }
+    void handle_events();
+	// 清空缓存
+    void clear();
+
+private:
+    entry* load( const char* path );
+    void insert( entry* e );
+    bool remove( entry* e );
+	// 超出上限时淘汰最久未使用的条目,keep除外,无引用的条目放入dead
+    void evict( entry* keep, std::vector< entry* >& dead );
+    bool build_variant( entry* e, content_encoding encoding, variant& v );
+	// 后台线程依次生成队列中的压缩版本
+    static void* builder( void* arg );
+    void run_builder();
+	// 条目占用的内存字节数,包括映射和已生成的压缩版本
+    static size_t charge( const entry* e );
+    void destroy( entry* e );
+
+private:
+	// 未使用inotify时,超过该秒数的条目在使用前重新检查修改时间
+    static const int REVALIDATE_SECONDS = 1;
+	// 缓存的最大条目数,限制大文件占用的描述符
+    static const size_t MAX_ENTRIES = 1024;
+
+    size_t m_max_bytes;
+    size_t m_sendfile_min;
+    size_t m_bytes;
+    int m_notify_fd;
+    std::unordered_map< std::string, entry* > m_entries;
+    std::unordered_multimap< int, entry* > m_watches;
+	// 最近使用的条目在前
+    std::list< entry* > m_lru;
+    locker m_lock;
+	// 待生成的压缩版本,队列中的条目各持有一个引用,由m_lock保护
+    std::list< std::pair< entry*, content_encoding > > m_build_queue;
+    sem m_build_sem;
+    bool m_stop;
+    pthread_t m_builder;
+};
+
+#endif
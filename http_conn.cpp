@@ -1,15 +1,44 @@
 #include "http_conn.h"
+#include "reactor.h"
 
 const char* ok_200_title = "OK";
+const char* ok_206_title = "Partial Content";
+const char* not_modified_304_title = "Not Modified";
 const char* error_400_title = "Bad Request";
 const char* error_400_form = "Your request has bad syntax or is inherently impossible to satisfy.\n";
 const char* error_403_title = "Forbidden";
 const char* error_403_form = "You do not have permission to get file from this server.\n";
 const char* error_404_title = "Not Found";
 const char* error_404_form = "The requested file was not found on this server.\n";
+const char* error_405_title = "Method Not Allowed";
+const char* error_405_form = "The requested method is not supported for this resource.\n";
+const char* error_413_title = "Payload Too Large";
+const char* error_413_form = "The request body is larger than the server is willing to process.\n";
+const char* error_414_title = "URI Too Long";
+const char* error_414_form = "The query string is longer than the server is willing to process.\n";
+const char* error_416_title = "Range Not Satisfiable";
+const char* error_416_form = "The requested range is not satisfiable.\n";
 const char* error_500_title = "Internal Error";
 const char* error_500_form = "There was an unusual problem serving the requested file.\n";
+const char* error_501_title = "Not Implemented";
+const char* error_501_form = "The server does not support the requested method or transfer coding.\n";
+const char* error_502_title = "Bad Gateway";
+const char* error_502_form = "The CGI program did not produce a valid response.\n";
+const char* error_503_title = "Service Unavailable";
+const char* error_503_form = "Too many CGI programs are running, please try again later.\n";
+const char* error_504_title = "Gateway Timeout";
+const char* error_504_form = "The CGI program did not respond in time.\n";
+// 各类资源允许的请求方法
+const char* allow_all = "GET, HEAD, POST, OPTIONS";
+const char* allow_file = "GET, HEAD, OPTIONS";
+const char* allow_cgi = "GET, OPTIONS";
 const char* doc_root = ".";
+// 与http_conn::METHOD的顺序一致
+static const char* METHOD_NAMES[] = { "GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT", "PATCH" };
+// 动态内容值得压缩的最小长度
+static const size_t DYNAMIC_COMPRESS_MIN = 256;
+// 动态内容每次请求都要压缩,使用较快的压缩级别
+static const int DYNAMIC_COMPRESS_LEVEL[ ENCODING_COUNT ] = { 0, 5, 4 };
 // 设置文件描述符为非阻塞
 int setnonblocking( int fd )
 {
@@ -22,6 +51,8 @@ int setnonblocking( int fd )
 void addfd( int epollfd, int fd, bool one_shot )
 {
     epoll_event event;
+	// 高32位用于区分CGI管道的事件,须清零
+    event.data.u64 = 0;
     event.data.fd = fd;
 	// 数据可读, 边沿触发,TCP连接关闭
     event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
@@ -43,29 +74,174 @@ void removefd( int epollfd, int fd )
 void modfd( int epollfd, int fd, int ev )
 {
     epoll_event event;
+    event.data.u64 = 0;
     event.data.fd = fd;
     event.events = ev | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
     epoll_ctl( epollfd, EPOLL_CTL_MOD, fd, &event );
 }
 
 int http_conn::m_user_count = 0;
-int http_conn::m_epollfd = -1;
+file_cache* http_conn::m_file_cache = NULL;
+volatile bool http_conn::m_draining = false;
+unsigned int http_conn::m_header_timeout = 10000;
+unsigned int http_conn::m_body_timeout = 30000;
+unsigned int http_conn::m_idle_timeout = 15000;
+unsigned int http_conn::m_request_timeout = 600000;
+cgi_launcher* http_conn::m_cgi_launcher = NULL;
+unsigned int http_conn::m_cgi_timeout = 30000;
+int http_conn::m_max_conns = MAX_FD;
+unsigned int http_conn::m_shed_wait_ms = 500;
+bool http_conn::m_access_log = true;
+std::unordered_map< std::string, http_conn::handler > http_conn::m_handlers;
+
+// 流式应答的生成器,需要压缩时使用的压缩器,以及生成器写入的内容
+struct http_conn::stream_state
+{
+    response_stream* stream;
+    content_encoding encoding;
+    compress_stream compressor;
+    response_writer writer;
+
+    explicit stream_state( response_stream* s ) : stream( s ), encoding( ENCODING_IDENTITY ) {}
+    ~stream_state() { delete stream; }
+};
+
+// CGI程序输出管道的读端,程序的pid,尚未转换的头部,截止时间;
+// 发送队列中的数据过多时暂停读取管道,发送完毕后恢复
+struct http_conn::cgi_state
+{
+    int fd;
+    pid_t pid;
+    std::string head;
+    bool headers_done;
+    bool paused;
+    uint64_t deadline;
+
+    cgi_state( int f, uint64_t due ) : fd( f ), pid( 0 ), headers_done( false ), paused( false ), deadline( due ) {}
+};
+
+std::vector< std::pair< std::string, std::string > > http_conn::m_cache_controls;
+
+void http_conn::register_handler( const char* url, dynamic_handler handler, const char* content_type, bool local_only )
+{
+    http_conn::handler& h = m_handlers[ url ];
+    h.content = handler;
+    h.stream = NULL;
+    h.content_type = content_type;
+    h.local_only = local_only;
+}
+
+void http_conn::register_stream_handler( const char* url, stream_handler handler )
+{
+    http_conn::handler& h = m_handlers[ url ];
+    h.content = NULL;
+    h.stream = handler;
+    h.content_type = "text/html";
+    h.local_only = false;
+}
+
+bool http_conn::stats( const char* args, std::string& content )
+{
+    metrics::gauges values;
+    values.push_back( std::make_pair( "connections", ( int64_t )m_user_count ) );
+    values.push_back( std::make_pair( "log_buffers", ( int64_t )logger::buffers() ) );
+    values.push_back( std::make_pair( "metrics_blocks", ( int64_t )metrics::blocks() ) );
+    if ( m_cgi_launcher )
+    {
+        values.push_back( std::make_pair( "cgi_running", ( int64_t )m_cgi_launcher->running() ) );
+    }
+    if ( strstr( args, "format=prometheus" ) )
+    {
+        metrics::render_prometheus( values, content );
+    }
+    else
+    {
+        metrics::render_text( values, content );
+    }
+    return true;
+}
+
+void http_conn::set_cache_control( const char* prefix, const char* value )
+{
+    for ( size_t i = 0; i < m_cache_controls.size(); ++i )
+    {
+        if ( m_cache_controls[i].first == prefix )
+        {
+            m_cache_controls[i].second = value;
+            return;
+        }
+    }
+    m_cache_controls.push_back( std::make_pair( std::string( prefix ), std::string( value ) ) );
+}
 
 void http_conn::close_conn( bool real_close )
 {
     if( real_close && ( m_sockfd != -1 ) )
     {
+		// 工作线程不能操作时间轮,而且关闭之后描述符和连接对象可能立即被新连接复用,
+		// 只做标记,处理完毕后经由可写事件交还事件循环关闭
+        if( m_busy > 0 )
+        {
+            m_closing = true;
+            return;
+        }
+        if( m_wheel )
+        {
+            m_wheel->cancel( &m_timer );
+        }
         //modfd( m_epollfd, m_sockfd, EPOLLIN );
-        removefd( m_epollfd, m_sockfd );
-		close(m_sockfd);
+		// 丢弃尚未发送的数据,归还文件映射
+        metrics::observe( metrics::CONN_LIFETIME, metrics::now_ns() - m_accepted_ns );
+        metrics::observe( metrics::CONN_REQUESTS, m_served );
+        if ( m_uring_loop )
+        {
+			// 未完成的发送请求引用发送队列中的数据,先关闭连接使其失败,再归还数据;
+			// 管道中可能留有数据,也可能仍被请求使用,直接关闭
+            shutdown( m_sockfd, SHUT_RDWR );
+            if ( m_uring_send )
+            {
+                m_uring_loop->release_pipe( *m_uring_send, false );
+            }
+        }
+        m_out.clear();
+        unmap();
+		// 先移除等待的描述符,生成器删除时可能关闭它
+        stop_stream_wait();
+        delete m_stream;
+        m_stream = NULL;
+        if ( m_cgi )
+        {
+            finish_cgi( true );
+        }
+		// 已在发送队列中的应答随清空队列写出,剩下的是还在生成中的应答
+        while ( ! m_access.empty() )
+        {
+            log_access( m_access.front(), true );
+            m_access.pop_front();
+        }
+        if ( m_uring_loop )
+        {
+			// 未完成的接收请求持有套接字的引用,关闭描述符不能使其结束,已先关闭连接,
+			// 请求随即完成,完成事件按代数丢弃
+            close( m_sockfd );
+        }
+        else
+        {
+			// removefd同时关闭描述符
+            removefd( m_epollfd, m_sockfd );
+        }
         m_sockfd = -1;
-        m_user_count--;
+        __sync_fetch_and_sub( &m_user_count, 1 );
     }
 }
 
-void http_conn::init( int sockfd, const sockaddr_in& addr )
+void http_conn::init( int sockfd, const sockaddr_in& addr, int epollfd, timer_wheel* wheel, reactor* uring_loop )
 {
     m_sockfd = sockfd;
+    m_epollfd = epollfd;
+	// 描述符被复用时,原来的定时器已在关闭时取消
+    m_wheel = wheel;
+    m_closing = false;
     m_address = addr;
     int error = 0;
     socklen_t len = sizeof( error );
@@ -74,14 +250,47 @@ void http_conn::init( int sockfd, const sockaddr_in& addr )
 	// 确保地址复用
     // int reuse = 1;
     // setsockopt( m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof( reuse ) );
+    m_uring_loop = uring_loop;
+    m_stream_wake = 0;
+    m_stream_fd = -1;
+    ++m_generation;
+    m_uring_pending = 0;
 	// 连接描述符为一次触发,工作线程处理完成后应再次注册
-    addfd( m_epollfd, sockfd, true );
-    m_user_count++;
+    if ( m_uring_loop )
+    {
+        arm( EPOLLIN );
+    }
+    else
+    {
+        addfd( m_epollfd, sockfd, true );
+    }
+    __sync_fetch_and_add( &m_user_count, 1 );
+    m_file_address = 0;
+    m_file_entry = 0;
+    m_accepted_ns = metrics::now_ns();
+    m_served = 0;
 
     init();
+    update_timer();
 }
 
 void http_conn::init()
+{
+    m_keep_alive = false;
+    m_idle_since = monotonic_ms();
+    m_request_start = 0;
+    m_responding = false;
+    m_start_line = 0;
+    m_checked_idx = 0;
+    m_read_idx = 0;
+    m_out.clear();
+	// 不再清零整个缓冲区,解析只访问已读到的字节,溢出的块归还内存池
+    m_read_buf.reset();
+    m_write_buf.reset();
+    reset_request();
+}
+
+void http_conn::reset_request()
 {
     m_check_state = CHECK_STATE_REQUESTLINE;
     m_linger = false;
@@ -90,74 +299,107 @@ void http_conn::init()
     m_url = 0;
     m_version = 0;
     m_content_length = 0;
+    m_has_content_length = false;
+    m_expect_continue = false;
+    m_body_idx = 0;
+    m_body_end = 0;
+    m_chunked = false;
+    m_chunk_state = CHUNK_SIZE;
+    m_chunk_remaining = 0;
+    m_allow = allow_all;
     m_host = 0;
-    m_start_line = 0;
-    m_checked_idx = 0;
-    m_read_idx = 0;
+    m_range = 0;
+    m_if_range = 0;
+    m_if_none_match = 0;
+    m_if_modified_since = 0;
+    m_accept_encoding = 0;
+    m_body_start = 0;
     m_write_idx = 0;
-    memset( m_read_buf, '\0', READ_BUFFER_SIZE );
-    memset( m_write_buf, '\0', WRITE_BUFFER_SIZE );
-    memset( m_real_file, '\0', FILENAME_LEN );
-	//pid_socket = new int[MAX_FD];
+    m_headers_end = 0;
+    m_real_file[ 0 ] = '\0';
+	// 只清空内容,保留已分配的空间供下一个请求复用
+	m_dynamic_content.clear();
+    m_content_type = "text/html";
+}
+
+void http_conn::next_request()
+{
+	// 流式应答在生成完最后一块时才算结束
+    if ( ! m_stream )
+    {
+        end_access();
+    }
+    m_keep_alive = m_linger;
+    reset_request();
+	// 后续请求移到缓冲区开头,上一个请求的字段指针已不再使用
+    int remain = m_read_idx - m_checked_idx;
+    if ( remain > 0 )
+    {
+        memmove( m_read_buf.data(), m_read_buf.data() + m_checked_idx, remain );
+    }
+    m_read_idx = remain;
+    m_checked_idx = 0;
+    m_start_line = 0;
 }
 // 判断当前是否读取到http请求的一行
 http_conn::LINE_STATUS http_conn::parse_line()
 {
-    char temp;
-    for ( ; m_checked_idx < m_read_idx; ++m_checked_idx )
+    char* buf = m_read_buf.data();
+	// 按块查找下一个回车符或换行符
+    m_checked_idx = http_parser::find_line_end( buf + m_checked_idx, buf + m_read_idx ) - buf;
+	// 未能读取到完整的一行
+    if ( m_checked_idx == m_read_idx )
+    {
+        return LINE_OPEN;
+    }
+	// 遇到回车符
+    if ( buf[ m_checked_idx ] == '\r' )
     {
-		// 当前字符
-        temp = m_read_buf[ m_checked_idx ];
-		// 遇到回车符
-        if ( temp == '\r' )
+		// 到达本次读的字符串的末尾,返回信息不全状态
+        if ( ( m_checked_idx + 1 ) == m_read_idx )
         {
-			// 到达本次读的字符串的末尾,返回信息不全状态
-            if ( ( m_checked_idx + 1 ) == m_read_idx )
-            {
-                return LINE_OPEN;
-            }
-			// 下一个字符是换行符,读取到完整的一行请求,返回ok
-            else if ( m_read_buf[ m_checked_idx + 1 ] == '\n' )
-            {
-				// 将回车换行符改为结束符
-                m_read_buf[ m_checked_idx++ ] = '\0';
-                m_read_buf[ m_checked_idx++ ] = '\0';
-                return LINE_OK;
-            }
-			// 既没有到结尾,又不是换行符,请求出错
-            return LINE_BAD;
+            return LINE_OPEN;
         }
-		// 遇到换行符
-        else if( temp == '\n' )
+		// 下一个字符是换行符,读取到完整的一行请求,返回ok
+        else if ( buf[ m_checked_idx + 1 ] == '\n' )
         {
-			// 检查前一字符是否是回车符,是则返回就绪状态
-            if( ( m_checked_idx > 1 ) && ( m_read_buf[ m_checked_idx - 1 ] == '\r' ) )
-            {
-                m_read_buf[ m_checked_idx-1 ] = '\0';
-                m_read_buf[ m_checked_idx++ ] = '\0';
-                return LINE_OK;
-            }
-			// 否则请求出错
-            return LINE_BAD;
+			// 将回车换行符改为结束符
+            buf[ m_checked_idx++ ] = '\0';
+            buf[ m_checked_idx++ ] = '\0';
+            return LINE_OK;
         }
+		// 既没有到结尾,又不是换行符,请求出错
+        return LINE_BAD;
     }
-	// 未能读取到完整的一行
-    return LINE_OPEN;
+	// 遇到单独的换行符,请求出错
+    return LINE_BAD;
 }
 
 bool http_conn::read()
 {
-	// 接收数据超出存储空间
-    if( m_read_idx >= READ_BUFFER_SIZE )
-    {
-        return false;
-    }
 
+	// 收到新请求的第一个字节时开始计算请求的超时
+    bool first = m_read_idx == 0;
     int bytes_read = 0;
     while( true )
     {
 		// 读取接收缓冲区的数据
-        bytes_read = recv( m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0 );
+		// 保留一个字节给解析时添加的结束符,缓冲区满时扩充,
+		// 达到上限时先停止读取,由解析判断是否能处理已读到的数据
+        if( m_read_idx + 1 >= ( int )m_read_buf.capacity() )
+        {
+            const char* old_base = m_read_buf.data();
+            if( m_read_buf.capacity() >= MAX_READ_BUFFER )
+            {
+                break;
+            }
+            if( ! m_read_buf.grow( m_read_buf.capacity() * 2, m_read_idx ) )
+            {
+                return false;
+            }
+            rebase( old_base );
+        }
+        bytes_read = recv( m_sockfd, m_read_buf.data() + m_read_idx, m_read_buf.capacity() - 1 - m_read_idx, 0 );
         if ( bytes_read == -1 )
         {
 			// 没有数据可以读取,退出
@@ -175,8 +417,45 @@ bool http_conn::read()
 		// 继续读取数据
         m_read_idx += bytes_read;
     }
+    if( first && m_read_idx > 0 )
+    {
+        m_request_start = monotonic_ms();
+    }
+    return true;
+}
+bool http_conn::feed( const char* data, size_t len )
+{
+    bool first = m_read_idx == 0;
+	// 与read相同,保留一个字节给结束符,不够时扩充缓冲区
+    while ( m_read_idx + 1 + len > m_read_buf.capacity() )
+    {
+        const char* old_base = m_read_buf.data();
+        if ( m_read_buf.capacity() >= MAX_READ_BUFFER || ! m_read_buf.grow( m_read_buf.capacity() * 2, m_read_idx ) )
+        {
+            return false;
+        }
+        rebase( old_base );
+    }
+    memcpy( m_read_buf.data() + m_read_idx, data, len );
+    m_read_idx += len;
+    if ( first )
+    {
+        m_request_start = monotonic_ms();
+    }
     return true;
 }
+
+void http_conn::arm( int ev )
+{
+    if ( m_uring_loop )
+    {
+        m_uring_loop->arm( this, ev );
+    }
+    else
+    {
+        modfd( m_epollfd, m_sockfd, ev );
+    }
+}
 // 请求示例
 // telnet 219.216.110.149 12345
 // GET / HTTP/1.1
@@ -196,14 +475,26 @@ http_conn::HTTP_CODE http_conn::parse_request_line( char* text )
     *m_url++ = '\0';
     // method即为http请求的方法
     char* method = text;
-	// 判断该方法是否为get方法,忽略大小写
+	// 判断请求方法,忽略大小写,不支持的方法返回501
     if ( strcasecmp( method, "GET" ) == 0 )
     {
         m_method = GET;
     }
+    else if ( strcasecmp( method, "HEAD" ) == 0 )
+    {
+        m_method = HEAD;
+    }
+    else if ( strcasecmp( method, "POST" ) == 0 )
+    {
+        m_method = POST;
+    }
+    else if ( strcasecmp( method, "OPTIONS" ) == 0 )
+    {
+        m_method = OPTIONS;
+    }
     else
     {
-        return BAD_REQUEST;
+        return NOT_IMPLEMENTED;
     }
 	// 跳过多余的空格和制表符
     m_url += strspn( m_url, " \t" );
@@ -221,6 +512,12 @@ http_conn::HTTP_CODE http_conn::parse_request_line( char* text )
     if ( strcasecmp( m_version, "HTTP/1.1" ) != 0 )
     {
         return BAD_REQUEST;
+    }
+	// OPTIONS *询问服务器整体支持的方法
+    if ( m_method == OPTIONS && strcmp( m_url, "*" ) == 0 )
+    {
+        m_check_state = CHECK_STATE_HEADER;
+        return NO_REQUEST;
     }
 	// 首先跳过url的开头,然后寻找'/'所在位置
     if ( strncasecmp( m_url, "http://", 7 ) == 0 )
@@ -243,127 +540,426 @@ http_conn::HTTP_CODE http_conn::parse_request_line( char* text )
     return NO_REQUEST;
 }
 // 解析头部信息
-http_conn::HTTP_CODE http_conn::parse_headers( char* text )
+// 解析Accept-Encoding头部,q=0表示明确拒绝该编码,*代表其余未列出的编码
+static int parse_accept_encoding( const char* text )
+{
+    int accepted = 0, refused = 0;
+    bool any = false;
+    while ( *text )
+    {
+        text += strspn( text, " \t," );
+        size_t len = strcspn( text, " \t,;" );
+        if ( len == 0 )
+        {
+            break;
+        }
+        const char* name = text;
+        text += len;
+        text += strspn( text, " \t" );
+        bool zero = false;
+        if ( *text == ';' )
+        {
+            const char* q = text + 1;
+            q += strspn( q, " \t" );
+            if ( strncasecmp( q, "q=", 2 ) == 0 )
+            {
+                zero = atof( q + 2 ) <= 0;
+            }
+            text += strcspn( text, "," );
+        }
+        int bit = 0;
+        if ( len == 4 && strncasecmp( name, "gzip", 4 ) == 0 )
+        {
+            bit = 1 << ENCODING_GZIP;
+        }
+        else if ( len == 2 && strncasecmp( name, "br", 2 ) == 0 )
+        {
+            bit = 1 << ENCODING_BR;
+        }
+        else if ( len == 1 && *name == '*' )
+        {
+            any = ! zero;
+            continue;
+        }
+        if ( zero )
+        {
+            refused |= bit;
+        }
+        else
+        {
+            accepted |= bit;
+        }
+    }
+    if ( any )
+    {
+        accepted |= ( 1 << ENCODING_GZIP ) | ( 1 << ENCODING_BR );
+    }
+    return accepted & ~refused;
+}
+
+http_conn::HTTP_CODE http_conn::parse_headers( char* text, int len )
 {
 	// 遇到空行,这是请求头部结束的标志
     if( text[ 0 ] == '\0' )
     {
-		// 请求方法为head
-        if ( m_method == HEAD )
+		// 同时有分块传输和Content-Length时,前后的代理可能对请求体的长度理解不同,拒绝该请求
+        if ( m_chunked && m_has_content_length )
+        {
+            return BAD_REQUEST;
+        }
+		// 分块传输的请求体,长度在解码完成后才知道
+        if ( m_chunked )
+        {
+            m_check_state = CHECK_STATE_CONTENT;
+            m_body_start = monotonic_ms();
+            m_body_idx = m_body_end = m_checked_idx;
+            send_continue();
+            return NO_REQUEST;
+        }
+		// 请求体须能与请求头部一起放入读缓冲区
+        if ( m_content_length > MAX_READ_BUFFER - 1 - m_checked_idx )
         {
-            return GET_REQUEST;
+            return PAYLOAD_TOO_LARGE;
         }
 		// 如果接下来的请求内容不为空
         if ( m_content_length != 0 )
         {
 			// 转至请求内容处理状态
             m_check_state = CHECK_STATE_CONTENT;
+            m_body_start = monotonic_ms();
+            send_continue();
             return NO_REQUEST;
         }
 		// 请求内容为空,则已获取完整的请求
         return GET_REQUEST;
     }
-	// 处理connection的请求头部
-    else if ( strncasecmp( text, "Connection:", 11 ) == 0 )
+	// 以完美散列识别头部名称,头部的值去掉首尾空白后在原处截断,仍可作为字符串使用
+    str_view name, value;
+    if ( ! http_parser::split_header( text, len, name, value ) )
     {
-        text += 11;
-        text += strspn( text, " \t" );
-        if ( strcasecmp( text, "keep-alive" ) == 0 )
+		// 不是"名称: 值"形式的行忽略
+        return NO_REQUEST;
+    }
+    char* field = text + ( value.data - text );
+    field[ value.len ] = '\0';
+    switch ( http_parser::lookup_header( name.data, name.len ) )
+    {
+		// 处理connection的请求头部
+        case HEADER_CONNECTION:
+        {
+            if ( value.equals_nocase( "keep-alive" ) )
+            {
+                m_linger = true;
+            }
+            break;
+        }
+		// 处理请求内容长度,只能是十进制数字,重复出现时须与之前的值相同
+        case HEADER_CONTENT_LENGTH:
+        {
+            if ( value.empty() || strspn( field, "0123456789" ) != value.len )
+            {
+                return BAD_REQUEST;
+            }
+            errno = 0;
+            long long length = strtoll( field, NULL, 10 );
+            if ( errno == ERANGE )
+            {
+                return BAD_REQUEST;
+            }
+			// 超出int范围的长度一定超出读缓冲区,按过大处理
+            if ( length > INT_MAX )
+            {
+                length = INT_MAX;
+            }
+            if ( m_has_content_length && length != m_content_length )
+            {
+                return BAD_REQUEST;
+            }
+            m_has_content_length = true;
+            m_content_length = ( int )length;
+            break;
+        }
+		// 处理主机字段
+        case HEADER_HOST:
+        {
+            m_host = field;
+            break;
+        }
+		// 处理请求的字节区间
+        case HEADER_RANGE:
+        {
+            m_range = field;
+            break;
+        }
+		// 仅当文件未被修改时才按区间发送
+        case HEADER_IF_RANGE:
+        {
+            m_if_range = field;
+            break;
+        }
+		// 条件请求
+        case HEADER_IF_NONE_MATCH:
+        {
+            m_if_none_match = field;
+            break;
+        }
+        case HEADER_IF_MODIFIED_SINCE:
+        {
+            m_if_modified_since = field;
+            break;
+        }
+		// 客户端接受的内容编码
+        case HEADER_ACCEPT_ENCODING:
+        {
+            m_accept_encoding = parse_accept_encoding( field );
+            break;
+        }
+		// 客户端等待100 Continue之后才发送请求体,其他的期望不支持,忽略
+        case HEADER_EXPECT:
+        {
+            m_expect_continue = value.equals_nocase( "100-continue" );
+            break;
+        }
+		// 只支持分块传输,同时出现Content-Length时拒绝该请求
+        case HEADER_TRANSFER_ENCODING:
+        {
+            if ( ! value.equals_nocase( "chunked" ) )
+            {
+                return NOT_IMPLEMENTED;
+            }
+            m_chunked = true;
+            break;
+        }
+		// 其他的请求头部忽略
+        default:
         {
-            m_linger = true;
+            //printf( "oop! unknow header %s\n", text );
+            break;
         }
     }
-	// 处理请求内容长度
-    else if ( strncasecmp( text, "Content-Length:", 15 ) == 0 )
+	// 未遇到空行则继续分析请求头部
+    return NO_REQUEST;
+
+}
+
+void http_conn::send_continue()
+{
+	// 请求体已经开始到达时不再需要;之前的应答尚未发送完毕时不能插在前面,客户端等待一段时间后会直接发送请求体
+    if ( ! m_expect_continue || m_read_idx > m_checked_idx || ! m_out.empty() )
     {
-        text += 15;
-        text += strspn( text, " \t" );
-        m_content_length = atol( text );
+        return;
     }
-	// 处理主机字段
-    else if ( strncasecmp( text, "Host:", 5 ) == 0 )
+    static const char reply[] = "HTTP/1.1 100 Continue\r\n\r\n";
+    ssize_t ret = send( m_sockfd, reply, sizeof( reply ) - 1, MSG_NOSIGNAL | MSG_DONTWAIT );
+	// 没有发送完的部分排在应答之前发送
+    if ( ret < 0 )
     {
-        text += 5;
-        text += strspn( text, " \t" );
-        m_host = text;
+        ret = 0;
     }
-	// 其他的请求头部忽略
-    else
+    if ( ( size_t )ret < sizeof( reply ) - 1 )
     {
-        //printf( "oop! unknow header %s\n", text );
+        m_out.push_copy( reply + ret, sizeof( reply ) - 1 - ret );
     }
-	// 未遇到空行则继续分析请求头部
-    return NO_REQUEST;
-
 }
 
-http_conn::HTTP_CODE http_conn::parse_content( char* text )
+http_conn::HTTP_CODE http_conn::parse_content()
 {
+    if ( m_chunked )
+    {
+        return parse_chunked();
+    }
     if ( m_read_idx >= ( m_content_length + m_checked_idx ) )
     {
-        text[ m_content_length ] = '\0';
+		// 请求体之后可能紧跟着流水线的下一个请求,不写入结束符,按长度使用
+        m_body_idx = m_checked_idx;
+        m_body_end = m_body_idx + m_content_length;
+        m_checked_idx = m_body_end;
         return GET_REQUEST;
     }
 
     return NO_REQUEST;
 }
-// 读取http请求并进行处理
-http_conn::HTTP_CODE http_conn::process_read()
+
+// 十六进制数字的值,不是十六进制数字时返回-1
+static int hex_value( char c )
 {
-    LINE_STATUS line_status = LINE_OK;
-    HTTP_CODE ret = NO_REQUEST;
-    char* text = 0;
-	// 注意,当处理请求头部完成后,状态转移至CHECK_STATE_CONTENT,此时未继续分析,
-	// 只是确认后续收到的数据足够,则直接返回,若数据不够则继续读取
-	// 解析行的状态为OK时 或者 分析请求内容字段且行状态为OK时,持续处理
-    while ( ( ( m_check_state == CHECK_STATE_CONTENT ) && ( line_status == LINE_OK  ) )
-                || ( ( line_status = parse_line() ) == LINE_OK ) )
+    if ( c >= '0' && c <= '9' )
     {
-		// 获取待处理数据的起始位置
-        text = get_line();
-		// 更新起始偏置量,m_checked_idx指向的是下一行的起始偏置位置
-        m_start_line = m_checked_idx;
-        printf( "got 1 http line: %s\n", text );
-		
-		// 状态机转移
-        switch ( m_check_state )
+        return c - '0';
+    }
+    c |= 0x20;
+    if ( c >= 'a' && c <= 'f' )
+    {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+http_conn::HTTP_CODE http_conn::parse_chunked()
+{
+    char* buf = m_read_buf.data();
+	// 解码后的请求体不能超出读缓冲区的上限
+    int limit = MAX_READ_BUFFER - 1 - m_body_idx;
+    while ( true )
+    {
+        switch ( m_chunk_state )
         {
-            case CHECK_STATE_REQUESTLINE:
+            case CHUNK_SIZE:
+            case CHUNK_TRAILER:
             {
-				// 首先处理请求行
-                ret = parse_request_line( text );
-                if ( ret == BAD_REQUEST )
+                const char* eol = http_parser::find_line_end( buf + m_checked_idx, buf + m_read_idx );
+                if ( eol + 1 >= buf + m_read_idx )
+                {
+                    break;
+                }
+                if ( eol[0] != '\r' || eol[1] != '\n' )
                 {
                     return BAD_REQUEST;
                 }
-                break;
-            }
-            case CHECK_STATE_HEADER:
-            {
-				//printf("CHECK_STATE_HEADER\n");
-				// 然后处理请求头部
-                ret = parse_headers( text );
-				//printf("ret:%d  %d\n",ret,GET_REQUEST);
-                if ( ret == BAD_REQUEST )
+                const char* line = buf + m_checked_idx;
+                m_checked_idx = eol + 2 - buf;
+				// 尾部头部忽略,遇到空行时请求体结束
+                if ( m_chunk_state == CHUNK_TRAILER )
+                {
+                    if ( eol == line )
+                    {
+                        m_content_length = m_body_end - m_body_idx;
+                        return GET_REQUEST;
+                    }
+                    continue;
+                }
+				// 块大小为十六进制,其后可以有以';'开始的扩展
+                int size = 0;
+                const char* p = line;
+                for ( int digit; p < eol && ( digit = hex_value( *p ) ) >= 0; ++p )
+                {
+                    size = size * 16 + digit;
+                    if ( size > limit )
+                    {
+                        return PAYLOAD_TOO_LARGE;
+                    }
+                }
+                if ( p == line || ( p < eol && *p != ';' && *p != ' ' && *p != '\t' ) )
                 {
                     return BAD_REQUEST;
                 }
-                else if ( ret == GET_REQUEST )
+                if ( m_body_end - m_body_idx + size > limit )
                 {
-					//printf("request header end.Next do request\n");
-					// 处理http请求
-                    return do_request();
+                    return PAYLOAD_TOO_LARGE;
                 }
-                break;
+                m_chunk_remaining = size;
+                m_chunk_state = size > 0 ? CHUNK_DATA : CHUNK_TRAILER;
+                continue;
+            }
+            case CHUNK_DATA:
+            {
+				// 块数据前移,紧接在已解码的数据之后
+                int n = m_read_idx - m_checked_idx;
+                if ( n > m_chunk_remaining )
+                {
+                    n = m_chunk_remaining;
+                }
+                if ( n == 0 )
+                {
+                    break;
+                }
+                memmove( buf + m_body_end, buf + m_checked_idx, n );
+                m_body_end += n;
+                m_checked_idx += n;
+                m_chunk_remaining -= n;
+                if ( m_chunk_remaining == 0 )
+                {
+                    m_chunk_state = CHUNK_DATA_END;
+                }
+                continue;
+            }
+            case CHUNK_DATA_END:
+            {
+                if ( m_read_idx - m_checked_idx < 2 )
+                {
+                    break;
+                }
+                if ( buf[ m_checked_idx ] != '\r' || buf[ m_checked_idx + 1 ] != '\n' )
+                {
+                    return BAD_REQUEST;
+                }
+                m_checked_idx += 2;
+                m_chunk_state = CHUNK_SIZE;
+                continue;
+            }
+        }
+		// 数据不足,未解析的数据移到已解码的数据之后,使已处理的块头不再占用缓冲区
+        int remain = m_read_idx - m_checked_idx;
+        memmove( buf + m_body_end, buf + m_checked_idx, remain );
+        m_checked_idx = m_body_end;
+        m_read_idx = m_body_end + remain;
+        return NO_REQUEST;
+    }
+}
+// 读取http请求并进行处理
+http_conn::HTTP_CODE http_conn::process_read()
+{
+    LINE_STATUS line_status = LINE_OK;
+    HTTP_CODE ret = NO_REQUEST;
+    char* text = 0;
+	// 注意,当处理请求头部完成后,状态转移至CHECK_STATE_CONTENT,此时未继续分析,
+	// 只是确认后续收到的数据足够,则直接返回,若数据不够则继续读取
+	// 解析行的状态为OK时 或者 分析请求内容字段且行状态为OK时,持续处理,
+	// 请求体不按行解析,数据不足时不能再查找行,否则会越过未读完的请求体
+    while ( ( ( m_check_state == CHECK_STATE_CONTENT ) && ( line_status == LINE_OK  ) )
+                || ( ( m_check_state != CHECK_STATE_CONTENT ) && ( ( line_status = parse_line() ) == LINE_OK ) ) )
+    {
+		// 获取待处理数据的起始位置
+        text = get_line();
+		// 行的长度,不含已改为结束符的回车换行符
+        int len = m_checked_idx - m_start_line - 2;
+		// 更新起始偏置量,m_checked_idx指向的是下一行的起始偏置位置
+        m_start_line = m_checked_idx;
+        DEBUG_LOG( "got 1 http line: %s", text );
+		
+		// 状态机转移
+        switch ( m_check_state )
+        {
+            case CHECK_STATE_REQUESTLINE:
+            {
+				// 首先处理请求行
+                ret = parse_request_line( text );
+                if ( ret != NO_REQUEST )
+                {
+                    return ret;
+                }
+                break;
+            }
+            case CHECK_STATE_HEADER:
+            {
+				//printf("CHECK_STATE_HEADER\n");
+				// 然后处理请求头部
+                ret = parse_headers( text, len );
+				//printf("ret:%d  %d\n",ret,GET_REQUEST);
+                if ( ret == GET_REQUEST )
+                {
+					//printf("request header end.Next do request\n");
+					// 处理http请求
+                    return do_request();
+                }
+                else if ( ret != NO_REQUEST )
+                {
+                    return ret;
+                }
+                break;
             }
             case CHECK_STATE_CONTENT:
             {
 				//printf("CHECK_STATE_CONTENT\n");
-                ret = parse_content( text );
+                ret = parse_content();
 				// 请求数据量足够,则直接响应请求
                 if ( ret == GET_REQUEST )
                 {
                     return do_request();
+                }
+                else if ( ret != NO_REQUEST )
+                {
+                    return ret;
                 }
 				// 否则继续读取分析
                 line_status = LINE_OPEN;
@@ -381,8 +977,79 @@ http_conn::HTTP_CODE http_conn::process_read()
 
 http_conn::HTTP_CODE http_conn::do_request()
 {
+    m_do_request_start = metrics::now_ns();
+	// OPTIONS *
+	if ( m_method == OPTIONS && strcmp( m_url, "*" ) == 0 )
+	{
+		return OPTIONS_REQUEST;
+	}
+	// 首先查找该url是否注册了内置的处理函数,有则直接在工作线程中生成应答
+	if ( ! m_handlers.empty() )
+	{
+		char* ptr = strchr( m_url, '?' );
+		std::unordered_map< std::string, handler >::const_iterator it =
+			m_handlers.find( ptr ? std::string( m_url, ptr - m_url ) : std::string( m_url ) );
+		// 127.0.0.0/8
+		bool loopback = ( ntohl( m_address.sin_addr.s_addr ) >> 24 ) == 127;
+		if ( it != m_handlers.end() && ( ! it->second.local_only || loopback ) )
+		{
+			if ( m_method == OPTIONS )
+			{
+				return OPTIONS_REQUEST;
+			}
+			const char* args = cgiargs;
+			std::string body;
+			if ( m_method == POST )
+			{
+				// 表单以POST提交时参数在请求体中,请求体没有结束符,复制一份交给处理函数
+				body.assign( m_read_buf.data() + m_body_idx, m_body_end - m_body_idx );
+				args = body.c_str();
+			}
+			else if ( ptr )
+			{
+				size_t len = strlen( ptr + 1 );
+				if ( len >= FILENAME_LEN )
+				{
+					return URI_TOO_LONG;
+				}
+				memcpy( cgiargs, ptr + 1, len + 1 );
+			}
+			else
+			{
+				cgiargs[ 0 ] = '\0';
+			}
+			if ( it->second.stream )
+			{
+				response_stream* stream = it->second.stream( args );
+				if ( ! stream )
+				{
+					return INTERNAL_ERROR;
+				}
+				m_stream = new stream_state( stream );
+				return STREAM_REQUEST;
+			}
+			if ( ! it->second.content( args, m_dynamic_content ) )
+			{
+				return INTERNAL_ERROR;
+			}
+			m_content_type = it->second.content_type;
+			return DYNAMIC_REQUEST;
+		}
+	}
+	// 静态文件和CGI程序不接受请求体
+	bool cgi = strstr( m_url, "cgi-bin" ) != NULL;
+	if ( m_method == OPTIONS )
+	{
+		m_allow = cgi ? allow_cgi : allow_file;
+		return OPTIONS_REQUEST;
+	}
+	if ( m_method == POST || ( cgi && m_method != GET ) )
+	{
+		m_allow = cgi ? allow_cgi : allow_file;
+		return METHOD_NOT_ALLOWED;
+	}
 	// 首先判断是否为动态url
-	if (!strstr(m_url, "cgi-bin"))
+	if (!cgi)
 	{
 		// 静态url
 		// 首先复制服务器的源地址
@@ -390,27 +1057,31 @@ http_conn::HTTP_CODE http_conn::do_request()
 		int len = strlen( doc_root );
 		// 将请求的url复制到文件的地址变量
 		strncpy( m_real_file + len, m_url, FILENAME_LEN - len - 1 );
-		printf( "static file directory is: %s\n", m_real_file );
-		// 获取请求文件的相关信息,如果请求出错,直接返回
-		if ( stat( m_real_file, &m_file_stat ) < 0 )
-		{
-			return NO_RESOURCE;
-		}
-		// 确定其他人是否有读权限
-		if ( ! ( m_file_stat.st_mode & S_IROTH ) )
+		m_real_file[ FILENAME_LEN - 1 ] = '\0';
+		DEBUG_LOG( "static file directory is: %s", m_real_file );
+		// 从共享缓存获取文件的映射,命中时无需stat,open和mmap
+		m_file_entry = m_file_cache->acquire( m_real_file );
+		if ( ! m_file_entry )
 		{
-			return FORBIDDEN_REQUEST;
-		}
-		// 确定该地址是否是目录
-		if ( S_ISDIR( m_file_stat.st_mode ) )
-		{
-			return BAD_REQUEST;
+			// 未能获取,再区分失败的原因
+			if ( stat( m_real_file, &m_file_stat ) < 0 )
+			{
+				return NO_RESOURCE;
+			}
+			// 确定其他人是否有读权限
+			if ( ! ( m_file_stat.st_mode & S_IROTH ) )
+			{
+				return FORBIDDEN_REQUEST;
+			}
+			// 确定该地址是否是目录
+			if ( S_ISDIR( m_file_stat.st_mode ) )
+			{
+				return BAD_REQUEST;
+			}
+			return INTERNAL_ERROR;
 		}
-		// 以只读方式打开文件
-		int fd = open( m_real_file, O_RDONLY );
-		// 映射到内存空间
-		m_file_address = ( char* )mmap( 0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
-		close( fd );
+		m_file_stat = m_file_entry->st;
+		m_file_address = m_file_entry->address;
 		return FILE_REQUEST;
 	}
 	else
@@ -422,7 +1093,12 @@ http_conn::HTTP_CODE http_conn::do_request()
 		// 如果找到了参数分隔符,就将参数复制到cgiargs
 		if (ptr) 
 		{
-			strcpy(cgiargs, ptr+1);
+			size_t len = strlen( ptr + 1 );
+			if ( len >= FILENAME_LEN )
+			{
+				return URI_TOO_LONG;
+			}
+			memcpy( cgiargs, ptr + 1, len + 1 );
 			*ptr = '\0';
 		}
 		else 
@@ -432,6 +1108,7 @@ http_conn::HTTP_CODE http_conn::do_request()
 		int len = strlen( doc_root );
 		// 将请求的url复制到文件的地址变量
 		strncpy( m_real_file + len, m_url, FILENAME_LEN - len - 1 );
+		m_real_file[ FILENAME_LEN - 1 ] = '\0';
 		// 获取请求文件的相关信息,如果请求出错,直接返回
 		if ( stat( m_real_file, &m_file_stat ) < 0 )
 		{
@@ -448,99 +1125,245 @@ http_conn::HTTP_CODE http_conn::do_request()
 	}
 }
 
+// 发送队列归还文件段所引用的缓存条目
+static void release_file( void* arg )
+{
+    http_conn::m_file_cache->release( ( file_cache::entry* )arg );
+}
+
 void http_conn::unmap()
 {
-    if( m_file_address )
+    if( m_file_entry )
     {
-		// 释放映射的内存空间
-        munmap( m_file_address, m_file_stat.st_size );
+		// 归还缓存中的文件映射,映射本身由缓存管理
+        m_file_cache->release( m_file_entry );
+        m_file_entry = 0;
         m_file_address = 0;
     }
 }
 
 bool http_conn::write()
 {
-    int temp = 0;
-    int bytes_have_send = 0;
-    int bytes_to_send = m_write_idx;
-    if ( bytes_to_send == 0 )
+	// io_uring后端的发送作为请求提交,完成后由事件循环继续;无法提交时直接发送
+    if ( m_uring_loop && ! m_out.empty() && m_uring_loop->send( this ) )
     {
-		// 用epoll监听套接字
-        modfd( m_epollfd, m_sockfd, EPOLLIN );
-        init();
         return true;
     }
-
-    while( 1 )
+    uint64_t start = metrics::now_ns();
+    size_t pending = m_out.size();
+	// 从上次停止的位置继续发送队列中的数据
+    out_queue::SEND_STATUS status = m_out.empty() ? out_queue::SEND_DONE : m_out.send( m_sockfd );
+    if ( status != out_queue::SEND_ERROR )
     {
-        temp = writev( m_sockfd, m_iv, m_iv_count );
-        if ( temp <= -1 )
+        metrics::add( metrics::BYTES_SENT, pending - m_out.size() );
+    }
+    metrics::observe( metrics::WRITE_TIME, metrics::now_ns() - start );
+    switch ( status )
+    {
+        case out_queue::SEND_AGAIN:
+        {
+			// 等待写缓冲区有空间
+            arm( EPOLLOUT );
+            return true;
+        }
+        case out_queue::SEND_ERROR:
         {
-			// 如果写缓冲区没有空间
-            if( errno == EAGAIN )
-            {
-				// 等待写缓冲区有空间
-                modfd( m_epollfd, m_sockfd, EPOLLOUT );
-                return true;
-            }
 			// 释放映射的内存空间
+            m_out.clear();
             unmap();
             return false;
         }
-		// 更新待发送的字节数
-        bytes_to_send -= temp;
-		// 更新已经发送的字节数
-        bytes_have_send += temp;
-		// 检查是否发送完毕
-        if ( bytes_to_send <= bytes_have_send )
+        default:
         {
-			// 释放映射的内存空间
-            unmap();
-			printf("write complete.\n");
-			// 如果客户要求保持连接
-            if( m_linger )
-            {
-				// 初始化
-                init();
-				// 继续监听套接字的读事件
-                modfd( m_epollfd, m_sockfd, EPOLLIN );
-                return true;
-            }
-            else
-            {
-				// 客户不要求保持连接
-                //modfd( m_epollfd, m_sockfd, EPOLLIN );
-                return false;
-            } 
+            break;
+        }
+    }
+	// 发送完毕,释放映射的内存空间
+    unmap();
+	// 流式应答尚未结束,由调用者交给工作线程生成下一批内容
+    if( m_stream )
+    {
+        return true;
+    }
+	// CGI程序仍在输出,发送队列腾空后恢复读取管道
+    if( m_cgi )
+    {
+        if( m_cgi->paused )
+        {
+            m_cgi->paused = false;
+            arm_cgi( EPOLL_CTL_MOD );
+        }
+        return true;
+    }
+    DEBUG_LOG( "write complete on %d", m_sockfd );
+	// 如果客户要求保持连接,服务器正在退出时不再保持
+    if( m_keep_alive && ! m_draining )
+    {
+        m_responding = false;
+        m_idle_since = monotonic_ms();
+        if( m_read_idx > 0 )
+        {
+			// 缓冲区中还有后续请求,由调用者接着处理,请求的超时从现在开始计算
+            m_request_start = m_idle_since;
+            return true;
         }
+		// 初始化
+        init();
+		// 继续监听套接字的读事件
+        arm( EPOLLIN );
+        return true;
     }
+	// 客户不要求保持连接
+    return false;
 }
 
-bool http_conn::add_response( const char* format, ... )
+void http_conn::push_headers()
+{
+	// HEAD请求不发送写缓冲区中头部之后的应答内容
+    m_out.push_copy( m_write_buf.data(), m_method == HEAD ? m_headers_end : m_write_idx );
+    m_write_idx = 0;
+}
+
+bool http_conn::head_only( file_cache::entry* entry )
 {
-	// 如果写缓冲区已满,返回错误
-    if( m_write_idx >= WRITE_BUFFER_SIZE )
+    if ( m_method != HEAD )
     {
         return false;
     }
-    va_list arg_list;
-    va_start( arg_list, format );
-	// 将输入参数写入写缓冲区
-    int len = vsnprintf( m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list );
-    if( len >= ( WRITE_BUFFER_SIZE - 1 - m_write_idx ) )
+    m_file_cache->release( entry );
+    return true;
+}
+
+bool http_conn::add_response( const char* format, ... )
+{
+    while( true )
     {
-        return false;
+        va_list arg_list;
+        va_start( arg_list, format );
+		// 将输入参数写入写缓冲区
+        int room = m_write_buf.capacity() - 1 - m_write_idx;
+        int len = vsnprintf( m_write_buf.data() + m_write_idx, room, format, arg_list );
+        va_end( arg_list );
+        if( len < 0 )
+        {
+            return false;
+        }
+        if( len < room )
+        {
+            m_write_idx += len;
+            return true;
+        }
+		// 写缓冲区不够时扩充,应答头部超出上限时返回错误
+        size_t need = m_write_idx + len + 1;
+        if( need > MAX_WRITE_BUFFER || ! m_write_buf.grow( need, m_write_idx ) )
+        {
+            return false;
+        }
+    }
+}
+
+void http_conn::rebase( const char* old_base )
+{
+    char** fields[] = { &m_url, &m_version, &m_host, &m_range, &m_if_range, &m_if_none_match, &m_if_modified_since };
+    for ( size_t i = 0; i < sizeof( fields ) / sizeof( fields[0] ); ++i )
+    {
+        if ( *fields[i] )
+        {
+            *fields[i] = m_read_buf.data() + ( *fields[i] - old_base );
+        }
     }
-    m_write_idx += len;
-    va_end( arg_list );
-    return true;
 }
 
 bool http_conn::add_status_line( int status, const char* title )
 {
+	// 每个应答只有一个状态行,在这里统计请求数和状态码
+    ++m_served;
+    metrics::add( metrics::REQUESTS );
+    if ( status >= 100 && status < 600 )
+    {
+        metrics::add( ( metrics::counter_id )( metrics::RESPONSES_1XX + status / 100 - 1 ) );
+    }
+    if ( m_access_log )
+    {
+        begin_access( status );
+    }
     return add_response( "%s %d %s\r\n", "HTTP/1.1", status, title );
 }
 
+void http_conn::begin_access( int status )
+{
+	// 尚未加入发送队列的记录属于被丢弃的状态行,例如生成过程中出错改为返回错误应答
+    if ( m_access.empty() || m_access.back().queued )
+    {
+        m_access.push_back( access_record() );
+    }
+    access_record& record = m_access.back();
+    record.conn = this;
+    record.status = status;
+	// 请求行未能解析时没有方法和url;url中的引号,反斜杠和控制字符按百分号编码,保证一行可以解析
+    record.method = m_version ? METHOD_NAMES[ m_method ] : "-";
+    size_t len = 0;
+    for ( const char* p = m_version ? m_url : "-"; *p && len < ACCESS_URL_MAX; ++p )
+    {
+        unsigned char c = *p;
+        if ( c == '"' || c == '\\' || c < 0x20 || c == 0x7f )
+        {
+            len += snprintf( record.url + len, 4, "%%%02X", c );
+        }
+        else
+        {
+            record.url[ len++ ] = c;
+        }
+    }
+    record.url[ len ] = '\0';
+    record.start = m_request_start;
+	// 状态行还在写缓冲区中,发送队列的当前位置就是应答的起点
+    record.begin = m_out.pushed_total();
+    record.end = record.begin;
+    record.queued = false;
+}
+
+void http_conn::end_access()
+{
+    if ( m_access.empty() || m_access.back().queued )
+    {
+        return;
+    }
+    access_record& record = m_access.back();
+    record.end = m_out.pushed_total();
+    record.queued = true;
+    m_out.push_mark( access_sent, &record );
+}
+
+void http_conn::access_sent( void* arg, bool sent )
+{
+	// 标记按加入的顺序到达,对应的记录总在最前面
+    access_record* record = ( access_record* )arg;
+    http_conn* conn = record->conn;
+    conn->log_access( *record, ! sent );
+    conn->m_access.pop_front();
+}
+
+void http_conn::log_access( const access_record& record, bool aborted )
+{
+    char addr[ INET_ADDRSTRLEN ];
+    inet_ntop( AF_INET, &m_address.sin_addr, addr, sizeof( addr ) );
+	// 未发送完毕时按已发出的字节数计算,应答尚未全部加入发送队列时没有终点
+    uint64_t bytes = record.end - record.begin;
+    if ( aborted )
+    {
+        uint64_t sent = m_out.sent_total();
+        bytes = sent > record.begin ? sent - record.begin : 0;
+        if ( record.queued && bytes > record.end - record.begin )
+        {
+            bytes = record.end - record.begin;
+        }
+    }
+    unsigned long elapsed = record.start ? monotonic_ms() - record.start : 0;
+    ACCESS_LOG( "client=%s:%d method=%s url=\"%s\" status=%d bytes=%lu ms=%lu%s", addr, ntohs( m_address.sin_port ),
+        record.method, record.url, record.status, ( unsigned long )bytes, elapsed, aborted ? " aborted=1" : "" );
+}
+
 bool http_conn::add_headers( int content_len )
 {
     add_content_length( content_len );
@@ -556,51 +1379,637 @@ bool http_conn::add_content_length( int content_len )
 
 bool http_conn::add_linger()
 {
-    return add_response( "Connection: %s\r\n", ( m_linger == true ) ? "keep-alive" : "close" );
+    return add_response( "Connection: %s\r\n", ( m_linger == true && ! m_draining ) ? "keep-alive" : "close" );
+}
+
+uint64_t http_conn::deadline() const
+{
+    if ( m_responding )
+    {
+        uint64_t request_deadline = m_request_start + m_request_timeout;
+        if ( m_cgi && m_cgi->deadline < request_deadline )
+        {
+            return m_cgi->deadline;
+        }
+        if ( m_stream_wake && m_stream_wake < request_deadline )
+        {
+            return m_stream_wake;
+        }
+        return request_deadline;
+    }
+    if ( m_read_idx == 0 )
+    {
+        return m_idle_since + m_idle_timeout;
+    }
+    uint64_t request_deadline = m_request_start + m_request_timeout;
+    if ( m_check_state == CHECK_STATE_CONTENT )
+    {
+        uint64_t body_deadline = m_body_start + m_body_timeout;
+        return body_deadline < request_deadline ? body_deadline : request_deadline;
+    }
+    uint64_t header_deadline = m_request_start + m_header_timeout;
+    return header_deadline < request_deadline ? header_deadline : request_deadline;
+}
+
+void http_conn::update_timer()
+{
+    if ( m_sockfd != -1 && m_wheel )
+    {
+        m_wheel->schedule( &m_timer, deadline() );
+    }
+}
+
+void http_conn::expire( uint64_t now )
+{
+	// 正在处理,稍后再检查
+    if ( m_busy > 0 )
+    {
+        m_wheel->schedule( &m_timer, now + timer_wheel::TICK_MS * 10 );
+        return;
+    }
+	// 工作线程要求关闭,但套接字一直不可写,没有收到交还的事件
+    if ( m_closing )
+    {
+        close_conn();
+        return;
+    }
+    uint64_t due = deadline();
+    if ( due > now )
+    {
+        m_wheel->schedule( &m_timer, due );
+        return;
+    }
+	// 流式应答的等待结束,经由可写事件交给工作线程继续生成
+    if ( m_stream_wake && m_stream_wake <= now )
+    {
+        m_stream_wake = 0;
+        arm( EPOLLOUT );
+        update_timer();
+        return;
+    }
+	// CGI程序超时,尚未输出头部时终止它并返回504,否则应答已无法完成,只能关闭连接
+    if ( m_cgi && m_cgi->deadline <= now && ! m_cgi->headers_done )
+    {
+        WARN_LOG( "cgi program %d timed out", ( int )m_cgi->pid );
+        metrics::add( metrics::CGI_TIMEOUTS );
+        finish_cgi( true );
+        if ( process_write( GATEWAY_TIMEOUT ) )
+        {
+            next_request();
+            arm( EPOLLOUT );
+            update_timer();
+            return;
+        }
+    }
+    INFO_LOG( "connection %d timed out", m_sockfd );
+    metrics::add( metrics::TIMEOUTS );
+    close_conn();
+}
+
+bool http_conn::drain()
+{
+    if ( m_sockfd == -1 )
+    {
+        return false;
+    }
+    if ( m_busy > 0 )
+    {
+        return true;
+    }
+	// 没有读到请求也没有待发送的应答,只是在等待下一个请求
+    if ( m_closing || ( ! m_responding && m_read_idx == 0 && m_out.empty() ) )
+    {
+        close_conn();
+        return false;
+    }
+    return true;
 }
 
 bool http_conn::add_blank_line()
 {
-    return add_response( "%s", "\r\n" );
+    if ( ! add_response( "%s", "\r\n" ) )
+    {
+        return false;
+    }
+    m_headers_end = m_write_idx;
+    return true;
 }
 
 bool http_conn::add_content( const char* content )
 {
     return add_response( "%s", content );
 }
-// 根据http请求状态处理http应答的相关内容
-bool http_conn::process_write( HTTP_CODE ret )
+// 一次请求最多接受的区间数,超过时忽略Range头部发送整个文件
+static const int MAX_RANGES = 16;
+
+// 解析Range头部中的字节区间,区间保存在[first[i], last[i]]中
+// 返回可满足的区间数;格式错误或者区间过多时返回0,表示忽略该头部;所有区间都无法满足时返回-1
+static int parse_ranges( const char* spec, off_t size, off_t* first, off_t* last )
 {
-    switch ( ret )
+    if ( strncasecmp( spec, "bytes=", 6 ) != 0 )
     {
-		// 内部错误
-        case INTERNAL_ERROR:
+        return 0;
+    }
+    spec += 6;
+    int count = 0;
+    while ( *spec )
+    {
+        spec += strspn( spec, " \t" );
+        char* end;
+        off_t a, b;
+        bool satisfiable = true;
+        if ( *spec == '-' )
         {
-			// 应答状态行
-            add_status_line( 500, error_500_title );
-			// 应答头部
-            add_headers( strlen( error_500_form ) );
-			// 添加应答内容
-            if ( ! add_content( error_500_form ) )
+			// 最后n个字节
+            long long n = strtoll( spec + 1, &end, 10 );
+            if ( end == spec + 1 || n < 0 )
             {
-                return false;
+                return 0;
             }
-            break;
+            satisfiable = n > 0;
+            a = n >= size ? 0 : size - n;
+            b = size - 1;
         }
-		// 错误请求
-        case BAD_REQUEST:
+        else if ( *spec >= '0' && *spec <= '9' )
         {
-            add_status_line( 400, error_400_title );
-            add_headers( strlen( error_400_form ) );
-            if ( ! add_content( error_400_form ) )
+            a = strtoll( spec, &end, 10 );
+            if ( *end != '-' )
             {
-                return false;
+                return 0;
             }
-            break;
-        }
-		// 无该请求资源
-        case NO_RESOURCE:
-        {
+            spec = end + 1;
+            b = size - 1;
+            if ( *spec >= '0' && *spec <= '9' )
+            {
+                long long n = strtoll( spec, &end, 10 );
+                if ( n < a )
+                {
+                    return 0;
+                }
+                b = n < size ? n : size - 1;
+            }
+            else
+            {
+                end = const_cast< char* >( spec );
+            }
+            satisfiable = a < size;
+        }
+        else
+        {
+            return 0;
+        }
+        spec = end + strspn( end, " \t" );
+        if ( *spec == ',' )
+        {
+            ++spec;
+        }
+        else if ( *spec )
+        {
+            return 0;
+        }
+        if ( satisfiable )
+        {
+            if ( count == MAX_RANGES )
+            {
+                return 0;
+            }
+            first[ count ] = a;
+            last[ count ] = b;
+            ++count;
+        }
+    }
+    return count > 0 ? count : -1;
+}
+
+// 根据文件名推断内容类型,用于多区间应答的各部分
+static const char* content_type( const char* path )
+{
+    const char* ext = strrchr( path, '.' );
+    if ( ext && strcasecmp( ext, ".txt" ) == 0 )
+    {
+        return "text/plain";
+    }
+    if ( ext && ( strcasecmp( ext, ".html" ) == 0 || strcasecmp( ext, ".htm" ) == 0 ) )
+    {
+        return "text/html";
+    }
+    return "application/octet-stream";
+}
+
+// 将文件的一个区间加入发送队列,直接引用缓存中的描述符或映射,
+// last为true时该段发送完毕后由队列归还缓存条目
+static void push_file_part( out_queue& out, file_cache::entry* entry, off_t offset, off_t len, bool last )
+{
+    out_queue::release_func release = last ? release_file : 0;
+    if ( entry->fd >= 0 )
+    {
+        out.push_file( entry->fd, offset, len, release, entry );
+    }
+    else
+    {
+        out.push_buffer( entry->address + offset, len, release, entry );
+    }
+}
+
+// If-Range的值须与当前文件的强校验值或者修改时间完全一致
+bool http_conn::if_range_matches() const
+{
+    if ( ! m_if_range )
+    {
+        return true;
+    }
+    if ( m_if_range[0] == '"' || strncmp( m_if_range, "W/", 2 ) == 0 )
+    {
+        return strcmp( m_if_range, m_file_entry->etag ) == 0;
+    }
+    return strcmp( m_if_range, m_file_entry->last_modified ) == 0;
+}
+
+// 整个文件的某个压缩版本加入发送队列,发送完毕后归还缓存条目
+static void push_file_variant( out_queue& out, file_cache::entry* entry, const file_cache::variant* v )
+{
+    if ( v->fd >= 0 )
+    {
+        out.push_file( v->fd, 0, v->size, release_file, entry );
+    }
+    else if ( v->address )
+    {
+        out.push_buffer( v->address, v->size, release_file, entry );
+    }
+    else
+    {
+        out.push_buffer( v->data.data(), v->size, release_file, entry );
+    }
+}
+
+// 比较两个实体校验值,忽略弱校验前缀
+static bool etag_equal( const char* a, size_t a_len, const char* b )
+{
+    if ( a_len > 2 && strncmp( a, "W/", 2 ) == 0 )
+    {
+        a += 2;
+        a_len -= 2;
+    }
+    if ( strncmp( b, "W/", 2 ) == 0 )
+    {
+        b += 2;
+    }
+    return strlen( b ) == a_len && strncmp( a, b, a_len ) == 0;
+}
+
+bool http_conn::not_modified( const char* etag ) const
+{
+	// If-None-Match优先,为逗号分隔的校验值列表或者*
+    if ( m_if_none_match )
+    {
+        const char* p = m_if_none_match;
+        while ( *p )
+        {
+            p += strspn( p, " \t," );
+            size_t len = strcspn( p, " \t," );
+            if ( len == 0 )
+            {
+                break;
+            }
+            if ( ( len == 1 && *p == '*' ) || etag_equal( p, len, etag ) )
+            {
+                return true;
+            }
+            p += len;
+        }
+        return false;
+    }
+    if ( m_if_modified_since )
+    {
+        struct tm tm;
+        memset( &tm, 0, sizeof( tm ) );
+        if ( strptime( m_if_modified_since, "%a, %d %b %Y %H:%M:%S GMT", &tm ) )
+        {
+            return m_file_stat.st_mtime <= timegm( &tm );
+        }
+    }
+    return false;
+}
+
+bool http_conn::add_cache_control()
+{
+	// 选取最长的匹配前缀
+    const std::string* value = NULL;
+    size_t best = 0;
+    for ( size_t i = 0; i < m_cache_controls.size(); ++i )
+    {
+        const std::string& prefix = m_cache_controls[i].first;
+        if ( prefix.size() >= best && strncmp( m_url, prefix.data(), prefix.size() ) == 0 )
+        {
+            value = &m_cache_controls[i].second;
+            best = prefix.size();
+        }
+    }
+    return ! value || add_response( "Cache-Control: %s\r\n", value->c_str() );
+}
+
+bool http_conn::add_validators( const file_cache::entry* entry, const char* etag )
+{
+	// 可压缩的文件按Accept-Encoding发送不同的内容,须告知中间缓存
+    if ( file_cache::compressible( entry ) && ! add_response( "Vary: Accept-Encoding\r\n" ) )
+    {
+        return false;
+    }
+    return add_response( "Accept-Ranges: bytes\r\nETag: %s\r\nLast-Modified: %s\r\n", etag, entry->last_modified )
+        && add_cache_control();
+}
+
+const file_cache::variant* http_conn::select_variant( content_encoding& encoding )
+{
+	// 区间请求总是针对未压缩的原文件
+    if ( m_range || ! m_accept_encoding )
+    {
+        return NULL;
+    }
+    static const content_encoding preferred[] = { ENCODING_BR, ENCODING_GZIP };
+    for ( size_t i = 0; i < sizeof( preferred ) / sizeof( preferred[0] ); ++i )
+    {
+        if ( ! ( m_accept_encoding & ( 1 << preferred[i] ) ) )
+        {
+            continue;
+        }
+        const file_cache::variant* v = m_file_cache->get_variant( m_file_entry, preferred[i] );
+        if ( v )
+        {
+            encoding = preferred[i];
+            return v;
+        }
+    }
+    return NULL;
+}
+
+content_encoding http_conn::compress_dynamic()
+{
+    content_encoding encoding = ENCODING_IDENTITY;
+    if ( m_dynamic_content.size() < DYNAMIC_COMPRESS_MIN )
+    {
+        return encoding;
+    }
+    if ( m_accept_encoding & ( 1 << ENCODING_BR ) )
+    {
+        encoding = ENCODING_BR;
+    }
+    else if ( m_accept_encoding & ( 1 << ENCODING_GZIP ) )
+    {
+        encoding = ENCODING_GZIP;
+    }
+    else
+    {
+        return encoding;
+    }
+    std::string compressed;
+    if ( ! compress_buffer( encoding, DYNAMIC_COMPRESS_LEVEL[ encoding ], m_dynamic_content.data(), m_dynamic_content.size(), compressed ) )
+    {
+        return ENCODING_IDENTITY;
+    }
+    m_dynamic_content.swap( compressed );
+    return encoding;
+}
+
+bool http_conn::add_file_response()
+{
+    content_encoding encoding = ENCODING_IDENTITY;
+    const file_cache::variant* v = select_variant( encoding );
+    const char* etag = v ? v->etag : m_file_entry->etag;
+	// 客户端缓存的副本仍然有效时只发送头部
+    if ( not_modified( etag ) )
+    {
+        add_status_line( 304, not_modified_304_title );
+        add_validators( m_file_entry, etag );
+        add_linger();
+        add_blank_line();
+        unmap();
+        push_headers();
+        return true;
+    }
+
+    off_t size = m_file_stat.st_size;
+    off_t first[ MAX_RANGES ], last[ MAX_RANGES ];
+    int count = 0;
+    if ( m_range && if_range_matches() )
+    {
+        count = parse_ranges( m_range, size, first, last );
+    }
+    if ( count < 0 )
+    {
+		// 所有区间都超出了文件范围
+        unmap();
+        add_status_line( 416, error_416_title );
+        add_response( "Content-Range: bytes */%ld\r\n", ( long )size );
+        add_headers( strlen( error_416_form ) );
+        if ( ! add_content( error_416_form ) )
+        {
+            return false;
+        }
+        push_headers();
+        return true;
+    }
+	// 缓存条目交给发送队列
+    file_cache::entry* entry = m_file_entry;
+    m_file_entry = 0;
+    m_file_address = 0;
+    if ( v )
+    {
+		// 发送整个文件的压缩版本
+        add_status_line( 200, ok_200_title );
+        add_response( "Content-Encoding: %s\r\n", encoding_name( encoding ) );
+        add_validators( entry, etag );
+        add_headers( v->size );
+        push_headers();
+        if ( ! head_only( entry ) )
+        {
+            push_file_variant( m_out, entry, v );
+        }
+        return true;
+    }
+    if ( count == 0 )
+    {
+		// 发送整个文件
+        add_status_line( 200, ok_200_title );
+        add_validators( entry, etag );
+        add_headers( size );
+        push_headers();
+        if ( ! head_only( entry ) )
+        {
+            push_file_part( m_out, entry, 0, size, true );
+        }
+        return true;
+    }
+    add_status_line( 206, ok_206_title );
+    add_validators( entry, etag );
+    if ( count == 1 )
+    {
+		// 单个区间
+        add_response( "Content-Range: bytes %ld-%ld/%ld\r\n", ( long )first[0], ( long )last[0], ( long )size );
+        add_headers( last[0] - first[0] + 1 );
+        push_headers();
+        if ( ! head_only( entry ) )
+        {
+            push_file_part( m_out, entry, first[0], last[0] - first[0] + 1, true );
+        }
+        return true;
+    }
+	// 多个区间,以multipart/byteranges格式发送,先生成各部分的头部以计算总长度
+    static unsigned int boundary_seq = 0;
+    char boundary[ 32 ];
+    snprintf( boundary, sizeof( boundary ), "%08lx%08x", ( unsigned long )time( NULL ),
+        __sync_fetch_and_add( &boundary_seq, 1 ) );
+    const char* type = content_type( m_real_file );
+    std::string part_headers[ MAX_RANGES ];
+    char buf[ 256 ];
+    off_t total = 0;
+    for ( int i = 0; i < count; ++i )
+    {
+        snprintf( buf, sizeof( buf ), "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %ld-%ld/%ld\r\n\r\n",
+            boundary, type, ( long )first[i], ( long )last[i], ( long )size );
+        part_headers[i] = buf;
+        total += part_headers[i].size() + last[i] - first[i] + 1;
+    }
+    snprintf( buf, sizeof( buf ), "\r\n--%s--\r\n", boundary );
+    total += strlen( buf );
+    add_response( "Content-Type: multipart/byteranges; boundary=%s\r\n", boundary );
+    add_headers( total );
+    push_headers();
+    if ( head_only( entry ) )
+    {
+        return true;
+    }
+    for ( int i = 0; i < count; ++i )
+    {
+        m_out.push_copy( part_headers[i].data(), part_headers[i].size() );
+        push_file_part( m_out, entry, first[i], last[i] - first[i] + 1, i == count - 1 );
+    }
+    m_out.push_copy( buf, strlen( buf ) );
+    return true;
+}
+
+// 发送队列释放内置处理函数生成的应答内容
+static void release_content( void* arg )
+{
+    delete ( std::string* )arg;
+}
+
+void http_conn::push_chunk( std::string& data )
+{
+	// 空块表示应答结束,不能发送
+    if ( data.empty() )
+    {
+        return;
+    }
+    char size[ 32 ];
+    int len = snprintf( size, sizeof( size ), "%lx\r\n", ( unsigned long )data.size() );
+    m_out.push_copy( size, len );
+    std::string* content = new std::string;
+    content->swap( data );
+    m_out.push_buffer( content->data(), content->size(), release_content, content );
+    m_out.push_copy( "\r\n", 2 );
+}
+
+bool http_conn::continue_stream()
+{
+    stream_state& state = *m_stream;
+    bool more = true;
+	// 发送队列中的数据足够时暂停生成,等发送完毕后再继续
+    while ( more && m_out.size() < STREAM_BATCH )
+    {
+        more = state.stream->next( state.writer );
+        if ( state.stream->failed() )
+        {
+            return false;
+        }
+        std::string& data = state.writer.pending();
+        if ( state.encoding != ENCODING_IDENTITY )
+        {
+			// 每块都刷新压缩器的输出,客户端收到一块即可解压显示
+            std::string compressed;
+            bool ok = more ? state.compressor.write( data.data(), data.size(), compressed, true )
+                : state.compressor.write( data.data(), data.size(), compressed ) && state.compressor.finish( compressed );
+            if ( ! ok )
+            {
+                return false;
+            }
+            data.swap( compressed );
+        }
+        push_chunk( data );
+        data.clear();
+        if ( ! more )
+        {
+            break;
+        }
+		// 生成器要求等待,这一块发送之后由定时器唤醒
+        unsigned int delay = state.stream->delay();
+        if ( delay )
+        {
+            m_stream_wake = monotonic_ms() + delay;
+            break;
+        }
+		// 生成器等待描述符就绪,由连接所属的事件循环收到就绪事件
+        unsigned int events = 0;
+        int fd = state.stream->wait_fd( events );
+        if ( fd >= 0 )
+        {
+            epoll_event event;
+            event.data.u64 = STREAM_EVENT | ( uint32_t )m_sockfd;
+            event.events = events | EPOLLET | EPOLLONESHOT;
+            if ( epoll_ctl( m_epollfd, EPOLL_CTL_ADD, fd, &event ) < 0 )
+            {
+                ERROR_LOG( "stream wait on fd %d failed: %s", fd, strerror( errno ) );
+                return false;
+            }
+            m_stream_fd = fd;
+            break;
+        }
+    }
+    if ( ! more )
+    {
+		// 最后的空块,没有尾部头部
+        m_out.push_copy( "0\r\n\r\n", 5 );
+        delete m_stream;
+        m_stream = NULL;
+        end_access();
+    }
+    return true;
+}
+
+// 根据http请求状态处理http应答的相关内容
+bool http_conn::process_write( HTTP_CODE ret )
+{
+    switch ( ret )
+    {
+		// 内部错误
+        case INTERNAL_ERROR:
+        {
+			// 应答状态行
+            add_status_line( 500, error_500_title );
+			// 应答头部
+            add_headers( strlen( error_500_form ) );
+			// 添加应答内容
+            if ( ! add_content( error_500_form ) )
+            {
+                return false;
+            }
+            break;
+        }
+		// 错误请求,请求的边界已无法确定,应答后关闭连接
+        case BAD_REQUEST:
+        {
+            m_linger = false;
+            add_status_line( 400, error_400_title );
+            add_headers( strlen( error_400_form ) );
+            if ( ! add_content( error_400_form ) )
+            {
+                return false;
+            }
+            break;
+        }
+		// 无该请求资源
+        case NO_RESOURCE:
+        {
             add_status_line( 404, error_404_title );
             add_headers( strlen( error_404_form ) );
             if ( ! add_content( error_404_form ) )
@@ -619,23 +2028,107 @@ bool http_conn::process_write( HTTP_CODE ret )
                 return false;
             }
             break;
+        }
+		// 请求方法不适用于该资源
+        case METHOD_NOT_ALLOWED:
+        {
+            add_status_line( 405, error_405_title );
+            add_response( "Allow: %s\r\n", m_allow );
+            add_headers( strlen( error_405_form ) );
+            if ( ! add_content( error_405_form ) )
+            {
+                return false;
+            }
+            break;
+        }
+		// 请求体过大,没有读取的请求体无法跳过,应答后关闭连接
+        case PAYLOAD_TOO_LARGE:
+        {
+            m_linger = false;
+            add_status_line( 413, error_413_title );
+            add_headers( strlen( error_413_form ) );
+            if ( ! add_content( error_413_form ) )
+            {
+                return false;
+            }
+            break;
+        }
+		// 查询参数超出cgiargs的长度
+        case URI_TOO_LONG:
+        {
+            add_status_line( 414, error_414_title );
+            add_headers( strlen( error_414_form ) );
+            if ( ! add_content( error_414_form ) )
+            {
+                return false;
+            }
+            break;
+        }
+		// 不支持的请求方法或传输编码,应答后关闭连接
+        case NOT_IMPLEMENTED:
+        {
+            m_linger = false;
+            add_status_line( 501, error_501_title );
+            add_response( "Allow: %s\r\n", allow_all );
+            add_headers( strlen( error_501_form ) );
+            if ( ! add_content( error_501_form ) )
+            {
+                return false;
+            }
+            break;
+        }
+		// CGI程序的输出无法解析
+        case BAD_GATEWAY:
+        {
+            add_status_line( 502, error_502_title );
+            add_headers( strlen( error_502_form ) );
+            if ( ! add_content( error_502_form ) )
+            {
+                return false;
+            }
+            break;
+        }
+		// 同时运行的CGI程序已达上限,或者启动器不可用
+        case SERVICE_UNAVAILABLE:
+        {
+            add_status_line( 503, error_503_title );
+            add_response( "Retry-After: %d\r\n", 1 );
+            add_headers( strlen( error_503_form ) );
+            if ( ! add_content( error_503_form ) )
+            {
+                return false;
+            }
+            break;
+        }
+		// CGI程序超时
+        case GATEWAY_TIMEOUT:
+        {
+            add_status_line( 504, error_504_title );
+            add_headers( strlen( error_504_form ) );
+            if ( ! add_content( error_504_form ) )
+            {
+                return false;
+            }
+            break;
+        }
+		// 告知客户端资源支持的请求方法
+        case OPTIONS_REQUEST:
+        {
+            add_status_line( 200, ok_200_title );
+            add_response( "Allow: %s\r\n", m_allow );
+            add_headers( 0 );
+            break;
         }
 		// 获取到了相关文件
         case FILE_REQUEST:
         {
-            add_status_line( 200, ok_200_title );
             if ( m_file_stat.st_size != 0 )
             {
-                add_headers( m_file_stat.st_size );
-                m_iv[ 0 ].iov_base = m_write_buf;
-                m_iv[ 0 ].iov_len = m_write_idx;
-                m_iv[ 1 ].iov_base = m_file_address;
-                m_iv[ 1 ].iov_len = m_file_stat.st_size;
-                m_iv_count = 2;
-                return true;
+                return add_file_response();
             }
             else
             {
+                add_status_line( 200, ok_200_title );
 				// 请求的文件的大小为空
                 const char* ok_string = "<html><body></body></html>";
                 add_headers( strlen( ok_string ) );
@@ -644,6 +2137,65 @@ bool http_conn::process_write( HTTP_CODE ret )
                     return false;
                 }
             }
+            break;
+        }
+		// 内置处理函数生成的动态内容
+        case DYNAMIC_REQUEST:
+        {
+            add_status_line( 200, ok_200_title );
+            content_encoding encoding = compress_dynamic();
+            add_response( "Content-Type: %s\r\n", m_content_type );
+            add_response( "Vary: Accept-Encoding\r\n" );
+            if ( encoding != ENCODING_IDENTITY )
+            {
+                add_response( "Content-Encoding: %s\r\n", encoding_name( encoding ) );
+            }
+            add_cache_control();
+            add_headers( m_dynamic_content.size() );
+            push_headers();
+            if ( m_method == HEAD )
+            {
+                return true;
+            }
+			// 应答内容交给发送队列,发送完毕后释放,下一个请求可以继续生成内容
+            std::string* content = new std::string;
+            content->swap( m_dynamic_content );
+            m_out.push_buffer( content->data(), content->size(), release_content, content );
+            return true;
+        }
+		// 流式处理函数的应答,长度未知,以分块传输编码边生成边发送
+        case STREAM_REQUEST:
+        {
+            add_status_line( 200, ok_200_title );
+            add_response( "Content-Type: %s\r\n", "text/html" );
+            add_response( "Vary: Accept-Encoding\r\n" );
+            content_encoding encoding = ENCODING_IDENTITY;
+            if ( m_accept_encoding & ( 1 << ENCODING_BR ) )
+            {
+                encoding = ENCODING_BR;
+            }
+            else if ( m_accept_encoding & ( 1 << ENCODING_GZIP ) )
+            {
+                encoding = ENCODING_GZIP;
+            }
+            if ( encoding != ENCODING_IDENTITY && m_method != HEAD
+                && m_stream->compressor.init( encoding, DYNAMIC_COMPRESS_LEVEL[ encoding ] ) )
+            {
+                m_stream->encoding = encoding;
+                add_response( "Content-Encoding: %s\r\n", encoding_name( encoding ) );
+            }
+            add_cache_control();
+            add_response( "Transfer-Encoding: chunked\r\n" );
+            add_linger();
+            add_blank_line();
+            push_headers();
+            if ( m_method == HEAD )
+            {
+                delete m_stream;
+                m_stream = NULL;
+                return true;
+            }
+            return continue_stream();
         }
         default:
         {
@@ -651,113 +2203,373 @@ bool http_conn::process_write( HTTP_CODE ret )
         }
     }
 	// 将应答内容存入发送缓冲区
-    m_iv[ 0 ].iov_base = m_write_buf;
-    m_iv[ 0 ].iov_len = m_write_idx;
-    m_iv_count = 1;
+    push_headers();
     return true;
 }
 // http的处理函数接口
 void http_conn::process()
 {
-	// 首先读取相应http请求
-    HTTP_CODE read_ret = process_read();
-	// 请求不完整,继续监听套接字的读事件,本次处理结束
-    if ( read_ret == NO_REQUEST )
+    process_request();
+	// 由工作线程处理时,处理完毕之后定时器才能关闭连接;要求关闭的连接经由可写事件交还事件循环,
+	// end_work之后事件循环可能随时关闭连接,不能再访问本对象
+    if ( m_busy > 0 )
     {
-		// 继续监听套接字的读事件
-        modfd( m_epollfd, m_sockfd, EPOLLIN );
+        if ( m_closing )
+        {
+            arm( EPOLLOUT );
+        }
+        end_work();
+    }
+}
+
+void http_conn::process_request()
+{
+	// 流式应答的前一批内容已发送完毕,继续生成
+    if ( m_stream )
+    {
+        if ( ! continue_stream() )
+        {
+            close_conn();
+            return;
+        }
+        arm( EPOLLOUT );
         return;
     }
-	else if( read_ret == DYNAMIC_SERVE)
-	{
-		//printf("dynamic request\n");
-		// 服务动态内容
-		serve_dynamic();
-		// 重置连接
-		// reset_socket();
-		//继续监听套接字的读事件
-		// init();
-        // modfd( m_epollfd, m_sockfd, EPOLLIN );
+	// 客户端可以不等应答连续发送多个请求,依次处理缓冲区中的完整请求,
+	// 各应答按请求的顺序排入发送队列,合并发送
+    int handled = 0;
+    while ( true )
+    {
+		// 首先读取相应http请求
+        uint64_t parse_start = metrics::now_ns();
+        m_do_request_start = 0;
+        HTTP_CODE read_ret = process_read();
+		// 解析和do_request的耗时分开统计,请求不完整时不计
+        if ( read_ret != NO_REQUEST )
+        {
+            uint64_t now = metrics::now_ns();
+            if ( m_do_request_start )
+            {
+                metrics::observe( metrics::PARSE_TIME, m_do_request_start - parse_start );
+                metrics::observe( metrics::DO_REQUEST_TIME, now - m_do_request_start );
+            }
+            else
+            {
+                metrics::observe( metrics::PARSE_TIME, now - parse_start );
+            }
+        }
+		// 请求不完整,本次处理结束
+        if ( read_ret == NO_REQUEST )
+        {
+            break;
+        }
+        else if( read_ret == DYNAMIC_SERVE )
+        {
+			// CGI程序的输出经管道转发,排在已生成的应答之后,
+			// 程序结束时才丢弃该请求,之前不处理后续请求
+            uint64_t spawn_start = metrics::now_ns();
+            if ( start_cgi() )
+            {
+                metrics::add( metrics::CGI_STARTED );
+                metrics::observe( metrics::CGI_SPAWN_TIME, metrics::now_ns() - spawn_start );
+                m_responding = true;
+                ++handled;
+                break;
+            }
+            metrics::add( metrics::CGI_REJECTED );
+            read_ret = SERVICE_UNAVAILABLE;
+        }
+		// 根据请求状态往写缓冲区中写入相应内容
+        m_responding = true;
+        if ( ! process_write( read_ret ) )
+        {
+            close_conn();
+            return;
+        }
+        ++handled;
+        next_request();
+		// 客户不要求保持连接时不再处理后续请求,流式应答结束之前后续的应答也不能发送
+        if ( m_stream || ! m_keep_alive || m_draining || handled == MAX_PIPELINE )
+        {
+            break;
+        }
+    }
+    if ( handled == 0 )
+    {
+		// 缓冲区已满仍不能得到完整的请求,放弃该连接;排空期间没有待处理的数据时也直接关闭
+        if ( m_read_idx + 1 >= MAX_READ_BUFFER || ( m_draining && m_read_idx == 0 && ! m_responding && m_out.empty() ) )
+        {
+            close_conn();
+            return;
+        }
+		// 继续监听套接字的读事件
+        arm( EPOLLIN );
         return;
-	}
-	// 根据请求状态往写缓冲区中写入相应内容
-    bool write_ret = process_write( read_ret );
-    if ( ! write_ret )
+    }
+	// 开始读取CGI程序的输出,之前没有已生成的应答时,等有输出后再监听写事件;
+	// 管道注册之后事件循环就可能转发输出,修改发送队列,须是处理的最后一步
+    if ( m_cgi )
     {
-        close_conn();
+        if ( ! m_out.empty() )
+        {
+            arm( EPOLLOUT );
+        }
+        arm_cgi( EPOLL_CTL_ADD );
+        return;
     }
 	// 监听套接字的写事件,后续将由主线程完成数据的发送
-    modfd( m_epollfd, m_sockfd, EPOLLOUT );
-}
-
-// 服务动态内容
-void http_conn::serve_dynamic()
-{
-	char buf[MAXLINE], *emptylist[] = { NULL };
-    /* Return first part of HTTP response */
-    sprintf(buf, "HTTP/1.1 200 OK\r\n"); 
-    Rio_writen(m_sockfd, buf, strlen(buf));
-    sprintf(buf, "Server: Yuntian Web Server\r\n");
-    Rio_writen(m_sockfd, buf, strlen(buf));
-	int ret = Fork();
-    if (ret == 0) 
-	{ 
-		/* Child */ //line:netp:servedynamic:fork
-		/* Real server would set all CGI vars here */
-		// 设置环境变量
-		setenv("QUERY_STRING", cgiargs, 1); //line:netp:servedynamic:setenv
-		Dup2(m_sockfd, STDOUT_FILENO);         /* Redirect stdout to client */ //line:netp:servedynamic:dup2
-		// 调用CGI程序,参数列表为空,实际参数通过环境变量传递
-		Execve(m_real_file, emptylist, environ); /* Run CGI program */ //line:netp:servedynamic:execve
-		printf("child process end.\n");
-		exit(0);
-    }
-	else if(ret == -1)
-	{
-		// 创建进程出错,关闭连接
-		close_conn();
-	}
-	else
-	{
-		//close_conn();
-		// 父进程
-		// 继续监听套接字的读事件
-        //modfd( m_epollfd, m_sockfd, EPOLLIN );
-		
-		pid_socket[ret] = m_sockfd;
-		// printf("parent process's child:%d, socket:%d.\n",ret,m_sockfd);
-		
-		// wait(NULL);
-		// reset_socket();
+    arm( EPOLLOUT );
+}
+
+bool http_conn::start_cgi()
+{
+    if ( ! m_cgi_launcher || ! m_cgi_launcher->acquire() )
+    {
+        return false;
+    }
+	// 读端非阻塞,由事件循环读取;写端交给子进程作为标准输出
+    int fds[2];
+    if ( pipe2( fds, O_CLOEXEC ) < 0 )
+    {
+        m_cgi_launcher->release();
+        return false;
+    }
+    setnonblocking( fds[0] );
+    char addr[ INET_ADDRSTRLEN ];
+    inet_ntop( AF_INET, &m_address.sin_addr, addr, sizeof( addr ) );
+	// 实际参数通过环境变量传递
+    std::vector< std::string > env;
+    env.push_back( std::string( "QUERY_STRING=" ) + cgiargs );
+    env.push_back( "REQUEST_METHOD=GET" );
+    env.push_back( std::string( "SCRIPT_NAME=" ) + m_url );
+    env.push_back( "SERVER_PROTOCOL=HTTP/1.1" );
+    env.push_back( "GATEWAY_INTERFACE=CGI/1.1" );
+    env.push_back( std::string( "REMOTE_ADDR=" ) + addr );
+    bool ok = m_cgi_launcher->launch( m_real_file, env, fds[1] );
+    close( fds[1] );
+    if ( ! ok )
+    {
+        close( fds[0] );
+        m_cgi_launcher->release();
+        return false;
+    }
+    m_cgi = new cgi_state( fds[0], monotonic_ms() + m_cgi_timeout );
+    return true;
+}
+
+void http_conn::arm_cgi( int op )
+{
+    epoll_event event;
+    event.data.u64 = CGI_EVENT | ( uint32_t )m_sockfd;
+    event.events = EPOLLIN | EPOLLET | EPOLLONESHOT;
+    epoll_ctl( m_epollfd, op, m_cgi->fd, &event );
+}
+
+void http_conn::stop_stream_wait()
+{
+    if ( m_stream_fd >= 0 )
+    {
+        epoll_ctl( m_epollfd, EPOLL_CTL_DEL, m_stream_fd, NULL );
+        m_stream_fd = -1;
+    }
+}
+
+void http_conn::stream_event()
+{
+	// 同一批事件中连接已先行关闭
+    if ( m_stream_fd < 0 )
+    {
         return;
-	}
-    //Wait(NULL); /* Parent waits for and reaps child */ //line:netp:servedynamic:wait
+    }
+    stop_stream_wait();
+    arm( EPOLLOUT );
 }
 
-void http_conn::reset_socket()
+void http_conn::finish_cgi( bool kill_child )
 {
-	//如果客户要求保持连接
-	if( m_linger )
-	{
-		//初始化
-		init();
-		//继续监听套接字的读事件
-		modfd( m_epollfd, m_sockfd, EPOLLIN );
-		printf("remain sockfd:%d\n", m_sockfd);
-	}
-	else
-	{
-		//客户不要求保持连接
-		//modfd( m_epollfd, m_sockfd, EPOLLIN );
-		printf("close sockfd:%d\n", m_sockfd);
-		close_conn();
-	}
-	
-	//初始化
-	// init();
-	//继续监听套接字的读事件
-	// modfd( m_epollfd, m_sockfd, EPOLLIN );
-	return;	
+    if ( kill_child && m_cgi->pid > 0 )
+    {
+		// CGI程序自成进程组,它创建的子进程一起终止;程序可能已被启动进程回收,由启动进程判断
+        m_cgi_launcher->terminate( m_cgi->pid );
+    }
+    removefd( m_epollfd, m_cgi->fd );
+    m_cgi_launcher->release();
+    delete m_cgi;
+    m_cgi = NULL;
+}
+
+bool http_conn::cgi_event()
+{
+	// 同一批事件中连接已先行关闭
+    if ( ! m_cgi )
+    {
+        return true;
+    }
+    char buf[ 16384 ];
+    bool done = false;
+    bool ok = true;
+	// 发送队列中的数据足够时暂停读取,CGI程序随之阻塞在管道上,等发送完毕后再继续
+    while ( ! done && m_out.size() < STREAM_BATCH )
+    {
+        ssize_t n = ::read( m_cgi->fd, buf, sizeof( buf ) );
+        if ( n > 0 )
+        {
+            ok = relay_cgi( buf, n );
+            done = ! ok;
+        }
+        else if ( n == 0 || ( errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK ) )
+        {
+            done = true;
+        }
+        else if ( errno != EINTR )
+        {
+            break;
+        }
+    }
+    if ( done )
+    {
+        if ( ok && m_cgi->headers_done )
+        {
+			// 最后的空块
+            m_out.push_copy( "0\r\n\r\n", 5 );
+            finish_cgi( false );
+        }
+        else
+        {
+			// 头部无法解析,或者没有输出完整的头部就已结束
+            finish_cgi( ! ok );
+            if ( ! process_write( BAD_GATEWAY ) )
+            {
+                return false;
+            }
+        }
+        next_request();
+    }
+    else if ( m_out.size() >= STREAM_BATCH )
+    {
+        m_cgi->paused = true;
+    }
+    else
+    {
+        arm_cgi( EPOLL_CTL_MOD );
+    }
+    if ( ! m_out.empty() )
+    {
+        arm( EPOLLOUT );
+    }
+    return true;
 }
 
+bool http_conn::relay_cgi( const char* data, size_t len )
+{
+    cgi_state& cgi = *m_cgi;
+    if ( cgi.headers_done )
+    {
+        std::string chunk( data, len );
+        push_chunk( chunk );
+        return true;
+    }
+    cgi.head.append( data, len );
+    if ( cgi.pid == 0 )
+    {
+        if ( cgi.head.size() < sizeof( pid_t ) )
+        {
+            return true;
+        }
+        memcpy( &cgi.pid, cgi.head.data(), sizeof( pid_t ) );
+        cgi.head.erase( 0, sizeof( pid_t ) );
+    }
+	// 头部以空行结束,CGI程序也可能只用换行符
+    size_t end = cgi.head.find( "\r\n\r\n" );
+    size_t sep = 4;
+    size_t lf = cgi.head.find( "\n\n" );
+    if ( lf != std::string::npos && ( end == std::string::npos || lf < end ) )
+    {
+        end = lf;
+        sep = 2;
+    }
+    if ( end == std::string::npos )
+    {
+        return cgi.head.size() <= MAX_CGI_HEADER;
+    }
+    if ( end > MAX_CGI_HEADER || ! add_cgi_headers( cgi.head.data(), end ) )
+    {
+        return false;
+    }
+    cgi.headers_done = true;
+    std::string body( cgi.head, end + sep );
+    std::string().swap( cgi.head );
+    push_chunk( body );
+    return true;
+}
 
+bool http_conn::add_cgi_headers( const char* head, size_t len )
+{
+    int status = 200;
+    std::string title = ok_200_title;
+    bool has_status = false;
+    bool location = false;
+    std::string fields;
+    const char* p = head;
+    const char* end = head + len;
+    while ( p < end )
+    {
+        const char* eol = ( const char* )memchr( p, '\n', end - p );
+        if ( ! eol )
+        {
+            eol = end;
+        }
+        size_t n = eol - p;
+        if ( n > 0 && p[ n - 1 ] == '\r' )
+        {
+            --n;
+        }
+        str_view name, value;
+        if ( ! http_parser::split_header( p, n, name, value ) || name.empty() )
+        {
+            return false;
+        }
+		// Status头部给出状态码和原因短语,如"404 Not Found"
+        if ( name.equals_nocase( "Status" ) )
+        {
+            std::string text( value.data, value.len );
+            char* reason = NULL;
+            long code = strtol( text.c_str(), &reason, 10 );
+            if ( code < 100 || code > 999 )
+            {
+                return false;
+            }
+            status = code;
+            title = reason + strspn( reason, " \t" );
+            has_status = true;
+        }
+		// 连接和传输编码由服务器决定
+        else if ( ! name.equals_nocase( "Connection" ) && ! name.equals_nocase( "Keep-Alive" )
+            && ! name.equals_nocase( "Content-Length" ) && ! name.equals_nocase( "Transfer-Encoding" ) )
+        {
+            location = location || name.equals_nocase( "Location" );
+            fields.append( p, n );
+            fields += "\r\n";
+        }
+        p = eol + 1;
+    }
+	// 只给出Location时为重定向
+    if ( location && ! has_status )
+    {
+        status = 302;
+        title = "Found";
+    }
+    add_status_line( status, title.c_str() );
+    if ( ! add_response( "%s", fields.c_str() ) )
+    {
+        return false;
+    }
+    add_response( "Transfer-Encoding: chunked\r\n" );
+    add_linger();
+    if ( ! add_blank_line() )
+    {
+        return false;
+    }
+    push_headers();
+    return true;
+}
@@ -4,6 +4,7 @@
 #include <unistd.h>
 #include <signal.h>
 #include <sys/types.h>
+#include <sched.h>
 #include <sys/epoll.h>
 #include <fcntl.h>
 #include <sys/socket.h>
@@ -18,97 +19,381 @@
 #include <sys/mman.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <limits.h>
 #include <sys/uio.h>
 #include "locker.h"
-#include "my_func.h"
+#include "file_cache.h"
+#include "out_queue.h"
+#include "timer_wheel.h"
+#include "buffer_pool.h"
+#include "slab_pool.h"
+#include "http_parser.h"
+#include "response_stream.h"
+#include "cgi_launcher.h"
+#include "metrics.h"
+#include "logger.h"
 #include <unordered_map>
+#include <string>
+#include <vector>
+#include <deque>
 #include <sys/wait.h>
 //#include "csapp.h"
 //using namespace std;
 #define MAX_FD 65536
+class reactor;
+// 内置动态请求的处理函数,args为url中'?'之后的参数,content为生成的应答内容
+typedef bool ( *dynamic_handler )( const char* args, std::string& content );
+// 内置的流式处理函数,创建应答内容的生成器,失败时返回NULL,应答以分块传输编码边生成边发送
+typedef response_stream* ( *stream_handler )( const char* args );
+
 class http_conn
 {
+	// io_uring后端的事件循环直接读写连接的提交状态
+    friend class reactor;
 public:
     static const int FILENAME_LEN = 200;
-    static const int READ_BUFFER_SIZE = 2048;
-    static const int WRITE_BUFFER_SIZE = 1024;
+	// 读写缓冲区的内联大小,请求或应答头部更长时从内存池扩充,直到各自的上限
+    static const int READ_BUFFER_SIZE = 1024;
+    static const int WRITE_BUFFER_SIZE = 512;
+    static const int MAX_READ_BUFFER = 65536;
+    static const int MAX_WRITE_BUFFER = 8192;
+	// 一次处理的流水线请求数的上限,其余的在这批应答发送完毕后再处理
+    static const int MAX_PIPELINE = 16;
+	// 流式应答每次生成到发送队列中至少有这么多字节为止,发送完毕后再继续生成
+    static const size_t STREAM_BATCH = 65536;
+	// CGI程序输出管道的epoll事件以此标记,低32位为所属连接的套接字
+    static const uint64_t CGI_EVENT = 1ULL << 32;
+	// 流式应答等待的描述符的epoll事件以此标记,低32位为所属连接的套接字
+    static const uint64_t STREAM_EVENT = 1ULL << 33;
+	// CGI程序输出的头部的最大长度
+    static const size_t MAX_CGI_HEADER = 4096;
+	// 访问日志中url的最大长度,超出的部分截断
+    static const size_t ACCESS_URL_MAX = 160;
     enum METHOD { GET = 0, POST, HEAD, PUT, DELETE, TRACE, OPTIONS, CONNECT, PATCH };
     enum CHECK_STATE { CHECK_STATE_REQUESTLINE = 0, CHECK_STATE_HEADER, CHECK_STATE_CONTENT };
-    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION, DYNAMIC_SERVE};
+    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION, DYNAMIC_SERVE, DYNAMIC_REQUEST,
+                     OPTIONS_REQUEST, METHOD_NOT_ALLOWED, PAYLOAD_TOO_LARGE, NOT_IMPLEMENTED, STREAM_REQUEST,
+                     SERVICE_UNAVAILABLE, BAD_GATEWAY, GATEWAY_TIMEOUT, URI_TOO_LONG };
     enum LINE_STATUS { LINE_OK = 0, LINE_BAD, LINE_OPEN };
+	// 分块传输的请求体的解析状态:块大小行,块数据,块数据之后的回车换行,尾部头部
+    enum CHUNK_STATE { CHUNK_SIZE = 0, CHUNK_DATA, CHUNK_DATA_END, CHUNK_TRAILER };
 
 public:
-    http_conn(){}
-    ~http_conn(){}
+    http_conn() : m_stream( NULL ), m_stream_wake( 0 ), m_stream_fd( -1 ), m_cgi( NULL ), m_wheel( NULL ), m_busy( 0 ), m_closing( false ), m_uring_loop( NULL ), m_generation( 0 ), m_uring_pending( 0 ), m_uring_send( NULL )
+    {
+        timer_wheel::init_node( &m_timer, this );
+    }
+    ~http_conn() { delete m_uring_send; }
 
 public:
-    void init( int sockfd, const sockaddr_in& addr );
+	// 初始化新接受的连接,并注册到epollfd所在的事件循环,wheel为该事件循环的时间轮;
+	// uring_loop不为NULL时套接字不加入epoll,读取和等待可写都经由该事件循环的io_uring提交
+    void init( int sockfd, const sockaddr_in& addr, int epollfd, timer_wheel* wheel, reactor* uring_loop = NULL );
     void close_conn( bool real_close = true );
     void process();
     bool read();
+	// io_uring接收到的数据追加到读缓冲区,超出读缓冲区的上限时返回false
+    bool feed( const char* data, size_t len );
     bool write();
-	void reset_socket();
+	// CGI程序的输出管道可读或已关闭,在连接所属的事件循环线程中调用,返回false时关闭连接
+    bool cgi_event();
+	// 流式应答等待的描述符已就绪,在连接所属的事件循环线程中调用,经由可写事件继续生成
+    void stream_event();
+	// 发送队列已空,需要继续生成流式应答(生成器未要求等待),或者应答已发送完毕,读缓冲区中还有客户端以流水线方式发来的后续请求
+    bool request_pending() const { return m_out.empty() && ( ( m_stream && ! m_stream_wake && m_stream_fd < 0 ) || ( ! m_responding && m_read_idx > 0 ) ); }
+	// 服务器退出时由连接所属的事件循环调用,关闭空闲的连接,返回连接是否仍未关闭;
+	// 工作线程正在处理的连接不关闭,由工作线程处理完毕后关闭
+    bool drain();
+	// 以下三个函数只在连接所属的事件循环线程中调用
+	// 按连接当前所处的阶段重新设置超时
+    void update_timer();
+	// 定时器到期,截止时间已过时关闭连接,否则按新的截止时间重新设置
+    void expire( uint64_t now );
+	// 交给工作线程之前调用,处理期间定时器到期也不关闭连接
+    void begin_work() { __sync_fetch_and_add( &m_busy, 1 ); }
+	// 工作线程处理完毕,或者未能交给工作线程时调用
+    void end_work() { __sync_fetch_and_sub( &m_busy, 1 ); }
+	// 工作线程在重新监听事件之后才调用end_work,事件循环收到事件时等它完成这最后一步
+    void wait_idle() const
+    {
+        while ( m_busy > 0 )
+        {
+            sched_yield();
+        }
+        __sync_synchronize();
+    }
+	// 工作线程要求关闭连接,由事件循环完成关闭
+    bool closing() const { return m_closing; }
+	// 为url注册内置的处理函数,content_type为生成内容的类型,须在工作线程启动之前调用;
+	// local_only为true时只响应回环地址的客户端,其他客户端按普通文件处理,通常得到404
+	static void register_handler( const char* url, dynamic_handler handler, const char* content_type = "text/html", bool local_only = false );
+	static void register_stream_handler( const char* url, stream_handler handler );
+	// 为以prefix开头的url设置Cache-Control,多个前缀匹配时取最长的,须在工作线程启动之前调用
+	static void set_cache_control( const char* prefix, const char* value );
+	// 内部的统计页面,args含format=prometheus时输出Prometheus格式
+	static bool stats( const char* args, std::string& content );
 
 private:
     void init();
+	// 重置单个请求的解析状态
+    void reset_request();
+	// 一个请求的应答生成之后,丢弃已处理的请求,保留缓冲区中的后续数据
+    void next_request();
+    void process_request();
     HTTP_CODE process_read();
     bool process_write( HTTP_CODE ret );
 
     HTTP_CODE parse_request_line( char* text );
-    HTTP_CODE parse_headers( char* text );
-    HTTP_CODE parse_content( char* text );
+    HTTP_CODE parse_headers( char* text, int len );
+    HTTP_CODE parse_content();
+	// 在读缓冲区中原地解码分块传输的请求体
+    HTTP_CODE parse_chunked();
+	// 请求头部带有Expect: 100-continue时,在读取请求体之前回复100 Continue
+    void send_continue();
     HTTP_CODE do_request();
 	// 获取当前待读取的行的起始位置
-    char* get_line() { return m_read_buf + m_start_line; }
-	// 服务动态内容
-	void serve_dynamic();
-	// 重置连接
-	//void reset_socket();
+    char* get_line() { return m_read_buf.data() + m_start_line; }
+	// 交给CGI启动器运行请求的程序,并发数已达上限或启动器不可用时返回false
+    bool start_cgi();
+	// 转发CGI程序的输出,先读出pid,再把头部转换为应答头部,之后的内容作为块发送
+    bool relay_cgi( const char* data, size_t len );
+    bool add_cgi_headers( const char* head, size_t len );
+	// 注册或重新监听CGI输出管道的可读事件
+    void arm_cgi( int op );
+	// 不再等待流式应答的描述符,从epoll实例中移除,描述符由生成器关闭
+    void stop_stream_wait();
+	// 等待套接字可读(EPOLLIN)或可写(EPOLLOUT),一次触发
+    void arm( int ev );
+	// CGI程序结束或放弃时关闭管道,kill_child为true时终止仍在运行的程序
+    void finish_cgi( bool kill_child );
     LINE_STATUS parse_line();
 
     void unmap();
+	// 读缓冲区扩充后,将指向原缓冲区的请求字段指针移到新缓冲区
+    void rebase( const char* old_base );
     bool add_response( const char* format, ... );
+	// 写缓冲区中的应答头部复制到发送队列,写缓冲区留给下一个应答
+    void push_headers();
+	// HEAD请求只发送头部,归还文件条目并返回true
+    bool head_only( file_cache::entry* entry );
     bool add_content( const char* content );
     bool add_status_line( int status, const char* title );
+	// 一个应答的访问日志,begin和end为应答在发送队列中的起止位置,end在应答全部加入发送队列时确定
+	struct access_record
+	{
+		http_conn* conn;
+		int status;
+		const char* method;
+		char url[ ACCESS_URL_MAX + 4 ];
+		uint64_t start;
+		uint64_t begin;
+		uint64_t end;
+		bool queued;
+	};
+	// 生成状态行时记下访问日志所需的请求信息,应答发送完毕或连接关闭时才写出
+    void begin_access( int status );
+	// 当前应答已全部加入发送队列,在其后放一个标记,发送到标记处时写出访问日志
+    void end_access();
+    static void access_sent( void* arg, bool sent );
+	// 访问日志中记录一个应答:客户端地址,请求行,状态码,发送的字节数和从收到请求到发送完毕的耗时,
+	// 未发送完毕就关闭连接时加上aborted=1
+    void log_access( const access_record& record, bool aborted );
     bool add_headers( int content_length );
     bool add_content_length( int content_length );
     bool add_linger();
     bool add_blank_line();
+	// 添加文件应答,根据Range头部发送整个文件,部分内容或者多个区间
+    bool add_file_response();
+    bool if_range_matches() const;
+	// 根据If-None-Match和If-Modified-Since判断客户端缓存的副本是否仍然有效
+    bool not_modified( const char* etag ) const;
+	// 添加文件的校验值和缓存控制头部,etag为实际发送版本的校验值
+    bool add_validators( const file_cache::entry* entry, const char* etag );
+	// 按客户端接受的编码选择文件的压缩版本,没有可用的版本时返回NULL
+    const file_cache::variant* select_variant( content_encoding& encoding );
+	// 压缩内置处理函数生成的应答内容
+    content_encoding compress_dynamic();
+	// 生成流式应答的下一批内容并加入发送队列,应答结束时写出最后的空块
+    bool continue_stream();
+	// 将data作为一个块加入发送队列,data被取走
+    void push_chunk( std::string& data );
+    bool add_cache_control();
+	// 连接当前阶段的截止时间
+    uint64_t deadline() const;
 
 public:
-    static int m_epollfd;
+	// 所有事件循环的连接总数
     static int m_user_count;
-	//void handle_child(int sig);
-	static int pid_socket[MAX_FD];
+	// 所有连接共享的静态文件缓存
+    static file_cache* m_file_cache;
+	// 服务器正在退出,应答发送完毕后不再保持连接
+    static volatile bool m_draining;
+	// 各阶段的超时(毫秒):读取请求头部,读取请求体,保持连接的空闲时间,从收到请求到应答发送完毕
+    static unsigned int m_header_timeout;
+    static unsigned int m_body_timeout;
+    static unsigned int m_idle_timeout;
+    static unsigned int m_request_timeout;
+	// CGI程序的启动器,为NULL时CGI请求返回503
+    static cgi_launcher* m_cgi_launcher;
+	// CGI程序从启动到输出结束的超时(毫秒)
+    static unsigned int m_cgi_timeout;
+	// 连接数的上限,达到上限后新接受的连接直接以503拒绝
+    static int m_max_conns;
+	// 线程池中任务的平均排队时间超过该值(毫秒)时,新接受的连接直接以503拒绝,0表示不按排队时间拒绝
+    static unsigned int m_shed_wait_ms;
+	// 是否记录访问日志,与编译时的日志级别无关
+    static bool m_access_log;
+
+private:
+	// 内置处理函数,两种之一不为NULL
+	struct handler
+	{
+		dynamic_handler content;
+		stream_handler stream;
+		const char* content_type;
+		bool local_only;
+	};
+	// 流式应答的状态,只在生成流式应答期间存在
+	struct stream_state;
+	// CGI程序的运行状态,只在CGI程序运行期间存在
+	struct cgi_state;
+	// io_uring后端正在进行的发送:内存段以sendmsg发送,提交时内核即复制msghdr和iovec;
+	// 文件段经向事件循环借用的管道以两次链接的splice发送,发送队列发完后归还管道
+	struct uring_send
+	{
+		enum OP { SEND_MSG = 0, SEND_FILE, SEND_PIPE };
+		OP op;
+		msghdr msg;
+		iovec iov[ out_queue::MAX_IOV ];
+		int pipe[ 2 ];
+		unsigned int pipe_size;
+		// 已读入管道尚未发出的字节数,文件读入管道的请求的结果
+		size_t piped;
+		int spliced;
+	};
+	// url到内置处理函数的映射,启动后只读,工作线程可以无锁查找
+	static std::unordered_map< std::string, handler > m_handlers;
+	// url前缀到Cache-Control值的映射
+	static std::vector< std::pair< std::string, std::string > > m_cache_controls;
 
 
 private:
     int m_sockfd;
     sockaddr_in m_address;
+	// 连接所属事件循环的epoll实例
+    int m_epollfd;
 
-    char m_read_buf[ READ_BUFFER_SIZE ];
+    conn_buffer< READ_BUFFER_SIZE > m_read_buf;
     int m_read_idx;
     int m_checked_idx;
     int m_start_line;
-    char m_write_buf[ WRITE_BUFFER_SIZE ];
+    conn_buffer< WRITE_BUFFER_SIZE > m_write_buf;
     int m_write_idx;
+	// 写缓冲区中应答头部的结束位置
+    int m_headers_end;
 
     CHECK_STATE m_check_state;
     METHOD m_method;
 
     char m_real_file[ FILENAME_LEN ];
     char* m_url;
-	// 动态url的参数
+	// 动态url的参数,更长的查询参数以414拒绝
 	char cgiargs[FILENAME_LEN];
+	// 内置处理函数生成的应答内容
+	std::string m_dynamic_content;
+	const char* m_content_type;
+	// 正在生成的流式应答
+	stream_state* m_stream;
+	// 流式应答的生成器要求等待时,再次生成的时间(毫秒),由定时器唤醒;不等待时为0
+	uint64_t m_stream_wake;
+	// 流式应答的生成器等待就绪的描述符,已加入连接所属的epoll实例;不等待时为-1
+	int m_stream_fd;
+	// 正在运行的CGI程序
+	cgi_state* m_cgi;
     char* m_version;
     char* m_host;
+	// Range和If-Range头部的值
+    char* m_range;
+    char* m_if_range;
+	// 条件请求头部的值
+    char* m_if_none_match;
+    char* m_if_modified_since;
+	// 客户端接受的内容编码,以content_encoding为位序的掩码
+    int m_accept_encoding;
     int m_content_length;
+	// 请求中出现过Content-Length头部,请求体须在收到之前先回复100 Continue
+    bool m_has_content_length;
+    bool m_expect_continue;
+	// 请求体在读缓冲区中的起止位置,分块传输的请求体解码后连续存放在这里
+    int m_body_idx;
+    int m_body_end;
+	// 分块传输的解析状态和当前块剩余的字节数
+    bool m_chunked;
+    CHUNK_STATE m_chunk_state;
+    int m_chunk_remaining;
+	// 405应答和OPTIONS应答中的Allow头部
+    const char* m_allow;
     bool m_linger;
+	// 最近一个已生成应答的请求要求保持连接
+    bool m_keep_alive;
 
     char* m_file_address;
     struct stat m_file_stat;
-    struct iovec m_iv[2];
-    int m_iv_count;
+	// 从缓存获取的文件条目,应答发送完毕后释放
+    file_cache::entry* m_file_entry;
+	// 待发送的应答头部和内容
+    out_queue m_out;
+	// 尚未写出访问日志的应答,按生成的顺序排列,已加入发送队列的应答排在前面
+    std::deque< access_record > m_access;
+	// 所属事件循环的时间轮和本连接的定时器
+    timer_wheel* m_wheel;
+    timer_wheel::node m_timer;
+	// 正在由工作线程处理
+    volatile int m_busy;
+	// 工作线程中调用close_conn时只设置该标记,连接只由所属的事件循环关闭
+    bool m_closing;
+	// 开始空闲,收到请求的第一个字节,开始读取请求体的时间
+    uint64_t m_idle_since;
+    uint64_t m_request_start;
+    uint64_t m_body_start;
+	// 已经生成应答,正在发送
+    volatile bool m_responding;
+	// 接受连接的时间(纳秒)和已应答的请求数,关闭时计入统计
+    uint64_t m_accepted_ns;
+    int m_served;
+	// do_request开始的时间,用于区分解析和处理的耗时
+    uint64_t m_do_request_start;
+	// io_uring后端的事件循环,为NULL时使用epoll
+    reactor* m_uring_loop;
+	// 描述符每次被新连接使用时加1,用于丢弃属于已关闭连接的完成事件
+    uint32_t m_generation;
+	// 已提交尚未完成的请求,EPOLLIN为接收,EPOLLOUT为等待可写或发送
+    int m_uring_pending;
+	// 第一次经io_uring发送时分配,随连接对象复用
+    uring_send* m_uring_send;
+};
+
+// 按描述符索引的连接表,连接对象在描述符第一次被使用时从内存池分配,之后保留给该描述符复用
+class conn_table
+{
+public:
+    conn_table() : m_conns( new http_conn*[ MAX_FD ]() ) {}
+    ~conn_table() { delete [] m_conns; }
+	// 描述符对应的连接,尚未分配时返回NULL
+    http_conn* get( int fd ) const { return m_conns[ fd ]; }
+	// 描述符对应的连接,尚未分配时分配,内存不足时返回NULL
+    http_conn* acquire( int fd )
+    {
+        if ( ! m_conns[ fd ] )
+        {
+            m_conns[ fd ] = m_pool.alloc();
+        }
+        return m_conns[ fd ];
+    }
+
+private:
+    http_conn** m_conns;
+    slab_pool< http_conn > m_pool;
 };
 
 #endif
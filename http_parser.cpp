@@ -0,0 +1,178 @@
+#include <assert.h>
+#include "http_parser.h"
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+#define HTTP_PARSER_X86 1
+#endif
+
+namespace
+{
+// 逐字节查找,也用于处理块查找剩下的不足一块的尾部
+const char* find_scalar( const char* p, const char* end )
+{
+    for ( ; p < end; ++p )
+    {
+        if ( *p == '\r' || *p == '\n' )
+        {
+            return p;
+        }
+    }
+    return end;
+}
+
+#ifdef HTTP_PARSER_X86
+// 每次比较32字节,两个结束符的比较结果合并为一个位掩码
+__attribute__(( target( "avx2" ) ))
+const char* find_avx2( const char* p, const char* end )
+{
+    const __m256i cr = _mm256_set1_epi8( '\r' );
+    const __m256i lf = _mm256_set1_epi8( '\n' );
+    for ( ; end - p >= 32; p += 32 )
+    {
+        __m256i block = _mm256_loadu_si256( ( const __m256i* )p );
+        unsigned mask = _mm256_movemask_epi8(
+            _mm256_or_si256( _mm256_cmpeq_epi8( block, cr ), _mm256_cmpeq_epi8( block, lf ) ) );
+        if ( mask )
+        {
+            return p + __builtin_ctz( mask );
+        }
+    }
+    return find_scalar( p, end );
+}
+
+// 每次比较16字节,pcmpestri直接给出第一个属于字符集合的位置
+__attribute__(( target( "sse4.2" ) ))
+const char* find_sse42( const char* p, const char* end )
+{
+    const __m128i set = _mm_setr_epi8( '\r', '\n', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 );
+    for ( ; end - p >= 16; p += 16 )
+    {
+        __m128i block = _mm_loadu_si128( ( const __m128i* )p );
+        int i = _mm_cmpestri( set, 2, block, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT );
+        if ( i < 16 )
+        {
+            return p + i;
+        }
+    }
+    return find_scalar( p, end );
+}
+#endif
+
+typedef const char* ( *scan_func )( const char*, const char* );
+
+struct scanner
+{
+    scan_func find;
+    const char* name;
+
+    scanner() : find( find_scalar ), name( "scalar" )
+    {
+#ifdef HTTP_PARSER_X86
+		// 在main之前运行,须先初始化cpu信息
+        __builtin_cpu_init();
+        if ( __builtin_cpu_supports( "avx2" ) )
+        {
+            find = find_avx2;
+            name = "avx2";
+        }
+        else if ( __builtin_cpu_supports( "sse4.2" ) )
+        {
+            find = find_sse42;
+            name = "sse4.2";
+        }
+#endif
+    }
+};
+
+const scanner g_scanner;
+
+// 与header_id的顺序一致
+const char* const HEADER_NAMES[ HEADER_COUNT ] =
+{
+    "Connection",
+    "Content-Length",
+    "Host",
+    "Range",
+    "If-Range",
+    "If-None-Match",
+    "If-Modified-Since",
+    "Accept-Encoding",
+    "Transfer-Encoding",
+    "Expect",
+};
+
+// 散列由长度,首字符和末字符(忽略大小写)计算,对上述名称没有冲突,
+// 查找时只需比较一次;增加头部后若出现冲突,须调整乘数或者槽数
+const size_t HASH_SLOTS = 16;
+
+inline size_t header_hash( const char* name, size_t len )
+{
+    return ( len + ( name[0] | 0x20 ) + ( name[ len - 1 ] | 0x20 ) * 7 ) & ( HASH_SLOTS - 1 );
+}
+
+struct header_table
+{
+    signed char slots[ HASH_SLOTS ];
+    size_t lengths[ HEADER_COUNT ];
+
+    header_table()
+    {
+        memset( slots, HEADER_UNKNOWN, sizeof( slots ) );
+        for ( int id = 0; id < HEADER_COUNT; ++id )
+        {
+            lengths[ id ] = strlen( HEADER_NAMES[ id ] );
+            size_t h = header_hash( HEADER_NAMES[ id ], lengths[ id ] );
+            assert( slots[ h ] == HEADER_UNKNOWN );
+            slots[ h ] = id;
+        }
+    }
+};
+
+const header_table g_headers;
+}
+
+const char* http_parser::find_line_end( const char* begin, const char* end )
+{
+    return g_scanner.find( begin, end );
+}
+
+const char* http_parser::scanner_name()
+{
+    return g_scanner.name;
+}
+
+header_id http_parser::lookup_header( const char* name, size_t len )
+{
+    if ( len == 0 )
+    {
+        return HEADER_UNKNOWN;
+    }
+    int id = g_headers.slots[ header_hash( name, len ) ];
+    if ( id == HEADER_UNKNOWN || g_headers.lengths[ id ] != len || strncasecmp( HEADER_NAMES[ id ], name, len ) != 0 )
+    {
+        return HEADER_UNKNOWN;
+    }
+    return ( header_id )id;
+}
+
+bool http_parser::split_header( const char* line, size_t len, str_view& name, str_view& value )
+{
+    const char* colon = ( const char* )memchr( line, ':', len );
+    if ( ! colon )
+    {
+        return false;
+    }
+    name = str_view( line, colon - line );
+    const char* p = colon + 1;
+    const char* end = line + len;
+    while ( p < end && ( *p == ' ' || *p == '\t' ) )
+    {
+        ++p;
+    }
+    while ( end > p && ( end[-1] == ' ' || end[-1] == '\t' ) )
+    {
+        --end;
+    }
+    value = str_view( p, end - p );
+    return true;
+}
@@ -0,0 +1,52 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+
+// 指向读缓冲区内部的字符串片段,不复制数据,也不要求以结束符结尾
+struct str_view
+{
+    const char* data;
+    size_t len;
+
+    str_view() : data( NULL ), len( 0 ) {}
+    str_view( const char* d, size_t n ) : data( d ), len( n ) {}
+    bool empty() const { return len == 0; }
+	// 忽略大小写比较
+    bool equals_nocase( const char* s ) const { return strlen( s ) == len && strncasecmp( data, s, len ) == 0; }
+};
+
+// 服务器处理的请求头部,其余的头部解析为HEADER_UNKNOWN
+enum header_id
+{
+    HEADER_UNKNOWN = -1,
+    HEADER_CONNECTION,
+    HEADER_CONTENT_LENGTH,
+    HEADER_HOST,
+    HEADER_RANGE,
+    HEADER_IF_RANGE,
+    HEADER_IF_NONE_MATCH,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_ACCEPT_ENCODING,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_EXPECT,
+    HEADER_COUNT
+};
+
+// 请求解析的基本操作:按块查找行结束符,以完美散列识别头部名称
+namespace http_parser
+{
+	// 在[begin, end)中查找第一个'\r'或'\n',没有时返回end;
+	// 启动时按cpuid选用AVX2(每次32字节),SSE4.2(每次16字节)或逐字节的实现
+    const char* find_line_end( const char* begin, const char* end );
+	// 当前使用的查找实现的名称
+    const char* scanner_name();
+	// 查找头部名称对应的编号,忽略大小写
+    header_id lookup_header( const char* name, size_t len );
+	// 将一行头部拆分为名称和值,值去掉首尾的空白,没有冒号时返回false
+    bool split_header( const char* line, size_t len, str_view& name, str_view& value );
+}
+
+#endif
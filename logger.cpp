@@ -0,0 +1,403 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <new>
+#include <string>
+#include <vector>
+#include "locker.h"
+#include "metrics.h"
+#include "logger.h"
+
+namespace
+{
+// 每个线程的缓冲区可存放的消息数,须为2的幂
+const size_t RING_SIZE = 2048;
+// 后台线程两次收集之间的间隔(纳秒),有缓冲区过半时不等待
+const long FLUSH_INTERVAL_NS = 20 * 1000000L;
+
+// 一条消息,时间在记录时取得,由后台线程格式化
+struct record
+{
+    int64_t sec;
+    int32_t nsec;
+    uint8_t stream;
+    uint8_t level;
+    uint16_t len;
+    char text[ logger::MESSAGE_MAX ];
+};
+
+// 单生产者单消费者的环形缓冲区,生产者为所属线程,消费者为后台线程,
+// 两个位置分处不同的缓存行,双方只写自己的位置
+struct ring
+{
+	// 下一条消息的写入位置,只由所属线程修改
+    alignas( 64 ) std::atomic< size_t > head;
+    std::atomic< uint64_t > dropped;
+	// 下一条消息的读取位置,只由后台线程修改
+    alignas( 64 ) std::atomic< size_t > tail;
+	// 线程的编号,按第一次记录的顺序,输出在错误日志中
+    int id;
+    alignas( 64 ) record records[ RING_SIZE ];
+};
+
+// 一个日志文件,后台线程把一批消息先拼接到batch中,再一次写出
+struct output
+{
+    const char* name;
+    int fd;
+    size_t size;
+    std::string batch;
+};
+
+const char* LEVEL_NAMES[] = { "DEBUG", "INFO ", "WARN ", "ERROR" };
+
+__thread ring* t_ring = NULL;
+locker g_lock;
+std::vector< ring* > g_rings;
+// 所属线程已退出的缓冲区,其中的消息写出之后可以交给新线程
+std::vector< ring* > g_free_rings;
+pthread_key_t g_ring_key;
+pthread_once_t g_key_once = PTHREAD_ONCE_INIT;
+output g_outputs[ logger::STREAM_COUNT ] =
+{
+    { "error.log", STDOUT_FILENO, 0, std::string() },
+    { "access.log", STDOUT_FILENO, 0, std::string() },
+};
+// 为空时写到标准输出,不轮转
+std::string g_dir;
+size_t g_max_bytes = 0;
+unsigned int g_rotate_seconds = 0;
+time_t g_next_rotate = 0;
+pthread_t g_thread;
+bool g_started = false;
+bool g_stopped = false;
+std::atomic< bool > g_running( false );
+// 已经报告过的丢弃数
+uint64_t g_reported = 0;
+
+// 线程退出时调用,缓冲区不释放,其中的消息仍会写出
+void release_thread( void* arg )
+{
+    t_ring = NULL;
+    g_lock.lock();
+    g_free_rings.push_back( ( ring* )arg );
+    g_lock.unlock();
+}
+
+void create_key()
+{
+    if ( pthread_key_create( &g_ring_key, release_thread ) != 0 )
+    {
+        abort();
+    }
+}
+
+ring* register_thread()
+{
+    pthread_once( &g_key_once, create_key );
+    ring* r = NULL;
+    g_lock.lock();
+	// 优先复用已退出线程的缓冲区,须等后台线程取走其中的消息,
+	// 否则频繁创建的短命线程会使缓冲区和收集的开销无限增长
+    for ( size_t i = 0; i < g_free_rings.size(); ++i )
+    {
+        ring* f = g_free_rings[i];
+        if ( f->tail.load( std::memory_order_acquire ) == f->head.load( std::memory_order_relaxed ) )
+        {
+            r = f;
+            g_free_rings[i] = g_free_rings.back();
+            g_free_rings.pop_back();
+            break;
+        }
+    }
+    if ( ! r )
+    {
+		// 按缓存行对齐分配,不释放
+        void* mem = NULL;
+        if ( posix_memalign( &mem, 64, sizeof( ring ) ) != 0 )
+        {
+            abort();
+        }
+        r = new ( mem ) ring;
+        r->head.store( 0, std::memory_order_relaxed );
+        r->tail.store( 0, std::memory_order_relaxed );
+        r->dropped.store( 0, std::memory_order_relaxed );
+        r->id = g_rings.size();
+        g_rings.push_back( r );
+    }
+    g_lock.unlock();
+    pthread_setspecific( g_ring_key, r );
+    t_ring = r;
+    return r;
+}
+
+time_t next_rotate( time_t now )
+{
+    return g_rotate_seconds ? ( now / g_rotate_seconds + 1 ) * g_rotate_seconds : 0;
+}
+
+bool open_output( output& out )
+{
+    std::string path = g_dir + "/" + out.name;
+    int fd = open( path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644 );
+    if ( fd < 0 )
+    {
+        return false;
+    }
+    struct stat st;
+    out.size = fstat( fd, &st ) == 0 ? st.st_size : 0;
+    out.fd = fd;
+    return true;
+}
+
+// 当前文件改名为"名称.年月日-时分秒",同一秒内多次轮转时再加序号,然后打开新文件
+void rotate( output& out, time_t now )
+{
+    std::string path = g_dir + "/" + out.name;
+    struct tm tm;
+    localtime_r( &now, &tm );
+    char suffix[ 32 ];
+    strftime( suffix, sizeof( suffix ), ".%Y%m%d-%H%M%S", &tm );
+    std::string target = path + suffix;
+    for ( int i = 1; access( target.c_str(), F_OK ) == 0; ++i )
+    {
+        char seq[ 16 ];
+        snprintf( seq, sizeof( seq ), ".%d", i );
+        target = path + suffix + seq;
+    }
+    if ( rename( path.c_str(), target.c_str() ) < 0 )
+    {
+        return;
+    }
+    int old_fd = out.fd;
+	// 新文件打不开时继续写入改名后的文件
+    if ( open_output( out ) )
+    {
+        close( old_fd );
+    }
+}
+
+void write_all( int fd, const char* data, size_t len )
+{
+    while ( len > 0 )
+    {
+        ssize_t n = ::write( fd, data, len );
+        if ( n < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+			// 磁盘已满等错误,只能丢弃这一批
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+// 消息的时间,同一秒内的消息复用格式化的结果
+void append_time( std::string& out, const record& r )
+{
+    static time_t last = -1;
+    static char text[ 32 ];
+    if ( r.sec != last )
+    {
+        time_t sec = r.sec;
+        struct tm tm;
+        localtime_r( &sec, &tm );
+        strftime( text, sizeof( text ), "%Y-%m-%d %H:%M:%S", &tm );
+        last = r.sec;
+    }
+    char buf[ 64 ];
+    int len = snprintf( buf, sizeof( buf ), "%s.%06d ", text, ( int )( r.nsec / 1000 ) );
+    out.append( buf, len );
+}
+
+// 收集各线程缓冲区中的消息,同一线程的消息保持顺序,不同线程之间只按收集的批次大致有序;
+// 返回是否有缓冲区已用过半,此时不等待下一个间隔
+bool collect()
+{
+    g_lock.lock();
+    std::vector< ring* > rings( g_rings );
+    g_lock.unlock();
+    bool busy = false;
+    uint64_t dropped = 0;
+    for ( size_t i = 0; i < rings.size(); ++i )
+    {
+        ring* r = rings[i];
+        size_t tail = r->tail.load( std::memory_order_relaxed );
+        size_t head = r->head.load( std::memory_order_acquire );
+        busy = busy || head - tail >= RING_SIZE / 2;
+        for ( ; tail != head; ++tail )
+        {
+            const record& rec = r->records[ tail & ( RING_SIZE - 1 ) ];
+            std::string& batch = g_outputs[ rec.stream ].batch;
+            append_time( batch, rec );
+            if ( rec.stream == logger::ERROR_STREAM )
+            {
+                char prefix[ 32 ];
+                int len = snprintf( prefix, sizeof( prefix ), "%s [%d] ", LEVEL_NAMES[ rec.level ], r->id );
+                batch.append( prefix, len );
+            }
+            batch.append( rec.text, rec.len );
+            batch += '\n';
+        }
+		// 消息已复制,槽位可以重新写入
+        r->tail.store( tail, std::memory_order_release );
+        dropped += r->dropped.load( std::memory_order_relaxed );
+    }
+    if ( dropped > g_reported )
+    {
+        char text[ 64 ];
+        int len = snprintf( text, sizeof( text ), "%llu log messages dropped\n", ( unsigned long long )( dropped - g_reported ) );
+        g_outputs[ logger::ERROR_STREAM ].batch.append( text, len );
+        metrics::add( metrics::LOG_DROPPED, dropped - g_reported );
+        g_reported = dropped;
+    }
+    return busy;
+}
+
+// 写出各文件的一批消息,然后检查是否需要轮转
+void flush()
+{
+    time_t now = time( NULL );
+    bool rotate_time = g_rotate_seconds && now >= g_next_rotate;
+    for ( int i = 0; i < logger::STREAM_COUNT; ++i )
+    {
+        output& out = g_outputs[i];
+        if ( ! out.batch.empty() )
+        {
+            write_all( out.fd, out.batch.data(), out.batch.size() );
+            out.size += out.batch.size();
+            out.batch.clear();
+        }
+		// 空文件不轮转
+        if ( ! g_dir.empty() && out.size > 0 && ( rotate_time || ( g_max_bytes && out.size >= g_max_bytes ) ) )
+        {
+            rotate( out, now );
+        }
+    }
+    if ( rotate_time )
+    {
+        g_next_rotate = next_rotate( now );
+    }
+}
+
+void* run( void* )
+{
+    while ( g_running.load( std::memory_order_acquire ) )
+    {
+        bool busy = collect();
+        flush();
+        if ( ! busy )
+        {
+            struct timespec ts = { 0, FLUSH_INTERVAL_NS };
+            nanosleep( &ts, NULL );
+        }
+    }
+    return NULL;
+}
+}
+
+bool logger::start( const char* dir, size_t max_bytes, unsigned int rotate_seconds )
+{
+    if ( dir )
+    {
+        g_dir = dir;
+        g_max_bytes = max_bytes;
+        g_rotate_seconds = rotate_seconds;
+        g_next_rotate = next_rotate( time( NULL ) );
+        for ( int i = 0; i < STREAM_COUNT; ++i )
+        {
+            if ( ! open_output( g_outputs[i] ) )
+            {
+                return false;
+            }
+        }
+    }
+    g_running.store( true, std::memory_order_release );
+    if ( pthread_create( &g_thread, NULL, run, NULL ) != 0 )
+    {
+        g_running.store( false, std::memory_order_release );
+        return false;
+    }
+    g_started = true;
+    return true;
+}
+
+void logger::stop()
+{
+    if ( g_stopped )
+    {
+        return;
+    }
+    g_stopped = true;
+    if ( g_started )
+    {
+        g_running.store( false, std::memory_order_release );
+        pthread_join( g_thread, NULL );
+    }
+	// 后台线程已退出,在这里写出剩余的消息
+    collect();
+    flush();
+}
+
+void logger::write( stream s, level l, const char* format, ... )
+{
+    ring* r = t_ring ? t_ring : register_thread();
+    size_t head = r->head.load( std::memory_order_relaxed );
+    if ( head - r->tail.load( std::memory_order_acquire ) >= RING_SIZE )
+    {
+		// 只有本线程修改丢弃数,不需要原子的加法
+        r->dropped.store( r->dropped.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+        return;
+    }
+    record& rec = r->records[ head & ( RING_SIZE - 1 ) ];
+    struct timespec ts;
+    clock_gettime( CLOCK_REALTIME, &ts );
+    rec.sec = ts.tv_sec;
+    rec.nsec = ts.tv_nsec;
+    rec.stream = s;
+    rec.level = l;
+    va_list args;
+    va_start( args, format );
+    int len = vsnprintf( rec.text, sizeof( rec.text ), format, args );
+    va_end( args );
+    len = len < 0 ? 0 : ( len < ( int )sizeof( rec.text ) ? len : sizeof( rec.text ) - 1 );
+	// 每条消息占一行,去掉末尾的换行符
+    while ( len > 0 && rec.text[ len - 1 ] == '\n' )
+    {
+        --len;
+    }
+    rec.len = len;
+    r->head.store( head + 1, std::memory_order_release );
+}
+
+size_t logger::buffers()
+{
+    g_lock.lock();
+    size_t count = g_rings.size();
+    g_lock.unlock();
+    return count;
+}
+
+uint64_t logger::dropped()
+{
+    uint64_t total = 0;
+    g_lock.lock();
+    for ( size_t i = 0; i < g_rings.size(); ++i )
+    {
+        total += g_rings[i]->dropped.load( std::memory_order_relaxed );
+    }
+    g_lock.unlock();
+    return total;
+}
@@ -0,0 +1,61 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 异步日志:每个线程第一次记录时分配自己的环形缓冲区,记录时只在本线程格式化一条消息
+// 写入缓冲区,不加锁也不调用write;后台线程定期收集各缓冲区的消息,成批写入文件,
+// 文件超过大小或到达轮转时间时改名保存。缓冲区满时丢弃消息并计数,从不阻塞请求的处理
+namespace logger
+{
+    enum level { LEVEL_DEBUG = 0, LEVEL_INFO, LEVEL_WARN, LEVEL_ERROR };
+	// 错误日志记录运行信息,访问日志每个应答一行
+    enum stream { ERROR_STREAM = 0, ACCESS_STREAM, STREAM_COUNT };
+
+	// 一条消息的最大长度,更长的截断
+    static const size_t MESSAGE_MAX = 240;
+
+	// 启动后台线程,dir为NULL时都写到标准输出,否则写到dir下的error.log和access.log;
+	// 文件达到max_bytes或者每隔rotate_seconds(按整点对齐)轮转一次,为0时不按该条件轮转。
+	// 启动之前记录的消息留在缓冲区中,启动后写出;打开文件或创建线程失败时返回false
+    bool start( const char* dir, size_t max_bytes, unsigned int rotate_seconds );
+	// 写出所有缓冲区中的消息并停止后台线程,未启动时直接写到标准输出
+    void stop();
+	// 记录一条消息,可在任意线程调用
+    void write( stream s, level l, const char* format, ... ) __attribute__(( format( printf, 3, 4 ) ));
+	// 因缓冲区已满而丢弃的消息数
+    uint64_t dropped();
+	// 已分配的线程缓冲区数,线程退出且消息写出后缓冲区留给新线程使用
+    size_t buffers();
+}
+
+// 编译时的日志级别,低于该级别的日志语句不编译,参数也不求值
+#ifndef LOG_LEVEL
+#define LOG_LEVEL 1
+#endif
+
+#if LOG_LEVEL <= 0
+#define DEBUG_LOG( ... ) logger::write( logger::ERROR_STREAM, logger::LEVEL_DEBUG, __VA_ARGS__ )
+#else
+#define DEBUG_LOG( ... ) ( ( void )0 )
+#endif
+
+#if LOG_LEVEL <= 1
+#define INFO_LOG( ... ) logger::write( logger::ERROR_STREAM, logger::LEVEL_INFO, __VA_ARGS__ )
+#else
+#define INFO_LOG( ... ) ( ( void )0 )
+#endif
+
+#if LOG_LEVEL <= 2
+#define WARN_LOG( ... ) logger::write( logger::ERROR_STREAM, logger::LEVEL_WARN, __VA_ARGS__ )
+#else
+#define WARN_LOG( ... ) ( ( void )0 )
+#endif
+
+#define ERROR_LOG( ... ) logger::write( logger::ERROR_STREAM, logger::LEVEL_ERROR, __VA_ARGS__ )
+
+// 访问日志不受日志级别控制,由运行时的开关决定是否记录
+#define ACCESS_LOG( ... ) logger::write( logger::ACCESS_STREAM, logger::LEVEL_INFO, __VA_ARGS__ )
+
+#endif
@@ -10,40 +10,48 @@
 #include <cassert>
 #include <sys/epoll.h>
 #include <unordered_map>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <time.h>
+#include <limits.h>
+#include <getopt.h>
 
 
 #include "locker.h"
 #include "threadpool.h"
 #include "http_conn.h"
+#include "search.h"
+#include "reactor.h"
+#include "logger.h"
 
 //#define MAX_FD 65536
 #define MAX_EVENT_NUMBER 10000
 //using namespace std;
-extern int addfd( int epollfd, int fd, bool one_shot );
-extern int removefd( int epollfd, int fd );
+extern void addfd( int epollfd, int fd, bool one_shot );
+extern void removefd( int epollfd, int fd );
 extern int setnonblocking( int fd );
 
 static int pipefd[2];
-int http_conn::pid_socket[MAX_FD]={0};
+// 平滑升级时向新进程传递监听描述符和旧进程pid的环境变量
+static const char* LISTEN_FDS_ENV = "WEB_SERVER_LISTEN_FDS";
+static const char* UPGRADE_PID_ENV = "WEB_SERVER_UPGRADE_PID";
 
 
 //SIGCHLD信号处理函数
-void handle_child(http_conn* users, int *pid_socket)
+// CGI程序是启动进程的子进程,由它回收,这里只回收启动进程和升级时启动的新进程
+void handle_child()
 {
 	pid_t pid;
 	int stat;
 	while((pid = waitpid(-1, &stat, WNOHANG)) > 0)
 	{
-		// 对结束的子进程进行善后处理
-		if(pid_socket[pid] > 0)
+		if( http_conn::m_cgi_launcher && pid == http_conn::m_cgi_launcher->pid() )
 		{
-			int socket = pid_socket[pid];
-			printf("handle child process:%d, socket:%d.\n",pid,socket);
-			users[socket].reset_socket();
-			pid_socket[pid] = 0;
+			// 已有的空闲子进程仍可使用,用完之后CGI请求返回503
+			ERROR_LOG( "cgi launcher %d exited", ( int )pid );
 		}
 	}
-	printf("handle_child end.\n");
 }
 // 信号处理函数
 void sig_handler( int sig )
@@ -71,76 +79,540 @@ void addsig( int sig, void( handler )(int), bool restart = true )
     assert( sigaction( sig, &sa, NULL ) != -1 );
 }
 
-void show_error( int connfd, const char* info )
+// 创建监听套接字,reuseport为true时多个套接字可以绑定同一端口,由内核在它们之间分配连接;
+// backlog为已完成握手等待接受的连接队列的长度
+static int open_listen( const char* ip, int port, bool reuseport, int backlog )
 {
-	// 首先在服务器终端输出相应错误信息
-    printf( "%s", info );
-	// 向客户端发送相应错误信息
-    send( connfd, info, strlen( info ), 0 );
-	// 关闭客户端的套接字
-    close( connfd );
+	// 创建一个ipv4协议的字节流的套接字
+    int listenfd = socket( PF_INET, SOCK_STREAM, 0 );
+    if( listenfd < 0 )
+    {
+        return -1;
+    }
+	// 不设置SO_LINGER{1,0}:连接套接字会继承该选项,close时将丢弃内核缓冲区中
+	// 尚未发出的数据并发送复位报文段,sendfile一次排入的大文件内容会被截断
+	// 正常关闭的连接会在本端留下TIME_WAIT,需允许重启时立即重新绑定端口
+    int reuse = 1;
+    setsockopt( listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof( reuse ) );
+    if( reuseport && setsockopt( listenfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof( reuse ) ) < 0 )
+    {
+        close( listenfd );
+        return -1;
+    }
+
+    struct sockaddr_in address;
+    bzero( &address, sizeof( address ) );
+	// 协议族为ipv4协议
+    address.sin_family = AF_INET;
+	// 将ip地址转换为网络字节顺序
+    inet_pton( AF_INET, ip, &address.sin_addr );
+	// 将端口转换为网络字节顺序
+    address.sin_port = htons( port );
+	// 将本地的socket地址与监听描述符listenfd绑定,并设置为监听描述符
+    if( bind( listenfd, ( struct sockaddr* )&address, sizeof( address ) ) < 0 || listen( listenfd, backlog ) < 0 )
+    {
+        close( listenfd );
+        return -1;
+    }
+    return listenfd;
+}
+
+
+// 取出旧进程传递过来的监听描述符,并清除环境变量,返回旧进程的pid,不是由升级启动时返回0
+static pid_t inherit_listen_fds( std::vector< int >& fds )
+{
+    const char* value = getenv( LISTEN_FDS_ENV );
+    const char* parent = getenv( UPGRADE_PID_ENV );
+    pid_t pid = parent ? atoi( parent ) : 0;
+    for( const char* p = value; p && *p; )
+    {
+        char* end;
+        long fd = strtol( p, &end, 10 );
+        if( end == p )
+        {
+            break;
+        }
+        int accepting = 0;
+        socklen_t len = sizeof( accepting );
+		// 只接受仍处于监听状态的套接字
+        if( getsockopt( fd, SOL_SOCKET, SO_ACCEPTCONN, &accepting, &len ) == 0 && accepting )
+        {
+            fds.push_back( fd );
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+    unsetenv( LISTEN_FDS_ENV );
+    unsetenv( UPGRADE_PID_ENV );
+    return pid;
+}
+
+// 平滑升级:以相同的参数启动新的可执行文件,并把监听描述符交给它,
+// 新进程就绪后向本进程发送SIGTERM,本进程随即停止接受连接并排空
+static bool spawn_upgrade( const char* path, char* argv[], const std::vector< int >& listenfds )
+{
+	// 在fork之前准备好新进程的环境变量,子进程中只调用异步信号安全的函数
+    std::string fds;
+    for( size_t i = 0; i < listenfds.size(); ++i )
+    {
+        char buf[ 16 ];
+        snprintf( buf, sizeof( buf ), i ? ",%d" : "%d", listenfds[i] );
+        fds += buf;
+    }
+    std::vector< std::string > vars;
+    vars.push_back( std::string( LISTEN_FDS_ENV ) + "=" + fds );
+    char buf[ 64 ];
+    snprintf( buf, sizeof( buf ), "%s=%d", UPGRADE_PID_ENV, ( int )getpid() );
+    vars.push_back( buf );
+    std::vector< char* > envp;
+    for( size_t i = 0; i < vars.size(); ++i )
+    {
+        envp.push_back( const_cast< char* >( vars[i].c_str() ) );
+    }
+    size_t prefix = strlen( LISTEN_FDS_ENV );
+    for( char** e = environ; *e; ++e )
+    {
+        if( strncmp( *e, LISTEN_FDS_ENV, prefix ) != 0 && strncmp( *e, UPGRADE_PID_ENV, strlen( UPGRADE_PID_ENV ) ) != 0 )
+        {
+            envp.push_back( *e );
+        }
+    }
+    envp.push_back( NULL );
+    std::vector< int > keep( listenfds );
+    std::sort( keep.begin(), keep.end() );
+
+    pid_t pid = fork();
+    if( pid < 0 )
+    {
+        return false;
+    }
+    if( pid == 0 )
+    {
+		// 除标准输入输出和监听描述符外,关闭继承的所有描述符
+        unsigned int first = 3;
+        for( size_t i = 0; i < keep.size(); ++i )
+        {
+            if( ( unsigned int )keep[i] > first )
+            {
+                close_range( first, keep[i] - 1, 0 );
+            }
+            first = keep[i] + 1;
+        }
+        close_range( first, ~0U, 0 );
+        execve( path, argv, &envp[0] );
+        _exit( 1 );
+    }
+    INFO_LOG( "upgrade: started new process %d", ( int )pid );
+    return true;
+}
+
+// 可选的命令行参数
+struct server_options
+{
+    size_t cache_bytes;     // 静态文件缓存的字节数上限
+    size_t sendfile_min;    // 不小于该大小的文件使用sendfile发送,0表示不使用
+    bool cache_control;     // 是否指定了Cache-Control,未指定时使用默认设置
+    int threads;            // 线程池的工作线程数
+    int reactors;           // 独立事件循环的个数,0表示单个事件循环加线程池
+    bool pin_cpus;          // 是否将事件循环线程绑定到cpu
+    bool io_uring;          // 事件循环是否使用io_uring,内核不支持时使用epoll
+    int drain_seconds;      // 退出时等待连接发送完毕的最长时间
+    int cgi_max;            // 同时运行的CGI程序数的上限
+    int cgi_spare;          // 预先创建的等待运行CGI程序的子进程数
+    const char* log_dir;    // 日志文件的目录,NULL表示写到标准输出
+    size_t log_max_bytes;   // 日志文件达到该大小时轮转
+    unsigned int log_rotate_seconds;    // 日志文件的轮转周期,0表示不按时间轮转
+    int backlog;            // 监听套接字的连接队列长度
+    bool shed_wait;         // 是否指定了按排队时间拒绝连接,只用于线程池
+};
+
+// 系统允许的最大连接队列长度,更大的backlog会被内核截断;读不到时使用SOMAXCONN
+static int default_backlog()
+{
+    int value = 0;
+    FILE* f = fopen( "/proc/sys/net/core/somaxconn", "r" );
+    if( f )
+    {
+        if( fscanf( f, "%d", &value ) != 1 )
+        {
+            value = 0;
+        }
+        fclose( f );
+    }
+    return value > 0 ? value : SOMAXCONN;
+}
+
+// 解析以秒为单位的超时,转换为毫秒
+static bool parse_timeout( const char* arg, unsigned int& ms )
+{
+    int seconds = atoi( arg );
+    if( seconds <= 0 )
+    {
+        return false;
+    }
+    ms = seconds * 1000;
+    return true;
+}
+
+static void usage( const char* prog )
+{
+    printf( "usage: %s [options] ip_address port_number\n", prog );
+    printf( "  --cache-mb N      static file cache size in MB (default 64)\n" );
+    printf( "  --sendfile-kb N   send files of at least N KB with sendfile, 0 disables (default 256)\n" );
+    printf( "  --cache-control PREFIX=VALUE\n" );
+    printf( "                    Cache-Control for urls starting with PREFIX, may be repeated\n" );
+    printf( "                    (default /=no-cache and /file/=public, max-age=86400)\n" );
+    printf( "  --threads N       number of worker threads in the thread pool (default 8)\n" );
+    printf( "  --reactors N      run N event loops with their own SO_REUSEPORT listen sockets,\n" );
+    printf( "                    requests are handled in the loops without the thread pool (default 0)\n" );
+    printf( "  --pin-cpus        pin event loop i to cpu i (with --reactors)\n" );
+    printf( "  --io-uring        use io_uring instead of epoll in the event loops (with --reactors),\n" );
+    printf( "                    falls back to epoll when the kernel does not support it\n" );
+    printf( "  --header-timeout N  close connections that take over N seconds to send headers (default 10)\n" );
+    printf( "  --body-timeout N    close connections that take over N seconds to send the body (default 30)\n" );
+    printf( "  --idle-timeout N    close keep-alive connections idle for N seconds (default 15)\n" );
+    printf( "  --request-timeout N close connections whose request and response take over N seconds (default 600)\n" );
+    printf( "  --cgi-max N       run at most N CGI programs at once, others get 503 (default 16)\n" );
+    printf( "  --cgi-spare N     keep N pre-forked processes waiting to run CGI programs (default 4)\n" );
+    printf( "  --cgi-timeout N   kill CGI programs that run over N seconds (default 30)\n" );
+    printf( "  --drain-seconds N on SIGTERM wait at most N seconds for responses in flight (default 10)\n" );
+    printf( "  --backlog N       length of the listen queue (default net.core.somaxconn)\n" );
+    printf( "  --max-conns N     answer new connections with 503 beyond N open connections (default %d)\n", MAX_FD );
+    printf( "  --shed-wait-ms N  answer new connections with 503 while requests wait over N ms on average\n" );
+    printf( "                    in the thread pool queue, 0 disables (default 500);\n" );
+    printf( "                    not allowed with --reactors, which has no thread pool\n" );
+    printf( "  --log-dir DIR     write error.log and access.log in DIR instead of stdout\n" );
+    printf( "  --log-max-mb N    rotate a log file when it reaches N MB, 0 disables (default 64)\n" );
+    printf( "  --log-rotate-hours N  also rotate log files every N hours, 0 disables (default 24)\n" );
+    printf( "  --no-access-log   do not write access.log\n" );
+    printf( "signals: SIGTERM/SIGINT drain and exit, SIGHUP reload book index and file cache,\n" );
+    printf( "         SIGUSR2 start the new binary on the same listen sockets, then drain and exit\n" );
+    printf( "statistics: GET /_stats[?format=prometheus], answered to loopback clients only\n" );
+}
+
+// 解析可选参数,解析后optind指向ip地址
+static bool parse_options( int argc, char* argv[], server_options& opt )
+{
+    static const struct option long_options[] =
+    {
+        { "cache-mb", required_argument, NULL, 'c' },
+        { "sendfile-kb", required_argument, NULL, 's' },
+        { "cache-control", required_argument, NULL, 'C' },
+        { "threads", required_argument, NULL, 't' },
+        { "reactors", required_argument, NULL, 'r' },
+        { "pin-cpus", no_argument, NULL, 'p' },
+        { "io-uring", no_argument, NULL, 'u' },
+        { "drain-seconds", required_argument, NULL, 'd' },
+        { "header-timeout", required_argument, NULL, 'H' },
+        { "body-timeout", required_argument, NULL, 'B' },
+        { "idle-timeout", required_argument, NULL, 'I' },
+        { "request-timeout", required_argument, NULL, 'R' },
+        { "cgi-max", required_argument, NULL, 'M' },
+        { "cgi-spare", required_argument, NULL, 'S' },
+        { "cgi-timeout", required_argument, NULL, 'T' },
+        { "log-dir", required_argument, NULL, 'L' },
+        { "log-max-mb", required_argument, NULL, 'm' },
+        { "log-rotate-hours", required_argument, NULL, 'h' },
+        { "no-access-log", no_argument, NULL, 'A' },
+        { "backlog", required_argument, NULL, 'b' },
+        { "max-conns", required_argument, NULL, 'n' },
+        { "shed-wait-ms", required_argument, NULL, 'w' },
+        { NULL, 0, NULL, 0 }
+    };
+    opt.cache_bytes = 64 << 20;
+    opt.sendfile_min = 256 << 10;
+    opt.cache_control = false;
+    opt.threads = 8;
+    opt.reactors = 0;
+    opt.pin_cpus = false;
+    opt.io_uring = false;
+    opt.drain_seconds = 10;
+    opt.cgi_max = 16;
+    opt.cgi_spare = 4;
+    opt.log_dir = NULL;
+    opt.log_max_bytes = ( size_t )64 << 20;
+    opt.log_rotate_seconds = 24 * 3600;
+    opt.backlog = default_backlog();
+    opt.shed_wait = false;
+    int c;
+    while( ( c = getopt_long( argc, argv, "", long_options, NULL ) ) != -1 )
+    {
+        switch( c )
+        {
+            case 'c':
+                opt.cache_bytes = ( size_t )atol( optarg ) << 20;
+                break;
+            case 's':
+                opt.sendfile_min = ( size_t )atol( optarg ) << 10;
+                break;
+            case 'C':
+            {
+                char* value = strchr( optarg, '=' );
+                if( ! value )
+                {
+                    return false;
+                }
+                *value++ = '\0';
+                http_conn::set_cache_control( optarg, value );
+                opt.cache_control = true;
+                break;
+            }
+            case 't':
+                opt.threads = atoi( optarg );
+                if( opt.threads <= 0 )
+                {
+                    return false;
+                }
+                break;
+            case 'r':
+                opt.reactors = atoi( optarg );
+                if( opt.reactors < 0 )
+                {
+                    return false;
+                }
+                break;
+            case 'p':
+                opt.pin_cpus = true;
+                break;
+            case 'u':
+                opt.io_uring = true;
+                break;
+            case 'd':
+                opt.drain_seconds = atoi( optarg );
+                break;
+            case 'H':
+                if( ! parse_timeout( optarg, http_conn::m_header_timeout ) )
+                {
+                    return false;
+                }
+                break;
+            case 'B':
+                if( ! parse_timeout( optarg, http_conn::m_body_timeout ) )
+                {
+                    return false;
+                }
+                break;
+            case 'I':
+                if( ! parse_timeout( optarg, http_conn::m_idle_timeout ) )
+                {
+                    return false;
+                }
+                break;
+            case 'R':
+                if( ! parse_timeout( optarg, http_conn::m_request_timeout ) )
+                {
+                    return false;
+                }
+                break;
+            case 'M':
+                opt.cgi_max = atoi( optarg );
+                if( opt.cgi_max <= 0 )
+                {
+                    return false;
+                }
+                break;
+            case 'S':
+                opt.cgi_spare = atoi( optarg );
+                if( opt.cgi_spare <= 0 )
+                {
+                    return false;
+                }
+                break;
+            case 'T':
+                if( ! parse_timeout( optarg, http_conn::m_cgi_timeout ) )
+                {
+                    return false;
+                }
+                break;
+            case 'L':
+                opt.log_dir = optarg;
+                break;
+            case 'm':
+                opt.log_max_bytes = ( size_t )atol( optarg ) << 20;
+                break;
+            case 'h':
+                opt.log_rotate_seconds = atoi( optarg ) * 3600;
+                break;
+            case 'A':
+                http_conn::m_access_log = false;
+                break;
+            case 'b':
+                opt.backlog = atoi( optarg );
+                if( opt.backlog <= 0 )
+                {
+                    return false;
+                }
+                break;
+            case 'n':
+                http_conn::m_max_conns = atoi( optarg );
+                if( http_conn::m_max_conns <= 0 )
+                {
+                    return false;
+                }
+                break;
+            case 'w':
+                http_conn::m_shed_wait_ms = atoi( optarg );
+                opt.shed_wait = true;
+                break;
+            default:
+                return false;
+        }
+    }
+	// 多事件循环模式下请求不经过线程池,排队时间无从计算
+    if( opt.shed_wait && opt.reactors > 0 )
+    {
+        return false;
+    }
+    return argc - optind >= 2;
 }
 
 
 int main( int argc, char* argv[] )
 {
-	// 首先检查输入参数的数目是否正确
-    if( argc <= 2 )
+	// 首先检查输入参数是否正确
+    server_options opt;
+    if( ! parse_options( argc, argv, opt ) )
     {
 		// 错误的话则输出本程序的正确用法
-        printf( "usage: %s ip_address port_number\n", basename( argv[0] ) );
+        usage( basename( argv[0] ) );
         return 1;
     }
 	// 获取输入的ip地址和端口号
-    const char* ip = argv[1];
-    int port = atoi( argv[2] );
+    const char* ip = argv[ optind ];
+    int port = atoi( argv[ optind + 1 ] );
+	// 可执行文件的路径,升级时执行该路径上的新文件,而不是本进程已被替换的旧映像
+    char exe_path[ PATH_MAX ];
+    ssize_t exe_len = readlink( "/proc/self/exe", exe_path, sizeof( exe_path ) - 1 );
+    exe_path[ exe_len > 0 ? exe_len : 0 ] = '\0';
+	// 由旧进程平滑升级启动时沿用它的监听描述符
+    std::vector< int > inherited;
+    pid_t upgrade_from = inherit_listen_fds( inherited );
+	// CGI程序的启动进程须在创建线程和加载索引之前fork,此时进程还很小
+    try
+    {
+        http_conn::m_cgi_launcher = new cgi_launcher( opt.cgi_spare, opt.cgi_max );
+    }
+    catch( ... )
+    {
+        ERROR_LOG( "start cgi launcher failed, cgi requests will get 503" );
+    }
+	// 日志的后台线程在启动进程fork之后创建,之前的消息留在缓冲区中;
+	// 之后任何位置退出时都写出剩余的消息
+    if( ! logger::start( opt.log_dir, opt.log_max_bytes, opt.log_rotate_seconds ) )
+    {
+        printf( "open log files in %s failed: %s\n", opt.log_dir, strerror( errno ) );
+        return 1;
+    }
+    atexit( logger::stop );
 	// 对于进程收到的管道错误做忽略处理
     addsig( SIGPIPE, SIG_IGN );
-	// 创建线程池
+	// 创建线程池,多事件循环模式下请求在事件循环中直接处理,不需要线程池
     threadpool< http_conn >* pool = NULL;
     try
     {
-        pool = new threadpool< http_conn >;
+        if( opt.reactors == 0 )
+        {
+            pool = new threadpool< http_conn >( opt.threads );
+        }
     }
     catch( ... )
     {
         return 1;
     }
+	// 建立书籍的全文索引,注册内置的动态处理函数,搜索请求不再创建子进程
+    if( ! search_init( ".", "/file", "cgi-bin/books.idx" ) )
+    {
+        ERROR_LOG( "build book index failed" );
+        return 1;
+    }
+    http_conn::register_stream_handler( "/cgi-bin/search", search_book );
+	// 内部统计:计数器和各阶段耗时的直方图,?format=prometheus输出Prometheus格式;
+	// 只提供给本机的客户端,外部的请求得到404
+    http_conn::register_handler( "/_stats", http_conn::stats, "text/plain; charset=utf-8", true );
+	// 主页等文件每次都向服务器确认是否修改,书籍可以在客户端缓存一天
+    if( ! opt.cache_control )
+    {
+        http_conn::set_cache_control( "/", "no-cache" );
+        http_conn::set_cache_control( "/file/", "public, max-age=86400" );
+    }
+	// 静态文件缓存
+    http_conn::m_file_cache = new file_cache( opt.cache_bytes, opt.sendfile_min );
 	// 用户类的数组
-    http_conn* users = new http_conn[ MAX_FD ];
-    assert( users );
-    int user_count = 0;
-	// 创建一个ipv4协议的字节流的套接字
-    int listenfd = socket( PF_INET, SOCK_STREAM, 0 );
-	// close系统调用立即返回.舍弃TCP缓冲区数据,发送复位报文段
-    assert( listenfd >= 0 );
-    struct linger tmp = { 1, 0 };
-    setsockopt( listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof( tmp ) );
-
+	// 按描述符索引的连接表,连接对象在用到时才分配
+    conn_table* users = new conn_table;
     int ret = 0;
-    struct sockaddr_in address;
-    bzero( &address, sizeof( address ) );
-	// 协议族为ipv4协议
-    address.sin_family = AF_INET;
-	// 将ip地址转换为网络字节顺序
-    inet_pton( AF_INET, ip, &address.sin_addr );
-	// 将端口转换为网络字节顺序
-    address.sin_port = htons( port );
-	// 将本地的socket地址与监听描述符listenfd绑定
-    ret = bind( listenfd, ( struct sockaddr* )&address, sizeof( address ) );
-    assert( ret >= 0 );
-	// 将listenfd设置为监听描述符,最大值设为5
-    ret = listen( listenfd, 20 );
-    assert( ret >= 0 );
 	// epoll事件的数组
     epoll_event events[ MAX_EVENT_NUMBER ];
 	// 参数被忽略,但必须大于0,创建一个epoll实例
     int epollfd = epoll_create( 5 );
     assert( epollfd != -1 );
-	// 将监听描述符添加到epoll队列
-    addfd( epollfd, listenfd, false );
-	// 客户类也使用同一epoll
-    http_conn::m_epollfd = epollfd;
+	// 单事件循环模式下连接的超时
+    timer_wheel wheel( monotonic_ms() );
+	// 单事件循环模式下主线程接受并读写所有连接,多事件循环模式下主线程只处理信号和文件修改
+    int listenfd = -1;
+    std::vector< int > listenfds;
+    std::vector< reactor* > reactors;
+    size_t wanted = opt.reactors == 0 ? 1 : opt.reactors;
+    for( size_t i = 0; i < inherited.size(); ++i )
+    {
+        if( listenfds.size() < wanted )
+        {
+			// 再次listen只更新连接队列的长度,队列中的连接不受影响
+            listen( inherited[i], opt.backlog );
+            listenfds.push_back( inherited[i] );
+        }
+        else
+        {
+            close( inherited[i] );
+        }
+    }
+    while( listenfds.size() < wanted )
+    {
+        int fd = open_listen( ip, port, opt.reactors > 0, opt.backlog );
+        if( fd < 0 )
+        {
+            ERROR_LOG( "listen on %s:%d failed: %s", ip, port, strerror( errno ) );
+            return 1;
+        }
+        listenfds.push_back( fd );
+    }
+    if( opt.reactors == 0 )
+    {
+        listenfd = listenfds[0];
+		// 将监听描述符添加到epoll队列
+        addfd( epollfd, listenfd, false );
+        if( opt.io_uring )
+        {
+            WARN_LOG( "--io-uring needs --reactors, using epoll" );
+        }
+    }
+    else
+    {
+        long cpus = sysconf( _SC_NPROCESSORS_ONLN );
+		// 启动时检查一次内核是否支持所需的io_uring特性
+        bool use_uring = opt.io_uring && uring::supported();
+        if( opt.io_uring )
+        {
+            INFO_LOG( use_uring ? "event loops use io_uring" : "io_uring not supported, event loops use epoll" );
+        }
+        for( int i = 0; i < opt.reactors; ++i )
+        {
+            int fd = listenfds[i];
+            reactor* r = NULL;
+            try
+            {
+                r = new reactor( users, fd, use_uring );
+            }
+            catch( ... )
+            {
+                return 1;
+            }
+            if( ! r->start( opt.pin_cpus && cpus > 0 ? i % cpus : -1 ) )
+            {
+                return 1;
+            }
+            reactors.push_back( r );
+        }
+    }
 	
 	// 创建管道,注册pipefd[0]的可读事件
 	ret = socketpair( PF_UNIX, SOCK_STREAM, 0, pipefd );
@@ -149,17 +621,51 @@ int main( int argc, char* argv[] )
     addfd( epollfd, pipefd[0],false);
 	// 注册SIGCHLD的处理函数
 	addsig( SIGCHLD, sig_handler);
+	// 退出,重新加载和平滑升级
+	addsig( SIGTERM, sig_handler );
+	addsig( SIGINT, sig_handler );
+	addsig( SIGHUP, sig_handler );
+	addsig( SIGUSR2, sig_handler );
+	// 监听静态文件的修改,使缓存失效
+    int notify_fd = http_conn::m_file_cache->notify_fd();
+    if( notify_fd >= 0 )
+    {
+        addfd( epollfd, notify_fd, false );
+    }
 
 
+	// 新进程已经就绪,通知旧进程停止接受连接并退出
+    if( upgrade_from > 0 && upgrade_from == getppid() )
+    {
+        kill( upgrade_from, SIGTERM );
+    }
+
+	// 收到SIGTERM后进入排空状态,到达截止时间时不再等待
+    bool draining = false;
+    time_t drain_deadline = 0;
     while( true )
     {
+        if( draining )
+        {
+			// 监听套接字已经关闭,主线程的时间轮中只剩由它接受的连接,使用独立事件循环时为空
+            bool done = drain_conns( wheel ) == 0;
+            for( size_t i = 0; i < reactors.size(); ++i )
+            {
+                done = done && reactors[i]->finished();
+            }
+            if( done || time( NULL ) >= drain_deadline )
+            {
+                INFO_LOG( "drain %s, exit", done ? "complete" : "timed out" );
+                break;
+            }
+        }
 		// 阻塞等待有事件到来
-        int number = epoll_wait( epollfd, events, MAX_EVENT_NUMBER, -1 );
-		printf("current user num:%d	event_num: %d\n",http_conn::m_user_count, number);
+        int number = epoll_wait( epollfd, events, MAX_EVENT_NUMBER, loop_timeout( wheel, draining ) );
+		DEBUG_LOG( "current user num:%d	event_num: %d", http_conn::m_user_count, number );
 		// 如果出现错误并且错误类型不是中断错误
         if ( ( number < 0 ) && ( errno != EINTR ) )
         {
-            printf( "epoll failure\n" );
+            ERROR_LOG( "epoll failure: %s", strerror( errno ) );
             break;
         }
 
@@ -167,34 +673,18 @@ int main( int argc, char* argv[] )
         {
 			// 获取对应的文件描述符
             int sockfd = events[i].data.fd;
-			printf("event sockfd:%d.\n", sockfd);
+			DEBUG_LOG( "event sockfd:%d.", sockfd );
 			// 如果是来自监听描述符的事件
             if( sockfd == listenfd )
             {
-				printf(" listen event.\n");
-                struct sockaddr_in client_address;
-                socklen_t client_addrlength = sizeof( client_address );
-				// 获得连接描述符
-                int connfd = accept( listenfd, ( struct sockaddr* )&client_address, &client_addrlength );
-                if ( connfd < 0 )
-                {
-                    printf( "errno is: %d\n", errno );
-                    continue;
-                }
-				// 检查用户数量是否超出限制
-                if( http_conn::m_user_count >= MAX_FD )
-                {
-                    show_error( connfd, "Internal server busy" );
-                    continue;
-                }
-                // 用户类进行初始化
-                users[connfd].init( connfd, client_address );
+				DEBUG_LOG( "listen event." );
+                accept_conn( *users, listenfd, epollfd, &wheel, pool );
             }
 			
 			// 监听信号源的管道可读
 			else if( ( sockfd == pipefd[0] ) && ( events[i].events & EPOLLIN ) )
             {
-				printf("pipe can be readed.\n");
+				DEBUG_LOG( "pipe can be readed." );
                 int sig;
                 char signals[1024];
                 ret = recv( pipefd[0], signals, sizeof( signals ), 0 );
@@ -219,70 +709,74 @@ int main( int argc, char* argv[] )
                         // }
 						if(signals[i] == SIGCHLD)
 						{
-							handle_child(users, http_conn::pid_socket);
+							handle_child();
+						}
+						else if( ( signals[i] == SIGTERM || signals[i] == SIGINT ) && ! draining )
+						{
+							// 停止接受新连接,已有的连接发送完当前应答后关闭
+							INFO_LOG( "draining connections" );
+							draining = true;
+							drain_deadline = time( NULL ) + opt.drain_seconds;
+							http_conn::m_draining = true;
+							if( listenfd >= 0 )
+							{
+								removefd( epollfd, listenfd );
+								listenfd = -1;
+							}
+							for( size_t j = 0; j < reactors.size(); ++j )
+							{
+								reactors[j]->drain();
+							}
+						}
+						else if( signals[i] == SIGHUP )
+						{
+							// 书籍更新后重新加载索引,清空文件缓存;索引可能需要重新建立,
+							// 在后台线程中进行,建立期间的搜索仍使用原来的索引
+							search_reload_async();
+							http_conn::m_file_cache->clear();
+						}
+						else if( signals[i] == SIGUSR2 && ! draining )
+						{
+							if( exe_path[0] == '\0' || ! spawn_upgrade( exe_path, argv, listenfds ) )
+							{
+								ERROR_LOG( "upgrade failed: %s", strerror( errno ) );
+							}
 						}
 						else
 						{
-							printf("unknown pipe signal!\n");
+							WARN_LOG( "unknown pipe signal %d", signals[i] );
 						}
                     }
                 }
-				printf("pipe handle end.\n");
+				DEBUG_LOG( "pipe handle end." );
             }
 			
-			// EPOLLRDHUP: TCP连接被对方关闭,或者对方关闭了写操作
-			// EPOLLHUP: 挂起
-			// EPOLLERR: 错误
-            else if( events[i].events & ( EPOLLRDHUP | EPOLLHUP | EPOLLERR ) )
-            {
-				printf("error event.\n");
-				if(events[i].events & EPOLLRDHUP)
-				{
-					printf("EPOLLRDHUP.\n");
-				}
-				else if(events[i].events & EPOLLHUP)
-				{
-					printf("EPOLLHUP.\n");
-				}
-				else
-				{
-					printf("EPOLLERR.\n");
-				}
-                users[sockfd].close_conn();
-            }
-			// 数据可读
-            else if( events[i].events & EPOLLIN )
-            {
-				printf("read event.\n");
-                if( users[sockfd].read() )
-                {
-                    pool->append( users + sockfd );
-                }
-                else
-                {
-                    users[sockfd].close_conn();
-                }
-            }
-			// 数据可写
-            else if( events[i].events & EPOLLOUT )
+			// 缓存的静态文件被修改
+            else if( sockfd == notify_fd )
             {
-				printf("write event.\n");
-                if( !users[sockfd].write() )
-                {
-                    users[sockfd].close_conn();
-					printf("write error.\n");
-                }
+                http_conn::m_file_cache->handle_events();
             }
             else
             {
-				printf("unknown event.\n");
-			}
+                handle_conn_event( *users, events[i], pool );
+            }
         }
+        expire_conns( wheel );
     }
 
-    close( epollfd );
-    close( listenfd );
-    delete [] users;
+	// 先停止事件循环和工作线程,再释放它们使用的连接和缓存
+    for( size_t i = 0; i < reactors.size(); ++i )
+    {
+        delete reactors[i];
+    }
     delete pool;
+    close( epollfd );
+    if( listenfd >= 0 )
+    {
+        close( listenfd );
+    }
+    delete users;
+    delete http_conn::m_file_cache;
+    delete http_conn::m_cgi_launcher;
     return 0;
 }
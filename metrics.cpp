@@ -0,0 +1,269 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "locker.h"
+#include "metrics.h"
+
+__thread metrics::thread_block* metrics::t_block = NULL;
+
+namespace
+{
+// 计数器的名称,同名的计数器以label区分,在Prometheus格式中合为一个指标
+struct counter_desc
+{
+    const char* name;
+    const char* label;
+    const char* help;
+};
+
+// 与counter_id的顺序一致
+const counter_desc COUNTERS[ metrics::COUNTER_COUNT ] =
+{
+    { "accepts", NULL, "Accepted connections." },
+    { "requests", NULL, "Requests answered." },
+    { "responses", "1xx", "Responses by status class." },
+    { "responses", "2xx", "Responses by status class." },
+    { "responses", "3xx", "Responses by status class." },
+    { "responses", "4xx", "Responses by status class." },
+    { "responses", "5xx", "Responses by status class." },
+    { "sent_bytes", NULL, "Bytes written to clients." },
+    { "timeouts", NULL, "Connections closed by a timeout." },
+    { "queue_full", NULL, "Connections dropped because the work queue was full." },
+    { "shed", NULL, "Connections answered with 503 at accept because the server was overloaded." },
+    { "cgi_started", NULL, "CGI programs started." },
+    { "cgi_rejected", NULL, "CGI requests answered with 503." },
+    { "cgi_timeouts", NULL, "CGI programs killed by the timeout." },
+    { "log_dropped", NULL, "Log messages dropped because a thread's log ring was full." },
+};
+
+// 耗时类的直方图以纳秒记录,输出时换算为微秒(文本)或秒(Prometheus)
+struct histogram_desc
+{
+    const char* name;
+    bool time;
+    const char* help;
+};
+
+// 与histogram_id的顺序一致
+const histogram_desc HISTOGRAMS[ metrics::HISTOGRAM_COUNT ] =
+{
+    { "accept", true, "Time to accept and set up a connection." },
+    { "parse", true, "Time to parse a request, excluding do_request." },
+    { "do_request", true, "Time to map a request to a file or handler." },
+    { "write", true, "Time spent in one write() call." },
+    { "cgi_spawn", true, "Time to hand a CGI request to the launcher." },
+    { "queue_wait", true, "Time a connection waited in the thread pool queue." },
+    { "conn_lifetime", true, "Connection lifetime." },
+    { "conn_requests", false, "Requests served per connection." },
+};
+
+locker g_lock;
+std::vector< metrics::thread_block* > g_blocks;
+// 所属线程已退出的数据块,其中的值仍计入合并结果,新线程在其上继续累加
+std::vector< metrics::thread_block* > g_free_blocks;
+pthread_key_t g_block_key;
+pthread_once_t g_key_once = PTHREAD_ONCE_INIT;
+
+// 线程退出时调用,数据块交给之后创建的线程
+void release_block( void* arg )
+{
+    metrics::t_block = NULL;
+    g_lock.lock();
+    g_free_blocks.push_back( ( metrics::thread_block* )arg );
+    g_lock.unlock();
+}
+
+void create_key()
+{
+    if ( pthread_key_create( &g_block_key, release_block ) != 0 )
+    {
+        abort();
+    }
+}
+const uint64_t g_start = metrics::now_ns();
+
+// 合并所有线程的数据,各线程可能正在写入,读到的值只是近似一致
+void snapshot( metrics::thread_block& total )
+{
+    memset( &total, 0, sizeof( total ) );
+    g_lock.lock();
+    for ( size_t b = 0; b < g_blocks.size(); ++b )
+    {
+        const volatile metrics::thread_block* block = g_blocks[b];
+        for ( int i = 0; i < metrics::COUNTER_COUNT; ++i )
+        {
+            total.counters[i] += block->counters[i];
+        }
+        for ( int i = 0; i < metrics::HISTOGRAM_COUNT; ++i )
+        {
+            const volatile metrics::histogram& from = block->histograms[i];
+            metrics::histogram& to = total.histograms[i];
+            for ( int k = 0; k < metrics::BUCKETS; ++k )
+            {
+                to.buckets[k] += from.buckets[k];
+            }
+            to.count += from.count;
+            to.sum += from.sum;
+            to.max = from.max > to.max ? from.max : to.max;
+        }
+    }
+    g_lock.unlock();
+}
+
+// 按桶估计百分位数,取所在桶的上界,不超过最大值
+uint64_t percentile( const metrics::histogram& h, double p )
+{
+    if ( h.count == 0 )
+    {
+        return 0;
+    }
+    uint64_t target = ( uint64_t )( p / 100.0 * h.count + 0.999999 );
+    uint64_t seen = 0;
+    for ( int i = 0; i < metrics::BUCKETS; ++i )
+    {
+        seen += h.buckets[i];
+        if ( seen >= target )
+        {
+            uint64_t bound = i < 63 ? ( ( uint64_t )1 << i ) : h.max;
+            return bound < h.max ? bound : h.max;
+        }
+    }
+    return h.max;
+}
+
+void append( std::string& out, const char* format, ... ) __attribute__(( format( printf, 2, 3 ) ));
+
+void append( std::string& out, const char* format, ... )
+{
+    char buf[ 512 ];
+    va_list args;
+    va_start( args, format );
+    int len = vsnprintf( buf, sizeof( buf ), format, args );
+    va_end( args );
+    if ( len > 0 )
+    {
+        out.append( buf, len < ( int )sizeof( buf ) ? len : sizeof( buf ) - 1 );
+    }
+}
+}
+
+metrics::thread_block* metrics::register_thread()
+{
+    pthread_once( &g_key_once, create_key );
+    thread_block* block = NULL;
+    g_lock.lock();
+    if ( ! g_free_blocks.empty() )
+    {
+        block = g_free_blocks.back();
+        g_free_blocks.pop_back();
+    }
+    g_lock.unlock();
+    if ( ! block )
+    {
+		// 按缓存行对齐分配,不释放
+        void* mem = NULL;
+        if ( posix_memalign( &mem, 64, sizeof( thread_block ) ) != 0 )
+        {
+            abort();
+        }
+        block = ( thread_block* )mem;
+        memset( block, 0, sizeof( *block ) );
+        g_lock.lock();
+        g_blocks.push_back( block );
+        g_lock.unlock();
+    }
+    pthread_setspecific( g_block_key, block );
+    t_block = block;
+    return block;
+}
+
+size_t metrics::blocks()
+{
+    g_lock.lock();
+    size_t count = g_blocks.size();
+    g_lock.unlock();
+    return count;
+}
+
+void metrics::render_text( const gauges& values, std::string& out )
+{
+    thread_block total;
+    snapshot( total );
+    append( out, "uptime_seconds %.1f\n", ( now_ns() - g_start ) / 1e9 );
+    for ( size_t i = 0; i < values.size(); ++i )
+    {
+        append( out, "%s %lld\n", values[i].first, ( long long )values[i].second );
+    }
+    for ( int i = 0; i < COUNTER_COUNT; ++i )
+    {
+        const counter_desc& d = COUNTERS[i];
+        append( out, d.label ? "%s_%s %llu\n" : "%s%s %llu\n", d.name, d.label ? d.label : "",
+            ( unsigned long long )total.counters[i] );
+    }
+    append( out, "\n%-18s %10s %10s %10s %10s %10s %10s\n", "histogram", "count", "mean", "p50", "p90", "p99", "max" );
+    for ( int i = 0; i < HISTOGRAM_COUNT; ++i )
+    {
+        const histogram_desc& d = HISTOGRAMS[i];
+        const histogram& h = total.histograms[i];
+		// 耗时以微秒显示
+        double scale = d.time ? 1e-3 : 1;
+        std::string name = std::string( d.name ) + ( d.time ? "_us" : "" );
+        append( out, "%-18s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", name.c_str(), ( unsigned long long )h.count,
+            h.count ? h.sum * scale / h.count : 0, percentile( h, 50 ) * scale, percentile( h, 90 ) * scale,
+            percentile( h, 99 ) * scale, h.max * scale );
+    }
+}
+
+void metrics::render_prometheus( const gauges& values, std::string& out )
+{
+    thread_block total;
+    snapshot( total );
+    append( out, "# HELP web_server_uptime_seconds Time since the server started.\n" );
+    append( out, "# TYPE web_server_uptime_seconds gauge\n" );
+    append( out, "web_server_uptime_seconds %.3f\n", ( now_ns() - g_start ) / 1e9 );
+    for ( size_t i = 0; i < values.size(); ++i )
+    {
+        append( out, "# TYPE web_server_%s gauge\n", values[i].first );
+        append( out, "web_server_%s %lld\n", values[i].first, ( long long )values[i].second );
+    }
+    for ( int i = 0; i < COUNTER_COUNT; ++i )
+    {
+        const counter_desc& d = COUNTERS[i];
+		// 同名计数器只输出一次说明
+        if ( i == 0 || strcmp( COUNTERS[ i - 1 ].name, d.name ) != 0 )
+        {
+            append( out, "# HELP web_server_%s_total %s\n", d.name, d.help );
+            append( out, "# TYPE web_server_%s_total counter\n", d.name );
+        }
+        if ( d.label )
+        {
+            append( out, "web_server_%s_total{class=\"%s\"} %llu\n", d.name, d.label, ( unsigned long long )total.counters[i] );
+        }
+        else
+        {
+            append( out, "web_server_%s_total %llu\n", d.name, ( unsigned long long )total.counters[i] );
+        }
+    }
+    for ( int i = 0; i < HISTOGRAM_COUNT; ++i )
+    {
+        const histogram_desc& d = HISTOGRAMS[i];
+        const histogram& h = total.histograms[i];
+        std::string name = std::string( "web_server_" ) + d.name + ( d.time ? "_seconds" : "" );
+        double scale = d.time ? 1e-9 : 1;
+        append( out, "# HELP %s %s\n", name.c_str(), d.help );
+        append( out, "# TYPE %s histogram\n", name.c_str() );
+		// 桶的上界为2^k,最后一个桶即+Inf
+        uint64_t cumulative = 0;
+        for ( int k = 0; k < BUCKETS - 1; ++k )
+        {
+            cumulative += h.buckets[k];
+            append( out, "%s_bucket{le=\"%g\"} %llu\n", name.c_str(), ( double )( ( uint64_t )1 << k ) * scale,
+                ( unsigned long long )cumulative );
+        }
+        append( out, "%s_bucket{le=\"+Inf\"} %llu\n", name.c_str(), ( unsigned long long )h.count );
+        append( out, "%s_sum %.9g\n", name.c_str(), h.sum * scale );
+        append( out, "%s_count %llu\n", name.c_str(), ( unsigned long long )h.count );
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include <time.h>
+
+// 服务器的计数器和直方图,每个线程第一次记录时分配自己的一份,记录时只写本线程的数据,
+// 不加锁也没有原子操作;读取时合并所有线程的数据,读到的是近似一致的快照
+namespace metrics
+{
+    enum counter_id
+    {
+        ACCEPTS,            // 接受的连接
+        REQUESTS,           // 生成了应答的请求
+        RESPONSES_1XX,      // 按状态码分类的应答,顺序不能改变
+        RESPONSES_2XX,
+        RESPONSES_3XX,
+        RESPONSES_4XX,
+        RESPONSES_5XX,
+        BYTES_SENT,         // 发送的字节数
+        TIMEOUTS,           // 超时关闭的连接
+        QUEUE_FULL,         // 工作队列已满而放弃的连接
+        SHED,               // 过载时接受后直接以503拒绝的连接
+        CGI_STARTED,        // 启动的CGI程序
+        CGI_REJECTED,       // 并发数已达上限或启动失败而返回503的CGI请求
+        CGI_TIMEOUTS,       // 超时被终止的CGI程序
+        LOG_DROPPED,        // 因缓冲区已满而丢弃的日志消息
+        COUNTER_COUNT
+    };
+
+	// 耗时以纳秒记录,CONN_REQUESTS为连接关闭时已处理的请求数
+    enum histogram_id
+    {
+        ACCEPT_TIME,        // 接受并初始化一个连接
+        PARSE_TIME,         // 解析请求,不含do_request
+        DO_REQUEST_TIME,    // 查找文件或调用处理函数
+        WRITE_TIME,         // 一次write()调用
+        CGI_SPAWN_TIME,     // 创建管道并把作业交给CGI启动器
+        QUEUE_WAIT_TIME,    // 请求在线程池队列中等待的时间
+        CONN_LIFETIME,      // 连接从接受到关闭的时间
+        CONN_REQUESTS,
+        HISTOGRAM_COUNT
+    };
+
+	// 按2的幂分桶,第i个桶记录小于2^i的值,最后一个桶记录所有更大的值
+    static const int BUCKETS = 40;
+
+    struct histogram
+    {
+        uint64_t buckets[ BUCKETS ];
+        uint64_t count;
+        uint64_t sum;
+        uint64_t max;
+    };
+
+	// 一个线程的全部数据,按缓存行对齐,避免与其他线程的数据伪共享
+    struct thread_block
+    {
+        uint64_t counters[ COUNTER_COUNT ];
+        histogram histograms[ HISTOGRAM_COUNT ];
+    } __attribute__(( aligned( 64 ) ));
+
+	// 当前线程的数据,第一次调用时分配并登记;线程退出后数据块留给新线程继续累加
+    thread_block* register_thread();
+	// 已分配的线程数据块数
+    size_t blocks();
+    extern __thread thread_block* t_block;
+
+    inline thread_block* block()
+    {
+        return t_block ? t_block : register_thread();
+    }
+
+    inline void add( counter_id id, uint64_t n = 1 )
+    {
+        block()->counters[ id ] += n;
+    }
+
+    inline void observe( histogram_id id, uint64_t value )
+    {
+        histogram& h = block()->histograms[ id ];
+        int i = value ? 64 - __builtin_clzll( value ) : 0;
+        ++h.buckets[ i < BUCKETS ? i : BUCKETS - 1 ];
+        ++h.count;
+        h.sum += value;
+        h.max = value > h.max ? value : h.max;
+    }
+
+	// 单调时钟的当前时间,单位为纳秒
+    inline uint64_t now_ns()
+    {
+        struct timespec ts;
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+        return ( uint64_t )ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+	// 由其他模块提供的即时值,如当前连接数
+    typedef std::vector< std::pair< const char*, int64_t > > gauges;
+	// 合并各线程的数据,输出为易读的文本,或者Prometheus的文本格式
+    void render_text( const gauges& values, std::string& out );
+    void render_prometheus( const gauges& values, std::string& out );
+}
+
+#endif
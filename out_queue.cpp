@@ -0,0 +1,261 @@
+#include <errno.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "out_queue.h"
+
+// 异步发送期间复制的数据各自分配,随段发送完毕释放
+static void release_copy( void* arg )
+{
+    delete ( std::string* )arg;
+}
+
+out_queue::out_queue() : m_head( 0 ), m_bytes( 0 ), m_pushed_total( 0 ), m_sent_total( 0 ), m_clearing( false ), m_pinned( false )
+{
+}
+
+out_queue::~out_queue()
+{
+    clear();
+}
+
+void out_queue::push_buffer( const char* data, size_t len, release_func release, void* arg )
+{
+    segment seg;
+    seg.type = SEGMENT_BUFFER;
+    seg.data = data;
+    seg.copy_offset = 0;
+    seg.fd = -1;
+    seg.file_offset = 0;
+    seg.len = len;
+    seg.release = release;
+    seg.mark = 0;
+    seg.arg = arg;
+    m_segments.push_back( seg );
+    m_bytes += len;
+    m_pushed_total += len;
+}
+
+void out_queue::push_copy( const char* data, size_t len )
+{
+	// 共享存储扩容会移动内核正在引用的数据
+    if ( m_pinned && m_copies.size() + len > m_copies.capacity() )
+    {
+        std::string* copy = new std::string( data, len );
+        push_buffer( copy->data(), len, release_copy, copy );
+        return;
+    }
+	// 与前一个复制段相邻时直接合并
+    if ( ! empty() && m_segments.back().type == SEGMENT_COPY
+        && m_segments.back().copy_offset + m_segments.back().len == m_copies.size() )
+    {
+        m_segments.back().len += len;
+    }
+    else
+    {
+        segment seg;
+        seg.type = SEGMENT_COPY;
+        seg.data = 0;
+        seg.copy_offset = m_copies.size();
+        seg.fd = -1;
+        seg.file_offset = 0;
+        seg.len = len;
+        seg.release = 0;
+        seg.mark = 0;
+        seg.arg = 0;
+        m_segments.push_back( seg );
+    }
+    m_copies.append( data, len );
+    m_bytes += len;
+    m_pushed_total += len;
+}
+
+void out_queue::push_file( int fd, off_t offset, size_t len, release_func release, void* arg )
+{
+    segment seg;
+    seg.type = SEGMENT_FILE;
+    seg.data = 0;
+    seg.copy_offset = 0;
+    seg.fd = fd;
+    seg.file_offset = offset;
+    seg.len = len;
+    seg.release = release;
+    seg.mark = 0;
+    seg.arg = arg;
+    m_segments.push_back( seg );
+    m_bytes += len;
+    m_pushed_total += len;
+}
+
+void out_queue::push_mark( mark_func mark, void* arg )
+{
+    segment seg;
+    seg.type = SEGMENT_MARK;
+    seg.data = 0;
+    seg.copy_offset = 0;
+    seg.fd = -1;
+    seg.file_offset = 0;
+    seg.len = 0;
+    seg.release = 0;
+    seg.mark = mark;
+    seg.arg = arg;
+    m_segments.push_back( seg );
+}
+
+out_queue::SEND_STATUS out_queue::send( int sockfd )
+{
+    struct iovec iv[ MAX_IOV ];
+    bool more;
+    int fd;
+    off_t offset;
+    size_t len;
+    int count;
+    while ( ( count = next_send( iv, more, fd, offset, len ) ) >= 0 )
+    {
+        ssize_t ret;
+        if ( count == 0 )
+        {
+            ret = sendfile( sockfd, fd, &offset, len );
+            if ( ret == 0 )
+            {
+				// 文件在发送过程中被截断
+                return SEND_ERROR;
+            }
+        }
+        else
+        {
+            struct msghdr msg = msghdr();
+            msg.msg_iov = iv;
+            msg.msg_iovlen = count;
+			// 其后紧跟文件段时,提示内核暂缓发出不满的报文段
+            ret = sendmsg( sockfd, &msg, more ? MSG_MORE : 0 );
+        }
+        if ( ret < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+            return ( errno == EAGAIN || errno == EWOULDBLOCK ) ? SEND_AGAIN : SEND_ERROR;
+        }
+        sent( ret );
+    }
+    return SEND_DONE;
+}
+
+int out_queue::next_send( struct iovec* iov, bool& more, int& fd, off_t& offset, size_t& len )
+{
+    if ( skip_empty() )
+    {
+        return -1;
+    }
+    const segment& head = m_segments[ m_head ];
+    if ( head.type == SEGMENT_FILE )
+    {
+        fd = head.fd;
+        offset = head.file_offset;
+        len = head.len;
+        return 0;
+    }
+	// 合并连续的内存段
+    int count = 0;
+    size_t i = m_head;
+    for ( ; i < m_segments.size() && count < MAX_IOV && m_segments[i].type != SEGMENT_FILE; ++i )
+    {
+        const segment& seg = m_segments[i];
+        if ( seg.len == 0 )
+        {
+            continue;
+        }
+        iov[ count ].iov_base = const_cast< char* >(
+            seg.type == SEGMENT_COPY ? m_copies.data() + seg.copy_offset : seg.data );
+        iov[ count ].iov_len = seg.len;
+        ++count;
+    }
+    more = i < m_segments.size() && m_segments[i].type == SEGMENT_FILE;
+    return count;
+}
+
+void out_queue::sent( size_t n )
+{
+    m_pinned = false;
+    consume( n );
+	// 紧随其后的标记此时已可回调
+    skip_empty();
+}
+
+bool out_queue::skip_empty()
+{
+    while ( m_head < m_segments.size() && m_segments[ m_head ].len == 0 )
+    {
+        finish( m_segments[ m_head ] );
+    }
+    if ( m_head < m_segments.size() )
+    {
+        return false;
+    }
+	// 全部发送完毕,复用已分配的空间
+    m_segments.clear();
+    m_copies.clear();
+    m_head = 0;
+    return true;
+}
+
+void out_queue::consume( size_t n )
+{
+    m_bytes -= n;
+    m_sent_total += n;
+    while ( n > 0 && m_head < m_segments.size() )
+    {
+        segment& seg = m_segments[ m_head ];
+        size_t step = n < seg.len ? n : seg.len;
+        if ( seg.type == SEGMENT_BUFFER )
+        {
+            seg.data += step;
+        }
+        else if ( seg.type == SEGMENT_COPY )
+        {
+            seg.copy_offset += step;
+        }
+        else
+        {
+            seg.file_offset += step;
+        }
+        seg.len -= step;
+        n -= step;
+        if ( seg.len == 0 )
+        {
+            finish( seg );
+        }
+    }
+}
+
+void out_queue::finish( segment& seg )
+{
+    if ( seg.release )
+    {
+        seg.release( seg.arg );
+        seg.release = 0;
+    }
+    if ( seg.mark )
+    {
+        seg.mark( seg.arg, ! m_clearing );
+        seg.mark = 0;
+    }
+    ++m_head;
+}
+
+void out_queue::clear()
+{
+    m_clearing = true;
+    while ( m_head < m_segments.size() )
+    {
+        finish( m_segments[ m_head ] );
+    }
+    m_clearing = false;
+    m_pinned = false;
+    m_segments.clear();
+    m_copies.clear();
+    m_head = 0;
+    m_bytes = 0;
+}
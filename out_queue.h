@@ -0,0 +1,92 @@
+#ifndef OUT_QUEUE_H
+#define OUT_QUEUE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <string>
+#include <vector>
+
+// 连接的发送队列
+// 由内存段和文件段依次组成,记录已经发送到的位置,套接字写满时返回,
+// 下次可写时从内核停止的字节处继续发送;相邻的内存段合并为一次writev,文件段使用sendfile
+// 也可以由next_send取出下一次发送的内容,交给io_uring异步发送,完成后以sent告知发出的字节数
+class out_queue
+{
+public:
+    enum SEND_STATUS { SEND_DONE = 0, SEND_AGAIN, SEND_ERROR };
+	// 单次writev合并的内存段数上限
+    static const int MAX_IOV = 16;
+	// 段发送完毕或者队列清空时的回调,用于归还段所引用的资源
+    typedef void ( *release_func )( void* arg );
+	// 标记之前的数据全部发出时以sent为true回调,未全部发出就清空队列时以false回调
+    typedef void ( *mark_func )( void* arg, bool sent );
+
+public:
+    out_queue();
+    ~out_queue();
+
+	// 追加一段内存,其内容在发送完毕前须保持有效
+    void push_buffer( const char* data, size_t len, release_func release = 0, void* arg = 0 );
+	// 将一段数据复制到队列自己的存储中再追加
+    void push_copy( const char* data, size_t len );
+	// 追加文件fd中从offset开始的len个字节
+    void push_file( int fd, off_t offset, size_t len, release_func release = 0, void* arg = 0 );
+	// 追加一个不含数据的标记,用于得知一个应答何时发送完毕
+    void push_mark( mark_func mark, void* arg );
+	// 发送队列中的数据,直到全部发送完毕,套接字写满或者出错
+    SEND_STATUS send( int sockfd );
+	// 下一次发送的内容:队首起连续的内存段填入iov,返回段数,more表示其后紧跟文件段;
+	// 队首为文件段时返回0,由fd,offset和len给出;队列已空时返回-1
+    int next_send( struct iovec* iov, bool& more, int& fd, off_t& offset, size_t& len );
+	// 异步发送已提交,完成之前内核引用队列中的内存,此后复制的数据不放入可能扩容的共享存储
+    void pin() { m_pinned = true; }
+	// 发出了n个字节,异步发送完成时调用,同时解除pin
+    void sent( size_t n );
+	// 丢弃尚未发送的数据并归还资源
+    void clear();
+
+    bool empty() const { return m_head == m_segments.size(); }
+	// 尚未发送的字节数
+    size_t size() const { return m_bytes; }
+	// 累计追加和已发送的字节数,相减即为某一位置之前尚未发送的数据
+    uint64_t pushed_total() const { return m_pushed_total; }
+    uint64_t sent_total() const { return m_sent_total; }
+
+private:
+    enum SEGMENT_TYPE { SEGMENT_BUFFER = 0, SEGMENT_COPY, SEGMENT_FILE, SEGMENT_MARK };
+    struct segment
+    {
+        SEGMENT_TYPE type;
+        const char* data;       // 内存段的当前位置
+        size_t copy_offset;     // 复制段在m_copies中的当前位置
+        int fd;                 // 文件段的描述符
+        off_t file_offset;      // 文件段的当前偏移
+        size_t len;             // 段中尚未发送的字节数
+        release_func release;
+        mark_func mark;
+        void* arg;
+    };
+
+	// 跳过已经发送的n个字节
+    void consume( size_t n );
+	// 跳过已发完的段和标记,全部发送完毕时复用已分配的空间并返回true
+    bool skip_empty();
+    void finish( segment& seg );
+
+private:
+    std::vector< segment > m_segments;
+	// 第一个尚未发送完的段
+    size_t m_head;
+    size_t m_bytes;
+    uint64_t m_pushed_total;
+    uint64_t m_sent_total;
+	// 正在清空队列,标记以未发送回调
+    bool m_clearing;
+	// 有已提交尚未完成的异步发送
+    bool m_pinned;
+	// push_copy复制的数据,按偏移引用,扩容时不影响已有的段
+    std::string m_copies;
+};
+
+#endif
@@ -0,0 +1,780 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include "reactor.h"
+#include "logger.h"
+
+extern void addfd( int epollfd, int fd, bool one_shot );
+
+// 每次epoll_wait最多返回的事件数
+static const int REACTOR_EVENT_NUMBER = 1024;
+// io_uring的提交队列大小,接收缓冲区的个数和大小;数据到达后立即复制到连接的读缓冲区,
+// 缓冲区随即归还,只需覆盖一轮循环中同时到达的数据
+static const unsigned int URING_ENTRIES = 1024;
+static const unsigned int URING_BUFFERS = 512;
+static const unsigned int URING_BUFFER_SIZE = 4096;
+// 新建的管道扩大到的容量,文件段每次经管道发送至多一个管道容量的字节
+static const unsigned int URING_SPLICE_CHUNK = 1 << 20;
+// 每个事件循环保留的空闲管道数,其余的归还时关闭;管道容量计入用户的管道总容量限制
+static const size_t URING_SPARE_PIPES = 16;
+
+// io_uring请求的种类
+enum uring_kind { URING_ACCEPT = 1, URING_RECV, URING_POLLOUT, URING_EPOLL, URING_SEND, URING_SPLICE };
+
+// 请求的tag:高8位为种类,其后24位为连接的代数,低32位为描述符
+static uint64_t uring_tag( uint64_t kind, uint32_t generation, int fd )
+{
+    return kind << 56 | ( uint64_t )( generation & 0xffffff ) << 32 | ( uint32_t )fd;
+}
+
+// 过载时的应答,不读取请求,发送后即关闭连接
+static const char BUSY_RESPONSE[] = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\n"
+    "Content-Length: 0\r\nConnection: close\r\n\r\n";
+
+static void reject_conn( int connfd, const char* info )
+{
+	// 日志级别高于DEBUG时info不被使用
+    ( void )info;
+    DEBUG_LOG( "reject connection %d: %s", connfd, info );
+    metrics::add( metrics::SHED );
+	// 新连接的发送缓冲区是空的,不会阻塞;发送失败也只是少了这个应答
+    ssize_t ret = send( connfd, BUSY_RESPONSE, sizeof( BUSY_RESPONSE ) - 1, MSG_DONTWAIT | MSG_NOSIGNAL );
+    ( void )ret;
+    close( connfd );
+}
+
+// 初始化新接受的连接,start为开始接受的时间,shed为true时以503拒绝
+static void setup_conn( conn_table& users, int connfd, const sockaddr_in& client_address, int epollfd, timer_wheel* wheel,
+    reactor* uring_loop, uint64_t start, bool shed = false )
+{
+	// 检查用户数量是否超出限制,连接表按描述符索引,描述符也不能超出表的大小
+    if( http_conn::m_user_count >= http_conn::m_max_conns || connfd >= MAX_FD )
+    {
+        reject_conn( connfd, "too many connections" );
+        return;
+    }
+    if( shed )
+    {
+        reject_conn( connfd, "work queue overloaded" );
+        return;
+    }
+	// 用户类进行初始化
+    http_conn* conn = users.acquire( connfd );
+    if( ! conn )
+    {
+        reject_conn( connfd, "out of memory" );
+        return;
+    }
+    conn->init( connfd, client_address, epollfd, wheel, uring_loop );
+    metrics::add( metrics::ACCEPTS );
+    metrics::observe( metrics::ACCEPT_TIME, metrics::now_ns() - start );
+}
+
+void accept_conn( conn_table& users, int listenfd, int epollfd, timer_wheel* wheel, threadpool< http_conn >* pool )
+{
+	// 过载与否在一批连接开始时判断一次
+    bool shed = pool && http_conn::m_shed_wait_ms && pool->overloaded( ( uint64_t )http_conn::m_shed_wait_ms * 1000000 );
+	// 监听描述符为边沿触发,须接受到队列为空为止,否则剩下的连接要等下一个新连接到达才会被处理
+    while( true )
+    {
+        uint64_t start = metrics::now_ns();
+        struct sockaddr_in client_address;
+        socklen_t client_addrlength = sizeof( client_address );
+		// 获得连接描述符,直接设为非阻塞并在exec时关闭
+        int connfd = accept4( listenfd, ( struct sockaddr* )&client_address, &client_addrlength, SOCK_NONBLOCK | SOCK_CLOEXEC );
+        if ( connfd < 0 )
+        {
+            if( errno == EAGAIN || errno == EWOULDBLOCK )
+            {
+                break;
+            }
+			// 连接在排队期间已被客户端复位,或者被信号打断,继续接受下一个
+            if( errno == ECONNABORTED || errno == EINTR )
+            {
+                continue;
+            }
+			// 描述符用完等错误,剩下的连接留在队列中,有新连接到达时再接受
+            WARN_LOG( "accept failed: %s", strerror( errno ) );
+            break;
+        }
+        setup_conn( users, connfd, client_address, epollfd, wheel, NULL, start, shed );
+    }
+}
+
+// 处理连接读缓冲区中的请求,没有线程池时在事件循环线程中直接处理
+static void dispatch_request( http_conn* conn, threadpool< http_conn >* pool )
+{
+    if( ! pool )
+    {
+        conn->process();
+        conn->update_timer();
+        return;
+    }
+    conn->update_timer();
+    conn->begin_work();
+	// 工作队列已满时放弃该连接,否则它将不再收到任何事件
+    if( ! pool->append( conn ) )
+    {
+        WARN_LOG( "work queue full" );
+        metrics::add( metrics::QUEUE_FULL );
+        conn->end_work();
+        conn->close_conn();
+    }
+}
+
+// 连接可写:继续发送,发送完毕后处理读缓冲区中流水线发来的后续请求
+static void write_conn( http_conn* conn, threadpool< http_conn >* pool )
+{
+    if( !conn->write() )
+    {
+        conn->close_conn();
+        DEBUG_LOG( "write error." );
+    }
+	// 读缓冲区中还有流水线发来的后续请求,不会再有可读事件,直接处理
+    else if( conn->request_pending() )
+    {
+        dispatch_request( conn, pool );
+    }
+    else
+    {
+        conn->update_timer();
+    }
+}
+
+void handle_conn_event( conn_table& users, const epoll_event& event, threadpool< http_conn >* pool )
+{
+	// CGI程序的输出管道,低32位为所属连接的套接字,在事件循环中直接转发
+    if( event.data.u64 & http_conn::CGI_EVENT )
+    {
+        http_conn* owner = users.get( ( int )( uint32_t )event.data.u64 );
+        owner->wait_idle();
+        if( owner->closing() || ! owner->cgi_event() )
+        {
+            owner->close_conn();
+        }
+        else
+        {
+            owner->update_timer();
+        }
+        return;
+    }
+	// 流式应答等待的描述符就绪,低32位为所属连接的套接字,经由可写事件继续生成
+    if( event.data.u64 & http_conn::STREAM_EVENT )
+    {
+        http_conn* owner = users.get( ( int )( uint32_t )event.data.u64 );
+        owner->wait_idle();
+        if( owner->closing() )
+        {
+            owner->close_conn();
+        }
+        else
+        {
+            owner->stream_event();
+        }
+        return;
+    }
+    http_conn* conn = users.get( event.data.fd );
+    conn->wait_idle();
+	// 工作线程要求关闭的连接
+    if( conn->closing() )
+    {
+        conn->close_conn();
+    }
+	// EPOLLRDHUP: TCP连接被对方关闭,或者对方关闭了写操作
+	// EPOLLHUP: 挂起
+	// EPOLLERR: 错误
+    else if( event.events & ( EPOLLRDHUP | EPOLLHUP | EPOLLERR ) )
+    {
+        DEBUG_LOG( "error event %s on %d", ( event.events & EPOLLRDHUP ) ? "EPOLLRDHUP"
+            : ( event.events & EPOLLHUP ) ? "EPOLLHUP" : "EPOLLERR", event.data.fd );
+        conn->close_conn();
+    }
+	// 数据可读
+    else if( event.events & EPOLLIN )
+    {
+        DEBUG_LOG( "read event on %d", event.data.fd );
+        if( ! conn->read() )
+        {
+            conn->close_conn();
+        }
+        else
+        {
+            dispatch_request( conn, pool );
+        }
+    }
+	// 数据可写
+    else if( event.events & EPOLLOUT )
+    {
+        DEBUG_LOG( "write event on %d", event.data.fd );
+        write_conn( conn, pool );
+    }
+    else
+    {
+        WARN_LOG( "unknown event %#x on %d", event.events, event.data.fd );
+    }
+}
+
+int drain_conns( timer_wheel& wheel )
+{
+	// 事件循环的每个连接在关闭之前都在其时间轮中,先取出再逐个处理,关闭会将节点移出时间轮
+    std::vector< timer_wheel::node* > nodes;
+    wheel.collect( nodes );
+    int live = 0;
+    for( size_t i = 0; i < nodes.size(); ++i )
+    {
+        if( ( ( http_conn* )nodes[i]->data )->drain() )
+        {
+            ++live;
+        }
+    }
+    return live;
+}
+
+void expire_conns( timer_wheel& wheel )
+{
+    uint64_t now = monotonic_ms();
+    timer_wheel::node expired;
+    if( wheel.advance( now, &expired ) == 0 )
+    {
+        return;
+    }
+    timer_wheel::node* n;
+    while( ( n = timer_wheel::pop( &expired ) ) != NULL )
+    {
+        ( ( http_conn* )n->data )->expire( now );
+    }
+}
+
+int loop_timeout( const timer_wheel& wheel, bool draining )
+{
+    int timeout = wheel.next_timeout( monotonic_ms() );
+    if( draining && ( timeout < 0 || timeout > DRAIN_TICK_MS ) )
+    {
+        timeout = DRAIN_TICK_MS;
+    }
+    return timeout;
+}
+
+reactor::reactor( conn_table* users, int listenfd, bool use_uring ) :
+        m_users( users ), m_listenfd( listenfd ), m_epollfd( -1 ), m_wakefd( -1 ), m_wheel( monotonic_ms() ),
+        m_started( false ), m_stop( false ),
+        m_draining( false ), m_finished( false ), m_use_uring( use_uring ), m_ring( NULL )
+{
+    m_epollfd = epoll_create( 5 );
+    m_wakefd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+    if( m_epollfd < 0 || m_wakefd < 0 )
+    {
+        if( m_epollfd >= 0 )
+        {
+            close( m_epollfd );
+        }
+        throw std::exception();
+    }
+	// 使用io_uring时由多次触发的accept接受连接
+    if( ! m_use_uring )
+    {
+        addfd( m_epollfd, m_listenfd, false );
+    }
+    addfd( m_epollfd, m_wakefd, false );
+}
+
+reactor::~reactor()
+{
+    stop();
+    delete m_ring;
+    for( size_t i = 0; i < m_pipes.size(); ++i )
+    {
+        close( m_pipes[i] );
+    }
+    close( m_wakefd );
+    close( m_epollfd );
+    if( m_listenfd >= 0 )
+    {
+        close( m_listenfd );
+    }
+}
+
+bool reactor::start( int cpu )
+{
+    if( pthread_create( &m_thread, NULL, worker, this ) != 0 )
+    {
+        return false;
+    }
+    m_started = true;
+	// 绑定失败不影响运行,只是由内核调度
+    if( cpu >= 0 )
+    {
+        cpu_set_t set;
+        CPU_ZERO( &set );
+        CPU_SET( cpu, &set );
+        if( pthread_setaffinity_np( m_thread, sizeof( set ), &set ) != 0 )
+        {
+            WARN_LOG( "pin reactor to cpu %d failed", cpu );
+        }
+    }
+    return true;
+}
+
+void reactor::stop()
+{
+    if( ! m_started )
+    {
+        return;
+    }
+    m_stop = true;
+    uint64_t one = 1;
+    ssize_t ret = ::write( m_wakefd, &one, sizeof( one ) );
+    ( void )ret;
+    pthread_join( m_thread, NULL );
+    m_started = false;
+}
+
+void reactor::drain()
+{
+    m_draining = true;
+    uint64_t one = 1;
+    ssize_t ret = ::write( m_wakefd, &one, sizeof( one ) );
+    ( void )ret;
+}
+
+void* reactor::worker( void* arg )
+{
+    reactor* r = ( reactor* )arg;
+    r->run();
+    return r;
+}
+
+void reactor::run()
+{
+	// 指定了SINGLE_ISSUER时只有创建io_uring的线程能提交请求,因此在本线程中创建
+    if( m_use_uring )
+    {
+        try
+        {
+            m_ring = new uring( URING_ENTRIES, URING_BUFFERS, URING_BUFFER_SIZE );
+        }
+        catch( ... )
+        {
+            m_ring = NULL;
+        }
+        if( m_ring )
+        {
+            run_uring();
+            return;
+        }
+        WARN_LOG( "create io_uring failed, reactor falls back to epoll" );
+        addfd( m_epollfd, m_listenfd, false );
+    }
+    run_epoll();
+}
+
+void reactor::run_epoll()
+{
+    epoll_event events[ REACTOR_EVENT_NUMBER ];
+    while( ! m_stop )
+    {
+        if( m_draining )
+        {
+			// 关闭监听套接字,未接受的连接留给共享该套接字的新进程
+            if( m_listenfd >= 0 )
+            {
+                epoll_ctl( m_epollfd, EPOLL_CTL_DEL, m_listenfd, 0 );
+                close( m_listenfd );
+                m_listenfd = -1;
+            }
+            if( drain_conns( m_wheel ) == 0 )
+            {
+                m_finished = true;
+                break;
+            }
+        }
+        int number = epoll_wait( m_epollfd, events, REACTOR_EVENT_NUMBER, loop_timeout( m_wheel, m_draining ) );
+        if ( ( number < 0 ) && ( errno != EINTR ) )
+        {
+            ERROR_LOG( "epoll failure: %s", strerror( errno ) );
+            break;
+        }
+        for ( int i = 0; i < number; i++ )
+        {
+            int sockfd = events[i].data.fd;
+            if( sockfd == m_listenfd )
+            {
+                accept_conn( *m_users, m_listenfd, m_epollfd, &m_wheel );
+            }
+            else if( sockfd == m_wakefd )
+            {
+                uint64_t value;
+                ssize_t ret = ::read( m_wakefd, &value, sizeof( value ) );
+                ( void )ret;
+            }
+            else
+            {
+                handle_conn_event( *m_users, events[i], NULL );
+            }
+        }
+        expire_conns( m_wheel );
+    }
+}
+
+void reactor::run_uring()
+{
+    m_ring->accept( m_listenfd, uring_tag( URING_ACCEPT, 0, m_listenfd ) );
+    m_ring->poll( m_epollfd, POLLIN, true, uring_tag( URING_EPOLL, 0, m_epollfd ) );
+    while( ! m_stop )
+    {
+        if( m_draining )
+        {
+			// 取消接受连接的请求并关闭监听套接字,未接受的连接留给共享该套接字的新进程;
+			// 取消之前已接受的连接在本轮的完成事件中初始化,然后一起排空
+            if( m_listenfd >= 0 )
+            {
+                m_ring->cancel( uring_tag( URING_ACCEPT, 0, m_listenfd ) );
+                close( m_listenfd );
+                m_listenfd = -1;
+            }
+            else if( drain_conns( m_wheel ) == 0 )
+            {
+                m_finished = true;
+                break;
+            }
+        }
+        if( m_ring->wait( loop_timeout( m_wheel, m_draining ) ) < 0 )
+        {
+            ERROR_LOG( "io_uring failure: %s", strerror( errno ) );
+            break;
+        }
+        io_uring_cqe cqe;
+        while( m_ring->next( cqe ) )
+        {
+            handle_completion( cqe );
+        }
+        expire_conns( m_wheel );
+    }
+}
+
+void reactor::arm( http_conn* conn, int ev )
+{
+	// 与epoll的一次触发相同,同一种请求未完成时不重复提交
+    int kind = ( ev & EPOLLOUT ) ? EPOLLOUT : EPOLLIN;
+    if( conn->m_uring_pending & kind )
+    {
+        return;
+    }
+	// 发送队列中有数据时直接提交发送,否则等待可写,由可写事件交还事件循环
+    if( kind == EPOLLOUT && ! conn->m_out.empty() && submit_send( conn ) )
+    {
+        return;
+    }
+    conn->m_uring_pending |= kind;
+    int fd = conn->m_sockfd;
+    if( kind == EPOLLOUT )
+    {
+        m_ring->poll( fd, POLLOUT, false, uring_tag( URING_POLLOUT, conn->m_generation, fd ) );
+    }
+    else
+    {
+        m_ring->recv( fd, uring_tag( URING_RECV, conn->m_generation, fd ) );
+    }
+}
+
+bool reactor::send( http_conn* conn )
+{
+    if( conn->m_uring_pending & EPOLLOUT )
+    {
+        return true;
+    }
+    return submit_send( conn );
+}
+
+bool reactor::submit_send( http_conn* conn )
+{
+    if( ! conn->m_uring_send )
+    {
+        conn->m_uring_send = new http_conn::uring_send;
+        conn->m_uring_send->pipe[0] = conn->m_uring_send->pipe[1] = -1;
+        conn->m_uring_send->piped = 0;
+    }
+    http_conn::uring_send& s = *conn->m_uring_send;
+    int fd = conn->m_sockfd;
+    uint64_t tag = uring_tag( URING_SEND, conn->m_generation, fd );
+	// 上次读入管道的数据没有全部发出,先发完
+    if( s.piped > 0 )
+    {
+        s.op = http_conn::uring_send::SEND_PIPE;
+        m_ring->splice_pipe( s.pipe[0], fd, s.piped, 0, tag );
+        conn->m_uring_pending |= EPOLLOUT;
+        return true;
+    }
+    bool more = false;
+    int file;
+    off_t offset;
+    size_t len;
+    int count = conn->m_out.next_send( s.iov, more, file, offset, len );
+    if( count > 0 )
+    {
+        s.op = http_conn::uring_send::SEND_MSG;
+        s.msg = msghdr();
+        s.msg.msg_iov = s.iov;
+        s.msg.msg_iovlen = count;
+        conn->m_out.pin();
+		// 其后紧跟文件段时,提示内核暂缓发出不满的报文段
+        m_ring->sendmsg( fd, &s.msg, more ? MSG_MORE : 0, tag );
+        conn->m_uring_pending |= EPOLLOUT;
+        return true;
+    }
+    if( count < 0 || ( s.pipe[0] < 0 && ! acquire_pipe( s ) ) )
+    {
+        return false;
+    }
+    s.op = http_conn::uring_send::SEND_FILE;
+    s.spliced = 0;
+    unsigned int n = len < s.pipe_size ? len : s.pipe_size;
+    m_ring->splice_file( file, offset, s.pipe, fd, n, n < len ? SPLICE_F_MORE : 0,
+        uring_tag( URING_SPLICE, conn->m_generation, fd ), tag );
+    conn->m_uring_pending |= EPOLLOUT;
+    return true;
+}
+
+void reactor::send_done( http_conn* conn, int res )
+{
+    http_conn::uring_send& s = *conn->m_uring_send;
+    if( s.op == http_conn::uring_send::SEND_FILE )
+    {
+		// 文件读取出错,或者在发送过程中被截断
+        if( s.spliced <= 0 )
+        {
+            conn->close_conn();
+            return;
+        }
+        s.piped += s.spliced;
+		// 读入管道的不足一整块,链接的发送被取消,管道中的数据下次发出
+        if( res == -ECANCELED )
+        {
+            res = 0;
+        }
+        else if( res == 0 )
+        {
+            res = -EPIPE;
+        }
+    }
+    else if( s.op == http_conn::uring_send::SEND_PIPE && res == 0 )
+    {
+        res = -EPIPE;
+    }
+	// splice不等待套接字可写,等可写之后再次提交
+    if( res == -EAGAIN )
+    {
+        conn->m_uring_pending |= EPOLLOUT;
+        m_ring->poll( conn->m_sockfd, POLLOUT, false, uring_tag( URING_POLLOUT, conn->m_generation, conn->m_sockfd ) );
+        return;
+    }
+    if( res < 0 )
+    {
+        DEBUG_LOG( "send on %d failed: %s", conn->m_sockfd, strerror( -res ) );
+        conn->close_conn();
+        return;
+    }
+    if( s.op != http_conn::uring_send::SEND_MSG )
+    {
+        s.piped -= res;
+    }
+    conn->m_out.sent( res );
+    metrics::add( metrics::BYTES_SENT, res );
+    if( ! conn->m_out.empty() )
+    {
+        arm( conn, EPOLLOUT );
+        return;
+    }
+	// 发送完毕,管道已空,归还给事件循环
+    release_pipe( s, true );
+    write_conn( conn, NULL );
+}
+
+bool reactor::acquire_pipe( http_conn::uring_send& s )
+{
+    if( ! m_pipes.empty() )
+    {
+        s.pipe[1] = m_pipes.back();
+        m_pipes.pop_back();
+        s.pipe[0] = m_pipes.back();
+        m_pipes.pop_back();
+    }
+	// 管道由io_uring的工作线程读写,非阻塞以免空管道或满管道使其一直等待
+    else if( pipe2( s.pipe, O_NONBLOCK | O_CLOEXEC ) < 0 )
+    {
+        WARN_LOG( "create pipe for splice failed: %s", strerror( errno ) );
+        s.pipe[0] = s.pipe[1] = -1;
+        return false;
+    }
+    else
+    {
+		// 用户的管道总容量超出限制时不能扩大,保持原来的容量
+        fcntl( s.pipe[1], F_SETPIPE_SZ, URING_SPLICE_CHUNK );
+    }
+    int size = fcntl( s.pipe[1], F_GETPIPE_SZ );
+    s.pipe_size = size > 0 ? size : 4096;
+    return true;
+}
+
+void reactor::release_pipe( http_conn::uring_send& s, bool reuse )
+{
+    if( s.pipe[0] < 0 )
+    {
+        return;
+    }
+    if( reuse && s.piped == 0 && m_pipes.size() < URING_SPARE_PIPES * 2 )
+    {
+        m_pipes.push_back( s.pipe[0] );
+        m_pipes.push_back( s.pipe[1] );
+    }
+    else
+    {
+        close( s.pipe[0] );
+        close( s.pipe[1] );
+    }
+    s.pipe[0] = s.pipe[1] = -1;
+    s.piped = 0;
+}
+
+void reactor::handle_completion( const io_uring_cqe& cqe )
+{
+    int kind = cqe.user_data >> 56;
+    uint32_t generation = ( cqe.user_data >> 32 ) & 0xffffff;
+    int fd = ( int )( uint32_t )cqe.user_data;
+    switch( kind )
+    {
+        case URING_ACCEPT:
+        {
+            if( cqe.res >= 0 )
+            {
+				// 多次触发的accept不返回对端地址
+                sockaddr_in addr;
+                socklen_t len = sizeof( addr );
+                if( getpeername( cqe.res, ( sockaddr* )&addr, &len ) < 0 )
+                {
+                    memset( &addr, 0, sizeof( addr ) );
+                }
+                setup_conn( *m_users, cqe.res, addr, m_epollfd, &m_wheel, this, metrics::now_ns() );
+            }
+            else if( cqe.res != -ECANCELED )
+            {
+                WARN_LOG( "accept failed: %s", strerror( -cqe.res ) );
+            }
+			// 内核因出错结束了多次触发的请求时重新提交
+            if( ! ( cqe.flags & IORING_CQE_F_MORE ) && cqe.res != -ECANCELED && m_listenfd >= 0 )
+            {
+                m_ring->accept( m_listenfd, cqe.user_data );
+            }
+            break;
+        }
+        case URING_EPOLL:
+        {
+			// CGI管道,流式应答等待的描述符和eventfd,取完所有就绪的事件,否则不会再次触发
+            epoll_event events[ REACTOR_EVENT_NUMBER ];
+            int number;
+            do
+            {
+                number = epoll_wait( m_epollfd, events, REACTOR_EVENT_NUMBER, 0 );
+                for( int i = 0; i < number; ++i )
+                {
+                    if( events[i].data.fd == m_wakefd )
+                    {
+                        uint64_t value;
+                        ssize_t ret = ::read( m_wakefd, &value, sizeof( value ) );
+                        ( void )ret;
+                    }
+                    else
+                    {
+                        handle_conn_event( *m_users, events[i], NULL );
+                    }
+                }
+            } while( number == REACTOR_EVENT_NUMBER );
+            if( ! ( cqe.flags & IORING_CQE_F_MORE ) )
+            {
+                m_ring->poll( m_epollfd, POLLIN, true, cqe.user_data );
+            }
+            break;
+        }
+        case URING_RECV:
+        case URING_POLLOUT:
+        case URING_SEND:
+        case URING_SPLICE:
+        {
+            uint16_t buffer = 0;
+            bool has_buffer = uring::buffer_id( cqe, buffer );
+            http_conn* conn = m_users->get( fd );
+			// 连接已经关闭,描述符可能已被新连接使用
+            if( ! conn || conn->m_sockfd != fd || ( conn->m_generation & 0xffffff ) != generation )
+            {
+                if( has_buffer )
+                {
+                    m_ring->recycle( buffer );
+                }
+                break;
+            }
+			// 文件读入管道的结果,由随后链接的发送请求一起处理
+            if( kind == URING_SPLICE )
+            {
+                conn->m_uring_send->spliced = cqe.res;
+                break;
+            }
+            if( kind == URING_SEND )
+            {
+                conn->m_uring_pending &= ~EPOLLOUT;
+                send_done( conn, cqe.res );
+                break;
+            }
+            if( kind == URING_POLLOUT )
+            {
+                conn->m_uring_pending &= ~EPOLLOUT;
+                if( cqe.res < 0 || ( cqe.res & ( POLLERR | POLLHUP ) ) )
+                {
+                    conn->close_conn();
+                }
+                else
+                {
+                    write_conn( conn, NULL );
+                }
+                break;
+            }
+            conn->m_uring_pending &= ~EPOLLIN;
+            bool ok;
+            if( cqe.res == -ENOBUFS )
+            {
+				// 缓冲区暂时用完,直接从套接字读取
+                ok = conn->read();
+            }
+            else
+            {
+                ok = cqe.res > 0 && has_buffer && conn->feed( m_ring->buffer( buffer ), cqe.res );
+            }
+            if( has_buffer )
+            {
+                m_ring->recycle( buffer );
+            }
+            if( ! ok )
+            {
+                conn->close_conn();
+            }
+            else if( conn->request_pending() )
+            {
+                dispatch_request( conn, NULL );
+            }
+			// 正在发送应答时数据留在读缓冲区,发送完毕后处理;否则继续接收
+            else if( ! conn->m_responding )
+            {
+                arm( conn, EPOLLIN );
+            }
+            break;
+        }
+        default:
+        {
+            break;
+        }
+    }
+}
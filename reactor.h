@@ -0,0 +1,83 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <vector>
+#include "http_conn.h"
+#include "threadpool.h"
+#include "timer_wheel.h"
+#include "uring.h"
+
+// 接受监听描述符上所有排队的新连接,注册到epollfd所在的事件循环及其时间轮;
+// 连接数已达上限,或者pool不为NULL且线程池过载时,新连接以503拒绝
+void accept_conn( conn_table& users, int listenfd, int epollfd, timer_wheel* wheel, threadpool< http_conn >* pool = NULL );
+// 处理连接描述符上的事件,pool为NULL时在当前线程直接处理请求
+void handle_conn_event( conn_table& users, const epoll_event& event, threadpool< http_conn >* pool );
+// 关闭时间轮所属事件循环的空闲连接,返回尚未关闭的连接数
+int drain_conns( timer_wheel& wheel );
+// 推进时间轮,关闭超时的连接
+void expire_conns( timer_wheel& wheel );
+// 根据时间轮计算epoll_wait的超时,排空期间不超过DRAIN_TICK_MS
+int loop_timeout( const timer_wheel& wheel, bool draining );
+// 排空期间事件循环检查连接的间隔
+static const int DRAIN_TICK_MS = 100;
+
+// 独立的事件循环线程,拥有自己的监听套接字(SO_REUSEPORT),epoll实例以及由它接受的连接,
+// 连接的读取,请求处理和发送都在本线程完成,不需要与其他线程交接。
+// 使用io_uring时,接受连接,接收数据和发送都作为请求提交,每轮循环一次系统调用
+// 提交所有连接的请求并收取完成事件;内存段以sendmsg发送,文件段经管道以链接的两次splice发送。
+// CGI管道,流式应答等待的描述符和唤醒用的eventfd仍在epoll实例中,epoll描述符本身经io_uring等待
+class reactor
+{
+public:
+	// use_uring为true时使用io_uring,线程中创建失败时退回epoll
+    reactor( conn_table* users, int listenfd, bool use_uring = false );
+    ~reactor();
+	// 启动事件循环线程,cpu不小于0时将线程绑定到该cpu上
+    bool start( int cpu );
+	// 通知事件循环退出,并等待线程结束
+    void stop();
+	// 停止接受新连接,所有连接关闭后事件循环结束
+    void drain();
+    bool finished() const { return m_finished; }
+	// io_uring后端:连接等待可读或可写,由http_conn在本事件循环线程中调用;
+	// 等待可写时发送队列中有数据则直接提交发送
+    void arm( http_conn* conn, int ev );
+	// io_uring后端:提交发送队列中下一部分数据的发送,已有请求未完成时不重复提交,
+	// 无法提交(借不到管道)时返回false,由连接直接发送
+    bool send( http_conn* conn );
+	// 归还连接借用的管道,reuse为false,管道中还有数据或者空闲的管道已足够时关闭
+    void release_pipe( http_conn::uring_send& s, bool reuse );
+
+private:
+    static void* worker( void* arg );
+    void run();
+    void run_epoll();
+    void run_uring();
+    void handle_completion( const io_uring_cqe& cqe );
+    bool submit_send( http_conn* conn );
+	// 发送请求完成,res为发出的字节数或错误码
+    void send_done( http_conn* conn, int res );
+    bool acquire_pipe( http_conn::uring_send& s );
+
+private:
+    conn_table* m_users;
+    int m_listenfd;
+    int m_epollfd;
+	// 用于唤醒事件循环的eventfd
+    int m_wakefd;
+    timer_wheel m_wheel;
+    pthread_t m_thread;
+    bool m_started;
+    volatile bool m_stop;
+    volatile bool m_draining;
+    volatile bool m_finished;
+    bool m_use_uring;
+	// 只在事件循环线程中创建和使用
+    uring* m_ring;
+	// 空闲的管道,依次为读端和写端
+    std::vector< int > m_pipes;
+};
+
+#endif
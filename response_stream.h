@@ -0,0 +1,38 @@
+#ifndef RESPONSE_STREAM_H
+#define RESPONSE_STREAM_H
+
+#include <stddef.h>
+#include <string>
+
+// 流式应答的写入接口,每次生成的内容由连接作为一个块,按分块传输编码发送,需要时先压缩
+class response_writer
+{
+public:
+    void append( const char* data, size_t len ) { m_data.append( data, len ); }
+    void append( const char* str ) { m_data += str; }
+    void append( const std::string& data ) { m_data += data; }
+	// 已写入尚未发送的内容,可以直接追加,由连接取走后清空
+    std::string& pending() { return m_data; }
+
+private:
+    std::string m_data;
+};
+
+// 流式应答的生成器,由内置的流式处理函数创建,连接在发送队列中的数据发送完毕后
+// 再次调用next生成下一部分,生成速度不会超过客户端接收的速度;
+// 在工作线程中调用,同一时刻只有一个线程使用,应答结束或连接关闭时由连接删除
+class response_stream
+{
+public:
+    virtual ~response_stream() {}
+	// 向writer写入下一部分内容,还有后续内容时返回true,全部写完时返回false
+    virtual bool next( response_writer& writer ) = 0;
+	// next返回后至少等待多少毫秒再次调用,0表示发送队列有空间即调用
+    virtual unsigned int delay() const { return 0; }
+	// next返回后等待的描述符,就绪(events为EPOLLIN或EPOLLOUT)之后再次调用,不等待时返回-1
+    virtual int wait_fd( unsigned int& events ) const { events = 0; return -1; }
+	// 生成出错,应答无法完成,连接随即关闭
+    virtual bool failed() const { return false; }
+};
+
+#endif
@@ -0,0 +1,279 @@
+#include <errno.h>
+#include <pthread.h>
+#include <iconv.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include "book_index.h"
+#include "search.h"
+#include "logger.h"
+
+// 每本书最多显示的命中位置数
+static const size_t MAX_HITS_PER_BOOK = 5;
+// 摘要中命中位置前后保留的字节数
+static const size_t SNIPPET_CONTEXT = 60;
+
+// 书籍的全文索引,建立后只读,各工作线程共享;重新加载时整体替换,
+// 正在进行的搜索持有旧索引的引用,结束后旧索引才释放
+static std::shared_ptr< book_index > g_index;
+// search_init的参数,重新加载时使用
+static std::string g_root, g_url_prefix, g_index_path;
+// 尚未处理的后台重新加载请求数,不为0时已有后台线程在运行
+static std::atomic< int > g_reload_requests( 0 );
+
+// 字符编码转换器,iconv句柄不能在线程间共享,每个线程各持有一份
+class converter
+{
+public:
+    converter( const char* to, const char* from ) : m_cd( iconv_open( to, from ) ) {}
+    ~converter()
+    {
+        if ( m_cd != ( iconv_t )-1 )
+        {
+            iconv_close( m_cd );
+        }
+    }
+	// 转换失败时返回false,out中为已转换的部分
+    bool convert( const char* in, size_t len, std::string& out )
+    {
+        out.clear();
+        if ( m_cd == ( iconv_t )-1 )
+        {
+            return false;
+        }
+        iconv( m_cd, NULL, NULL, NULL, NULL );
+        char buf[ 256 ];
+        char* src = const_cast< char* >( in );
+        while ( len > 0 )
+        {
+            char* dst = buf;
+            size_t left = sizeof( buf );
+            size_t ret = iconv( m_cd, &src, &len, &dst, &left );
+            out.append( buf, dst - buf );
+            if ( ret == ( size_t )-1 && errno != E2BIG )
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    iconv_t m_cd;
+};
+
+static thread_local converter to_gbk( "GBK", "UTF-8" );
+static thread_local converter to_utf8( "UTF-8", "GBK" );
+
+// 将十六进制字符转换为数值,非法字符返回-1
+static int hex_value( char c )
+{
+    if ( c >= '0' && c <= '9' )
+    {
+        return c - '0';
+    }
+    if ( c >= 'a' && c <= 'f' )
+    {
+        return c - 'a' + 10;
+    }
+    if ( c >= 'A' && c <= 'F' )
+    {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// 从查询参数中取出名为key的参数值,并进行url解码
+static bool get_arg( const char* args, const char* key, std::string& value )
+{
+    size_t key_len = strlen( key );
+    const char* p = args;
+    while ( p && *p )
+    {
+        const char* end = strchr( p, '&' );
+        if ( ! end )
+        {
+            end = p + strlen( p );
+        }
+        if ( ( size_t )( end - p ) > key_len && strncmp( p, key, key_len ) == 0 && p[ key_len ] == '=' )
+        {
+            value.clear();
+            for ( p += key_len + 1; p < end; ++p )
+            {
+                if ( *p == '+' )
+                {
+                    value += ' ';
+                }
+                else if ( *p == '%' && end - p > 2 && hex_value( p[1] ) >= 0 && hex_value( p[2] ) >= 0 )
+                {
+                    value += ( char )( hex_value( p[1] ) * 16 + hex_value( p[2] ) );
+                    p += 2;
+                }
+                else
+                {
+                    value += *p;
+                }
+            }
+            return true;
+        }
+        p = *end ? end + 1 : end;
+    }
+    return false;
+}
+
+// 将gbk文本转换为utf-8并进行html转义后追加到content
+static void append_text( const char* text, size_t len, std::string& content )
+{
+    std::string utf8;
+    to_utf8.convert( text, len, utf8 );
+    for ( size_t i = 0; i < utf8.size(); ++i )
+    {
+        switch ( utf8[i] )
+        {
+            case '<': content += "&lt;"; break;
+            case '>': content += "&gt;"; break;
+            case '&': content += "&amp;"; break;
+            case '"': content += "&quot;"; break;
+            default: content += utf8[i]; break;
+        }
+    }
+}
+
+bool search_init( const char* root, const char* url_prefix, const char* index_path )
+{
+    g_root = root;
+    g_url_prefix = url_prefix;
+    g_index_path = index_path;
+    return search_reload();
+}
+
+bool search_reload()
+{
+    std::shared_ptr< book_index > index( new book_index );
+    if ( index->load( g_index_path.c_str(), g_root.c_str(), g_url_prefix.c_str() ) )
+    {
+        INFO_LOG( "book index loaded from %s", g_index_path.c_str() );
+    }
+    else
+    {
+        INFO_LOG( "book index %s missing or stale, rebuilding", g_index_path.c_str() );
+        if ( ! index->build( ( g_root + g_url_prefix ).c_str(), g_url_prefix.c_str() ) )
+        {
+            return false;
+        }
+    }
+    std::atomic_store( &g_index, index );
+    return true;
+}
+
+static void* reload_thread( void* )
+{
+	// 运行期间新到的请求合并为一次重新加载
+    int requests;
+    do
+    {
+        requests = g_reload_requests.load();
+        if ( ! search_reload() )
+        {
+            ERROR_LOG( "reload book index failed, keep the old one" );
+        }
+    } while ( g_reload_requests.fetch_sub( requests ) != requests );
+    return NULL;
+}
+
+void search_reload_async()
+{
+    if ( g_reload_requests.fetch_add( 1 ) != 0 )
+    {
+        return;
+    }
+    pthread_t thread;
+    if ( pthread_create( &thread, NULL, reload_thread, NULL ) != 0 )
+    {
+        ERROR_LOG( "create reload thread failed: %s", strerror( errno ) );
+        g_reload_requests.store( 0 );
+        return;
+    }
+    pthread_detach( thread );
+}
+
+// 每次生成的书籍数
+static const size_t BOOKS_PER_STEP = 4;
+
+// 书籍搜索的流式应答,先发送页面开头和书名匹配的结果,再检索全文,
+// 检索结果每次生成若干本书,客户端可以在全部结果生成之前开始显示
+static stream_task search_task( std::string args, response_writer& out )
+{
+	// 检索期间持有索引的引用,重新加载不影响正在进行的搜索
+    std::shared_ptr< book_index > index = std::atomic_load( &g_index );
+    std::string book, query;
+    get_arg( args.c_str(), "book", book );
+	// 主页为utf-8编码,表单提交的查询串需转换为书籍使用的gbk编码
+    if ( ! to_gbk.convert( book.data(), book.size(), query ) )
+    {
+        query = book;
+    }
+    std::string& content = out.pending();
+    char buf[ 64 ];
+    bool found = false;
+    content += "<meta charset=\"utf-8\">Welcome to yun tian shu ji: ";
+	// 书名匹配的书籍排在最前面
+    for ( int i = 0; i < index->book_count(); ++i )
+    {
+        const book_index::book& b = index->get_book( i );
+        if ( ! book.empty() && strstr( book.c_str(), b.name.c_str() ) )
+        {
+            content += "<p><a href=\"" + b.url + "\">" + b.name + "</a></p>";
+            found = true;
+        }
+    }
+    co_await stream_task::flush();
+
+	// 全文检索
+    std::vector< book_index::book_result > results;
+    int total = index->search( query.data(), query.size(), results, MAX_HITS_PER_BOOK );
+    if ( total > 0 )
+    {
+        snprintf( buf, sizeof( buf ), "<p>%d matches in %d books</p>", total, ( int )results.size() );
+        content += buf;
+        found = true;
+    }
+    for ( size_t i = 0; i < results.size(); ++i )
+    {
+        if ( i % BOOKS_PER_STEP == 0 )
+        {
+            co_await stream_task::flush();
+        }
+        const book_index::book_result& r = results[i];
+        const book_index::book& b = index->get_book( r.book );
+        snprintf( buf, sizeof( buf ), " (%d)", r.count );
+        content += "<h3><a href=\"" + b.url + "\">" + b.name + "</a>" + buf + "</h3>";
+        for ( size_t j = 0; j < r.offsets.size(); ++j )
+        {
+            uint32_t offset = r.offsets[j];
+            uint32_t begin, end;
+            index->snippet( r.book, offset, query.size(), SNIPPET_CONTEXT, begin, end );
+            snprintf( buf, sizeof( buf ), "<p>@%u: ", offset );
+            content += buf;
+            append_text( b.text + begin, offset - begin, content );
+            content += "<b>";
+            append_text( b.text + offset, query.size(), content );
+            content += "</b>";
+            append_text( b.text + offset + query.size(), end - offset - query.size(), content );
+            content += "</p>";
+        }
+    }
+    if ( ! found )
+    {
+        content += "<p>Not found!</p>";
+    }
+    content += "<p>Thanks for visiting!</p>";
+}
+
+response_stream* search_book( const char* args )
+{
+    return new task_stream( search_task, args );
+}
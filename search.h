@@ -0,0 +1,19 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <string>
+#include "task.h"
+
+// 加载root+url_prefix目录下所有书籍的全文索引,url_prefix为书籍的访问路径前缀
+// 优先只读映射make_index离线生成的index_path,文件不存在或已过期时在内存中重新建立
+bool search_init( const char* root, const char* url_prefix, const char* index_path );
+// 按search_init的参数重新加载索引,供书籍更新后使用,失败时继续使用原来的索引
+bool search_reload();
+// 在后台线程中执行search_reload,建立完成后替换索引,调用线程不等待;
+// 正在重新加载时再次调用,则本次完成后再加载一次
+void search_reload_async();
+// 书籍搜索的内置流式处理函数,注册到/cgi-bin/search,在线程池的工作线程中运行
+// args为查询参数,形如book=xxx,按书名和书籍内容检索,返回的生成器分批生成html页面
+response_stream* search_book( const char* args );
+
+#endif
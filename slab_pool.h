@@ -0,0 +1,60 @@
+#ifndef SLAB_POOL_H
+#define SLAB_POOL_H
+
+#include <new>
+#include <vector>
+#include <stdlib.h>
+#include "locker.h"
+
+// 按块批量分配对象,每块SLAB_OBJECTS个,对象在取出时才构造,块中未用到的部分不会被访问,
+// 因而不占用物理内存;对象不单独释放,由使用者保留复用,在内存池析构时统一析构
+template< typename T, size_t SLAB_OBJECTS = 64 >
+class slab_pool
+{
+public:
+    slab_pool() : m_next( 0 ) {}
+    ~slab_pool()
+    {
+        for ( size_t i = 0; i < m_slabs.size(); ++i )
+        {
+            size_t count = ( i + 1 == m_slabs.size() ) ? m_next : SLAB_OBJECTS;
+            for ( size_t j = 0; j < count; ++j )
+            {
+                m_slabs[i][j].~T();
+            }
+            free( m_slabs[i] );
+        }
+    }
+	// 取出一个对象,内存不足时返回NULL
+    T* alloc()
+    {
+        m_lock.lock();
+        if ( m_slabs.empty() || m_next == SLAB_OBJECTS )
+        {
+            T* slab = ( T* )malloc( sizeof( T ) * SLAB_OBJECTS );
+            if ( ! slab )
+            {
+                m_lock.unlock();
+                return NULL;
+            }
+            m_slabs.push_back( slab );
+            m_next = 0;
+        }
+        T* object = new ( m_slabs.back() + m_next ) T;
+        ++m_next;
+        m_lock.unlock();
+        return object;
+    }
+
+private:
+    slab_pool( const slab_pool& );
+    slab_pool& operator=( const slab_pool& );
+
+private:
+    locker m_lock;
+    std::vector< T* > m_slabs;
+	// 最后一块中下一个未构造的对象
+    size_t m_next;
+};
+
+#endif
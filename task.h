@@ -0,0 +1,142 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <coroutine>
+#include <exception>
+#include <string>
+#include <sys/epoll.h>
+#include "response_stream.h"
+#include "logger.h"
+
+// 以协程编写的流式处理函数的返回类型。处理函数按顺序写出整个应答,
+// 在co_await flush()处把已写入的内容交给连接发送,在co_await sleep(ms)处等待一段时间,
+// 在co_await readable(fd)/writable(fd)处等待描述符就绪,挂起期间不占用工作线程,
+// 也没有线程阻塞在其上;由task_stream驱动,连接需要更多内容时恢复执行,协程的状态随task_stream删除
+class stream_task
+{
+public:
+    struct promise_type
+    {
+		// sleep请求的等待时间(毫秒),由task_stream取走
+        unsigned int delay = 0;
+		// 等待就绪的描述符和事件,由task_stream取走
+        int wait_fd = -1;
+        unsigned int wait_events = 0;
+        bool failed = false;
+
+        stream_task get_return_object() { return stream_task( std::coroutine_handle< promise_type >::from_promise( *this ) ); }
+		// 创建时不执行,第一次需要内容时才开始
+        std::suspend_always initial_suspend() noexcept { return {}; }
+		// 结束后保持挂起,由stream_task销毁
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception()
+        {
+            ERROR_LOG( "stream handler threw an exception" );
+            failed = true;
+        }
+    };
+    typedef std::coroutine_handle< promise_type > handle;
+
+	// co_await flush()的等待对象:已写入的内容作为一块发送,发送队列有空间时继续
+    struct flush_awaiter
+    {
+        bool await_ready() const noexcept { return false; }
+        void await_suspend( handle ) const noexcept {}
+        void await_resume() const noexcept {}
+    };
+	// co_await sleep(ms)的等待对象:已写入的内容发送之后,至少经过ms毫秒再继续,
+	// 由连接的定时器唤醒,精度为时间轮的一格
+    struct sleep_awaiter
+    {
+        unsigned int ms;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend( handle h ) const noexcept { h.promise().delay = ms ? ms : 1; }
+        void await_resume() const noexcept {}
+    };
+	// co_await readable(fd)/writable(fd)的等待对象:已写入的内容交给连接之后,等fd可读或可写再继续,
+	// 就绪事件由连接所属的事件循环收到;fd须为非阻塞的套接字或管道,由处理函数打开和关闭,
+	// 等待期间连接关闭时先从事件循环中移除,再销毁协程
+    struct ready_awaiter
+    {
+        int fd;
+        unsigned int events;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend( handle h ) const noexcept
+        {
+            h.promise().wait_fd = fd;
+            h.promise().wait_events = events;
+        }
+        void await_resume() const noexcept {}
+    };
+
+public:
+    stream_task( stream_task&& other ) noexcept : m_handle( other.m_handle ) { other.m_handle = handle(); }
+    ~stream_task()
+    {
+        if ( m_handle )
+        {
+            m_handle.destroy();
+        }
+    }
+    stream_task( const stream_task& ) = delete;
+    stream_task& operator=( const stream_task& ) = delete;
+
+	// 执行到下一个挂起点或者结束
+    void resume() { m_handle.resume(); }
+    bool done() const { return m_handle.done(); }
+    promise_type& promise() const { return m_handle.promise(); }
+
+    static flush_awaiter flush() { return flush_awaiter(); }
+    static sleep_awaiter sleep( unsigned int ms ) { return sleep_awaiter{ ms }; }
+    static ready_awaiter readable( int fd ) { return ready_awaiter{ fd, EPOLLIN }; }
+    static ready_awaiter writable( int fd ) { return ready_awaiter{ fd, EPOLLOUT }; }
+
+private:
+    explicit stream_task( handle h ) : m_handle( h ) {}
+
+private:
+    handle m_handle;
+};
+
+// 协程形式的流式处理函数,args为查询参数的副本,out为应答内容的写入对象
+typedef stream_task ( *task_handler )( std::string args, response_writer& out );
+
+// 把协程形式的处理函数适配为流式应答的生成器,注册的流式处理函数中
+// 返回new task_stream( handler, args )即可
+class task_stream : public response_stream
+{
+public:
+    task_stream( task_handler handler, const char* args ) : m_task( handler( args, m_out ) ), m_delay( 0 ), m_wait_fd( -1 ), m_wait_events( 0 ) {}
+
+    bool next( response_writer& writer )
+    {
+        m_task.resume();
+        writer.pending().append( m_out.pending() );
+        m_out.pending().clear();
+        stream_task::promise_type& promise = m_task.promise();
+        m_delay = promise.delay;
+        promise.delay = 0;
+        m_wait_fd = promise.wait_fd;
+        m_wait_events = promise.wait_events;
+        promise.wait_fd = -1;
+        return ! m_task.done();
+    }
+    unsigned int delay() const { return m_delay; }
+    int wait_fd( unsigned int& events ) const
+    {
+        events = m_wait_events;
+        return m_wait_fd;
+    }
+    bool failed() const { return m_task.promise().failed; }
+
+private:
+	// 先于m_task构造,协程创建时取得它的引用
+    response_writer m_out;
+    stream_task m_task;
+    unsigned int m_delay;
+    int m_wait_fd;
+    unsigned int m_wait_events;
+};
+
+#endif
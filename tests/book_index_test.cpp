@@ -0,0 +1,124 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "test.h"
+#include "../book_index.h"
+
+static std::string g_dir;
+
+static void write_file( const std::string& name, const char* text )
+{
+    FILE* fp = fopen( ( g_dir + "/file/" + name ).c_str(), "wb" );
+    fputs( text, fp );
+    fclose( fp );
+}
+
+// 书籍末尾的单个字符能找到,跨越末尾的检索找不到
+static void test_book_end()
+{
+    book_index index;
+    CHECK( index.build( ( g_dir + "/file" ).c_str(), "/file" ) );
+    CHECK_EQ( index.book_count(), 2 );
+    std::vector< book_index::book_result > results;
+    CHECK_EQ( index.search( "z", 1, results, 5 ), 1 );
+    CHECK( results.size() == 1 && results[0].offsets[0] == 5 );
+    CHECK_EQ( index.search( "yz", 2, results, 5 ), 1 );
+	// 两本书首尾相接,不能跨书匹配
+    CHECK_EQ( index.search( "zq", 2, results, 5 ), 0 );
+    CHECK_EQ( index.search( "ab", 2, results, 5 ), 2 );
+}
+
+// 单个字符使用字符的位置列表:所有出现都找到,双字节字符的后一半与下一个字符不会误配
+static void test_single_char()
+{
+    std::string dir = g_dir + "/gbk";
+    system( ( "mkdir -p " + dir ).c_str() );
+	// 的a的之的
+    FILE* fp = fopen( ( dir + "/c.txt" ).c_str(), "wb" );
+    fputs( "\xb5\xc4" "a" "\xb5\xc4\xd6\xae\xb5\xc4", fp );
+    fclose( fp );
+    book_index index;
+    CHECK( index.build( dir.c_str(), "/gbk" ) );
+    std::vector< book_index::book_result > results;
+    CHECK_EQ( index.search( "\xb5\xc4", 2, results, 5 ), 3 );
+    CHECK( results.size() == 1 && results[0].offsets.size() == 3 );
+    CHECK( results.size() == 1 && results[0].offsets[0] == 0 && results[0].offsets[1] == 3 && results[0].offsets[2] == 7 );
+    CHECK_EQ( index.search( "a", 1, results, 5 ), 1 );
+    CHECK_EQ( index.search( "\xc4\xd6", 2, results, 5 ), 0 );
+    CHECK_EQ( index.search( "\xb5\xc4\xd6\xae", 4, results, 5 ), 1 );
+    system( ( "rm -rf " + dir ).c_str() );
+}
+
+static bool load_index( book_index& index )
+{
+    return index.load( ( g_dir + "/books.idx" ).c_str(), g_dir.c_str(), "/file" );
+}
+
+// 索引文件可以保存后重新加载,检索结果与建立时相同
+static void test_save_load()
+{
+    book_index built;
+    CHECK( built.build( ( g_dir + "/file" ).c_str(), "/file" ) );
+    CHECK( built.save( ( g_dir + "/books.idx" ).c_str() ) );
+    book_index index;
+    CHECK( load_index( index ) );
+    CHECK_EQ( index.book_count(), 2 );
+    std::vector< book_index::book_result > results;
+    CHECK_EQ( index.search( "ab", 2, results, 5 ), 2 );
+    CHECK_EQ( index.search( "z", 1, results, 5 ), 1 );
+}
+
+// 被截断或内容损坏的索引文件不能加载
+static void test_corrupt()
+{
+    std::string path = g_dir + "/books.idx";
+    std::string copy = g_dir + "/books.idx.orig";
+    system( ( "cp " + path + " " + copy ).c_str() );
+    book_index index;
+	// 截断
+    truncate( path.c_str(), 100 );
+    CHECK( ! load_index( index ) );
+	// 最后一个位置超出书籍的范围
+    system( ( "cp " + copy + " " + path ).c_str() );
+    FILE* fp = fopen( path.c_str(), "r+b" );
+    fseek( fp, -4, SEEK_END );
+    uint32_t bad = 0xfffffff0;
+    fwrite( &bad, 4, 1, fp );
+    fclose( fp );
+    CHECK( ! load_index( index ) );
+	// 恢复之后可以加载
+    system( ( "cp " + copy + " " + path ).c_str() );
+    CHECK( load_index( index ) );
+}
+
+// 新增书籍或者书籍被修改后,旧的索引文件不再使用
+static void test_stale()
+{
+    book_index index;
+    CHECK( load_index( index ) );
+    write_file( "c.txt", "new book" );
+    CHECK( ! load_index( index ) );
+    unlink( ( g_dir + "/file/c.txt" ).c_str() );
+    CHECK( load_index( index ) );
+    sleep( 1 );
+    write_file( "b.txt", "qac" );
+    CHECK( ! load_index( index ) );
+}
+
+int main()
+{
+    char tmpl[] = "/tmp/book_index_test.XXXXXX";
+    g_dir = mkdtemp( tmpl );
+    system( ( "mkdir -p " + g_dir + "/file" ).c_str() );
+    write_file( "a.txt", "abcxyz" );
+    write_file( "b.txt", "qab" );
+    test_book_end();
+    test_single_char();
+    test_save_load();
+    test_corrupt();
+    test_stale();
+    system( ( "rm -rf " + g_dir ).c_str() );
+    return TEST_RESULT();
+}
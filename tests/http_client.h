@@ -0,0 +1,249 @@
+#ifndef HTTP_CLIENT_H
+#define HTTP_CLIENT_H
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
+
+// 接口测试的辅助函数:在回环地址上启动服务器,发送原始的请求,解析应答
+// 须在仓库根目录下运行,服务器以当前目录为文档根目录
+
+// 一个解析后的应答
+struct http_response
+{
+    int status;
+    std::string head;
+    std::string body;
+
+	// 头部的值,没有时返回空串,名字不区分大小写
+    std::string header( const char* name ) const
+    {
+        size_t len = strlen( name );
+        size_t pos = head.find( "\r\n" );
+        while ( pos != std::string::npos && pos + 2 < head.size() )
+        {
+            size_t start = pos + 2;
+            size_t end = head.find( "\r\n", start );
+            if ( end == std::string::npos )
+            {
+                end = head.size();
+            }
+            if ( end - start > len && strncasecmp( head.c_str() + start, name, len ) == 0 && head[ start + len ] == ':' )
+            {
+                size_t v = start + len + 1;
+                while ( v < end && head[v] == ' ' )
+                {
+                    ++v;
+                }
+                return head.substr( v, end - v );
+            }
+            pos = end;
+        }
+        return std::string();
+    }
+};
+
+// 取一个空闲的端口
+static int free_port()
+{
+    int fd = socket( AF_INET, SOCK_STREAM, 0 );
+    sockaddr_in addr;
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    bind( fd, ( sockaddr* )&addr, sizeof( addr ) );
+    socklen_t len = sizeof( addr );
+    getsockname( fd, ( sockaddr* )&addr, &len );
+    close( fd );
+    return ntohs( addr.sin_port );
+}
+
+static int connect_to( int port, const char* ip = "127.0.0.1" )
+{
+    int fd = socket( AF_INET, SOCK_STREAM, 0 );
+    sockaddr_in addr;
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sin_family = AF_INET;
+    inet_pton( AF_INET, ip, &addr.sin_addr );
+    addr.sin_port = htons( port );
+    if ( connect( fd, ( sockaddr* )&addr, sizeof( addr ) ) < 0 )
+    {
+        close( fd );
+        return -1;
+    }
+	// 服务器无应答时不永远等待
+    timeval tv = { 5, 0 };
+    setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof( tv ) );
+    return fd;
+}
+
+// 运行中的服务器进程
+struct test_server
+{
+    pid_t pid;
+    int port;
+
+	// args为附加的命令行参数,ip为监听的地址,启动后等待端口可以连接
+    explicit test_server( const std::vector< std::string >& args = std::vector< std::string >(), const char* ip = "127.0.0.1" ) : pid( -1 ), port( free_port() )
+    {
+        pid = fork();
+        if ( pid == 0 )
+        {
+            std::vector< std::string > argv;
+            argv.push_back( "./server" );
+            argv.insert( argv.end(), args.begin(), args.end() );
+            argv.push_back( ip );
+            char buf[ 16 ];
+            snprintf( buf, sizeof( buf ), "%d", port );
+            argv.push_back( buf );
+            std::vector< char* > ptrs;
+            for ( size_t i = 0; i < argv.size(); ++i )
+            {
+                ptrs.push_back( const_cast< char* >( argv[i].c_str() ) );
+            }
+            ptrs.push_back( NULL );
+            freopen( "/dev/null", "w", stdout );
+            execv( "./server", &ptrs[0] );
+            _exit( 127 );
+        }
+        for ( int i = 0; i < 200; ++i )
+        {
+            int fd = connect_to( port );
+            if ( fd >= 0 )
+            {
+                close( fd );
+                break;
+            }
+            usleep( 20000 );
+        }
+    }
+    ~test_server()
+    {
+        if ( pid > 0 )
+        {
+            kill( pid, SIGTERM );
+            waitpid( pid, NULL, 0 );
+        }
+    }
+};
+
+// 发送raw,读取到连接关闭为止,返回收到的全部数据
+static std::string exchange( int port, const std::string& raw, const char* ip = "127.0.0.1" )
+{
+    int fd = connect_to( port, ip );
+    if ( fd < 0 )
+    {
+        return std::string();
+    }
+    send( fd, raw.data(), raw.size(), MSG_NOSIGNAL );
+    std::string data;
+    char buf[ 65536 ];
+    ssize_t n;
+    while ( ( n = recv( fd, buf, sizeof( buf ), 0 ) ) > 0 )
+    {
+        data.append( buf, n );
+    }
+    close( fd );
+    return data;
+}
+
+// 从data的pos处解析一个应答,pos移到应答之后;head_only为true时应答没有内容(HEAD请求)
+static bool parse_response( const std::string& data, size_t& pos, http_response& r, bool head_only = false )
+{
+    size_t end = data.find( "\r\n\r\n", pos );
+    if ( end == std::string::npos || data.compare( pos, 9, "HTTP/1.1 " ) != 0 )
+    {
+        return false;
+    }
+    r.status = atoi( data.c_str() + pos + 9 );
+    r.head = data.substr( pos, end + 2 - pos );
+    r.body.clear();
+    pos = end + 4;
+    if ( head_only || r.status == 304 || r.status / 100 == 1 )
+    {
+        return true;
+    }
+    std::string length = r.header( "Content-Length" );
+    if ( ! length.empty() )
+    {
+        size_t len = atol( length.c_str() );
+        if ( pos + len > data.size() )
+        {
+            return false;
+        }
+        r.body = data.substr( pos, len );
+        pos += len;
+        return true;
+    }
+    if ( r.header( "Transfer-Encoding" ) == "chunked" )
+    {
+		// 解码分块传输的内容
+        while ( true )
+        {
+            size_t line = data.find( "\r\n", pos );
+            if ( line == std::string::npos )
+            {
+                return false;
+            }
+            size_t size = strtoul( data.c_str() + pos, NULL, 16 );
+            pos = line + 2;
+            if ( size == 0 )
+            {
+                pos += 2;
+                return pos <= data.size();
+            }
+            if ( pos + size + 2 > data.size() )
+            {
+                return false;
+            }
+            r.body.append( data, pos, size );
+            pos += size + 2;
+        }
+    }
+	// 没有长度时内容到连接关闭为止
+    r.body = data.substr( pos );
+    pos = data.size();
+    return true;
+}
+
+// 发送单个请求并解析应答,失败时status为0
+static http_response fetch( int port, const std::string& raw, bool head_only = false, const char* ip = "127.0.0.1" )
+{
+    http_response r;
+    r.status = 0;
+    std::string data = exchange( port, raw, ip );
+    size_t pos = 0;
+    if ( ! parse_response( data, pos, r, head_only ) )
+    {
+        r.status = 0;
+    }
+    return r;
+}
+
+static std::string read_file( const char* path )
+{
+    std::string data;
+    FILE* fp = fopen( path, "rb" );
+    if ( fp )
+    {
+        char buf[ 65536 ];
+        size_t n;
+        while ( ( n = fread( buf, 1, sizeof( buf ), fp ) ) > 0 )
+        {
+            data.append( buf, n );
+        }
+        fclose( fp );
+    }
+    return data;
+}
+
+#endif
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <string>
+#include "test.h"
+#include "../http_parser.h"
+
+// 运行时选择的是cpu支持的最快的查找方式
+static void test_scanner_name()
+{
+    std::string name = http_parser::scanner_name();
+#if defined( __x86_64__ ) || defined( __i386__ )
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports( "avx2" ) )
+    {
+        CHECK( name == "avx2" );
+    }
+    else if ( __builtin_cpu_supports( "sse4.2" ) )
+    {
+        CHECK( name == "sse4.2" );
+    }
+    else
+    {
+        CHECK( name == "scalar" );
+    }
+#else
+    CHECK( name == "scalar" );
+#endif
+}
+
+// 结束符在各个位置,包括块的边界和块查找剩下的尾部,结果与逐字节查找一致
+static void test_find_line_end()
+{
+    char buf[ 160 ];
+    int wrong = 0;
+    for ( size_t len = 0; len <= 100; ++len )
+    {
+        for ( size_t pos = 0; pos <= len; ++pos )
+        {
+            for ( int c = 0; c < 2; ++c )
+            {
+				// 从不对齐的地址开始
+                char* begin = buf + 1 + len % 7;
+                memset( begin, 'x', len );
+                if ( pos < len )
+                {
+                    begin[ pos ] = c ? '\n' : '\r';
+                }
+				// 范围之外的结束符不能被找到
+                begin[ len ] = '\n';
+                wrong += http_parser::find_line_end( begin, begin + len ) != begin + pos;
+            }
+        }
+    }
+    CHECK_EQ( wrong, 0 );
+	// 多个结束符时返回第一个
+    const char* line = "GET / HTTP/1.1\r\nHost: a\r\n";
+    CHECK( http_parser::find_line_end( line, line + strlen( line ) ) == line + 14 );
+}
+
+// 已知的头部名称忽略大小写,长度或字符不同的名称都不匹配
+static void test_lookup_header()
+{
+    static const char* const names[ HEADER_COUNT ] =
+    {
+        "connection", "CONTENT-LENGTH", "Host", "range", "If-Range", "if-none-match",
+        "If-Modified-Since", "accept-encoding", "Transfer-Encoding", "EXPECT",
+    };
+    for ( int id = 0; id < HEADER_COUNT; ++id )
+    {
+        CHECK_EQ( http_parser::lookup_header( names[ id ], strlen( names[ id ] ) ), ( header_id )id );
+    }
+    static const char* const unknown[] = { "", "H", "Hosts", "Hist", "Content-Type", "Connectiom", "X-Range", "Accept" };
+    for ( size_t i = 0; i < sizeof( unknown ) / sizeof( unknown[0] ); ++i )
+    {
+        CHECK_EQ( http_parser::lookup_header( unknown[i], strlen( unknown[i] ) ), HEADER_UNKNOWN );
+    }
+	// 名称不以结束符结尾,只比较给定的长度
+    CHECK_EQ( http_parser::lookup_header( "Range: bytes", 5 ), HEADER_RANGE );
+}
+
+// 值去掉首尾的空白,空值和没有冒号的行
+static void test_split_header()
+{
+    str_view name, value;
+    std::string line = "Host: \t example.com \t";
+    CHECK( http_parser::split_header( line.data(), line.size(), name, value ) );
+    CHECK( name.equals_nocase( "host" ) );
+    CHECK( std::string( value.data, value.len ) == "example.com" );
+    line = "Range:bytes=0-1";
+    CHECK( http_parser::split_header( line.data(), line.size(), name, value ) );
+    CHECK( std::string( value.data, value.len ) == "bytes=0-1" );
+    line = "X-Empty:   ";
+    CHECK( http_parser::split_header( line.data(), line.size(), name, value ) );
+    CHECK( value.empty() );
+    line = "no colon here";
+    CHECK( ! http_parser::split_header( line.data(), line.size(), name, value ) );
+	// 值中的冒号属于值
+    line = "If-Range: Sun, 18 Oct 2026 00:40:26 GMT";
+    CHECK( http_parser::split_header( line.data(), line.size(), name, value ) );
+    CHECK( name.equals_nocase( "If-Range" ) && value.len == 29 );
+}
+
+int main()
+{
+    test_scanner_name();
+    test_find_line_end();
+    test_lookup_header();
+    test_split_header();
+    return TEST_RESULT();
+}
@@ -0,0 +1,487 @@
+#include <stdio.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <sys/stat.h>
+#include "test.h"
+#include "http_client.h"
+
+static int g_port;
+static std::string g_home;
+
+static std::string get( const char* url, const std::string& headers )
+{
+    return std::string( "GET " ) + url + " HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n" + headers + "\r\n";
+}
+
+// 单个区间,后缀区间,多个区间和无法满足的区间
+static void test_range()
+{
+    http_response r = fetch( g_port, get( "/home.html", "Range: bytes=0-9\r\n" ) );
+    CHECK_EQ( r.status, 206 );
+    CHECK( r.header( "Content-Range" ) == "bytes 0-9/" + std::to_string( g_home.size() ) );
+    CHECK( r.body == g_home.substr( 0, 10 ) );
+
+    r = fetch( g_port, get( "/home.html", "Range: bytes=-5\r\n" ) );
+    CHECK_EQ( r.status, 206 );
+    CHECK( r.body == g_home.substr( g_home.size() - 5 ) );
+
+    r = fetch( g_port, get( "/home.html", "Range: bytes=0-1,5-6\r\n" ) );
+    CHECK_EQ( r.status, 206 );
+    CHECK( r.header( "Content-Type" ).compare( 0, 20, "multipart/byteranges" ) == 0 );
+    CHECK( r.body.find( g_home.substr( 5, 2 ) ) != std::string::npos );
+    CHECK( r.body.find( "Content-Range: bytes 5-6/" ) != std::string::npos );
+
+    r = fetch( g_port, get( "/home.html", "Range: bytes=99999-\r\n" ) );
+    CHECK_EQ( r.status, 416 );
+    CHECK( r.header( "Content-Range" ) == "bytes */" + std::to_string( g_home.size() ) );
+}
+
+// 校验值与修改时间命中时返回304,If-Range不一致时返回整个文件
+static void test_conditional()
+{
+    http_response r = fetch( g_port, get( "/home.html", "" ) );
+    CHECK_EQ( r.status, 200 );
+    std::string etag = r.header( "ETag" );
+    std::string modified = r.header( "Last-Modified" );
+    CHECK( ! etag.empty() && ! modified.empty() );
+
+    r = fetch( g_port, get( "/home.html", "If-None-Match: " + etag + "\r\n" ) );
+    CHECK_EQ( r.status, 304 );
+    CHECK( r.header( "ETag" ) == etag );
+    CHECK( r.body.empty() );
+
+    r = fetch( g_port, get( "/home.html", "If-None-Match: \"other\", " + etag + "\r\n" ) );
+    CHECK_EQ( r.status, 304 );
+
+    r = fetch( g_port, get( "/home.html", "If-None-Match: \"other\"\r\n" ) );
+    CHECK_EQ( r.status, 200 );
+    CHECK( r.body == g_home );
+
+    r = fetch( g_port, get( "/home.html", "If-Modified-Since: " + modified + "\r\n" ) );
+    CHECK_EQ( r.status, 304 );
+
+    r = fetch( g_port, get( "/home.html", "If-Modified-Since: Thu, 01 Jan 1970 00:00:00 GMT\r\n" ) );
+    CHECK_EQ( r.status, 200 );
+
+	// If-None-Match不匹配时忽略If-Modified-Since
+    r = fetch( g_port, get( "/home.html", "If-None-Match: \"other\"\r\nIf-Modified-Since: " + modified + "\r\n" ) );
+    CHECK_EQ( r.status, 200 );
+
+    r = fetch( g_port, get( "/home.html", "Range: bytes=0-9\r\nIf-Range: " + etag + "\r\n" ) );
+    CHECK_EQ( r.status, 206 );
+    CHECK( r.body == g_home.substr( 0, 10 ) );
+
+    r = fetch( g_port, get( "/home.html", "Range: bytes=0-9\r\nIf-Range: \"other\"\r\n" ) );
+    CHECK_EQ( r.status, 200 );
+    CHECK( r.body == g_home );
+}
+
+// 首次请求不等待压缩,先发送原文件,后台生成压缩版本之后的请求得到压缩的内容
+static void test_compressed_variant()
+{
+    http_response r = fetch( g_port, get( "/home.html", "Accept-Encoding: gzip\r\n" ) );
+    CHECK_EQ( r.status, 200 );
+    CHECK( r.header( "Vary" ) == "Accept-Encoding" );
+    CHECK( r.header( "Content-Encoding" ).empty() );
+    CHECK( r.body == g_home );
+    for ( int i = 0; i < 100 && r.header( "Content-Encoding" ).empty(); ++i )
+    {
+        usleep( 10000 );
+        r = fetch( g_port, get( "/home.html", "Accept-Encoding: gzip\r\n" ) );
+    }
+    CHECK_EQ( r.status, 200 );
+    CHECK( r.header( "Content-Encoding" ) == "gzip" );
+    CHECK( r.body.size() < g_home.size() && r.body.compare( 0, 2, "\x1f\x8b" ) == 0 );
+}
+
+// 一次发送的多个请求按顺序得到各自的应答,最后一个请求要求关闭连接
+static void test_pipelining()
+{
+    std::string raw;
+    raw += "GET /home.html HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n";
+    raw += "GET /missing.html HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n";
+    raw += "GET /home.html HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\nRange: bytes=1-3\r\n\r\n";
+    raw += "HEAD /home.html HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    std::string data = exchange( g_port, raw );
+    size_t pos = 0;
+    http_response r;
+    CHECK( parse_response( data, pos, r ) && r.status == 200 && r.body == g_home );
+    CHECK( r.header( "Connection" ) == "keep-alive" );
+    CHECK( parse_response( data, pos, r ) && r.status == 404 );
+    CHECK( parse_response( data, pos, r ) && r.status == 206 && r.body == g_home.substr( 1, 3 ) );
+    CHECK( parse_response( data, pos, r, true ) && r.status == 200 );
+    CHECK( r.header( "Content-Length" ) == std::to_string( g_home.size() ) );
+    CHECK( r.header( "Connection" ) == "close" );
+    CHECK_EQ( pos, data.size() );
+
+	// 逐字节发送的请求与一次发送的结果相同
+    int fd = connect_to( g_port );
+    std::string one = "GET /home.html HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    for ( size_t i = 0; i < one.size(); ++i )
+    {
+        send( fd, one.data() + i, 1, MSG_NOSIGNAL );
+    }
+    data.clear();
+    char buf[ 4096 ];
+    ssize_t n;
+    while ( ( n = recv( fd, buf, sizeof( buf ), 0 ) ) > 0 )
+    {
+        data.append( buf, n );
+    }
+    close( fd );
+    pos = 0;
+    CHECK( parse_response( data, pos, r ) && r.status == 200 && r.body == g_home );
+}
+
+static std::string post( const std::string& headers, const std::string& body )
+{
+    return "POST /cgi-bin/search HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n" + headers + "\r\n" + body;
+}
+
+// 以Content-Length和分块传输发送的请求体得到相同的应答
+static void test_request_body()
+{
+    http_response plain = fetch( g_port, post( "Content-Length: 8\r\n", "book=abc" ) );
+    CHECK_EQ( plain.status, 200 );
+    http_response chunked = fetch( g_port, post( "Transfer-Encoding: chunked\r\n", "3\r\nboo\r\n5;ext=1\r\nk=abc\r\n0\r\nX-Trailer: 1\r\n\r\n" ) );
+    CHECK_EQ( chunked.status, 200 );
+    CHECK( chunked.body == plain.body );
+	// 块长度不是十六进制数
+    CHECK_EQ( fetch( g_port, post( "Transfer-Encoding: chunked\r\n", "zz\r\nbook=abc\r\n0\r\n\r\n" ) ).status, 400 );
+    CHECK_EQ( fetch( g_port, post( "Transfer-Encoding: gzip\r\n", "" ) ).status, 501 );
+}
+
+// Content-Length只能是十进制数字,不能溢出,重复时须一致,不能与分块传输同时出现
+static void test_content_length()
+{
+    static const char* const bad[] = { "-1", "abc", "1e3", "+8", " ", "8 8", "99999999999999999999999" };
+    for ( size_t i = 0; i < sizeof( bad ) / sizeof( bad[0] ); ++i )
+    {
+        http_response r = fetch( g_port, post( std::string( "Content-Length: " ) + bad[i] + "\r\n", "book=abc" ) );
+        CHECK_EQ( r.status, 400 );
+    }
+    CHECK_EQ( fetch( g_port, post( "Content-Length: 9999999999\r\n", "book=abc" ) ).status, 413 );
+    CHECK_EQ( fetch( g_port, post( "Content-Length: 8\r\nContent-Length: 9\r\n", "book=abc" ) ).status, 400 );
+    CHECK_EQ( fetch( g_port, post( "Content-Length: 8\r\nContent-Length: 008\r\n", "book=abc" ) ).status, 200 );
+    CHECK_EQ( fetch( g_port, post( "Content-Length: 5\r\nTransfer-Encoding: chunked\r\n", "0\r\n\r\n" ) ).status, 400 );
+    CHECK_EQ( fetch( g_port, post( "Transfer-Encoding: chunked\r\nContent-Length: 5\r\n", "0\r\n\r\n" ) ).status, 400 );
+}
+
+// 查询参数超出缓冲区时返回414,服务器继续正常服务;恰好放得下的仍按普通请求处理
+static void test_long_query()
+{
+    std::string fit( 199, 'A' );
+    std::string url = "/cgi-bin/nope?" + fit;
+    CHECK_EQ( fetch( g_port, get( url.c_str(), "" ) ).status, 404 );
+    url = "/cgi-bin/search?" + fit;
+    CHECK_EQ( fetch( g_port, get( url.c_str(), "" ) ).status, 200 );
+    static const size_t lengths[] = { 200, 260, 4000, 60000 };
+    for ( size_t i = 0; i < sizeof( lengths ) / sizeof( lengths[0] ); ++i )
+    {
+        std::string query( lengths[i], 'A' );
+        url = "/cgi-bin/nope?" + query;
+        CHECK_EQ( fetch( g_port, get( url.c_str(), "" ) ).status, 414 );
+        url = "/cgi-bin/search?" + query;
+        CHECK_EQ( fetch( g_port, get( url.c_str(), "" ) ).status, 414 );
+    }
+    CHECK_EQ( fetch( g_port, get( "/home.html", "" ) ).status, 200 );
+}
+
+// 带有Expect: 100-continue的请求先得到100 Continue,发送请求体之后得到最终的应答
+static void test_expect_continue()
+{
+    int fd = connect_to( g_port );
+    std::string head = post( "Content-Length: 8\r\nExpect: 100-continue\r\n", "" );
+    send( fd, head.data(), head.size(), MSG_NOSIGNAL );
+    char buf[ 4096 ];
+    ssize_t n = recv( fd, buf, sizeof( buf ), 0 );
+    CHECK( n > 0 && std::string( buf, n ) == "HTTP/1.1 100 Continue\r\n\r\n" );
+    send( fd, "book=abc", 8, MSG_NOSIGNAL );
+    std::string data;
+    while ( ( n = recv( fd, buf, sizeof( buf ), 0 ) ) > 0 )
+    {
+        data.append( buf, n );
+    }
+    close( fd );
+    size_t pos = 0;
+    http_response r;
+    CHECK( parse_response( data, pos, r ) && r.status == 200 );
+	// 请求体与头部一起到达时不需要100 Continue
+    r = fetch( g_port, post( "Content-Length: 8\r\nExpect: 100-continue\r\n", "book=abc" ) );
+    CHECK_EQ( r.status, 200 );
+}
+
+// 进程已退出(不存在或者是尚未回收的僵尸进程)
+static bool process_gone( pid_t pid )
+{
+    char path[ 64 ];
+    snprintf( path, sizeof( path ), "/proc/%d/stat", ( int )pid );
+    std::string stat = read_file( path );
+    size_t paren = stat.rfind( ')' );
+    return stat.empty() || ( paren != std::string::npos && stat.compare( paren + 2, 1, "Z" ) == 0 );
+}
+
+// CGI程序超时返回504,程序创建的子进程随整个进程组一起终止
+static void test_cgi_timeout()
+{
+    const char* script = "cgi-bin/t_http_test_sleep";
+    const char* pid_file = "/tmp/t_http_test_sleep.pid";
+    FILE* fp = fopen( script, "w" );
+    fprintf( fp, "#!/bin/sh\nsleep 30 &\necho $! > %s\nsleep 30\n", pid_file );
+    fclose( fp );
+    chmod( script, 0755 );
+    unlink( pid_file );
+    {
+        std::vector< std::string > args;
+        args.push_back( "--cgi-timeout" );
+        args.push_back( "1" );
+        test_server server( args );
+        http_response r = fetch( server.port, get( "/cgi-bin/t_http_test_sleep", "" ) );
+        CHECK_EQ( r.status, 504 );
+        pid_t child = atoi( read_file( pid_file ).c_str() );
+        CHECK( child > 0 );
+        bool gone = false;
+        for ( int i = 0; i < 100 && ! gone; ++i )
+        {
+            gone = process_gone( child );
+            usleep( 20000 );
+        }
+        CHECK( gone );
+    }
+    unlink( script );
+    unlink( pid_file );
+}
+
+// 本机的一个非回环地址,没有时返回空串
+static std::string external_address()
+{
+    std::string result;
+    ifaddrs* list;
+    if ( getifaddrs( &list ) < 0 )
+    {
+        return result;
+    }
+    for ( ifaddrs* p = list; p && result.empty(); p = p->ifa_next )
+    {
+        if ( p->ifa_addr && p->ifa_addr->sa_family == AF_INET && ! ( p->ifa_flags & IFF_LOOPBACK ) )
+        {
+            char buf[ INET_ADDRSTRLEN ];
+            inet_ntop( AF_INET, &( ( sockaddr_in* )p->ifa_addr )->sin_addr, buf, sizeof( buf ) );
+            result = buf;
+        }
+    }
+    freeifaddrs( list );
+    return result;
+}
+
+// 统计页面只提供给回环地址的客户端
+static void test_stats_local_only()
+{
+    test_server server( std::vector< std::string >(), "0.0.0.0" );
+    http_response r = fetch( server.port, get( "/_stats", "" ) );
+    CHECK_EQ( r.status, 200 );
+    CHECK( r.body.find( "connections" ) != std::string::npos );
+    std::string ip = external_address();
+    if ( ip.empty() )
+    {
+        printf( "no external address, skip the remote /_stats check\n" );
+        return;
+    }
+    r = fetch( server.port, get( "/_stats?format=prometheus", "" ), false, ip.c_str() );
+    CHECK_EQ( r.status, 404 );
+    r = fetch( server.port, get( "/home.html", "" ), false, ip.c_str() );
+    CHECK_EQ( r.status, 200 );
+}
+
+// 访问日志在应答发送完毕后写出,记录发送的字节数;客户端中途断开时标记aborted=1;
+// --no-access-log时不写访问日志
+static void test_access_log()
+{
+    char dir[] = "/tmp/http_test_log.XXXXXX";
+    CHECK( mkdtemp( dir ) != NULL );
+    const char* big = "file/t_http_test_big.bin";
+    const size_t big_size = 16 << 20;
+    {
+        std::vector< std::string > args;
+        args.push_back( "--log-dir" );
+        args.push_back( dir );
+        test_server server( args );
+		// 比套接字缓冲区大得多的文件,客户端只读一点就关闭,服务器来不及发完;
+		// 服务器启动时会为file目录中的文件重建过期的书籍索引,启动之后再创建
+        FILE* fp = fopen( big, "w" );
+        std::string block( 1 << 20, 'x' );
+        for ( size_t i = 0; i < big_size; i += block.size() )
+        {
+            fwrite( block.data(), 1, block.size(), fp );
+        }
+        fclose( fp );
+        http_response r = fetch( server.port, get( "/home.html", "" ) );
+        CHECK_EQ( r.status, 200 );
+        int fd = socket( AF_INET, SOCK_STREAM, 0 );
+        int rcvbuf = 4096;
+        setsockopt( fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof( rcvbuf ) );
+        sockaddr_in addr = sockaddr_in();
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons( server.port );
+        inet_pton( AF_INET, "127.0.0.1", &addr.sin_addr );
+        CHECK( connect( fd, ( sockaddr* )&addr, sizeof( addr ) ) == 0 );
+        std::string raw = get( "/file/t_http_test_big.bin", "" );
+        send( fd, raw.data(), raw.size(), MSG_NOSIGNAL );
+        char buf[ 1024 ];
+        CHECK( recv( fd, buf, sizeof( buf ), 0 ) > 0 );
+        close( fd );
+		// 等服务器发现连接已断开
+        usleep( 300000 );
+    }
+    std::string log = read_file( ( std::string( dir ) + "/access.log" ).c_str() );
+    std::string home_line = "url=\"/home.html\" status=200 bytes=";
+    size_t pos = log.find( home_line );
+    CHECK( pos != std::string::npos );
+    if ( pos != std::string::npos )
+    {
+		// 字节数包括头部,至少是文件的大小,而且发送完毕,没有aborted标记
+        unsigned long bytes = strtoul( log.c_str() + pos + home_line.size(), NULL, 10 );
+        CHECK( bytes > g_home.size() );
+        size_t end = log.find( '\n', pos );
+        CHECK( log.substr( pos, end - pos ).find( "aborted" ) == std::string::npos );
+    }
+    std::string big_line = "url=\"/file/t_http_test_big.bin\" status=200 bytes=";
+    pos = log.find( big_line );
+    CHECK( pos != std::string::npos );
+    if ( pos != std::string::npos )
+    {
+        unsigned long bytes = strtoul( log.c_str() + pos + big_line.size(), NULL, 10 );
+        CHECK( bytes < big_size );
+        size_t end = log.find( '\n', pos );
+        CHECK( log.substr( pos, end - pos ).find( "aborted=1" ) != std::string::npos );
+    }
+    unlink( big );
+    unlink( ( std::string( dir ) + "/access.log" ).c_str() );
+    {
+        std::vector< std::string > args;
+        args.push_back( "--log-dir" );
+        args.push_back( dir );
+        args.push_back( "--no-access-log" );
+        test_server server( args );
+        http_response r = fetch( server.port, get( "/home.html", "" ) );
+        CHECK_EQ( r.status, 200 );
+    }
+    CHECK( read_file( ( std::string( dir ) + "/access.log" ).c_str() ).empty() );
+    std::string cleanup = std::string( "rm -rf " ) + dir;
+    CHECK( system( cleanup.c_str() ) == 0 );
+}
+
+// io_uring后端以sendmsg发送内存段,大文件经管道以splice发送:同一连接上先后的应答完整,
+// 区间应答中文件段与内存段交替,客户端中途断开不影响后续请求;内核不支持时退回epoll,结果相同
+static void test_uring_send()
+{
+    std::vector< std::string > args;
+    args.push_back( "--reactors" );
+    args.push_back( "1" );
+    args.push_back( "--io-uring" );
+    test_server server( args );
+	// 不小于sendfile阈值的文件作为文件段发送,启动之后再创建,以免重建书籍索引
+    const char* path = "file/t_http_test_uring.bin";
+    std::string content;
+    for ( size_t i = 0; i < ( 1 << 20 ) + 12345; ++i )
+    {
+        content += ( char )( i % 251 );
+    }
+    FILE* fp = fopen( path, "w" );
+    fwrite( content.data(), 1, content.size(), fp );
+    fclose( fp );
+
+    std::string raw = "GET /file/t_http_test_uring.bin HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n" + get( "/home.html", "" );
+    std::string data = exchange( server.port, raw );
+    size_t pos = 0;
+    http_response r;
+    CHECK( parse_response( data, pos, r ) );
+    CHECK_EQ( r.status, 200 );
+    CHECK( r.body == content );
+    CHECK( parse_response( data, pos, r ) );
+    CHECK_EQ( r.status, 200 );
+    CHECK( r.body == g_home );
+
+    r = fetch( server.port, get( "/file/t_http_test_uring.bin", "Range: bytes=10-99999,500000-\r\n" ) );
+    CHECK_EQ( r.status, 206 );
+    CHECK( r.body.find( content.substr( 10, 99990 ) ) != std::string::npos );
+    CHECK( r.body.find( content.substr( 500000 ) ) != std::string::npos );
+
+    int fd = socket( AF_INET, SOCK_STREAM, 0 );
+    int rcvbuf = 4096;
+    setsockopt( fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof( rcvbuf ) );
+    sockaddr_in addr = sockaddr_in();
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( server.port );
+    inet_pton( AF_INET, "127.0.0.1", &addr.sin_addr );
+    CHECK( connect( fd, ( sockaddr* )&addr, sizeof( addr ) ) == 0 );
+    raw = get( "/file/t_http_test_uring.bin", "" );
+    send( fd, raw.data(), raw.size(), MSG_NOSIGNAL );
+    char buf[ 1024 ];
+    CHECK( recv( fd, buf, sizeof( buf ), 0 ) > 0 );
+    close( fd );
+    usleep( 100000 );
+    r = fetch( server.port, get( "/file/t_http_test_uring.bin", "" ) );
+    CHECK_EQ( r.status, 200 );
+    CHECK( r.body == content );
+    unlink( path );
+}
+
+// 收到SIGTERM后空闲的连接立即关闭,正在进行的请求完成后服务器退出
+static void test_drain()
+{
+    test_server server;
+    int idle = connect_to( server.port );
+    int busy = connect_to( server.port );
+    CHECK( idle >= 0 && busy >= 0 );
+	// 不完整的请求,服务器须等待其余部分
+    std::string partial = "GET /home.html HTTP/1.1\r\nHost: localhost\r\n";
+    send( busy, partial.data(), partial.size(), MSG_NOSIGNAL );
+    usleep( 100000 );
+    kill( server.pid, SIGTERM );
+    char c;
+    CHECK_EQ( recv( idle, &c, 1, 0 ), 0 );
+    send( busy, "\r\n", 2, MSG_NOSIGNAL );
+    std::string data;
+    char buf[ 4096 ];
+    ssize_t n;
+    while ( ( n = recv( busy, buf, sizeof( buf ), 0 ) ) > 0 )
+    {
+        data.append( buf, n );
+    }
+    size_t pos = 0;
+    http_response r;
+    CHECK( parse_response( data, pos, r ) );
+    CHECK_EQ( r.status, 200 );
+    CHECK( r.header( "Connection" ) == "close" );
+    int status = -1;
+    for ( int i = 0; i < 100 && waitpid( server.pid, &status, WNOHANG ) == 0; ++i )
+    {
+        usleep( 20000 );
+    }
+    CHECK( WIFEXITED( status ) );
+    server.pid = -1;
+    close( idle );
+    close( busy );
+}
+
+int main()
+{
+    g_home = read_file( "home.html" );
+    test_server server;
+    g_port = server.port;
+    test_range();
+    test_conditional();
+    test_compressed_variant();
+    test_pipelining();
+    test_request_body();
+    test_content_length();
+    test_long_query();
+    test_expect_continue();
+    test_cgi_timeout();
+    test_stats_local_only();
+    test_access_log();
+    test_uring_send();
+    test_drain();
+    return TEST_RESULT();
+}
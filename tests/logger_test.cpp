@@ -0,0 +1,191 @@
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include "test.h"
+#include "../logger.h"
+#include "../metrics.h"
+
+static const int BATCHES = 8;
+static const int MESSAGES_PER_BATCH = 40;
+static const size_t MAX_BYTES = 4096;
+static const int SHORT_THREADS = 20;
+
+// 目录中名称以prefix开头的文件
+static std::vector< std::string > list_files( const std::string& dir, const std::string& prefix )
+{
+    std::vector< std::string > names;
+    DIR* d = opendir( dir.c_str() );
+    if ( ! d )
+    {
+        return names;
+    }
+    while ( struct dirent* e = readdir( d ) )
+    {
+        if ( strncmp( e->d_name, prefix.c_str(), prefix.size() ) == 0 )
+        {
+            names.push_back( e->d_name );
+        }
+    }
+    closedir( d );
+    return names;
+}
+
+static std::string read_all( const std::string& path )
+{
+    std::string data;
+    FILE* f = fopen( path.c_str(), "r" );
+    if ( ! f )
+    {
+        return data;
+    }
+    char buf[ 4096 ];
+    size_t n;
+    while ( ( n = fread( buf, 1, sizeof( buf ), f ) ) > 0 )
+    {
+        data.append( buf, n );
+    }
+    fclose( f );
+    return data;
+}
+
+// 轮转后的文件名为"名称.年月日-时分秒",同一秒内再次轮转时加".序号"
+static bool rotated_name( const std::string& name, const std::string& base )
+{
+    if ( name.size() < base.size() + 16 || name.compare( 0, base.size(), base ) != 0 )
+    {
+        return false;
+    }
+    const char* p = name.c_str() + base.size();
+    if ( p[0] != '.' || p[9] != '-' )
+    {
+        return false;
+    }
+    for ( int i = 1; i < 16; ++i )
+    {
+        if ( i != 9 && ( p[i] < '0' || p[i] > '9' ) )
+        {
+            return false;
+        }
+    }
+    p += 16;
+    if ( *p == '\0' )
+    {
+        return true;
+    }
+    return *p == '.' && p[1] && strspn( p + 1, "0123456789" ) == strlen( p + 1 );
+}
+
+static void* short_thread( void* arg )
+{
+    ERROR_LOG( "short thread %d", *( int* )arg );
+    metrics::add( metrics::ACCEPTS );
+    return NULL;
+}
+
+// 依次创建许多短命的线程,退出线程的日志缓冲区和统计数据块被复用,不随线程数增长,
+// 统计数据仍然计入
+static void test_thread_reuse()
+{
+    ERROR_LOG( "main thread" );
+    metrics::add( metrics::ACCEPTS );
+    size_t buffers = logger::buffers();
+    size_t blocks = metrics::blocks();
+    for ( int i = 0; i < SHORT_THREADS; ++i )
+    {
+        pthread_t thread;
+        CHECK( pthread_create( &thread, NULL, short_thread, &i ) == 0 );
+        pthread_join( thread, NULL );
+		// 等后台线程取走退出线程的消息
+        usleep( 50 * 1000 );
+    }
+    CHECK( logger::buffers() <= buffers + 1 );
+    CHECK( metrics::blocks() <= blocks + 1 );
+    std::string text;
+    metrics::render_text( metrics::gauges(), text );
+    char line[ 64 ];
+    snprintf( line, sizeof( line ), "accepts %d\n", SHORT_THREADS + 1 );
+    CHECK( text.find( line ) != std::string::npos );
+}
+
+// 文件超过上限时按批轮转,每条消息恰好出现在一个文件中;日志已由main启动
+static void test_size_rotation( const std::string& dir )
+{
+    for ( int b = 0; b < BATCHES; ++b )
+    {
+        for ( int i = 0; i < MESSAGES_PER_BATCH; ++i )
+        {
+            ACCESS_LOG( "client=127.0.0.1:1 method=GET url=\"/msg-%d-%d\" status=200 bytes=%d ms=0", b, i, b * 100 + i );
+        }
+		// 等后台线程写出这一批,下一批写入轮转后的文件
+        usleep( 60 * 1000 );
+    }
+    ERROR_LOG( "error stream message" );
+    logger::stop();
+
+    std::vector< std::string > files = list_files( dir, "access.log" );
+    int rotated = 0;
+    std::string all;
+    for ( size_t i = 0; i < files.size(); ++i )
+    {
+        std::string path = dir + "/" + files[i];
+        std::string data = read_all( path );
+        if ( files[i] != "access.log" )
+        {
+            ++rotated;
+            CHECK( rotated_name( files[i], "access.log" ) );
+			// 写满上限之后才轮转
+            CHECK( data.size() >= MAX_BYTES );
+        }
+        all += data;
+    }
+    CHECK( rotated >= 2 );
+    for ( int b = 0; b < BATCHES; ++b )
+    {
+        for ( int i = 0; i < MESSAGES_PER_BATCH; ++i )
+        {
+            char text[ 64 ];
+            snprintf( text, sizeof( text ), "url=\"/msg-%d-%d\"", b, i );
+            size_t pos = all.find( text );
+            CHECK( pos != std::string::npos );
+            CHECK( pos == std::string::npos || all.find( text, pos + 1 ) == std::string::npos );
+        }
+    }
+	// 错误日志很小,不轮转,与访问日志分开
+    std::vector< std::string > errors = list_files( dir, "error.log" );
+    CHECK_EQ( errors.size(), ( size_t )1 );
+    std::string error_log = read_all( dir + "/error.log" );
+    CHECK( error_log.find( "ERROR" ) != std::string::npos );
+    CHECK( error_log.find( "error stream message" ) != std::string::npos );
+    CHECK( error_log.find( "msg-" ) == std::string::npos );
+    for ( int i = 0; i < SHORT_THREADS; ++i )
+    {
+        char text[ 32 ];
+        snprintf( text, sizeof( text ), "short thread %d\n", i );
+        CHECK( error_log.find( text ) != std::string::npos );
+    }
+}
+
+int main()
+{
+    char dir[] = "/tmp/logger_test.XXXXXX";
+    if ( ! mkdtemp( dir ) )
+    {
+        perror( "mkdtemp" );
+        return 1;
+    }
+    CHECK( logger::start( dir, MAX_BYTES, 0 ) );
+    test_thread_reuse();
+    test_size_rotation( dir );
+    std::string cleanup = std::string( "rm -rf " ) + dir;
+    if ( system( cleanup.c_str() ) != 0 )
+    {
+        fprintf( stderr, "remove %s failed\n", dir );
+    }
+    return TEST_RESULT();
+}
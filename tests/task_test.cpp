@@ -0,0 +1,185 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <stdexcept>
+#include <string>
+#include "test.h"
+#include "../task.h"
+
+// 记录协程帧中局部对象的析构,协程被销毁时应随之析构
+static int g_destroyed = 0;
+
+struct guard
+{
+    ~guard() { ++g_destroyed; }
+};
+
+// 取出next写入的内容
+static std::string take( response_writer& writer )
+{
+    std::string data;
+    data.swap( writer.pending() );
+    return data;
+}
+
+static stream_task three_parts( std::string args, response_writer& out )
+{
+    out.append( args );
+    co_await stream_task::flush();
+    out.append( "b" );
+    co_await stream_task::flush();
+    out.append( "c" );
+}
+
+// 每次next执行到下一个flush,最后一部分返回false;参数是创建时的副本
+static void test_resume()
+{
+    char args[] = "a";
+    task_stream stream( three_parts, args );
+    args[0] = 'x';
+    response_writer writer;
+    CHECK( stream.next( writer ) );
+    CHECK_EQ( take( writer ), "a" );
+    CHECK( stream.next( writer ) );
+    CHECK_EQ( take( writer ), "b" );
+    CHECK( ! stream.next( writer ) );
+    CHECK_EQ( take( writer ), "c" );
+    CHECK( ! stream.failed() );
+    unsigned int events;
+    CHECK_EQ( stream.delay(), 0u );
+    CHECK_EQ( stream.wait_fd( events ), -1 );
+}
+
+static stream_task sleeper( std::string, response_writer& out )
+{
+    out.append( "1" );
+    co_await stream_task::sleep( 50 );
+    out.append( "2" );
+    co_await stream_task::sleep( 0 );
+    out.append( "3" );
+    co_await stream_task::flush();
+}
+
+// sleep的等待时间只对这一次next有效,0按1毫秒计,避免与不等待混淆
+static void test_sleep()
+{
+    task_stream stream( sleeper, "" );
+    response_writer writer;
+    CHECK( stream.next( writer ) );
+    CHECK_EQ( stream.delay(), 50u );
+    CHECK( stream.next( writer ) );
+    CHECK_EQ( stream.delay(), 1u );
+    CHECK( stream.next( writer ) );
+    CHECK_EQ( stream.delay(), 0u );
+    CHECK( ! stream.next( writer ) );
+    CHECK_EQ( take( writer ), "123" );
+}
+
+static stream_task pipe_reader( std::string args, response_writer& out )
+{
+    int fd = atoi( args.c_str() );
+    char buf[ 16 ];
+    ssize_t n;
+    while ( ( n = read( fd, buf, sizeof( buf ) ) ) != 0 )
+    {
+        if ( n < 0 )
+        {
+            co_await stream_task::readable( fd );
+            continue;
+        }
+        out.append( buf, n );
+    }
+}
+
+// 等待描述符可读:按事件循环的做法注册到epoll,就绪后再次next,读到的内容随之写出
+static void test_readable()
+{
+    int fds[2];
+    CHECK( pipe2( fds, O_NONBLOCK ) == 0 );
+    int epollfd = epoll_create1( 0 );
+    task_stream stream( pipe_reader, std::to_string( fds[0] ).c_str() );
+    response_writer writer;
+    unsigned int events = 0;
+    CHECK( stream.next( writer ) );
+    CHECK_EQ( stream.wait_fd( events ), fds[0] );
+    CHECK_EQ( events, ( unsigned int )EPOLLIN );
+    CHECK( take( writer ).empty() );
+
+    epoll_event event;
+    event.data.u64 = 7;
+    event.events = events | EPOLLET | EPOLLONESHOT;
+    CHECK( epoll_ctl( epollfd, EPOLL_CTL_ADD, fds[0], &event ) == 0 );
+    CHECK_EQ( epoll_wait( epollfd, &event, 1, 0 ), 0 );
+    CHECK( write( fds[1], "ready", 5 ) == 5 );
+    CHECK_EQ( epoll_wait( epollfd, &event, 1, 1000 ), 1 );
+    CHECK_EQ( event.data.u64, 7u );
+    epoll_ctl( epollfd, EPOLL_CTL_DEL, fds[0], NULL );
+
+    CHECK( stream.next( writer ) );
+    CHECK_EQ( take( writer ), "ready" );
+    CHECK_EQ( stream.wait_fd( events ), fds[0] );
+    close( fds[1] );
+    CHECK( ! stream.next( writer ) );
+    CHECK_EQ( stream.wait_fd( events ), -1 );
+    close( fds[0] );
+    close( epollfd );
+}
+
+static stream_task guarded( std::string, response_writer& out )
+{
+    guard g;
+    out.append( "x" );
+    co_await stream_task::flush();
+    out.append( "never" );
+}
+
+// 挂起中的协程随task_stream删除,帧中的局部对象析构,之后的内容不再生成;
+// 尚未开始执行的协程删除时,还没有构造的局部对象不析构
+static void test_destroy_suspended()
+{
+    g_destroyed = 0;
+    {
+        task_stream stream( guarded, "" );
+    }
+    CHECK_EQ( g_destroyed, 0 );
+    response_writer writer;
+    {
+        task_stream stream( guarded, "" );
+        CHECK( stream.next( writer ) );
+        CHECK_EQ( g_destroyed, 0 );
+    }
+    CHECK_EQ( g_destroyed, 1 );
+    CHECK_EQ( take( writer ), "x" );
+}
+
+static stream_task thrower( std::string, response_writer& out )
+{
+    guard g;
+    out.append( "partial" );
+    co_await stream_task::flush();
+    throw std::runtime_error( "broken" );
+}
+
+// 处理函数抛出异常:协程结束,failed为true,局部对象已析构,连接据此关闭
+static void test_exception()
+{
+    g_destroyed = 0;
+    task_stream stream( thrower, "" );
+    response_writer writer;
+    CHECK( stream.next( writer ) );
+    CHECK( ! stream.failed() );
+    CHECK( ! stream.next( writer ) );
+    CHECK( stream.failed() );
+    CHECK_EQ( g_destroyed, 1 );
+    CHECK_EQ( take( writer ), "partial" );
+}
+
+int main()
+{
+    test_resume();
+    test_sleep();
+    test_readable();
+    test_destroy_suspended();
+    test_exception();
+    return TEST_RESULT();
+}
@@ -0,0 +1,24 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+// 测试用的最小断言:失败时输出位置并计数,不中止,main最后以TEST_RESULT返回
+static int g_test_failures = 0;
+
+#define CHECK( cond ) \
+    do \
+    { \
+        if ( ! ( cond ) ) \
+        { \
+            fprintf( stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond ); \
+            ++g_test_failures; \
+        } \
+    } while ( 0 )
+
+#define CHECK_EQ( a, b ) CHECK( ( a ) == ( b ) )
+
+#define TEST_RESULT() \
+    ( printf( "%s: %s\n", __FILE__, g_test_failures ? "FAILED" : "ok" ), g_test_failures ? 1 : 0 )
+
+#endif
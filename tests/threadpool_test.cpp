@@ -0,0 +1,171 @@
+#include <pthread.h>
+#include <unistd.h>
+#include <atomic>
+#include <vector>
+#include "test.h"
+#include "../threadpool.h"
+
+// 测试用的任务,记录被处理的次数,gate不为空时等待其打开
+struct task
+{
+    std::atomic< int > runs;
+    std::atomic< bool >* gate;
+    std::atomic< int >* done;
+
+    task() : runs( 0 ), gate( NULL ), done( NULL ) {}
+    void process()
+    {
+        while ( gate && ! gate->load() )
+        {
+            usleep( 1000 );
+        }
+        runs.fetch_add( 1 );
+        done->fetch_add( 1 );
+    }
+};
+
+static const int PRODUCERS = 4;
+static const int TASKS_PER_PRODUCER = 20000;
+
+struct producer_arg
+{
+    threadpool< task >* pool;
+    task* tasks;
+};
+
+// 队列满时重试,直到所有任务入队
+static void* produce( void* arg )
+{
+    producer_arg* p = ( producer_arg* )arg;
+    for ( int i = 0; i < TASKS_PER_PRODUCER; ++i )
+    {
+        while ( ! p->pool->append( &p->tasks[i] ) )
+        {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static bool wait_for( std::atomic< int >& value, int expected )
+{
+    for ( int i = 0; i < 5000 && value.load() != expected; ++i )
+    {
+        usleep( 1000 );
+    }
+    return value.load() == expected;
+}
+
+// 多个生产者并发入队,每个任务恰好被处理一次
+static void test_mpmc()
+{
+    std::atomic< int > done( 0 );
+    std::vector< task > tasks( PRODUCERS * TASKS_PER_PRODUCER );
+    for ( size_t i = 0; i < tasks.size(); ++i )
+    {
+        tasks[i].done = &done;
+    }
+    {
+        threadpool< task > pool( 4, 64 );
+        pthread_t threads[ PRODUCERS ];
+        producer_arg args[ PRODUCERS ];
+        for ( int i = 0; i < PRODUCERS; ++i )
+        {
+            args[i].pool = &pool;
+            args[i].tasks = &tasks[ i * TASKS_PER_PRODUCER ];
+            pthread_create( &threads[i], NULL, produce, &args[i] );
+        }
+        for ( int i = 0; i < PRODUCERS; ++i )
+        {
+            pthread_join( threads[i], NULL );
+        }
+        CHECK( wait_for( done, PRODUCERS * TASKS_PER_PRODUCER ) );
+    }
+    int wrong = 0;
+    for ( size_t i = 0; i < tasks.size(); ++i )
+    {
+        wrong += tasks[i].runs.load() != 1;
+    }
+    CHECK_EQ( wrong, 0 );
+}
+
+// 槽位数取2的幂,全部占满之后入队失败,取走之后又可以入队
+static void test_full()
+{
+    std::atomic< bool > gate( false );
+    std::atomic< int > done( 0 );
+    task blocker;
+    blocker.gate = &gate;
+    blocker.done = &done;
+    std::vector< task > tasks( 3 );
+    for ( size_t i = 0; i < tasks.size(); ++i )
+    {
+        tasks[i].done = &done;
+    }
+    threadpool< task > pool( 1, 2 );
+    CHECK( pool.append( &blocker ) );
+	// 等待唯一的工作线程取走blocker并阻塞在其中
+    usleep( 50000 );
+    CHECK( pool.append( &tasks[0] ) );
+    CHECK( pool.append( &tasks[1] ) );
+    CHECK( ! pool.append( &tasks[2] ) );
+    gate.store( true );
+    CHECK( wait_for( done, 3 ) );
+    CHECK( pool.append( &tasks[2] ) );
+    CHECK( wait_for( done, 4 ) );
+}
+
+// 任务排队过久时过载,队列排空之后平均排队时间清零,新的请求不再被拒绝
+static void test_overload_reset()
+{
+    static const uint64_t LIMIT_NS = 10 * 1000000ULL;
+    std::atomic< bool > gate1( false );
+    std::atomic< bool > gate2( false );
+    std::atomic< int > done( 0 );
+    task blocker1, blocker2, blocker3;
+    blocker1.gate = &gate1;
+    blocker2.gate = &gate2;
+    blocker3.gate = &gate2;
+    blocker1.done = blocker2.done = blocker3.done = &done;
+    std::vector< task > tasks( 10 );
+    for ( size_t i = 0; i < tasks.size(); ++i )
+    {
+        tasks[i].done = &done;
+    }
+    threadpool< task > pool( 1, 64 );
+    CHECK( pool.append( &blocker1 ) );
+    usleep( 50000 );
+	// 这些任务都要等待blocker1,排队时间约50毫秒
+    for ( int i = 0; i < 8; ++i )
+    {
+        CHECK( pool.append( &tasks[i] ) );
+    }
+    CHECK( pool.append( &blocker2 ) );
+    CHECK( pool.append( &tasks[8] ) );
+    usleep( 50000 );
+    CHECK( ! pool.overloaded( LIMIT_NS ) );
+    gate1.store( true );
+	// 工作线程处理完8个任务后阻塞在blocker2中,tasks[8]仍在队列中
+    CHECK( wait_for( done, 9 ) );
+    usleep( 20000 );
+    CHECK( pool.overloaded( LIMIT_NS ) );
+    gate2.store( true );
+    CHECK( wait_for( done, 11 ) );
+    usleep( 20000 );
+	// 队列已排空,新的任务排在阻塞的任务之后,不因之前的突发而判为过载
+    gate2.store( false );
+    CHECK( pool.append( &blocker3 ) );
+    usleep( 20000 );
+    CHECK( pool.append( &tasks[9] ) );
+    CHECK( ! pool.overloaded( LIMIT_NS ) );
+    gate2.store( true );
+    CHECK( wait_for( done, 13 ) );
+}
+
+int main()
+{
+    test_mpmc();
+    test_full();
+    test_overload_reset();
+    return TEST_RESULT();
+}
@@ -0,0 +1,115 @@
+#include <vector>
+#include "test.h"
+#include "../timer_wheel.h"
+
+// 推进到now,返回到期节点的data,按到期顺序
+static std::vector< long > expire( timer_wheel& wheel, uint64_t now )
+{
+    std::vector< long > ids;
+    timer_wheel::node expired;
+    wheel.advance( now, &expired );
+    timer_wheel::node* n;
+    while ( ( n = timer_wheel::pop( &expired ) ) != NULL )
+    {
+        ids.push_back( ( long )n->data );
+    }
+    return ids;
+}
+
+// 截止时间按刻度向上取整,到期之前不会取出
+static void test_expire()
+{
+    timer_wheel wheel( 0 );
+    timer_wheel::node a, b;
+    timer_wheel::init_node( &a, ( void* )1 );
+    timer_wheel::init_node( &b, ( void* )2 );
+    CHECK_EQ( wheel.next_timeout( 0 ), -1 );
+    wheel.schedule( &a, 250 );
+    wheel.schedule( &b, 100 );
+    CHECK_EQ( wheel.size(), 2u );
+    CHECK_EQ( wheel.next_timeout( 0 ), 100 );
+    CHECK( expire( wheel, 99 ).empty() );
+    std::vector< long > ids = expire( wheel, 100 );
+    CHECK( ids.size() == 1 && ids[0] == 2 );
+    CHECK( ! timer_wheel::pending( &b ) );
+    CHECK( expire( wheel, 299 ).empty() );
+    ids = expire( wheel, 300 );
+    CHECK( ids.size() == 1 && ids[0] == 1 );
+    CHECK_EQ( wheel.size(), 0u );
+}
+
+// 重新设置会先取消原来的定时器,取消后不再到期
+static void test_reschedule_cancel()
+{
+    timer_wheel wheel( 1000 );
+    timer_wheel::node a, b;
+    timer_wheel::init_node( &a, ( void* )1 );
+    timer_wheel::init_node( &b, ( void* )2 );
+    wheel.schedule( &a, 1200 );
+    wheel.schedule( &a, 5000 );
+    wheel.schedule( &b, 1200 );
+    wheel.cancel( &b );
+    wheel.cancel( &b );
+    CHECK_EQ( wheel.size(), 1u );
+    CHECK( expire( wheel, 4900 ).empty() );
+    std::vector< long > ids = expire( wheel, 5000 );
+    CHECK( ids.size() == 1 && ids[0] == 1 );
+}
+
+// 远期的定时器放在高层,低层转完一圈时逐层下移,仍在正确的刻度到期
+static void test_cascade()
+{
+    timer_wheel wheel( 0 );
+    static const uint64_t due[] = { 6400, 6500, 409600, 409700, 30000000 };
+    const int count = sizeof( due ) / sizeof( due[0] );
+    timer_wheel::node nodes[ count ];
+    for ( int i = 0; i < count; ++i )
+    {
+        timer_wheel::init_node( &nodes[i], ( void* )( long )i );
+        wheel.schedule( &nodes[i], due[i] );
+    }
+    std::vector< timer_wheel::node* > all;
+    wheel.collect( all );
+    CHECK_EQ( all.size(), ( size_t )count );
+	// 以事件循环的方式推进:每次前进到next_timeout给出的时间
+    uint64_t now = 0;
+    int next = 0;
+    while ( wheel.size() > 0 && now < 40000000 )
+    {
+        now += wheel.next_timeout( now );
+        std::vector< long > ids = expire( wheel, now );
+        for ( size_t i = 0; i < ids.size(); ++i )
+        {
+            CHECK_EQ( ids[i], next );
+            CHECK_EQ( now, due[ next ] );
+            ++next;
+        }
+    }
+    CHECK_EQ( next, count );
+}
+
+// 超出最高层范围的定时器先放在最远的槽,转到时重新分配,不会提前到期
+static void test_far_future()
+{
+    timer_wheel wheel( 0 );
+    timer_wheel::node a;
+    timer_wheel::init_node( &a, ( void* )1 );
+    uint64_t due = ( ( uint64_t )1 << 25 ) * timer_wheel::TICK_MS;
+    wheel.schedule( &a, due );
+    uint64_t now = 0;
+    while ( wheel.size() > 0 )
+    {
+        now += wheel.next_timeout( now );
+        expire( wheel, now );
+    }
+    CHECK_EQ( now, due );
+}
+
+int main()
+{
+    test_expire();
+    test_reschedule_cancel();
+    test_cascade();
+    test_far_future();
+    return TEST_RESULT();
+}
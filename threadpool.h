@@ -1,63 +1,107 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 
-#include <list>
+#include <atomic>
 #include <cstdio>
+#include <cstdint>
 #include <exception>
 #include <pthread.h>
-#include "locker.h"
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "metrics.h"
+#include "logger.h"
 
+// 工作队列为有界的无锁多生产者多消费者环形缓冲区,每个槽位带有序号,
+// 入队和出队只需一次CAS,不为任务分配内存;空闲的工作线程在futex上休眠
 template< typename T >
 class threadpool
 {
 public:
     threadpool( int thread_number = 8, int max_requests = 10000 );
     ~threadpool();
+	// 队列已满时返回false
     bool append( T* request );
+	// 队列中有任务等待,且最近任务的平均排队时间超过wait_ns,此时新的连接应直接拒绝
+    bool overloaded( uint64_t wait_ns ) const
+    {
+        return m_enqueue_pos.load( std::memory_order_relaxed ) != m_dequeue_pos.load( std::memory_order_relaxed )
+            && m_wait_ewma.load( std::memory_order_relaxed ) > wait_ns;
+    }
 
 private:
+	// 环形缓冲区的槽位,seq等于入队位置时可写,等于入队位置加1时可读,
+	// enqueued为入队时间,用于统计任务在队列中等待的时间
+    struct cell
+    {
+        std::atomic< size_t > seq;
+        T* data;
+        uint64_t enqueued;
+    };
     static void* worker( void* arg );
     void run();
+    bool push( T* request );
+    bool pop( T*& request, uint64_t& enqueued );
+	// 没有任务时在futex上休眠,直到有新任务或者线程池停止
+    void park();
+	// 停止并等待所有已创建的线程退出,然后释放队列
+    void shutdown();
+    static long futex( std::atomic< int >* addr, int op, int val );
 
 private:
     int m_thread_number;
-    int m_max_requests;
     pthread_t* m_threads;
-    std::list< T* > m_workqueue;
-    locker m_queuelocker;
-    sem m_queuestat;
-    bool m_stop;
+    cell* m_cells;
+    size_t m_mask;
+	// 入队和出队位置分别由生产者和消费者修改,隔开以避免伪共享
+    char m_pad0[ 64 ];
+    std::atomic< size_t > m_enqueue_pos;
+    char m_pad1[ 64 ];
+    std::atomic< size_t > m_dequeue_pos;
+    char m_pad2[ 64 ];
+	// 休眠的工作线程数和唤醒序号
+    std::atomic< int > m_sleepers;
+    std::atomic< int > m_wakeups;
+    std::atomic< bool > m_stop;
+	// 任务排队时间的指数移动平均(纳秒),各工作线程不加锁地更新,只是近似值;队列排空时清零
+    std::atomic< uint64_t > m_wait_ewma;
 };
 // 线程池的构造函数
 template< typename T >
-threadpool< T >::threadpool( int thread_number, int max_requests ) : 
-        m_thread_number( thread_number ), m_max_requests( max_requests ), m_stop( false ), m_threads( NULL )
+threadpool< T >::threadpool( int thread_number, int max_requests ) :
+        m_thread_number( thread_number ), m_threads( NULL ), m_cells( NULL ), m_mask( 0 ),
+        m_enqueue_pos( 0 ), m_dequeue_pos( 0 ), m_sleepers( 0 ), m_wakeups( 0 ), m_stop( false ), m_wait_ewma( 0 )
 {
 	// 首先检查输入参数
     if( ( thread_number <= 0 ) || ( max_requests <= 0 ) )
     {
         throw std::exception();
     }
-	// 存放线程的数组
-    m_threads = new pthread_t[ m_thread_number ];
-    if( ! m_threads )
+	// 槽位数取不小于最大请求数的2的幂,以便用掩码取模
+    size_t capacity = 2;
+    while( capacity < ( size_t )max_requests )
     {
-        throw std::exception();
+        capacity <<= 1;
+    }
+    m_cells = new cell[ capacity ];
+    m_mask = capacity - 1;
+    for( size_t i = 0; i < capacity; ++i )
+    {
+        m_cells[i].seq.store( i, std::memory_order_relaxed );
+        m_cells[i].data = NULL;
     }
+	// 存放线程的数组
+    m_threads = new pthread_t[ m_thread_number ];
 
     for ( int i = 0; i < thread_number; ++i )
     {
-        printf( "create the %dth thread\n", i );
-		// 创建线程
+        DEBUG_LOG( "create the %dth thread", i );
+		// 创建线程,停止时需等待线程退出后才能释放队列
         if( pthread_create( m_threads + i, NULL, worker, this ) != 0 )
         {
-            delete [] m_threads;
-            throw std::exception();
-        }
-		// 线程脱离
-        if( pthread_detach( m_threads[i] ) )
-        {
-            delete [] m_threads;
+            m_thread_number = i;
+            shutdown();
             throw std::exception();
         }
     }
@@ -66,26 +110,129 @@ threadpool< T >::threadpool( int thread_number, int max_requests ) :
 template< typename T >
 threadpool< T >::~threadpool()
 {
+    shutdown();
+}
+
+template< typename T >
+void threadpool< T >::shutdown()
+{
+    m_stop.store( true );
+	// 唤醒所有休眠的工作线程并等待退出
+    m_wakeups.fetch_add( 1 );
+    futex( &m_wakeups, FUTEX_WAKE_PRIVATE, m_thread_number );
+    for( int i = 0; i < m_thread_number; ++i )
+    {
+        pthread_join( m_threads[i], NULL );
+    }
     delete [] m_threads;
-    m_stop = true;
+    delete [] m_cells;
+    m_threads = NULL;
+    m_cells = NULL;
+}
+
+template< typename T >
+long threadpool< T >::futex( std::atomic< int >* addr, int op, int val )
+{
+    return syscall( SYS_futex, reinterpret_cast< int* >( addr ), op, val, NULL, NULL, 0 );
 }
+
+template< typename T >
+bool threadpool< T >::push( T* request )
+{
+    size_t pos = m_enqueue_pos.load( std::memory_order_relaxed );
+    while( true )
+    {
+        cell* c = &m_cells[ pos & m_mask ];
+        size_t seq = c->seq.load( std::memory_order_acquire );
+        intptr_t diff = ( intptr_t )seq - ( intptr_t )pos;
+        if( diff == 0 )
+        {
+			// 槽位可写,抢占该入队位置
+            if( m_enqueue_pos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+            {
+                c->data = request;
+                c->enqueued = metrics::now_ns();
+                c->seq.store( pos + 1, std::memory_order_release );
+                return true;
+            }
+        }
+        else if( diff < 0 )
+        {
+			// 槽位中的任务尚未被取走,队列已满
+            return false;
+        }
+        else
+        {
+            pos = m_enqueue_pos.load( std::memory_order_relaxed );
+        }
+    }
+}
+
+template< typename T >
+bool threadpool< T >::pop( T*& request, uint64_t& enqueued )
+{
+    size_t pos = m_dequeue_pos.load( std::memory_order_relaxed );
+    while( true )
+    {
+        cell* c = &m_cells[ pos & m_mask ];
+        size_t seq = c->seq.load( std::memory_order_acquire );
+        intptr_t diff = ( intptr_t )seq - ( intptr_t )( pos + 1 );
+        if( diff == 0 )
+        {
+            if( m_dequeue_pos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+            {
+                request = c->data;
+                enqueued = c->enqueued;
+				// 槽位留给下一轮的入队位置
+                c->seq.store( pos + m_mask + 1, std::memory_order_release );
+                return true;
+            }
+        }
+        else if( diff < 0 )
+        {
+			// 队列为空
+            return false;
+        }
+        else
+        {
+            pos = m_dequeue_pos.load( std::memory_order_relaxed );
+        }
+    }
+}
+
 // 向工作队列添加任务
 template< typename T >
 bool threadpool< T >::append( T* request )
 {
-    m_queuelocker.lock();
-	// 首先检查工作队列中的任务数是否超过最大限制
-    if ( m_workqueue.size() > m_max_requests )
+    if( ! push( request ) )
     {
-        m_queuelocker.unlock();
         return false;
     }
-    m_workqueue.push_back( request );
-    m_queuelocker.unlock();
-	// 信号量解锁,工作线程将会从任务队列中取出任务并进行响应
-    m_queuestat.post();
+	// 与park中先登记休眠再检查队列相对应,保证任务不会在工作线程入睡时被遗漏
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+    if( m_sleepers.load( std::memory_order_relaxed ) > 0 )
+    {
+        m_wakeups.fetch_add( 1, std::memory_order_release );
+        futex( &m_wakeups, FUTEX_WAKE_PRIVATE, 1 );
+    }
     return true;
 }
+
+template< typename T >
+void threadpool< T >::park()
+{
+    int wakeups = m_wakeups.load( std::memory_order_acquire );
+    m_sleepers.fetch_add( 1 );
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+	// 登记之后再确认一次队列为空,之后入队的生产者一定会看到休眠的线程
+    if( m_dequeue_pos.load( std::memory_order_relaxed ) == m_enqueue_pos.load( std::memory_order_relaxed )
+        && ! m_stop.load() )
+    {
+        futex( &m_wakeups, FUTEX_WAIT_PRIVATE, wakeups );
+    }
+    m_sleepers.fetch_sub( 1 );
+}
+
 // 线程的工作函数
 template< typename T >
 void* threadpool< T >::worker( void* arg )
@@ -100,23 +247,38 @@ void* threadpool< T >::worker( void* arg )
 template< typename T >
 void threadpool< T >::run()
 {
+	// 入睡之前先短暂自旋,请求密集时避免频繁的系统调用
+    static const int SPIN_COUNT = 64;
+    int idle = 0;
 	// 如果停止变量为false则一直运行
-    while ( ! m_stop )
+    while ( ! m_stop.load( std::memory_order_relaxed ) )
     {
-		// 对任务标志变量加锁,并阻塞在这里,直到有任务需要处理
-        m_queuestat.wait();
-		// 对保护请求队列的互斥变量加锁
-        m_queuelocker.lock();
-		// 首先检查请求队列是否为空
-        if ( m_workqueue.empty() )
+        T* request = NULL;
+        uint64_t enqueued = 0;
+        if ( ! pop( request, enqueued ) )
         {
-            m_queuelocker.unlock();
+			// 队列已排空,之前的排队时间不再反映当前的负载,否则一次突发之后会长时间拒绝新连接
+            if ( idle == 0 && m_wait_ewma.load( std::memory_order_relaxed ) )
+            {
+                m_wait_ewma.store( 0, std::memory_order_relaxed );
+            }
+            if ( ++idle < SPIN_COUNT )
+            {
+                sched_yield();
+            }
+            else
+            {
+                park();
+                idle = 0;
+            }
             continue;
         }
-		// 取出请求
-        T* request = m_workqueue.front();
-        m_workqueue.pop_front();
-        m_queuelocker.unlock();
+        idle = 0;
+        uint64_t wait = metrics::now_ns() - enqueued;
+        metrics::observe( metrics::QUEUE_WAIT_TIME, wait );
+		// 新的排队时间占1/8的权重
+        uint64_t ewma = m_wait_ewma.load( std::memory_order_relaxed );
+        m_wait_ewma.store( ewma - ewma / 8 + wait / 8, std::memory_order_relaxed );
 		// 如果请求为空
         if ( ! request )
         {
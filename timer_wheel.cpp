@@ -0,0 +1,198 @@
+#include "timer_wheel.h"
+
+timer_wheel::timer_wheel( uint64_t now_ms ) : m_current( now_ms / TICK_MS ), m_count( 0 )
+{
+    for ( int level = 0; level < LEVELS; ++level )
+    {
+        for ( int i = 0; i < SLOTS; ++i )
+        {
+            m_slots[ level ][ i ].prev = &m_slots[ level ][ i ];
+            m_slots[ level ][ i ].next = &m_slots[ level ][ i ];
+        }
+    }
+}
+
+void timer_wheel::init_node( node* n, void* data )
+{
+    n->prev = NULL;
+    n->next = NULL;
+    n->expires = 0;
+    n->data = data;
+}
+
+void timer_wheel::link( node* head, node* n )
+{
+    n->prev = head->prev;
+    n->next = head;
+    head->prev->next = n;
+    head->prev = n;
+}
+
+void timer_wheel::unlink( node* n )
+{
+    n->prev->next = n->next;
+    n->next->prev = n->prev;
+    n->prev = NULL;
+    n->next = NULL;
+}
+
+void timer_wheel::place( node* n )
+{
+	// 由cascade调用时,当前刻度的第0层槽随后才处理,到期刻度等于当前刻度的节点放入该槽
+    if ( n->expires < m_current )
+    {
+        n->expires = m_current;
+    }
+	// 超出最高层范围的节点放在最高层最远的槽,转到时按原来的到期刻度重新分配
+    uint64_t tick = n->expires;
+    if ( tick - m_current >= ( ( uint64_t )1 << ( SLOT_BITS * LEVELS ) ) )
+    {
+        tick = m_current + ( ( uint64_t )1 << ( SLOT_BITS * LEVELS ) ) - 1;
+    }
+    uint64_t delta = tick - m_current;
+    int level = 0;
+    while ( level < LEVELS - 1 && delta >= ( ( uint64_t )1 << ( SLOT_BITS * ( level + 1 ) ) ) )
+    {
+        ++level;
+    }
+    link( &m_slots[ level ][ ( tick >> ( SLOT_BITS * level ) ) & SLOT_MASK ], n );
+}
+
+void timer_wheel::schedule( node* n, uint64_t expires_ms )
+{
+    if ( pending( n ) )
+    {
+        unlink( n );
+        --m_count;
+    }
+    n->expires = ( expires_ms + TICK_MS - 1 ) / TICK_MS;
+	// 当前刻度的槽已经处理过,已经过期的节点放入下一个刻度
+    if ( n->expires <= m_current )
+    {
+        n->expires = m_current + 1;
+    }
+    place( n );
+    ++m_count;
+}
+
+void timer_wheel::cancel( node* n )
+{
+    if ( pending( n ) )
+    {
+        unlink( n );
+        --m_count;
+    }
+}
+
+void timer_wheel::cascade( int level )
+{
+    node* head = &m_slots[ level ][ ( m_current >> ( SLOT_BITS * level ) ) & SLOT_MASK ];
+    node list;
+    list.prev = list.next = &list;
+	// 先整体摘下,重新分配时可能放回同一层的其他槽
+    if ( head->next != head )
+    {
+        list.next = head->next;
+        list.prev = head->prev;
+        list.next->prev = &list;
+        list.prev->next = &list;
+        head->prev = head->next = head;
+    }
+    while ( list.next != &list )
+    {
+        node* n = list.next;
+        unlink( n );
+        place( n );
+    }
+}
+
+int timer_wheel::advance( uint64_t now_ms, node* expired )
+{
+    expired->prev = expired->next = expired;
+    uint64_t target = now_ms / TICK_MS;
+	// 没有定时器时直接跳到目标刻度
+    if ( m_count == 0 )
+    {
+        if ( target > m_current )
+        {
+            m_current = target;
+        }
+        return 0;
+    }
+    int count = 0;
+    while ( m_current < target )
+    {
+        ++m_current;
+		// 低层转完一圈时,从上一层取出下一段的节点
+        for ( int level = 1; level < LEVELS; ++level )
+        {
+            if ( ( m_current & ( ( ( uint64_t )1 << ( SLOT_BITS * level ) ) - 1 ) ) != 0 )
+            {
+                break;
+            }
+            cascade( level );
+        }
+        node* head = &m_slots[0][ m_current & SLOT_MASK ];
+        while ( head->next != head )
+        {
+            node* n = head->next;
+            unlink( n );
+            --m_count;
+            link( expired, n );
+            ++count;
+        }
+        if ( m_count == 0 )
+        {
+            m_current = target;
+        }
+    }
+    return count;
+}
+
+timer_wheel::node* timer_wheel::pop( node* expired )
+{
+    if ( expired->next == expired )
+    {
+        return NULL;
+    }
+    node* n = expired->next;
+    unlink( n );
+    return n;
+}
+
+int timer_wheel::next_timeout( uint64_t now_ms ) const
+{
+    if ( m_count == 0 )
+    {
+        return -1;
+    }
+	// 第0层中最近的非空槽,没有时在第0层转完一圈时推进,以便分配上层的节点
+    uint64_t ticks = SLOTS - ( m_current & SLOT_MASK );
+    for ( uint64_t i = 1; i < ticks; ++i )
+    {
+        const node* head = &m_slots[0][ ( m_current + i ) & SLOT_MASK ];
+        if ( head->next != head )
+        {
+            ticks = i;
+            break;
+        }
+    }
+    uint64_t due = ( m_current + ticks ) * TICK_MS;
+    return due > now_ms ? ( int )( due - now_ms ) : 0;
+}
+
+void timer_wheel::collect( std::vector< node* >& nodes ) const
+{
+    nodes.reserve( nodes.size() + m_count );
+    for ( int level = 0; level < LEVELS; ++level )
+    {
+        for ( int i = 0; i < SLOTS; ++i )
+        {
+            const node* head = &m_slots[ level ][ i ];
+            for ( node* n = head->next; n != head; n = n->next )
+            {
+                nodes.push_back( n );
+            }
+        }
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <vector>
+
+// 单调时钟的当前时间,单位为毫秒
+inline uint64_t monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( uint64_t )ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 分层时间轮,每层64个槽,第0层每槽一个刻度,上一层每槽为下一层的一整圈,
+// 定时器节点嵌入在所属对象中,加入和取消都是O(1)的链表操作,不分配内存,
+// 高层的定时器在低层转完一圈时重新分配到低层;不是线程安全的,只能由所属事件循环使用
+class timer_wheel
+{
+public:
+    struct node
+    {
+        node* prev;
+        node* next;
+        uint64_t expires;   // 到期的刻度
+        void* data;         // 所属对象
+    };
+	// 刻度的长度,截止时间按刻度向上取整
+    static const uint64_t TICK_MS = 100;
+
+public:
+    explicit timer_wheel( uint64_t now_ms );
+	// 节点在使用前须初始化为未加入状态
+    static void init_node( node* n, void* data );
+    static bool pending( const node* n ) { return n->next != NULL; }
+	// 设置节点在expires_ms(单调时钟毫秒)到期,节点已在时间轮中时先取消
+    void schedule( node* n, uint64_t expires_ms );
+    void cancel( node* n );
+	// 推进到now_ms,到期的节点从时间轮中取出,放入expired链表,返回到期的节点数
+    int advance( uint64_t now_ms, node* expired );
+	// 从advance返回的到期链表中取出一个节点,链表为空时返回NULL,取出的节点可以重新设置
+    static node* pop( node* expired );
+	// 到下一次需要推进的时间间隔(毫秒),用作epoll_wait的超时,没有定时器时返回-1
+    int next_timeout( uint64_t now_ms ) const;
+    size_t size() const { return m_count; }
+	// 将时间轮中的所有节点放入nodes,不改变时间轮
+    void collect( std::vector< node* >& nodes ) const;
+
+private:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+    static const uint64_t SLOT_MASK = SLOTS - 1;
+	// 链表操作
+    static void link( node* head, node* n );
+    static void unlink( node* n );
+	// 按到期刻度放入对应层的槽
+    void place( node* n );
+	// 将上一层的一个槽中的节点重新分配到下面的层
+    void cascade( int level );
+
+private:
+	// 各槽的链表头,为循环链表的哨兵节点
+    node m_slots[ LEVELS ][ SLOTS ];
+	// 已经处理到的刻度
+    uint64_t m_current;
+    size_t m_count;
+};
+
+#endif
@@ -0,0 +1,303 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/time_types.h>
+#include <exception>
+#include "uring.h"
+
+static int io_uring_setup( unsigned int entries, io_uring_params* params )
+{
+    return syscall( __NR_io_uring_setup, entries, params );
+}
+
+static int io_uring_enter( int fd, unsigned int submit, unsigned int wait, unsigned int flags, const void* arg, size_t size )
+{
+    return syscall( __NR_io_uring_enter, fd, submit, wait, flags, arg, size );
+}
+
+static int io_uring_register( int fd, unsigned int opcode, const void* arg, unsigned int count )
+{
+    return syscall( __NR_io_uring_register, fd, opcode, arg, count );
+}
+
+uring::uring( unsigned int entries, unsigned int buffers, unsigned int size )
+    : m_fd( -1 ), m_sq_ring( MAP_FAILED ), m_sq_ring_size( 0 ),
+      m_sqes( ( io_uring_sqe* )MAP_FAILED ), m_sqes_size( 0 ), m_buf_ring( ( io_uring_buf_ring* )MAP_FAILED ),
+      m_buf_ring_size( 0 ), m_buf_entries( 0 ), m_buffers( ( char* )MAP_FAILED ), m_buffers_size( 0 ), m_buffer_size( size )
+{
+    io_uring_params params;
+    memset( &params, 0, sizeof( params ) );
+	// 只由本线程提交和收割,完成的后续处理推迟到等待时统一进行,较早的内核不支持时不用
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    m_fd = io_uring_setup( entries, &params );
+    if ( m_fd < 0 && errno == EINVAL )
+    {
+        memset( &params, 0, sizeof( params ) );
+        m_fd = io_uring_setup( entries, &params );
+    }
+    if ( m_fd < 0 || ! ( params.features & IORING_FEAT_SINGLE_MMAP ) || ! ( params.features & IORING_FEAT_EXT_ARG ) )
+    {
+        destroy();
+        throw std::exception();
+    }
+	// 提交队列和完成队列在同一个映射中
+    m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof( unsigned int );
+    size_t cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe );
+    if ( cq_ring_size > m_sq_ring_size )
+    {
+        m_sq_ring_size = cq_ring_size;
+    }
+    m_sq_ring = mmap( NULL, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING );
+    m_sqes_size = params.sq_entries * sizeof( io_uring_sqe );
+    m_sqes = ( io_uring_sqe* )mmap( NULL, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES );
+    if ( m_sq_ring == MAP_FAILED || m_sqes == MAP_FAILED )
+    {
+        destroy();
+        throw std::exception();
+    }
+    char* sq = ( char* )m_sq_ring;
+    m_sq_head = ( unsigned int* )( sq + params.sq_off.head );
+    m_sq_tail = ( unsigned int* )( sq + params.sq_off.tail );
+    m_sq_mask = *( unsigned int* )( sq + params.sq_off.ring_mask );
+    m_sq_entries = params.sq_entries;
+    m_sq_local_tail = *m_sq_tail;
+	// 提交队列项按顺序使用,索引数组固定为恒等映射
+    unsigned int* array = ( unsigned int* )( sq + params.sq_off.array );
+    for ( unsigned int i = 0; i < m_sq_entries; ++i )
+    {
+        array[i] = i;
+    }
+    m_cq_head = ( unsigned int* )( sq + params.cq_off.head );
+    m_cq_tail = ( unsigned int* )( sq + params.cq_off.tail );
+    m_cq_mask = *( unsigned int* )( sq + params.cq_off.ring_mask );
+    m_cqes = ( io_uring_cqe* )( sq + params.cq_off.cqes );
+
+	// 缓冲区环的项数须为2的幂
+    m_buf_entries = 1;
+    while ( m_buf_entries < buffers && m_buf_entries < 32768 )
+    {
+        m_buf_entries <<= 1;
+    }
+    m_buf_ring_size = m_buf_entries * sizeof( io_uring_buf );
+    m_buf_ring = ( io_uring_buf_ring* )mmap( NULL, m_buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    m_buffers_size = ( size_t )m_buf_entries * m_buffer_size;
+    m_buffers = ( char* )mmap( NULL, m_buffers_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ( m_buf_ring == MAP_FAILED || m_buffers == MAP_FAILED )
+    {
+        destroy();
+        throw std::exception();
+    }
+    io_uring_buf_reg reg;
+    memset( &reg, 0, sizeof( reg ) );
+    reg.ring_addr = ( uint64_t )( uintptr_t )m_buf_ring;
+    reg.ring_entries = m_buf_entries;
+    reg.bgid = BUFFER_GROUP;
+    if ( io_uring_register( m_fd, IORING_REGISTER_PBUF_RING, &reg, 1 ) < 0 )
+    {
+        destroy();
+        throw std::exception();
+    }
+    for ( unsigned int i = 0; i < m_buf_entries; ++i )
+    {
+        recycle( i );
+    }
+}
+
+uring::~uring()
+{
+    destroy();
+}
+
+void uring::destroy()
+{
+    if ( m_buffers != MAP_FAILED )
+    {
+        munmap( m_buffers, m_buffers_size );
+    }
+    if ( m_buf_ring != MAP_FAILED )
+    {
+        munmap( m_buf_ring, m_buf_ring_size );
+    }
+    if ( m_sqes != MAP_FAILED )
+    {
+        munmap( m_sqes, m_sqes_size );
+    }
+    if ( m_sq_ring != MAP_FAILED )
+    {
+        munmap( m_sq_ring, m_sq_ring_size );
+    }
+	// 关闭时内核取消所有未完成的请求
+    if ( m_fd >= 0 )
+    {
+        close( m_fd );
+    }
+}
+
+bool uring::supported()
+{
+	// 缓冲区环与多次触发的accept同在5.19加入,能注册缓冲区环即可认为都支持
+    try
+    {
+        uring probe( 4, 1, 64 );
+    }
+    catch ( ... )
+    {
+        return false;
+    }
+    return true;
+}
+
+unsigned int uring::publish()
+{
+    __atomic_store_n( m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE );
+    return m_sq_local_tail - __atomic_load_n( m_sq_head, __ATOMIC_ACQUIRE );
+}
+
+void uring::reserve( unsigned int count )
+{
+    while ( m_sq_local_tail - __atomic_load_n( m_sq_head, __ATOMIC_ACQUIRE ) + count > m_sq_entries )
+    {
+        if ( io_uring_enter( m_fd, publish(), 0, 0, NULL, 0 ) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY )
+        {
+            break;
+        }
+    }
+}
+
+io_uring_sqe* uring::get_sqe()
+{
+    reserve( 1 );
+    io_uring_sqe* sqe = &m_sqes[ m_sq_local_tail & m_sq_mask ];
+    memset( sqe, 0, sizeof( *sqe ) );
+    ++m_sq_local_tail;
+    return sqe;
+}
+
+void uring::accept( int listenfd, uint64_t tag )
+{
+    io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = tag;
+}
+
+void uring::recv( int fd, uint64_t tag )
+{
+    io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->len = m_buffer_size;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = tag;
+}
+
+void uring::poll( int fd, unsigned int events, bool multishot, uint64_t tag )
+{
+    io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->len = multishot ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data = tag;
+}
+
+void uring::sendmsg( int fd, const msghdr* msg, unsigned int flags, uint64_t tag )
+{
+    io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = ( uint64_t )( uintptr_t )msg;
+    sqe->len = 1;
+    sqe->msg_flags = flags;
+    sqe->user_data = tag;
+}
+
+void uring::splice_file( int fd_in, int64_t offset, const int pipe[ 2 ], int fd_out, unsigned int len, unsigned int flags, uint64_t in_tag, uint64_t out_tag )
+{
+    reserve( 2 );
+    io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->splice_fd_in = fd_in;
+    sqe->splice_off_in = offset;
+    sqe->fd = pipe[1];
+    sqe->off = ( uint64_t )-1;
+    sqe->len = len;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = in_tag;
+    splice_pipe( pipe[0], fd_out, len, flags, out_tag );
+}
+
+void uring::splice_pipe( int pipe_out, int fd_out, unsigned int len, unsigned int flags, uint64_t tag )
+{
+    io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->splice_fd_in = pipe_out;
+    sqe->splice_off_in = ( uint64_t )-1;
+    sqe->fd = fd_out;
+    sqe->off = ( uint64_t )-1;
+    sqe->len = len;
+    sqe->splice_flags = flags;
+    sqe->user_data = tag;
+}
+
+void uring::cancel( uint64_t tag )
+{
+    io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = tag;
+    sqe->user_data = 0;
+}
+
+int uring::wait( int timeout_ms )
+{
+    unsigned int submit = publish();
+	// 已有完成事件时只提交,不等待
+    unsigned int ready = __atomic_load_n( m_cq_tail, __ATOMIC_ACQUIRE ) - *m_cq_head;
+    io_uring_getevents_arg arg;
+    memset( &arg, 0, sizeof( arg ) );
+    __kernel_timespec ts;
+    if ( timeout_ms >= 0 )
+    {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = ( long long )( timeout_ms % 1000 ) * 1000000;
+        arg.ts = ( uint64_t )( uintptr_t )&ts;
+    }
+    int ret = io_uring_enter( m_fd, submit, ready ? 0 : 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof( arg ) );
+    if ( ret < 0 && errno != ETIME && errno != EINTR && errno != EAGAIN && errno != EBUSY )
+    {
+        return -1;
+    }
+    return 0;
+}
+
+bool uring::next( io_uring_cqe& cqe )
+{
+    unsigned int head = *m_cq_head;
+    if ( head == __atomic_load_n( m_cq_tail, __ATOMIC_ACQUIRE ) )
+    {
+        return false;
+    }
+	// 复制之后立即释放该项,处理完成事件时可以继续准备新的请求
+    cqe = m_cqes[ head & m_cq_mask ];
+    __atomic_store_n( m_cq_head, head + 1, __ATOMIC_RELEASE );
+    return true;
+}
+
+void uring::recycle( uint16_t id )
+{
+	// 环尾与第一项的保留字段重叠,只由本线程修改
+	// 按C++编译时头文件中的bufs不在偏移0处,直接把环当作io_uring_buf的数组
+    uint16_t tail = m_buf_ring->tail;
+    io_uring_buf* buf = ( io_uring_buf* )m_buf_ring + ( tail & ( m_buf_entries - 1 ) );
+    buf->addr = ( uint64_t )( uintptr_t )( m_buffers + ( size_t )id * m_buffer_size );
+    buf->len = m_buffer_size;
+    buf->bid = id;
+    __atomic_store_n( &m_buf_ring->tail, ( uint16_t )( tail + 1 ), __ATOMIC_RELEASE );
+}
@@ -0,0 +1,94 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+// io_uring的最小封装,直接使用系统调用,不依赖liburing;不是线程安全的,
+// 只能由创建它的线程使用。请求先放入提交队列,在wait中与等待完成事件一起提交,
+// 一次系统调用完成所有连接的一批请求
+class uring
+{
+public:
+	// 接收数据的缓冲区组号,内核从该组中为接收请求选择缓冲区
+    static const uint16_t BUFFER_GROUP = 0;
+
+public:
+	// entries为提交队列的大小,buffers个size字节的缓冲区供接收请求使用;失败时抛出异常
+    uring( unsigned int entries, unsigned int buffers, unsigned int size );
+    ~uring();
+	// 当前内核是否支持所需的特性:等待时的超时参数,缓冲区环和多次触发的accept(5.19之后)
+    static bool supported();
+
+	// 以下函数准备一个请求,tag在完成事件中原样返回
+	// 多次触发的accept,每个新连接一个完成事件,新描述符为非阻塞的
+    void accept( int listenfd, uint64_t tag );
+	// 接收数据,由内核从缓冲区组中选择缓冲区,数据到达之前不占用缓冲区
+    void recv( int fd, uint64_t tag );
+	// 等待描述符上的事件,multishot为true时每次就绪都产生完成事件
+    void poll( int fd, unsigned int events, bool multishot, uint64_t tag );
+	// 发送msg描述的数据,msg和其中的iovec只需在提交之前有效,数据须保持到完成
+    void sendmsg( int fd, const msghdr* msg, unsigned int flags, uint64_t tag );
+	// 经管道发送文件的一段:先把文件fd_in从offset开始的len个字节读入管道,链接的第二个请求
+	// 再从管道发往fd_out;读入不足len字节时第二个请求以-ECANCELED完成,管道中的数据留待再次发送
+    void splice_file( int fd_in, int64_t offset, const int pipe[ 2 ], int fd_out, unsigned int len, unsigned int flags, uint64_t in_tag, uint64_t out_tag );
+	// 把管道中的len个字节发往fd_out
+    void splice_pipe( int pipe_out, int fd_out, unsigned int len, unsigned int flags, uint64_t tag );
+	// 取消tag对应的请求,取消请求本身的完成事件的tag为0
+    void cancel( uint64_t tag );
+
+	// 提交已准备的请求,等待至少一个完成事件,timeout_ms为负数时一直等待;
+	// 超时或被信号中断时返回0,出错时返回-1
+    int wait( int timeout_ms );
+	// 取出下一个完成事件,没有时返回false
+    bool next( io_uring_cqe& cqe );
+
+	// 完成事件所用的缓冲区,没有使用缓冲区时返回false
+    static bool buffer_id( const io_uring_cqe& cqe, uint16_t& id )
+    {
+        id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        return cqe.flags & IORING_CQE_F_BUFFER;
+    }
+    const char* buffer( uint16_t id ) const { return m_buffers + ( size_t )id * m_buffer_size; }
+	// 数据取走之后归还缓冲区
+    void recycle( uint16_t id );
+
+private:
+	// 取得一个空闲的提交队列项,队列已满时先提交
+    io_uring_sqe* get_sqe();
+	// 确保提交队列中至少有count个空闲项,链接的请求须在同一次提交中
+    void reserve( unsigned int count );
+	// 更新共享的提交队列尾,返回尚未被内核取走的请求数
+    unsigned int publish();
+	// 释放映射和缓冲区,构造失败时也调用
+    void destroy();
+
+private:
+    int m_fd;
+	// 映射的提交队列和完成队列,两者在同一个映射中
+    void* m_sq_ring;
+    size_t m_sq_ring_size;
+    io_uring_sqe* m_sqes;
+    size_t m_sqes_size;
+    unsigned int* m_sq_head;
+    unsigned int* m_sq_tail;
+    unsigned int m_sq_mask;
+    unsigned int m_sq_entries;
+	// 已准备的请求写到的位置,提交时才更新到共享的m_sq_tail
+    unsigned int m_sq_local_tail;
+    unsigned int* m_cq_head;
+    unsigned int* m_cq_tail;
+    unsigned int m_cq_mask;
+    io_uring_cqe* m_cqes;
+	// 提供给内核的缓冲区环和缓冲区
+    io_uring_buf_ring* m_buf_ring;
+    size_t m_buf_ring_size;
+    unsigned int m_buf_entries;
+    char* m_buffers;
+    size_t m_buffers_size;
+    unsigned int m_buffer_size;
+};
+
+#endif